@@ -71,29 +71,17 @@ void MQTTClient(Client* c, Network* network, unsigned int command_timeout_ms, un
 
 int decodePacket(Client* c, int* value, int timeout)
 {
-    unsigned char i;
-    int multiplier = 1;
-    int len = 0;
-    const int MAX_NO_OF_REMAINING_LENGTH_BYTES = 4;
+    unsigned char buf[4];
+    int len = 0, rc;
 
-    *value = 0;
     do
     {
-        int rc = MQTTPACKET_READ_ERROR;
+        if (len == sizeof(buf) || c->ipstack->mqttread(c->ipstack, buf + len, 1, timeout) != 1)
+            return MQTTPACKET_READ_ERROR;
+        len++;
+    } while ((rc = MQTTPacket_decodeSpan(buf, len, value)) == 0);
 
-        if (++len > MAX_NO_OF_REMAINING_LENGTH_BYTES)
-        {
-            rc = MQTTPACKET_READ_ERROR; /* bad data */
-            goto exit;
-        }
-        rc = c->ipstack->mqttread(c->ipstack, &i, 1, timeout);
-        if (rc != 1)
-            goto exit;
-        *value += (i & 127) * multiplier;
-        multiplier *= 128;
-    } while ((i & 128) != 0);
-exit:
-    return len;
+    return rc;
 }
 
 
@@ -110,7 +98,8 @@ int readPacket(Client* c, Timer* timer)
 
     len = 1;
     /* 2. read the remaining length.  This is variable in itself */
-    decodePacket(c, &rem_len, left_ms(timer));
+    if (decodePacket(c, &rem_len, left_ms(timer)) < 0)
+        goto exit;
     len += MQTTPacket_encode(c->readbuf + 1, rem_len); /* put the original remaining length back into the buffer */
 
     /* 3. read the rest of the buffer using a callback to supply the rest of the data */
@@ -163,7 +152,7 @@ int deliverMessage(Client* c, MQTTString* topicName, MQTTMessage* message)
     // we have to find the right message handler - indexed by topic
     for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
     {
-        if (c->messageHandlers[i].topicFilter != 0 && (MQTTPacket_equals(topicName, (char*)c->messageHandlers[i].topicFilter) ||
+        if (c->messageHandlers[i].topicFilter != 0 && (MQTTPacket_equalsLen(topicName, c->messageHandlers[i].topicFilter, c->messageHandlers[i].topicFilterLen) ||
                 isTopicMatched((char*)c->messageHandlers[i].topicFilter, topicName)))
         {
             if (c->messageHandlers[i].fp != NULL)
@@ -366,7 +355,8 @@ int MQTTSubscribe(Client* c, const char* topicFilter, enum QoS qos, messageHandl
     Timer timer;
     int len = 0;
     MQTTString topic = MQTTString_initializer;
-    topic.cstring = (char *)topicFilter;
+    topic.lenstring.data = (char *)topicFilter;
+    topic.lenstring.len = strlen(topicFilter);
     
     InitTimer(&timer);
     countdown_ms(&timer, c->command_timeout_ms);
@@ -394,6 +384,7 @@ int MQTTSubscribe(Client* c, const char* topicFilter, enum QoS qos, messageHandl
                 if (c->messageHandlers[i].topicFilter == 0)
                 {
                     c->messageHandlers[i].topicFilter = topicFilter;
+                    c->messageHandlers[i].topicFilterLen = topic.lenstring.len;
                     c->messageHandlers[i].fp = messageHandler;
                     rc = 0;
                     break;
@@ -414,7 +405,8 @@ int MQTTUnsubscribe(Client* c, const char* topicFilter)
     int rc = FAILURE;
     Timer timer;    
     MQTTString topic = MQTTString_initializer;
-    topic.cstring = (char *)topicFilter;
+    topic.lenstring.data = (char *)topicFilter;
+    topic.lenstring.len = strlen(topicFilter);
     int len = 0;
 
     InitTimer(&timer);
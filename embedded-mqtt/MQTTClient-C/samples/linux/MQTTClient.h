@@ -79,6 +79,7 @@ struct Client {
     struct MessageHandlers
     {
         const char* topicFilter;
+        int topicFilterLen;
         void (*fp) (MessageData*);
     } messageHandlers[MAX_MESSAGE_HANDLERS];      // Message handlers are indexed by subscription topic
     
@@ -15,31 +15,55 @@
  *******************************************************************************/
 #include "MQTTClient.h"
 
+#include <string.h>
+
 static void NewMessageData(MessageData* md, MQTTString* aTopicName, MQTTMessage* aMessage) {
     md->topicName = aTopicName;
     md->message = aMessage;
 }
 
 
+static MQTTInflight* findInflight(MQTTClient* c, unsigned short id)
+{
+    unsigned int i;
+
+    for (i = 0; i < c->max_inflight; i++)
+        if (c->inflight[i].id == id)
+            return &c->inflight[i];
+    return NULL;
+}
+
+
 static int getNextPacketId(MQTTClient *c) {
-    return c->next_packetid = (c->next_packetid == MAX_PACKET_ID) ? 1 : c->next_packetid + 1;
+    do
+        c->next_packetid = (c->next_packetid == MAX_PACKET_ID) ? 1 : c->next_packetid + 1;
+    while (c->inflight_count > 0 && findInflight(c, c->next_packetid)); /* skip ids still awaiting acks */
+    return c->next_packetid;
 }
 
 
-static int sendPacket(MQTTClient* c, int length, Timer* timer)
+/* the buffers are advanced past what was written */
+static int writeBuffers(MQTTClient* c, NetworkBuffer* bufs, int count, Timer* timer)
 {
-    int rc = MQTT_FAILURE, 
-        sent = 0;
+    int rc = 0;
+    NetworkBuffer* end = bufs + count;
 
-    while (sent < length && !platform_timer_isexpired(timer))
+    while (1)
     {
-        rc = platform_network_write(c->ipstack, &c->buf[sent], length, platform_timer_left(timer));
+        while (bufs < end && rc >= bufs->len) // skip what was completely written
+            rc -= (bufs++)->len;
+        if (bufs == end || platform_timer_isexpired(timer))
+            break;
+        bufs->data += rc;
+        bufs->len -= rc;
+
+        rc = platform_network_writev(c->ipstack, bufs, end - bufs, platform_timer_left(timer));
+        c->writes++;
         if (rc < 0)  // there was an error writing the data
             break;
-        sent += rc;
     }
 
-    if (sent == length)
+    if (bufs == end)
     {
         platform_timer_countdown(&c->ping_timer, c->keepAliveInterval*1000); // record the fact that we have successfully sent the packet
         rc = MQTT_SUCCESS;
@@ -52,6 +76,58 @@ static int sendPacket(MQTTClient* c, int length, Timer* timer)
 }
 
 
+/* writes the packets collected while corked in one go */
+static int flushCork(MQTTClient* c, Timer* timer)
+{
+    NetworkBuffer buf = {c->corkbuf, c->cork_len};
+    int rc = MQTT_SUCCESS;
+
+    if (c->cork_len > 0)
+    {
+        rc = writeBuffers(c, &buf, 1, timer);
+        c->cork_len = 0;
+    }
+    return rc;
+}
+
+
+/* While corked the packet is copied after those already collected, unless 
+ * it does not fit. Otherwise those collected go first, then the packet. */
+static int sendPacketv(MQTTClient* c, NetworkBuffer* bufs, int count, Timer* timer)
+{
+    int rc = MQTT_SUCCESS;
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < count; i++)
+        len += bufs[i].len;
+
+    if (c->corked && c->cork_len + len > c->corkbuf_size)
+        rc = flushCork(c, timer);
+    if (rc == MQTT_SUCCESS && c->corked && c->cork_len + len <= c->corkbuf_size)
+    {
+        for (i = 0; i < count; i++)
+        {
+            memcpy(c->corkbuf + c->cork_len, bufs[i].data, bufs[i].len);
+            c->cork_len += bufs[i].len;
+        }
+    }
+    else if (rc == MQTT_SUCCESS && (rc = flushCork(c, timer)) == MQTT_SUCCESS)
+        rc = writeBuffers(c, bufs, count, timer);
+
+    if (rc == MQTT_SUCCESS)
+        c->packets_sent++;
+    return rc;
+}
+
+
+static int sendPacket(MQTTClient* c, int length, Timer* timer)
+{
+    NetworkBuffer buf = {c->buf, length};
+    return sendPacketv(c, &buf, 1, timer);
+}
+
+
 void MQTTClientInit(MQTTClient* c, Network* network, unsigned int command_timeout_ms,
 		unsigned char* sendbuf, size_t sendbuf_size, unsigned char* readbuf, size_t readbuf_size)
 {
@@ -62,14 +138,34 @@ void MQTTClientInit(MQTTClient* c, Network* network, unsigned int command_timeou
     c->buf_size = sendbuf_size;
     c->readbuf = readbuf;
     c->readbuf_size = readbuf_size;
+    c->rxbuf = NULL;
+    c->rxbuf_size = 0;
+    c->rx_start = c->rx_end = 0;
+    c->corkbuf = NULL;
+    c->corkbuf_size = c->cork_len = 0;
+    c->corked = 0;
+    c->packets_sent = c->writes = 0;
+    c->pool = NULL;
+    c->pool_index = -1;
     c->isconnected = 0;
     c->ping_outstanding = 0;
     c->messageHandler = 0;
     c->messageHandlerData = 0;
+    c->chunkHandler = 0;
 	c->next_packetid = 1;
 
+	c->inflight = NULL;
+	c->max_inflight = 0;
+	c->inflight_count = 0;
+
+    c->rtt_last = c->rtt_min = c->rtt_max = -1;
+    c->rtt_samples = 0;
+    c->rtt_sum = 0;
+
     platform_timer_init(&c->ping_timer);
     platform_timer_init(&c->pingresp_timer);
+    platform_timer_init(&c->last_received);
+    platform_timer_init(&c->ping_sent);
 	platform_mutex_init(&c->mutex);
 }
 
@@ -77,41 +173,295 @@ void MQTTClientInit(MQTTClient* c, Network* network, unsigned int command_timeou
 void MQTTClientDeinit(MQTTClient *c)
 {
     if (!c) return;
+    MQTTAbortInflight(c, MQTT_FAILURE);
+    MQTTSetMaxInflight(c, 0);
+    MQTTSetReadBufferPool(c, NULL);
     platform_timer_deinit(&c->ping_timer);
     platform_timer_deinit(&c->pingresp_timer);
+    platform_timer_deinit(&c->last_received);
+    platform_timer_deinit(&c->ping_sent);
     platform_mutex_deinit(&c->mutex);
 }
 
 
-static int decodePacket(MQTTClient* c, int* value, int timeout)
+void MQTTSetReceiveBuffer(MQTTClient* c, unsigned char* buf, size_t size)
 {
-    unsigned char i;
-    int multiplier = 1;
-    int len = 0;
-    const int MAX_NO_OF_REMAINING_LENGTH_BYTES = 4;
+    platform_mutex_lock(&c->mutex);
+    c->rxbuf = buf;
+    c->rxbuf_size = buf ? size : 0;
+    c->rx_start = c->rx_end = 0;
+    platform_mutex_unlock(&c->mutex);
+}
 
-    *value = 0;
-    do
+
+void MQTTSetCorkBuffer(MQTTClient* c, unsigned char* buf, size_t size)
+{
+    platform_mutex_lock(&c->mutex);
+    c->corkbuf = buf;
+    c->corkbuf_size = buf ? size : 0;
+    c->cork_len = 0;
+    c->corked = 0;
+    platform_mutex_unlock(&c->mutex);
+}
+
+
+int MQTTCork(MQTTClient* c)
+{
+    int rc = MQTT_FAILURE;
+
+    platform_mutex_lock(&c->mutex);
+    if (c->corkbuf)
+    {
+        c->corked = 1;
+        rc = MQTT_SUCCESS;
+    }
+    platform_mutex_unlock(&c->mutex);
+    return rc;
+}
+
+
+int MQTTUncork(MQTTClient* c)
+{
+    int rc = MQTT_SUCCESS;
+    Timer timer;
+
+    platform_mutex_lock(&c->mutex);
+    c->corked = 0;
+    if (c->cork_len > 0)
+    {
+        platform_timer_init(&timer);
+        platform_timer_countdown(&timer, c->command_timeout_ms);
+        rc = flushCork(c, &timer);
+    }
+    platform_mutex_unlock(&c->mutex);
+    return rc;
+}
+
+
+int MQTTBufferPoolInit(MQTTBufferPool* pool, unsigned char* mem, size_t size, int count, int* refs)
+{
+    if (!mem || !refs || size == 0 || count < 1)
+        return MQTT_FAILURE;
+
+    pool->mem = mem;
+    pool->size = size;
+    pool->count = count;
+    pool->refs = refs;
+    memset(refs, 0, count * sizeof(int));
+    platform_mutex_init(&pool->mutex);
+    return MQTT_SUCCESS;
+}
+
+
+void MQTTBufferPoolDeinit(MQTTBufferPool* pool)
+{
+    platform_mutex_deinit(&pool->mutex);
+}
+
+
+/* index of the buffer holding ptr, -1 if it is not one of the pool */
+static int poolIndex(MQTTBufferPool* pool, const void* ptr)
+{
+    const unsigned char* p = (const unsigned char*)ptr;
+
+    if (p < pool->mem || p >= pool->mem + pool->size * pool->count)
+        return -1;
+    return (int)((p - pool->mem) / pool->size);
+}
+
+
+int MQTTBufferRetain(MQTTBufferPool* pool, const void* ptr)
+{
+    int rc = MQTT_FAILURE;
+    int i = poolIndex(pool, ptr);
+
+    if (i < 0)
+        return rc;
+
+    platform_mutex_lock(&pool->mutex);
+    if (pool->refs[i] > 0)
+    {
+        pool->refs[i]++;
+        rc = MQTT_SUCCESS;
+    }
+    platform_mutex_unlock(&pool->mutex);
+    return rc;
+}
+
+
+void MQTTBufferRelease(MQTTBufferPool* pool, const void* ptr)
+{
+    int i = poolIndex(pool, ptr);
+
+    if (i < 0)
+        return;
+
+    platform_mutex_lock(&pool->mutex);
+    if (pool->refs[i] > 0)
+        pool->refs[i]--;
+    platform_mutex_unlock(&pool->mutex);
+}
+
+
+void MQTTSetReadBufferPool(MQTTClient* c, MQTTBufferPool* pool)
+{
+    platform_mutex_lock(&c->mutex);
+    if (c->pool && c->pool_index >= 0)
     {
-        int rc = MQTTPACKET_READ_ERROR;
+        /* the messages retained from the buffer keep it */
+        MQTTBufferRelease(c->pool, c->readbuf);
+        c->readbuf = c->own_readbuf;
+        c->readbuf_size = c->own_readbuf_size;
+        c->pool_index = -1;
+    }
+    c->pool = pool;
+    platform_mutex_unlock(&c->mutex);
+}
+
 
-        if (++len > MAX_NO_OF_REMAINING_LENGTH_BYTES)
+/* Reads the next packet into a free buffer of the pool if the last one was 
+ * retained, or was read into the client's own buffer because none was free.
+ * The own buffer is used again while all of the pool is retained. */
+static void nextReadBuffer(MQTTClient* c)
+{
+    MQTTBufferPool* pool = c->pool;
+    int i;
+
+    if (!pool)
+        return;
+
+    platform_mutex_lock(&pool->mutex);
+    if (c->pool_index < 0 || pool->refs[c->pool_index] > 1)
+    {
+        for (i = 0; i < pool->count && pool->refs[i] > 0; i++)
+            ;
+        if (c->pool_index >= 0)
+            pool->refs[c->pool_index]--;
+        else if (i < pool->count)
         {
-            rc = MQTTPACKET_READ_ERROR; /* bad data */
-            goto exit;
+            c->own_readbuf = c->readbuf;
+            c->own_readbuf_size = c->readbuf_size;
         }
-        rc = platform_network_read(c->ipstack, &i, 1, timeout);
-        if (rc != 1)
-            goto exit;
-        *value += (i & 127) * multiplier;
-        multiplier *= 128;
-    } while ((i & 128) != 0);
-exit:
-    return len;
+
+        if (i < pool->count)
+        {
+            pool->refs[i] = 1;
+            c->readbuf = pool->mem + i * pool->size;
+            c->readbuf_size = pool->size;
+            c->pool_index = i;
+        }
+        else if (c->pool_index >= 0)
+        {
+            c->readbuf = c->own_readbuf;
+            c->readbuf_size = c->own_readbuf_size;
+            c->pool_index = -1;
+        }
+    }
+    platform_mutex_unlock(&pool->mutex);
+}
+
+
+void MQTTGetSendStats(MQTTClient* c, MQTTSendStats* stats)
+{
+    platform_mutex_lock(&c->mutex);
+    stats->packets = c->packets_sent;
+    stats->writes = c->writes;
+    platform_mutex_unlock(&c->mutex);
+}
+
+
+/* Reads len bytes, from the receive buffer first. The buffer is refilled with
+ * whatever the network has, reads too large for it bypass it. Returns the 
+ * number of bytes read or the result of the failed network read. */
+static int readBytes(MQTTClient* c, unsigned char* buf, int len, int timeout_ms)
+{
+    Timer timer;
+    int got = 0;
+
+    if (!c->rxbuf)
+        return platform_network_read(c->ipstack, buf, len, timeout_ms);
+
+    platform_timer_init(&timer);
+    platform_timer_countdown(&timer, timeout_ms);
+
+    while (got < len)
+    {
+        int rc, n = c->rx_end - c->rx_start;
+
+        if (n > 0)
+        {
+            if (n > len - got)
+                n = len - got;
+            memcpy(buf + got, c->rxbuf + c->rx_start, n);
+            c->rx_start += n;
+            got += n;
+            continue;
+        }
+
+        c->rx_start = c->rx_end = 0;
+        if (len - got >= (int)c->rxbuf_size)
+        {
+            /* no point in buffering, read straight into place */
+            rc = platform_network_read(c->ipstack, buf + got, len - got, platform_timer_left(&timer));
+            if (rc > 0)
+                got += rc;
+            return got > 0 ? got : rc;
+        }
+
+        rc = platform_network_recv(c->ipstack, c->rxbuf, c->rxbuf_size, platform_timer_left(&timer));
+        if (rc <= 0)
+            return got > 0 ? got : rc;
+        c->rx_end = rc;
+    }
+
+    return got;
+}
+
+
+/* whether the receive buffer holds a complete packet */
+static int hasBufferedPacket(MQTTClient* c)
+{
+    int avail, len, rem_len;
+
+    if (!c->rxbuf || c->rx_end - c->rx_start < 2)
+        return 0;
+
+    avail = c->rx_end - c->rx_start - 1;
+    len = MQTTPacket_decodeSpan(c->rxbuf + c->rx_start + 1, avail, &rem_len);
+
+    return len > 0 && avail - len >= rem_len;
+}
+
+
+/* Decodes the remaining length of the packet whose header byte was read into
+ * value, straight from the receive buffer when all of it is there. Returns the
+ * number of bytes it took, or MQTTPACKET_READ_ERROR. */
+static int decodePacket(MQTTClient* c, int* value, int timeout)
+{
+    unsigned char buf[4];
+    int len = 0, rc;
+
+    if (c->rxbuf && (rc = MQTTPacket_decodeSpan(c->rxbuf + c->rx_start, c->rx_end - c->rx_start, value)) != 0)
+    {
+        if (rc > 0)
+            c->rx_start += rc;
+        return rc;
+    }
+
+    do
+    {
+        if (len == sizeof(buf) || readBytes(c, buf + len, 1, timeout) != 1)
+            return MQTTPACKET_READ_ERROR;
+        len++;
+    } while ((rc = MQTTPacket_decodeSpan(buf, len, value)) == 0);
+
+    return rc;
 }
 
 
-static int readPacket(MQTTClient* c, Timer* timer)
+/* Reads the whole packet if it fits readbuf. Otherwise only the fixed header
+ * is read and the length of the rest of the packet is returned in unread. */
+static int readPacket(MQTTClient* c, Timer* timer, int* unread)
 {
     int rc = MQTT_FAILURE;
     MQTTHeader header = {0};
@@ -119,7 +469,7 @@ static int readPacket(MQTTClient* c, Timer* timer)
     int rem_len = 0;
 
     /* 1. read the header byte.  This has the packet type in it */
-	int read_bytes = platform_network_read(c->ipstack, c->readbuf, 1, platform_timer_left(timer));
+	int read_bytes = readBytes(c, c->readbuf, 1, platform_timer_left(timer));
 
 	if (read_bytes != 1) 
 	{
@@ -130,11 +480,18 @@ static int readPacket(MQTTClient* c, Timer* timer)
 
     len = 1;
     /* 2. read the remaining length.  This is variable in itself */
-    decodePacket(c, &rem_len, platform_timer_left(timer));
+    if (decodePacket(c, &rem_len, platform_timer_left(timer)) < 0)
+    {
+        rc = MQTT_CONNECTION_LOST; // the packet boundary is lost
+        goto exit;
+    }
     len += MQTTPacket_encode(c->readbuf + 1, rem_len); /* put the original remaining length back into the buffer */
 
     /* 3. read the rest of the buffer using a callback to supply the rest of the data */
-    if (rem_len > 0 && (platform_network_read(c->ipstack, c->readbuf + len, rem_len, platform_timer_left(timer)) != rem_len))
+    *unread = 0;
+    if (len + rem_len > c->readbuf_size)
+        *unread = rem_len; /* left for the caller to stream or discard */
+    else if (rem_len > 0 && (readBytes(c, c->readbuf + len, rem_len, platform_timer_left(timer)) != rem_len))
         goto exit;
 
     header.byte = c->readbuf[0];
@@ -144,6 +501,108 @@ exit:
 }
 
 
+/* skip the rest of a packet which does not fit readbuf */
+static int discardPacket(MQTTClient* c, int unread, Timer* timer)
+{
+    while (unread > 0)
+    {
+        int len = unread < c->readbuf_size ? unread : c->readbuf_size;
+        if (readBytes(c, c->readbuf, len, platform_timer_left(timer)) != len)
+            return MQTT_CONNECTION_LOST; // the packet boundary is lost
+        unread -= len;
+    }
+    return MQTT_SUCCESS;
+}
+
+
+/* Reads the variable header of a PUBLISH which does not fit readbuf and hands 
+ * the payload to chunkHandler in pieces as large as the rest of readbuf, so 
+ * memory use does not depend on the message size. A message whose topic does 
+ * not fit readbuf, or which no chunkHandler takes, is skipped with 
+ * MQTT_BUFFER_OVERFLOW; msg keeps its QoS and packet id to be acknowledged. */
+static int streamPublish(MQTTClient* c, MQTTMessage* msg, MQTTString* topicName, int unread, Timer* timer)
+{
+    MQTTHeader header = {0};
+    int hdrlen = MQTTPacket_len(unread) - unread;
+    unsigned char* ptr = c->readbuf + hdrlen;
+    unsigned char* chunk;
+    int varlen, chunk_size;
+    size_t offset = 0;
+
+    header.byte = c->readbuf[0];
+    msg->dup = header.bits.dup;
+    msg->qos = (enum QoS)header.bits.qos;
+    msg->retained = header.bits.retain;
+
+    if (unread < 2 || readBytes(c, ptr, 2, platform_timer_left(timer)) != 2)
+        return MQTT_CONNECTION_LOST;
+    varlen = 2 + readInt(&ptr) + (msg->qos > 0 ? 2 : 0);
+    unread -= 2;
+
+    if (varlen > unread + 2)
+        return MQTT_CONNECTION_LOST; /* the topic overruns the packet, its boundary is lost */
+
+    if (hdrlen + varlen >= c->readbuf_size)
+    {
+        /* the topic does not fit: skip it and the payload, but keep the packet id 
+         * so that the message is still acknowledged at its QoS */
+        int topiclen = varlen - 2 - (msg->qos > 0 ? 2 : 0);
+        if (discardPacket(c, topiclen, timer) != MQTT_SUCCESS)
+            return MQTT_CONNECTION_LOST;
+        unread -= topiclen;
+        if (msg->qos > 0)
+        {
+            ptr = c->readbuf;
+            if (readBytes(c, ptr, 2, platform_timer_left(timer)) != 2)
+                return MQTT_CONNECTION_LOST;
+            msg->id = readInt(&ptr);
+            unread -= 2;
+        }
+        if (discardPacket(c, unread, timer) != MQTT_SUCCESS)
+            return MQTT_CONNECTION_LOST;
+        return MQTT_BUFFER_OVERFLOW;
+    }
+
+    if (readBytes(c, ptr, varlen - 2, platform_timer_left(timer)) != varlen - 2)
+        return MQTT_CONNECTION_LOST;
+    unread -= varlen - 2;
+
+    topicName->cstring = NULL;
+    topicName->lenstring.data = (char*)ptr;
+    topicName->lenstring.len = varlen - 2 - (msg->qos > 0 ? 2 : 0);
+    ptr += topicName->lenstring.len;
+    if (msg->qos > 0)
+        msg->id = readInt(&ptr);
+
+    chunk = ptr;
+    chunk_size = c->readbuf_size - (chunk - c->readbuf);
+    msg->payload = chunk;
+    msg->payloadlen = unread;
+
+    if (!c->chunkHandler)
+    {
+        /* nobody takes the payload, skip it but still acknowledge the message */
+        if (discardPacket(c, unread, timer) != MQTT_SUCCESS)
+            return MQTT_CONNECTION_LOST;
+        return MQTT_BUFFER_OVERFLOW;
+    }
+
+    while (unread > 0)
+    {
+        int len = unread < chunk_size ? unread : chunk_size;
+        if (readBytes(c, chunk, len, platform_timer_left(timer)) != len)
+            return MQTT_CONNECTION_LOST;
+        MessageData md;
+        NewMessageData(&md, topicName, msg);
+        c->chunkHandler(&md, offset, chunk, len, c->messageHandlerData);
+        offset += len;
+        unread -= len;
+    }
+
+    return MQTT_SUCCESS;
+}
+
+
 // assume topic filter and name is in correct format
 // # can only be at end
 // + and # can only be next to separator
@@ -191,6 +650,62 @@ int deliverMessage(MQTTClient* c, MQTTString* topicName, MQTTMessage* message)
 }
 
 
+static void completeInflight(MQTTClient* c, MQTTInflight* f, int rc)
+{
+    unsigned short id = f->id;
+    publishCompleteHandler handler = f->handler;
+    void* context = f->context;
+
+    platform_free(f->packet);
+    f->packet = NULL;
+    f->id = 0;
+    c->inflight_count--;
+
+    if (handler)
+        handler(id, rc, context);
+}
+
+
+/* first in-flight publish to run out of time waiting for its ack */
+static MQTTInflight* earliestInflight(MQTTClient* c)
+{
+    MQTTInflight* earliest = NULL;
+    unsigned int i;
+
+    for (i = 0; i < c->max_inflight && c->inflight_count > 0; i++)
+        if (c->inflight[i].id && (!earliest || 
+                platform_timer_left(&c->inflight[i].timer) < platform_timer_left(&earliest->timer)))
+            earliest = &c->inflight[i];
+    return earliest;
+}
+
+
+/* send again everything not acknowledged on the previous connection */
+static int resendInflight(MQTTClient* c)
+{
+    int rc = MQTT_SUCCESS;
+    unsigned int i;
+
+    for (i = 0; i < c->max_inflight && rc == MQTT_SUCCESS; i++)
+    {
+        MQTTInflight* f = &c->inflight[i];
+        if (!f->id)
+            continue;
+
+        Timer timer;
+        platform_timer_init(&timer);
+        platform_timer_countdown(&timer, c->command_timeout_ms);
+
+        if (f->awaiting != PUBCOMP)
+            f->packet[0] |= 0x08; /* DUP flag of the fixed header */
+        NetworkBuffer bufs[2] = {{f->packet, f->len}, {f->payload, f->payloadlen}};
+        rc = sendPacketv(c, bufs, 2, &timer);
+        platform_timer_countdown(&f->timer, c->command_timeout_ms);
+    }
+    return rc;
+}
+
+
 int keepalive(MQTTClient* c)
 {
     int rc = MQTT_FAILURE;
@@ -201,9 +716,7 @@ int keepalive(MQTTClient* c)
         goto exit;
     }
 
-    //printf("%s: %d, ping time left: %d, tick count = %u\n", __func__, __LINE__, TimerLeftMS(&c->ping_timer), xTaskGetTickCount());
-
-    if (platform_timer_isexpired(&c->ping_timer))
+    if (platform_timer_isexpired(&c->ping_timer) || platform_timer_isexpired(&c->last_received))
     {
         if (!c->ping_outstanding)
         {
@@ -214,8 +727,8 @@ int keepalive(MQTTClient* c)
             if (len > 0 && (rc = sendPacket(c, len, &timer)) == MQTT_SUCCESS) // send the ping packet
             {
                 platform_timer_countdown(&c->pingresp_timer, c->command_timeout_ms);
+                platform_timer_countdown(&c->ping_sent, MAX_RTT_MS);
                 c->ping_outstanding = 1;
-                platform_printf("sent ping request\n");
             }
 
             if (len > 0 && rc != MQTT_SUCCESS)
@@ -235,31 +748,80 @@ int cycle(MQTTClient* c, Timer* timer)
     Timer t;
     platform_timer_init(&t);
 
-    int len = 0, packet_type, rc = MQTT_SUCCESS;
+    int len = 0, packet_type, rc = MQTT_SUCCESS, unread = 0;
+
+    // what was collected while corked may be what the answer is waited for
+    if (flushCork(c, timer) != MQTT_SUCCESS)
+    {
+        rc = MQTT_CONNECTION_LOST;
+        goto exit;
+    }
+
+    nextReadBuffer(c);
 
     // read the socket, see what work is due
-    if ((packet_type = readPacket(c, timer)) == MQTT_CONNECTION_LOST)
+    if ((packet_type = readPacket(c, timer, &unread)) == MQTT_CONNECTION_LOST)
 	{
 		rc = MQTT_CONNECTION_LOST;
 		goto exit;
 	}
+
+    if (packet_type > 0)
+    {
+        /* the link is alive, an outstanding ping gets as long again to be answered */
+        platform_timer_countdown(&c->last_received, c->keepAliveInterval*1000);
+        if (c->ping_outstanding)
+            platform_timer_countdown(&c->pingresp_timer, c->command_timeout_ms);
+    }
+
+    if (unread > 0 && packet_type != PUBLISH)
+    {
+        // only publishes can be streamed, anything else too large is skipped
+        if ((rc = discardPacket(c, unread, timer)) == MQTT_SUCCESS)
+            rc = MQTT_BUFFER_OVERFLOW;
+        goto exit;
+    }
     
     switch (packet_type)
     {
         case CONNACK:
-        case PUBACK:
         case SUBACK:
             break;
+        case PUBACK:
+        case PUBCOMP:
+        {
+            unsigned short mypacketid;
+            unsigned char dup, type;
+            if (MQTTDeserialize_ack(&type, &dup, &mypacketid, c->readbuf, c->readbuf_size) == 1)
+            {
+                MQTTInflight* f = c->inflight_count > 0 ? findInflight(c, mypacketid) : NULL;
+                if (f && f->awaiting == type)
+                    completeInflight(c, f, MQTT_SUCCESS);
+            }
+            break;
+        }
         case PUBLISH:
         {
-            MQTTString topicName;
+            MQTTString topicName = MQTTString_initializer;
             MQTTMessage msg = {0};
-            int intQoS;
-            if (MQTTDeserialize_publish(&msg.dup, &intQoS, &msg.retained, &msg.id, &topicName,
-               (unsigned char**)&msg.payload, &msg.payloadlen, c->readbuf, c->readbuf_size) != 1)
-                goto exit;
-            msg.qos = (enum QoS)intQoS;
-            deliverMessage(c, &topicName, &msg);
+            int intQoS, streamed = MQTT_SUCCESS;
+            if (unread > 0)
+            {
+                /* a publish skipped as too large is still acknowledged */
+                if ((streamed = streamPublish(c, &msg, &topicName, unread, timer)) == MQTT_CONNECTION_LOST)
+                {
+                    rc = streamed;
+                    goto exit;
+                }
+            }
+            else
+            {
+                if (MQTTDeserialize_publish(&msg.dup, &intQoS, &msg.retained, &msg.id, &topicName,
+                   (unsigned char**)&msg.payload, &msg.payloadlen, c->readbuf, c->readbuf_size) != 1)
+                    goto exit;
+                msg.qos = (enum QoS)intQoS;
+                deliverMessage(c, &topicName, &msg);
+            }
             if (msg.qos != QOS0)
             {
                 if (msg.qos == QOS1)
@@ -276,6 +838,11 @@ int cycle(MQTTClient* c, Timer* timer)
                 if (rc == MQTT_FAILURE)
                     goto exit; // there was a problem
             }
+            if (streamed != MQTT_SUCCESS)
+            {
+                rc = streamed;
+                goto exit;
+            }
             break;
         }
         case PUBREC:
@@ -291,13 +858,33 @@ int cycle(MQTTClient* c, Timer* timer)
                 rc = MQTT_FAILURE; // there was a problem
             if (rc == MQTT_FAILURE)
                 goto exit; // there was a problem
+            MQTTInflight* f = c->inflight_count > 0 ? findInflight(c, mypacketid) : NULL;
+            if (f && f->awaiting == PUBREC)
+            {
+                /* from now on the PUBREL is what has to be retransmitted */
+                memcpy(f->packet, c->buf, len);
+                f->len = len;
+                f->payload = NULL;
+                f->payloadlen = 0;
+                f->awaiting = PUBCOMP;
+                platform_timer_countdown(&f->timer, c->command_timeout_ms);
+            }
             break;
         }
-        case PUBCOMP:
-            break;
         case PINGRESP:
+            if (c->ping_outstanding)
+            {
+                int rtt = MAX_RTT_MS - platform_timer_left(&c->ping_sent);
+
+                c->rtt_last = rtt;
+                if (c->rtt_samples == 0 || rtt < c->rtt_min)
+                    c->rtt_min = rtt;
+                if (rtt > c->rtt_max)
+                    c->rtt_max = rtt;
+                c->rtt_sum += rtt;
+                c->rtt_samples++;
+            }
             c->ping_outstanding = 0;
-            platform_printf("received ping response\n");
             break;
     }
 
@@ -346,7 +933,152 @@ int MQTTYield(MQTTClient* c, int timeout_ms)
 }
 
 
-int waitfor(MQTTClient* c, int packet_type, Timer* timer)
+int MQTTCycle(MQTTClient* c, int timeout_ms)
+{
+    int rc = MQTT_SUCCESS;
+    Timer timer;
+    platform_timer_init(&timer);
+    platform_timer_countdown(&timer, timeout_ms);
+
+    platform_mutex_lock(&c->mutex);
+
+    /* the network will not signal packets which are already buffered */
+    if (c->isconnected)
+        do
+            rc = cycle(c, &timer);
+        while (rc >= 0 && c->isconnected && hasBufferedPacket(c));
+
+    platform_mutex_unlock(&c->mutex);
+
+    return rc;
+}
+
+
+int MQTTReceive(MQTTClient* c)
+{
+    int rc = 1, len, rem_len;
+    size_t avail;
+
+    platform_mutex_lock(&c->mutex);
+
+    if (!c->rxbuf)
+        goto exit;
+
+    /* the partial packet left is moved to the front, to be completed in place */
+    if (c->rx_start > 0)
+    {
+        memmove(c->rxbuf, c->rxbuf + c->rx_start, c->rx_end - c->rx_start);
+        c->rx_end -= c->rx_start;
+        c->rx_start = 0;
+    }
+
+    if (c->rx_end < c->rxbuf_size)
+    {
+        /* negative when nothing is available yet */
+        if ((len = platform_network_recv(c->ipstack, c->rxbuf + c->rx_end, c->rxbuf_size - c->rx_end, 0)) == 0)
+        {
+            rc = MQTT_CONNECTION_LOST;
+            goto exit;
+        }
+        if (len > 0)
+            c->rx_end += len;
+    }
+
+    if (hasBufferedPacket(c))
+        goto exit;
+
+    /* a malformed remaining length is left for cycle to fail on */
+    avail = c->rx_end - c->rx_start;
+    len = avail < 2 ? 0 : MQTTPacket_decodeSpan(c->rxbuf + c->rx_start + 1, avail - 1, &rem_len);
+    if (len == 0)
+        rc = 0;
+    else if (len > 0)
+        rc = 1 + len + rem_len > (int)c->rxbuf_size ? MQTT_BUFFER_OVERFLOW : 0;
+
+exit:
+    platform_mutex_unlock(&c->mutex);
+    return rc;
+}
+
+
+int MQTTKeepalive(MQTTClient* c)
+{
+    int rc = MQTT_SUCCESS;
+
+    platform_mutex_lock(&c->mutex);
+
+    if (c->isconnected)
+    {
+        if (keepalive(c) == MQTT_CONNECTION_LOST)
+            rc = MQTT_CONNECTION_LOST;
+        else if (c->ping_outstanding && platform_timer_isexpired(&c->pingresp_timer))
+        {
+            c->ping_outstanding = 0;
+            platform_printf("ping response was not received within keepalive timeout of %d\n", 
+                    c->keepAliveInterval);
+            rc = MQTT_CONNECTION_LOST;
+        }
+        else
+        {
+            /* an ack overdue means the link is stalled, it is resent after reconnecting */
+            MQTTInflight* f = earliestInflight(c);
+            if (f && platform_timer_isexpired(&f->timer))
+                rc = MQTT_CONNECTION_LOST;
+        }
+    }
+
+    platform_mutex_unlock(&c->mutex);
+
+    return rc;
+}
+
+
+int MQTTKeepaliveLeft(MQTTClient* c)
+{
+    int left = -1;
+
+    platform_mutex_lock(&c->mutex);
+
+    if (c->isconnected && c->keepAliveInterval > 0)
+    {
+        if (c->ping_outstanding)
+            left = platform_timer_left(&c->pingresp_timer);
+        else
+        {
+            left = platform_timer_left(&c->ping_timer);
+            if (platform_timer_left(&c->last_received) < left)
+                left = platform_timer_left(&c->last_received);
+        }
+    }
+
+    if (c->isconnected)
+    {
+        MQTTInflight* f = earliestInflight(c);
+        if (f && (left < 0 || platform_timer_left(&f->timer) < left))
+            left = platform_timer_left(&f->timer);
+    }
+
+    platform_mutex_unlock(&c->mutex);
+
+    return left;
+}
+
+
+void MQTTGetRtt(MQTTClient* c, MQTTRtt* rtt)
+{
+    platform_mutex_lock(&c->mutex);
+
+    rtt->samples = c->rtt_samples;
+    rtt->last_ms = c->rtt_last;
+    rtt->min_ms = c->rtt_min;
+    rtt->max_ms = c->rtt_max;
+    rtt->avg_ms = c->rtt_samples > 0 ? (int)(c->rtt_sum / c->rtt_samples) : -1;
+
+    platform_mutex_unlock(&c->mutex);
+}
+
+
+int waitfor(MQTTClient* c, int packet_type, Timer* timer)
 {
     int rc = MQTT_FAILURE;
 
@@ -368,13 +1100,37 @@ int waitfor(MQTTClient* c, int packet_type, Timer* timer)
 }
 
 
-int MQTTConnect(MQTTClient* c, MQTTPacket_connectData* options)
+/* like waitfor, but skips acks belonging to other (in-flight) packet ids */
+static int waitforAck(MQTTClient* c, int packet_type, unsigned short id, Timer* timer)
+{
+    int rc;
+
+    do
+    {
+        unsigned short mypacketid = 0;
+        unsigned char dup, type;
+
+        if ((rc = waitfor(c, packet_type, timer)) != packet_type)
+            break;
+        if (MQTTDeserialize_ack(&type, &dup, &mypacketid, c->readbuf, c->readbuf_size) != 1 || mypacketid == id)
+            break;
+    }
+    while (1);
+
+    return rc;
+}
+
+
+int MQTTConnectWithResults(MQTTClient* c, MQTTPacket_connectData* options, MQTTConnackData* data)
 {
     Timer connect_timer;
     int rc = MQTT_FAILURE;
     MQTTPacket_connectData default_options = MQTTPacket_connectData_initializer;
     int len = 0;
 
+    data->rc = 255;
+    data->sessionPresent = 0;
+
 	platform_mutex_lock(&c->mutex);
 	if (c->isconnected) /* don't send connect packet again if we are already connected */
 		goto exit;
@@ -387,7 +1143,10 @@ int MQTTConnect(MQTTClient* c, MQTTPacket_connectData* options)
     
     c->ping_outstanding = 0;
     c->keepAliveInterval = options->keepAliveInterval;
+    c->cork_len = 0; /* left from the previous connection */
+    c->rx_start = c->rx_end = 0; /* nothing left over from a previous connection */
     platform_timer_countdown(&c->ping_timer, c->keepAliveInterval*1000);
+    platform_timer_countdown(&c->last_received, c->keepAliveInterval*1000);
 
     if ((len = MQTTSerialize_connect(c->buf, c->buf_size, options)) <= 0)
         goto exit;
@@ -397,16 +1156,17 @@ int MQTTConnect(MQTTClient* c, MQTTPacket_connectData* options)
     // this will be a blocking call, wait for the connack
     if (waitfor(c, CONNACK, &connect_timer) == CONNACK)
     {
-        unsigned char connack_rc = 255;
-        unsigned char sessionPresent = 0;
-        if (MQTTDeserialize_connack(&sessionPresent, &connack_rc, c->readbuf, c->readbuf_size) == 1)
-            rc = connack_rc;
+        if (MQTTDeserialize_connack(&data->sessionPresent, &data->rc, c->readbuf, c->readbuf_size) == 1)
+            rc = data->rc;
         else
             rc = MQTT_FAILURE;
     }
     else
         rc = MQTT_FAILURE;
     
+    if (rc == MQTT_SUCCESS && c->inflight_count > 0)
+        rc = resendInflight(c);
+
 exit:
     if (rc == MQTT_SUCCESS)
         c->isconnected = 1;
@@ -417,6 +1177,13 @@ exit:
 }
 
 
+int MQTTConnect(MQTTClient* c, MQTTPacket_connectData* options)
+{
+    MQTTConnackData data;
+    return MQTTConnectWithResults(c, options, &data);
+}
+
+
 int MQTTisConnected(MQTTClient* c)
 {
     int ret = 0;
@@ -438,7 +1205,8 @@ int MQTTSubscribe(MQTTClient* c, const char* topicFilter, enum QoS qos)
     Timer timer;
     int len = 0;
     MQTTString topic = MQTTString_initializer;
-    topic.cstring = (char *)topicFilter;
+    topic.lenstring.data = (char *)topicFilter;
+    topic.lenstring.len = strlen(topicFilter);
     
 	platform_mutex_lock(&c->mutex);
 
@@ -472,12 +1240,111 @@ exit:
 }
 
 
+/* the number of filters from topicFilters which fit in one subscribe packet */
+static int subscribeBatch(MQTTClient* c, int count, MQTTString topicFilters[])
+{
+    int n, rem_len = 2; /* packetid */
+
+    for (n = 0; n < count; n++)
+    {
+        int len = rem_len + 2 + MQTTstrlen(topicFilters[n]) + 1;
+        if ((size_t)MQTTPacket_len(len) > c->buf_size)
+            break;
+        rem_len = len;
+    }
+    return n;
+}
+
+
+int MQTTSubscribeMany(MQTTClient* c, int count, MQTTString topicFilters[], int requestedQoSs[], int grantedQoSs[])
+{
+    struct { unsigned short id; int first, count; } pending[MAX_SUBSCRIBE_INFLIGHT];
+    int npending = 0, next = 0, i;
+    int rc = MQTT_FAILURE;
+    Timer timer;
+
+    for (i = 0; i < count; i++)
+        grantedQoSs[i] = 0x80;
+
+    platform_mutex_lock(&c->mutex);
+
+    if (!c->isconnected)
+        goto exit;
+
+    platform_timer_init(&timer);
+    platform_timer_countdown(&timer, c->command_timeout_ms);
+
+    rc = MQTT_SUCCESS;
+    while (next < count || npending > 0)
+    {
+        if (next < count && npending < MAX_SUBSCRIBE_INFLIGHT)
+        {
+            int n = subscribeBatch(c, count - next, &topicFilters[next]);
+            if (n == 0)
+            {
+                next++; /* this filter alone is too long for the buffer, it stays refused */
+                continue;
+            }
+
+            unsigned short id = getNextPacketId(c);
+            int len = MQTTSerialize_subscribe(c->buf, c->buf_size, 0, id, n, &topicFilters[next], &requestedQoSs[next]);
+            if (len <= 0)
+            {
+                rc = MQTT_FAILURE;
+                break;
+            }
+            if ((rc = sendPacket(c, len, &timer)) != MQTT_SUCCESS)
+                break;
+
+            pending[npending].id = id;
+            pending[npending].first = next;
+            pending[npending].count = n;
+            npending++;
+            next += n;
+            continue;
+        }
+
+        if (waitfor(c, SUBACK, &timer) != SUBACK)
+        {
+            rc = MQTT_CONNECTION_LOST;
+            break;
+        }
+
+        unsigned short mypacketid;
+        unsigned char dup, type;
+        if (MQTTDeserialize_ack(&type, &dup, &mypacketid, c->readbuf, c->readbuf_size) != 1)
+            continue;
+        for (i = 0; i < npending && pending[i].id != mypacketid; i++)
+            ;
+        if (i == npending)
+            continue; /* not one of ours */
+
+        int granted = 0;
+        if (MQTTDeserialize_suback(&mypacketid, pending[i].count, &granted, &grantedQoSs[pending[i].first], 
+                    c->readbuf, c->readbuf_size) != 1 || granted != pending[i].count)
+        {
+            for (granted = 0; granted < pending[i].count; granted++)
+                grantedQoSs[pending[i].first + granted] = 0x80;
+        }
+        pending[i] = pending[--npending];
+
+        /* the timeout applies to each suback rather than to the whole set */
+        platform_timer_countdown(&timer, c->command_timeout_ms);
+    }
+
+exit:
+    platform_mutex_unlock(&c->mutex);
+    return rc;
+}
+
+
 int MQTTUnsubscribe(MQTTClient* c, const char* topicFilter)
 {   
     int rc = MQTT_FAILURE;
     Timer timer;    
     MQTTString topic = MQTTString_initializer;
-    topic.cstring = (char *)topicFilter;
+    topic.lenstring.data = (char *)topicFilter;
+    topic.lenstring.len = strlen(topicFilter);
     int len = 0;
 
 	platform_mutex_lock(&c->mutex);
@@ -510,11 +1377,18 @@ exit:
 
 
 int MQTTPublish(MQTTClient* c, const char* topicName, MQTTMessage* message)
+{
+    MQTTString topic = MQTTString_initializer;
+    topic.lenstring.data = (char *)topicName;
+    topic.lenstring.len = strlen(topicName);
+    return MQTTPublishTopic(c, topic, message);
+}
+
+
+int MQTTPublishTopic(MQTTClient* c, MQTTString topic, MQTTMessage* message)
 {
     int rc = MQTT_FAILURE;
     Timer timer;   
-    MQTTString topic = MQTTString_initializer;
-    topic.cstring = (char *)topicName;
     int len = 0;
 
 	platform_mutex_lock(&c->mutex);
@@ -527,18 +1401,19 @@ int MQTTPublish(MQTTClient* c, const char* topicName, MQTTMessage* message)
     if (message->qos == QOS1 || message->qos == QOS2)
         message->id = getNextPacketId(c);
     
-    len = MQTTSerialize_publish(c->buf, c->buf_size, 0, message->qos, message->retained, message->id, 
-              topic, (unsigned char*)message->payload, message->payloadlen);
+    len = MQTTSerialize_publishHeader(c->buf, c->buf_size, 0, message->qos, message->retained, message->id, 
+              topic, message->payloadlen);
     if (len <= 0)
         goto exit;
-    if ((rc = sendPacket(c, len, &timer)) != MQTT_SUCCESS) // send the subscribe packet
+    NetworkBuffer bufs[2] = {{c->buf, len}, {(unsigned char*)message->payload, message->payloadlen}};
+    if ((rc = sendPacketv(c, bufs, 2, &timer)) != MQTT_SUCCESS) // send the publish packet
     {
         goto exit; // there was a problem
     }
 
     if (message->qos == QOS1)
     {
-        if (waitfor(c, PUBACK, &timer) == PUBACK)
+        if (waitforAck(c, PUBACK, message->id, &timer) == PUBACK)
         {
             unsigned short mypacketid;
             unsigned char dup, type;
@@ -555,7 +1430,7 @@ int MQTTPublish(MQTTClient* c, const char* topicName, MQTTMessage* message)
     }
     else if (message->qos == QOS2)
     {
-        if (waitfor(c, PUBCOMP, &timer) == PUBCOMP)
+        if (waitforAck(c, PUBCOMP, message->id, &timer) == PUBCOMP)
         {
             unsigned short mypacketid;
             unsigned char dup, type;
@@ -574,6 +1449,201 @@ exit:
 }
 
 
+int MQTTSetMaxInflight(MQTTClient* c, unsigned int max_inflight)
+{
+    int rc = MQTT_SUCCESS;
+    unsigned int i;
+
+	platform_mutex_lock(&c->mutex);
+
+    if (c->inflight_count > 0)
+    {
+        rc = MQTT_FAILURE;
+        goto exit;
+    }
+
+    for (i = 0; i < c->max_inflight; i++)
+        platform_timer_deinit(&c->inflight[i].timer);
+    platform_free(c->inflight);
+    c->inflight = NULL;
+    c->max_inflight = 0;
+
+    if (max_inflight == 0)
+        goto exit;
+
+    if (!(c->inflight = (MQTTInflight*)platform_malloc(max_inflight * sizeof(MQTTInflight))))
+    {
+        rc = MQTT_FAILURE;
+        goto exit;
+    }
+    memset(c->inflight, 0, max_inflight * sizeof(MQTTInflight));
+    for (i = 0; i < max_inflight; i++)
+        platform_timer_init(&c->inflight[i].timer);
+    c->max_inflight = max_inflight;
+
+exit:
+	platform_mutex_unlock(&c->mutex);
+    return rc;
+}
+
+
+int MQTTPublishAsync(MQTTClient* c, const char* topicName, MQTTMessage* message,
+        publishCompleteHandler handler, void* context)
+{
+    MQTTString topic = MQTTString_initializer;
+    topic.lenstring.data = (char *)topicName;
+    topic.lenstring.len = strlen(topicName);
+    return MQTTPublishTopicAsync(c, topic, message, handler, context);
+}
+
+
+int MQTTPublishTopicAsync(MQTTClient* c, MQTTString topic, MQTTMessage* message,
+        publishCompleteHandler handler, void* context)
+{
+    int rc = MQTT_FAILURE;
+    Timer timer;
+    MQTTInflight* f = NULL;
+    int len = 0;
+
+	platform_mutex_lock(&c->mutex);
+	if (!c->isconnected)
+		goto exit;
+
+    platform_timer_init(&timer);
+    platform_timer_countdown(&timer, c->command_timeout_ms);
+
+    if (message->qos == QOS1 || message->qos == QOS2)
+    {
+        if (c->max_inflight == 0)
+            goto exit;
+
+        /* window is full, make room by handling incoming acks */
+        while (c->inflight_count >= c->max_inflight)
+        {
+            if (platform_timer_isexpired(&timer) || cycle(c, &timer) == MQTT_CONNECTION_LOST)
+            {
+                rc = MQTT_CONNECTION_LOST;
+                goto exit;
+            }
+        }
+
+        f = findInflight(c, 0);
+        message->id = getNextPacketId(c);
+    }
+
+    len = MQTTSerialize_publishHeader(c->buf, c->buf_size, 0, message->qos, message->retained, message->id, 
+              topic, message->payloadlen);
+    if (len <= 0)
+        goto exit;
+
+    if (f)
+    {
+        /* only the header is copied, the payload is referenced until completion */
+        if (!(f->packet = (unsigned char*)platform_malloc(len)))
+            goto exit;
+        memcpy(f->packet, c->buf, len);
+        f->len = len;
+        f->payload = (unsigned char*)message->payload;
+        f->payloadlen = message->payloadlen;
+        f->id = message->id;
+        f->awaiting = message->qos == QOS1 ? PUBACK : PUBREC;
+        f->handler = handler;
+        f->context = context;
+        platform_timer_countdown(&f->timer, c->command_timeout_ms);
+    }
+
+    NetworkBuffer bufs[2] = {{c->buf, len}, {(unsigned char*)message->payload, message->payloadlen}};
+    if ((rc = sendPacketv(c, bufs, 2, &timer)) != MQTT_SUCCESS)
+    {
+        if (f)
+        {
+            /* never went out, the caller is told by the return code */
+            platform_free(f->packet);
+            f->packet = NULL;
+            f->id = 0;
+        }
+        goto exit;
+    }
+
+    if (f)
+        c->inflight_count++;
+
+exit:
+	platform_mutex_unlock(&c->mutex);
+    return rc;
+}
+
+
+int MQTTWaitInflight(MQTTClient* c, int timeout_ms)
+{
+    int rc = MQTT_SUCCESS;
+    Timer timer;
+    platform_timer_init(&timer);
+    platform_timer_countdown(&timer, timeout_ms);
+
+	platform_mutex_lock(&c->mutex);
+
+    while (c->isconnected && c->inflight_count > 0)
+    {
+        if (platform_timer_isexpired(&timer))
+        {
+            rc = MQTT_FAILURE;
+            break;
+        }
+        if (cycle(c, &timer) == MQTT_CONNECTION_LOST)
+        {
+            rc = MQTT_CONNECTION_LOST;
+            break;
+        }
+    }
+
+	platform_mutex_unlock(&c->mutex);
+    return rc;
+}
+
+
+int MQTTWaitInflightRoom(MQTTClient* c, int timeout_ms)
+{
+    int rc = MQTT_SUCCESS;
+    Timer timer;
+    platform_timer_init(&timer);
+    platform_timer_countdown(&timer, timeout_ms);
+
+	platform_mutex_lock(&c->mutex);
+
+    while (c->isconnected && c->inflight_count >= c->max_inflight)
+    {
+        if (platform_timer_isexpired(&timer))
+        {
+            rc = MQTT_FAILURE;
+            break;
+        }
+        if (cycle(c, &timer) == MQTT_CONNECTION_LOST)
+        {
+            rc = MQTT_CONNECTION_LOST;
+            break;
+        }
+    }
+
+	platform_mutex_unlock(&c->mutex);
+    return rc;
+}
+
+
+void MQTTAbortInflight(MQTTClient* c, int rc)
+{
+    unsigned int i;
+
+    platform_mutex_lock(&c->mutex);
+
+    for (i = 0; i < c->max_inflight && c->inflight_count > 0; i++)
+        if (c->inflight[i].id)
+            completeInflight(c, &c->inflight[i], rc);
+
+    platform_mutex_unlock(&c->mutex);
+}
+
+
 int MQTTDisconnect(MQTTClient* c)
 {  
     int rc = MQTT_FAILURE;
@@ -584,6 +1654,7 @@ int MQTTDisconnect(MQTTClient* c)
     platform_timer_init(&timer);
     platform_timer_countdown(&timer, c->command_timeout_ms);
 
+    c->corked = 0; /* what was collected goes out before the disconnect packet */
 	len = MQTTSerialize_disconnect(c->buf, c->buf_size);
     if (len > 0)
         rc = sendPacket(c, len, &timer);            // send the disconnect packet
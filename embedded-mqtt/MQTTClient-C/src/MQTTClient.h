@@ -27,6 +27,14 @@
 
 #define MAX_PACKET_ID 65535 /* according to the MQTT specification - do not change! */
 
+#if !defined(MAX_SUBSCRIBE_INFLIGHT)
+#define MAX_SUBSCRIBE_INFLIGHT 4 /* SUBSCRIBE packets sent by MQTTSubscribeMany before waiting for a SUBACK */
+#endif
+
+#if !defined(MAX_RTT_MS)
+#define MAX_RTT_MS 3600000 /* round trips are timed with a countdown from this */
+#endif
+
 enum QoS { QOS0, QOS1, QOS2 };
 
 typedef struct MQTTMessage
@@ -45,6 +53,59 @@ typedef struct MessageData
     MQTTString* topicName;
 } MessageData;
 
+typedef struct MQTTConnackData
+{
+    unsigned char rc;
+    unsigned char sessionPresent;
+} MQTTConnackData;
+
+/* round trip times of the ping requests answered */
+typedef struct MQTTRtt
+{
+    unsigned int samples;
+    int last_ms,
+      min_ms,
+      avg_ms,
+      max_ms;
+} MQTTRtt;
+
+/* packets sent and the network writes they took, see MQTTCork */
+typedef struct MQTTSendStats
+{
+    unsigned long packets,
+      writes;
+} MQTTSendStats;
+
+/* Read buffers of the same size shared out by reference count, see 
+ * MQTTSetReadBufferPool. A buffer is free when nothing refers to it. */
+typedef struct MQTTBufferPool
+{
+    unsigned char* mem;         /* count buffers of size bytes */
+    size_t size;
+    int count;
+    int* refs;
+    Mutex mutex;
+} MQTTBufferPool;
+
+/* called once a QoS1/2 publish sent with MQTTPublishAsync is acknowledged (rc == MQTT_SUCCESS) or abandoned */
+typedef void (*publishCompleteHandler)(unsigned short id, int rc, void* context);
+
+/* An unacknowledged QoS1/2 publish. The packet header is kept for retransmission,
+ * the payload is referenced. Both are replaced by the PUBREL once the PUBREC of a
+ * QoS2 publish arrives. */
+typedef struct MQTTInflight
+{
+    unsigned short id;          /* 0 when the slot is free */
+    unsigned char awaiting;     /* PUBACK, PUBREC or PUBCOMP */
+    unsigned char* packet;
+    int len;
+    unsigned char* payload;
+    int payloadlen;
+    Timer timer;
+    publishCompleteHandler handler;
+    void* context;
+} MQTTInflight;
+
 typedef struct MQTTClient
 {
     unsigned int next_packetid,
@@ -53,17 +114,44 @@ typedef struct MQTTClient
       readbuf_size;
     unsigned char *buf,
       *readbuf;
+    unsigned char *rxbuf;       /* bytes received but not consumed yet, see MQTTSetReceiveBuffer */
+    size_t rxbuf_size,
+      rx_start,
+      rx_end;
+    unsigned char *corkbuf;     /* packets sent while corked, see MQTTCork */
+    size_t corkbuf_size,
+      cork_len;
+    int corked;
+    unsigned long packets_sent,
+      writes;
+    MQTTBufferPool* pool;       /* packets are read into its buffers, see MQTTSetReadBufferPool */
+    int pool_index;             /* of readbuf, -1 while reading into the own buffer */
+    unsigned char *own_readbuf;
+    size_t own_readbuf_size;
     unsigned int keepAliveInterval;
     char ping_outstanding;
     int isconnected;
 
     void (*messageHandler) (MessageData*, void*);
     void* messageHandlerData;
+    /* receives publishes too large for readbuf piece by piece, message->payloadlen is the total length */
+    void (*chunkHandler) (MessageData*, size_t offset, unsigned char* chunk, size_t chunklen, void*);
 
     Network* ipstack;
-    Timer ping_timer;
+    Timer ping_timer;           /* since the last packet sent */
     Timer pingresp_timer;
+    Timer last_received;        /* since the last packet received */
+    Timer ping_sent;            /* times the round trip of the outstanding ping */
+    int rtt_last,
+      rtt_min,
+      rtt_max;
+    unsigned int rtt_samples;
+    unsigned long rtt_sum;
 	Mutex mutex;
+
+    MQTTInflight* inflight;
+    unsigned int max_inflight,
+      inflight_count;
 #if defined(MQTT_TASK)
 	Thread thread;
 #endif 
@@ -84,6 +172,68 @@ void MQTTClientInit(MQTTClient* client, Network* network, unsigned int command_t
 
 void MQTTClientDeinit(MQTTClient *client);
 
+/** Set a buffer to receive into. Each socket read then pulls in as much as is
+ *  available, and packets are framed from the buffer, so a burst of small packets
+ *  costs a single read. Without it every part of a packet is a separate read.
+ *  @param client - the client object to use
+ *  @param buf - the receive buffer, 0 to read from the network directly
+ *  @param size - the size of the receive buffer
+ */
+void MQTTSetReceiveBuffer(MQTTClient* client, unsigned char* buf, size_t size);
+
+/** Set the buffer packets are collected in while the client is corked.
+ *  @param client - the client object to use
+ *  @param buf - the cork buffer, 0 to never cork
+ *  @param size - the size of the cork buffer
+ */
+void MQTTSetCorkBuffer(MQTTClient* client, unsigned char* buf, size_t size);
+
+/** MQTT Cork - collect the packets sent from now on in the cork buffer, so that
+ *  many small publishes go out in one network write. The buffer is written when
+ *  it is full, when the client waits for a packet and by MQTTUncork.
+ *  @param client - the client object to use
+ *  @return success code, failure if no cork buffer was set
+ */
+int MQTTCork(MQTTClient* client);
+
+/** MQTT Uncork - write the packets collected and send the next ones right away.
+ *  @param client - the client object to use
+ *  @return success code
+ */
+int MQTTUncork(MQTTClient* client);
+
+/** Set up a pool of count buffers of size bytes each, from mem. refs holds
+ *  the reference count of each buffer.
+ *  @return success code, failure if an argument is invalid
+ */
+int MQTTBufferPoolInit(MQTTBufferPool* pool, unsigned char* mem, size_t size, int count, int* refs);
+
+void MQTTBufferPoolDeinit(MQTTBufferPool* pool);
+
+/** Keep the pool buffer holding ptr, for instance the payload of a message
+ *  passed to the message handler, past the return of the handler. Every 
+ *  successful retain must be matched by a MQTTBufferRelease, from any thread.
+ *  @return success code, failure if ptr is not in a buffer of the pool
+ */
+int MQTTBufferRetain(MQTTBufferPool* pool, const void* ptr);
+
+void MQTTBufferRelease(MQTTBufferPool* pool, const void* ptr);
+
+/** Read packets into the buffers of a pool, each one in use only while the
+ *  packet read into it is handled or retained. Once a buffer is retained the
+ *  next packet is read into a free one, into readbuf if there is none. The
+ *  pool buffers must be as large as readbuf.
+ *  @param client - the client object to use
+ *  @param pool - the pool, 0 to read into readbuf only
+ */
+void MQTTSetReadBufferPool(MQTTClient* client, MQTTBufferPool* pool);
+
+/** MQTT Send Stats - the packets sent and the network writes they took
+ *  @param client - the client object to use
+ *  @param stats - the counters
+ */
+void MQTTGetSendStats(MQTTClient* client, MQTTSendStats* stats);
+
 /** MQTT Connect - send an MQTT connect packet down the network and wait for a Connack
  *  The nework object must be connected to the network endpoint before calling this
  *  @param options - connect options
@@ -91,7 +241,17 @@ void MQTTClientDeinit(MQTTClient *client);
  */
 int MQTTConnect(MQTTClient* client, MQTTPacket_connectData* options);
 
+/** MQTT Connect With Results - MQTTConnect which also returns the connack data.
+ *  sessionPresent is set when the server kept the state of a session started 
+ *  without cleansession, the subscriptions of the session are then still in place.
+ *  @param options - connect options
+ *  @param data - connack data returned
+ *  @return success code
+ */
+int MQTTConnectWithResults(MQTTClient* client, MQTTPacket_connectData* options, MQTTConnackData* data);
+
 /** MQTT Publish - send an MQTT publish packet and wait for all acks to complete for all QoSs
+ *  The payload is sent in place, its size is not limited by the send buffer.
  *  @param client - the client object to use
  *  @param topic - the topic to publish to
  *  @param message - the message to send
@@ -99,6 +259,71 @@ int MQTTConnect(MQTTClient* client, MQTTPacket_connectData* options);
  */
 int MQTTPublish(MQTTClient* client, const char*, MQTTMessage*);
 
+/** MQTT Publish Topic - MQTTPublish with the topic given as an MQTTString.
+ *  A lenstring topic is copied into the packet without scanning it for its length.
+ *  @param client - the client object to use
+ *  @param topic - the topic to publish to
+ *  @param message - the message to send
+ *  @return success code
+ */
+int MQTTPublishTopic(MQTTClient* client, MQTTString topic, MQTTMessage* message);
+
+/** Set the number of QoS1/2 publishes which may await acknowledgement at the same time.
+ *  Can only be changed while nothing is in flight.
+ *  @param client - the client object to use
+ *  @param max_inflight - window size, 0 frees the in-flight table
+ *  @return success code
+ */
+int MQTTSetMaxInflight(MQTTClient* client, unsigned int max_inflight);
+
+/** MQTT Publish Async - send an MQTT publish packet without waiting for the acks.
+ *  QoS1/2 publishes are kept in the in-flight table until PUBACK or PUBCOMP arrives, 
+ *  acks are matched by packet id in any order. Unacknowledged publishes are sent again
+ *  with the DUP flag by MQTTConnect. If the window is full incoming packets are
+ *  handled until a slot is freed or the command timeout expires.
+ *  The payload is sent in place, it must stay valid until the handler is called.
+ *  @param client - the client object to use
+ *  @param topic - the topic to publish to
+ *  @param message - the message to send, message->id is set for QoS1/2
+ *  @param handler - called on completion of a QoS1/2 publish, not called for QoS0 
+ *                   or when an error is returned
+ *  @param context - user supplied pointer passed to the handler
+ *  @return success code
+ */
+int MQTTPublishAsync(MQTTClient* client, const char* topic, MQTTMessage* message,
+        publishCompleteHandler handler, void* context);
+
+/** MQTT Publish Topic Async - MQTTPublishAsync with the topic given as an MQTTString.
+ *  @param client - the client object to use
+ *  @param topic - the topic to publish to
+ *  @param message - the message to send, message->id is set for QoS1/2
+ *  @param handler - called on completion of a QoS1/2 publish
+ *  @param context - user supplied pointer passed to the handler
+ *  @return success code
+ */
+int MQTTPublishTopicAsync(MQTTClient* client, MQTTString topic, MQTTMessage* message,
+        publishCompleteHandler handler, void* context);
+
+/** Handle incoming packets until every in-flight publish is acknowledged.
+ *  @param client - the client object to use
+ *  @param time - the time, in milliseconds, to wait for
+ *  @return success code
+ */
+int MQTTWaitInflight(MQTTClient* client, int time);
+
+/** Handle incoming packets until the in-flight window has room for another publish.
+ *  @param client - the client object to use
+ *  @param time - the time, in milliseconds, to wait for
+ *  @return success code
+ */
+int MQTTWaitInflightRoom(MQTTClient* client, int time);
+
+/** Drop all in-flight publishes, calling their handlers with the given return code.
+ *  @param client - the client object to use
+ *  @param rc - the return code to pass to the handlers
+ */
+void MQTTAbortInflight(MQTTClient* client, int rc);
+
 /** MQTT Subscribe - send an MQTT subscribe packet and wait for suback before returning.
  *  @param client - the client object to use
  *  @param topicFilter - the topic filter to subscribe to
@@ -108,6 +333,19 @@ int MQTTPublish(MQTTClient* client, const char*, MQTTMessage*);
  */
 int MQTTSubscribe(MQTTClient* client, const char* topicFilter, enum QoS);
 
+/** MQTT Subscribe Many - subscribe to a number of topic filters at once.
+ *  As many filters as fit in the send buffer are put in each subscribe packet and
+ *  up to MAX_SUBSCRIBE_INFLIGHT packets are sent before waiting for a suback. 
+ *  @param client - the client object to use
+ *  @param count - the number of topic filters
+ *  @param topicFilters - the topic filters to subscribe to
+ *  @param requestedQoSs - the QoS requested for each filter
+ *  @param grantedQoSs - set to the QoS granted for each filter, 0x80 if the subscription
+ *                       was refused or could not be sent
+ *  @return success code
+ */
+int MQTTSubscribeMany(MQTTClient* client, int count, MQTTString topicFilters[], int requestedQoSs[], int grantedQoSs[]);
+
 /** MQTT Subscribe - send an MQTT unsubscribe packet and wait for unsuback before returning.
  *  @param client - the client object to use
  *  @param topicFilter - the topic filter to unsubscribe from
@@ -128,6 +366,46 @@ int MQTTDisconnect(MQTTClient* client);
  */
 int MQTTYield(MQTTClient* client, int time);
 
+/** MQTT Cycle - read and handle an incoming packet, followed by any further
+ *  packets already complete in the receive buffer.
+ *  Meant to be called when the network is known to have data to read.
+ *  @param client - the client object to use
+ *  @param time - the time, in milliseconds, to wait for the packet to be read
+ *  @return the packet type read or a negative error code
+ */
+int MQTTCycle(MQTTClient* client, int time);
+
+/** MQTT Receive - read what the network has into the receive buffer without waiting.
+ *  Lets a thread driving many clients call MQTTCycle only once a packet is complete,
+ *  so that a slow sender does not hold it up. Partial packets stay buffered.
+ *  @param client - the client object to use
+ *  @return 1 if a complete packet is buffered or there is no receive buffer, 0 if more
+ *  bytes are needed, MQTT_BUFFER_OVERFLOW if the packet is larger than the receive buffer
+ *  and MQTTCycle has to wait for it, MQTT_CONNECTION_LOST if the peer closed the connection
+ */
+int MQTTReceive(MQTTClient* client);
+
+/** MQTT Keepalive - send a ping request if it is due and check for the ping response.
+ *  A ping is due when nothing was sent or nothing was received for the keepalive
+ *  interval. Any packet received while a ping is outstanding shows the link is alive
+ *  and gives the ping response more time.
+ *  @param client - the client object to use
+ *  @return MQTT_CONNECTION_LOST if the ping response or an in-flight ack did not arrive in time, otherwise success code
+ */
+int MQTTKeepalive(MQTTClient* client);
+
+/** Time left until MQTTKeepalive must be called, in-flight publish deadlines included.
+ *  @param client - the client object to use
+ *  @return the time in milliseconds or -1 if there is nothing to wait for
+ */
+int MQTTKeepaliveLeft(MQTTClient* client);
+
+/** Round trip times of the ping requests answered since the client was initialised.
+ *  @param client - the client object to use
+ *  @param rtt - filled with the times, all -1 if there was no sample yet
+ */
+void MQTTGetRtt(MQTTClient* client, MQTTRtt* rtt);
+
 int MQTTisConnected(MQTTClient* client);
 
 
@@ -222,6 +222,7 @@ private:
     struct MessageHandlers
     {
         const char* topicFilter;
+        int topicFilterLen;
         FP<void, MessageData&> fp;
     } messageHandlers[MAX_MESSAGE_HANDLERS];      // Message handlers are indexed by subscription topic
 
@@ -359,29 +360,17 @@ int MQTT::Client<Network, Timer, a, b>::sendPacket(int length, Timer& timer)
 template<class Network, class Timer, int a, int b>
 int MQTT::Client<Network, Timer, a, b>::decodePacket(int* value, int timeout)
 {
-    unsigned char c;
-    int multiplier = 1;
-    int len = 0;
-    const int MAX_NO_OF_REMAINING_LENGTH_BYTES = 4;
+    unsigned char buf[4];
+    int len = 0, rc;
 
-    *value = 0;
     do
     {
-        int rc = MQTTPACKET_READ_ERROR;
+        if (len == sizeof(buf) || ipstack.read(buf + len, 1, timeout) != 1)
+            return MQTTPACKET_READ_ERROR;
+        len++;
+    } while ((rc = MQTTPacket_decodeSpan(buf, len, value)) == 0);
 
-        if (++len > MAX_NO_OF_REMAINING_LENGTH_BYTES)
-        {
-            rc = MQTTPACKET_READ_ERROR; /* bad data */
-            goto exit;
-        }
-        rc = ipstack.read(&c, 1, timeout);
-        if (rc != 1)
-            goto exit;
-        *value += (c & 127) * multiplier;
-        multiplier *= 128;
-    } while ((c & 128) != 0);
-exit:
-    return len;
+    return rc;
 }
 
 
@@ -405,7 +394,8 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::readPacket(Timer& tim
 
     len = 1;
     /* 2. read the remaining length.  This is variable in itself */
-    decodePacket(&rem_len, timer.left_ms());
+    if (decodePacket(&rem_len, timer.left_ms()) < 0)
+        goto exit;
     len += MQTTPacket_encode(readbuf + 1, rem_len); /* put the original remaining length into the buffer */
 
 	if (rem_len > (MAX_MQTT_PACKET_SIZE - len))
@@ -476,7 +466,7 @@ int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::deliverMessage(MQTTSt
     // we have to find the right message handler - indexed by topic
     for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
     {
-        if (messageHandlers[i].topicFilter != 0 && (MQTTPacket_equals(&topicName, (char*)messageHandlers[i].topicFilter) ||
+        if (messageHandlers[i].topicFilter != 0 && (MQTTPacket_equalsLen(&topicName, messageHandlers[i].topicFilter, messageHandlers[i].topicFilterLen) ||
                 isTopicMatched((char*)messageHandlers[i].topicFilter, topicName)))
         {
             if (messageHandlers[i].fp.attached())
@@ -729,7 +719,7 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::su
     int rc = FAILURE;
     Timer timer = Timer(command_timeout_ms);
     int len = 0;
-    MQTTString topic = {(char*)topicFilter, {0, 0}};
+    MQTTString topic = {0, {(int)strlen(topicFilter), (char*)topicFilter}};
 
     if (!isconnected)
         goto exit;
@@ -753,6 +743,7 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::su
                 if (messageHandlers[i].topicFilter == 0)
                 {
                     messageHandlers[i].topicFilter = topicFilter;
+                    messageHandlers[i].topicFilterLen = topic.lenstring.len;
                     messageHandlers[i].fp.attach(messageHandler);
                     rc = 0;
                     break;
@@ -775,7 +766,7 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::un
 {
     int rc = FAILURE;
     Timer timer = Timer(command_timeout_ms);
-    MQTTString topic = {(char*)topicFilter, {0, 0}};
+    MQTTString topic = {0, {(int)strlen(topicFilter), (char*)topicFilter}};
     int len = 0;
 
     if (!isconnected)
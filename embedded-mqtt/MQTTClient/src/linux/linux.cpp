@@ -27,6 +27,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -36,9 +38,9 @@
 class IPStack 
 {
 public:    
-    IPStack()
+    IPStack() : mysock(-1), connect_time_ms(-1)
     {
-
+        cache.count = 0;
     }
     
 	int Socket_error(const char* aString)
@@ -55,57 +57,96 @@ public:
 		return errno;
 	}
 
-    int connect(const char* hostname, int port)
+    /* Connects to the addresses of hostname, cached for DNS_TTL seconds, with attempts racing
+     * each other as in RFC 8305: the next address is tried ATTEMPT_DELAY ms after the previous
+     * or as soon as it failed. Sockets are non-blocking so that a dead address cannot hold up
+     * the others, nor the connection past timeout_ms. */
+    int connect(const char* hostname, int port, int timeout_ms = CONNECT_TIMEOUT)
     {
-		int type = SOCK_STREAM;
-		struct sockaddr_in address;
-		int rc = -1;
-		sa_family_t family = AF_INET;
-		struct addrinfo *result = NULL;
-		struct addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL};
-
-		if ((rc = getaddrinfo(hostname, NULL, &hints, &result)) == 0)
-		{
-			struct addrinfo* res = result;
+        struct pollfd fds[MAX_ADDRS];
+        int nfds = 0, next = 0, count, i;
+        long start = now_ms(), next_start = start, now;
 
-			/* prefer ip4 addresses */
-			while (res)
-			{
-				if (res->ai_family == AF_INET)
-				{
-					result = res;
-					break;
-				}
-				res = res->ai_next;
-			}
+        mysock = -1;
+        if ((count = resolve(hostname)) == 0)
+            return -1;
 
-			if (result->ai_family == AF_INET)
-			{
-				address.sin_port = htons(port);
-				address.sin_family = family = AF_INET;
-				address.sin_addr = ((struct sockaddr_in*)(result->ai_addr))->sin_addr;
-			}
-			else
-				rc = -1;
+        while (mysock == -1 && (now = now_ms()) - start < timeout_ms)
+        {
+            if (next < count && (now >= next_start || nfds == 0))
+            {
+                struct sockaddr_storage* address = &cache.addrs[next];
+                int s = socket(address->ss_family, SOCK_STREAM, 0);
 
-			freeaddrinfo(result);
-		}
+                if (address->ss_family == AF_INET6)
+                    ((struct sockaddr_in6*)address)->sin6_port = htons(port);
+                else
+                    ((struct sockaddr_in*)address)->sin_port = htons(port);
 
-		if (rc == 0)
-		{
-			mysock = socket(family, type, 0);
-			if (mysock != -1)
-			{
-				int opt = 1;
+                if (s != -1 && fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK) == 0)
+                {
+                    if (::connect(s, (struct sockaddr*)address, cache.lens[next]) == 0)
+                        mysock = s;
+                    else if (errno == EINPROGRESS)
+                    {
+                        fds[nfds].fd = s;
+                        fds[nfds].events = POLLOUT;
+                        fds[nfds++].revents = 0;
+                        s = -1;
+                    }
+                }
+                if (s != -1 && s != mysock)
+                    ::close(s);
+                next++;
+                next_start = now + ATTEMPT_DELAY;
+                continue;
+            }
 
-				//if (setsockopt(mysock, SOL_SOCKET, SO_NOSIGPIPE, (void*)&opt, sizeof(opt)) != 0)
-				//	printf("Could not set SO_NOSIGPIPE for socket %d", mysock);
-				
-				rc = ::connect(mysock, (struct sockaddr*)&address, sizeof(address));
-			}
-		}
+            if (nfds == 0)
+                break;
+
+            int wait = (int)(start + timeout_ms - now);
+            if (next < count && next_start - now < wait)
+                wait = (int)(next_start - now);
+            if (poll(fds, nfds, wait) <= 0)
+                continue;
+
+            for (i = 0; i < nfds; i++)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+
+                if (fds[i].revents == 0)
+                    continue;
+                if (mysock == -1 && getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0)
+                    mysock = fds[i].fd;
+                else
+                {
+                    ::close(fds[i].fd);
+                    next_start = now;
+                }
+                fds[i--] = fds[--nfds];
+            }
+        }
+
+        for (i = 0; i < nfds; i++)
+            ::close(fds[i].fd);
 
-        return rc;
+        if (mysock == -1)
+        {
+            cache.count = 0; /* the addresses may have changed */
+            return -1;
+        }
+
+        fcntl(mysock, F_SETFL, fcntl(mysock, F_GETFL, 0) & ~O_NONBLOCK);
+        connect_time_ms = (int)(now_ms() - start);
+        return 0;
+    }
+
+    /* milliseconds the last successful connect took */
+    int connectTime()
+    {
+        return connect_time_ms;
     }
 
     int read(unsigned char* buffer, int len, int timeout_ms)
@@ -157,7 +198,73 @@ public:
     
 private:
 
+    enum { DNS_TTL = 60, CONNECT_TIMEOUT = 10000, ATTEMPT_DELAY = 250, MAX_ADDRS = 8 };
+
+    /* the addresses of the last host resolved, alternately IPv6 and IPv4 */
+    struct AddressCache
+    {
+        char host[MAXHOSTNAMELEN];
+        time_t expires;
+        int count;
+        struct sockaddr_storage addrs[MAX_ADDRS];
+        socklen_t lens[MAX_ADDRS];
+    };
+
+    static long now_ms()
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        return now.tv_sec * 1000L + now.tv_usec / 1000;
+    }
+
+    int resolve(const char* hostname)
+    {
+        struct addrinfo *result = NULL, *res;
+        struct addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL};
+        struct addrinfo* family[2][MAX_ADDRS];
+        int counts[2] = {0, 0};
+        int first = -1, i, f;
+
+        if (cache.count > 0 && strcmp(cache.host, hostname) == 0 && time(NULL) < cache.expires)
+            return cache.count;
+
+        cache.count = 0;
+        if (strlen(hostname) >= sizeof(cache.host) || getaddrinfo(hostname, NULL, &hints, &result) != 0)
+            return 0;
+
+        for (res = result; res; res = res->ai_next)
+        {
+            if (res->ai_family != AF_INET && res->ai_family != AF_INET6)
+                continue;
+            f = res->ai_family == AF_INET;
+            if (first < 0)
+                first = f;
+            if (counts[f] < MAX_ADDRS)
+                family[f][counts[f]++] = res;
+        }
+
+        for (i = 0; cache.count < MAX_ADDRS && (i < counts[0] || i < counts[1]); i++)
+        {
+            for (f = first; f >= 0 && f <= 1; f += first ? -1 : 1)
+            {
+                if (i < counts[f] && cache.count < MAX_ADDRS)
+                {
+                    memcpy(&cache.addrs[cache.count], family[f][i]->ai_addr, family[f][i]->ai_addrlen);
+                    cache.lens[cache.count++] = family[f][i]->ai_addrlen;
+                }
+            }
+        }
+
+        freeaddrinfo(result);
+
+        strcpy(cache.host, hostname);
+        cache.expires = time(NULL) + DNS_TTL;
+        return cache.count;
+    }
+
     int mysock; 
+    int connect_time_ms;
+    AddressCache cache;
     
 };
 
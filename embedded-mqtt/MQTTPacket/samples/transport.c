@@ -37,6 +37,7 @@
 #define ECONNRESET WSAECONNRESET
 #define ioctl ioctlsocket
 #define socklen_t int
+#define poll WSAPoll
 #else
 #define INVALID_SOCKET SOCKET_ERROR
 #include <sys/socket.h>
@@ -52,6 +53,8 @@
 #include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
+#include <poll.h>
+#include <time.h>
 #endif
 
 #if defined(WIN32)
@@ -101,91 +104,240 @@ int transport_getdatanb(void *sck, unsigned char* buf, int count)
 	return rc;
 }
 
+#if !defined(TRANSPORT_DNS_TTL)
+	/** seconds resolved addresses are reused for, getaddrinfo does not return the record TTL */
+	#define TRANSPORT_DNS_TTL 60
+#endif
+#if !defined(TRANSPORT_CONNECT_TIMEOUT)
+	/** milliseconds transport_open waits for a connection */
+	#define TRANSPORT_CONNECT_TIMEOUT 10000
+#endif
+/** milliseconds before the next address is tried while earlier attempts are still pending (RFC 8305) */
+#define TRANSPORT_ATTEMPT_DELAY 250
+#define TRANSPORT_MAX_ADDRS 8
+
 /**
-return >=0 for a socket descriptor, <0 for an error code
-@todo Basically moved from the sample without changes, should accomodate same usage for 'sock' for clarity,
-removing indirections
+The addresses of the last host resolved, in the order they are tried: alternately IPv6 and IPv4,
+starting with the first family returned by getaddrinfo.
 */
-int transport_open(char* addr, int port)
+static struct
+{
+	char host[MAXHOSTNAMELEN];
+	time_t expires;
+	int count;
+	struct sockaddr_storage addrs[TRANSPORT_MAX_ADDRS];
+	socklen_t lens[TRANSPORT_MAX_ADDRS];
+} dns_cache;
+
+static int connect_time_ms = -1;
+
+
+static long transport_now_ms(void)
 {
-int* sock = &mysock;
-	int type = SOCK_STREAM;
-	struct sockaddr_in address;
-#if defined(AF_INET6)
-	struct sockaddr_in6 address6;
-#endif
-	int rc = -1;
 #if defined(WIN32)
-	short family;
+	return (long)GetTickCount();
 #else
-	sa_family_t family = AF_INET;
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000L + now.tv_usec / 1000;
 #endif
-	struct addrinfo *result = NULL;
+}
+
+
+static int transport_resolve(char* addr)
+{
+	struct addrinfo *result = NULL, *res;
 	struct addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL};
-	static struct timeval tv;
+	struct addrinfo* family[2][TRANSPORT_MAX_ADDRS];
+	int counts[2] = {0, 0};
+	int first = -1, i, f;
 
-	*sock = -1;
-	if (addr[0] == '[')
-	  ++addr;
+	if (dns_cache.count > 0 && strcmp(dns_cache.host, addr) == 0 && time(NULL) < dns_cache.expires)
+		return dns_cache.count;
 
-	if ((rc = getaddrinfo(addr, NULL, &hints, &result)) == 0)
+	dns_cache.count = 0;
+	if (strlen(addr) >= sizeof(dns_cache.host) || getaddrinfo(addr, NULL, &hints, &result) != 0)
+		return 0;
+
+	for (res = result; res; res = res->ai_next)
 	{
-		struct addrinfo* res = result;
+		if (res->ai_family != AF_INET
+#if defined(AF_INET6)
+				&& res->ai_family != AF_INET6
+#endif
+				)
+			continue;
+		f = res->ai_family == AF_INET;
+		if (first < 0)
+			first = f;
+		if (counts[f] < TRANSPORT_MAX_ADDRS)
+			family[f][counts[f]++] = res;
+	}
 
-		/* prefer ip4 addresses */
-		while (res)
+	/* interleave the families so that a broken one only delays the other by one attempt */
+	for (i = 0; dns_cache.count < TRANSPORT_MAX_ADDRS && (i < counts[0] || i < counts[1]); i++)
+	{
+		for (f = first; f >= 0 && f <= 1; f += first ? -1 : 1)
 		{
-			if (res->ai_family == AF_INET)
+			if (i < counts[f] && dns_cache.count < TRANSPORT_MAX_ADDRS)
 			{
-				result = res;
-				break;
+				memcpy(&dns_cache.addrs[dns_cache.count], family[f][i]->ai_addr, family[f][i]->ai_addrlen);
+				dns_cache.lens[dns_cache.count++] = (socklen_t)family[f][i]->ai_addrlen;
 			}
-			res = res->ai_next;
 		}
+	}
 
-#if defined(AF_INET6)
-		if (result->ai_family == AF_INET6)
-		{
-			address6.sin6_port = htons(port);
-			address6.sin6_family = family = AF_INET6;
-			address6.sin6_addr = ((struct sockaddr_in6*)(result->ai_addr))->sin6_addr;
-		}
-		else
+	if (result)
+		freeaddrinfo(result);
+
+	strcpy(dns_cache.host, addr);
+	dns_cache.expires = time(NULL) + TRANSPORT_DNS_TTL;
+	return dns_cache.count;
+}
+
+
+static int transport_nonblocking(int sock, int on)
+{
+#if defined(WIN32)
+	u_long mode = on;
+	return ioctl(sock, FIONBIO, &mode);
+#else
+	int flags = fcntl(sock, F_GETFL, 0);
+	return fcntl(sock, F_SETFL, on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
 #endif
-		if (result->ai_family == AF_INET)
-		{
-			address.sin_port = htons(port);
-			address.sin_family = family = AF_INET;
-			address.sin_addr = ((struct sockaddr_in*)(result->ai_addr))->sin_addr;
-		}
-		else
-			rc = -1;
+}
 
-		freeaddrinfo(result);
-	}
 
-	if (rc == 0)
+/**
+Starts a connection attempt to each address in turn, the next one TRANSPORT_ATTEMPT_DELAY ms after
+the previous or as soon as it failed, and keeps the first which succeeds. Sockets are non-blocking
+so that a dead address cannot hold up the others, nor the connection past timeout_ms.
+*/
+static int transport_race(int count, int port, int timeout_ms)
+{
+	struct pollfd fds[TRANSPORT_MAX_ADDRS];
+	int nfds = 0, next = 0, sock = -1, i;
+	long start = transport_now_ms(), next_start = start, now;
+
+	while (sock == -1 && (now = transport_now_ms()) - start < timeout_ms)
 	{
-		*sock =	socket(family, type, 0);
-		if (*sock != -1)
+		if (next < count && (now >= next_start || nfds == 0))
 		{
-#if defined(NOSIGPIPE)
-			int opt = 1;
+			struct sockaddr_storage* address = &dns_cache.addrs[next];
+			int s = socket(address->ss_family, SOCK_STREAM, 0);
 
-			if (setsockopt(*sock, SOL_SOCKET, SO_NOSIGPIPE, (void*)&opt, sizeof(opt)) != 0)
-				Log(TRACE_MIN, -1, "Could not set SO_NOSIGPIPE for socket %d", *sock);
+#if defined(AF_INET6)
+			if (address->ss_family == AF_INET6)
+				((struct sockaddr_in6*)address)->sin6_port = htons(port);
+			else
 #endif
+				((struct sockaddr_in*)address)->sin_port = htons(port);
+
+			if (s != -1 && transport_nonblocking(s, 1) == 0)
+			{
+				if (connect(s, (struct sockaddr*)address, dns_cache.lens[next]) == 0)
+					sock = s;
+				else if (errno == EINPROGRESS || errno == EWOULDBLOCK)
+				{
+					fds[nfds].fd = s;
+					fds[nfds].events = POLLOUT;
+					fds[nfds++].revents = 0;
+					s = -1;
+				}
+			}
+			if (s != -1 && s != sock)
+				close(s);
+			next++;
+			next_start = now + TRANSPORT_ATTEMPT_DELAY;
+			continue;
+		}
+
+		if (nfds == 0)
+			break; /* every address failed */
 
-			if (family == AF_INET)
-				rc = connect(*sock, (struct sockaddr*)&address, sizeof(address));
-	#if defined(AF_INET6)
+		int wait = (int)(start + timeout_ms - now);
+		if (next < count && next_start - now < wait)
+			wait = (int)(next_start - now);
+		if (poll(fds, nfds, wait) <= 0)
+			continue;
+
+		for (i = 0; i < nfds; i++)
+		{
+			int err = 0;
+			socklen_t len = sizeof(err);
+
+			if (fds[i].revents == 0)
+				continue;
+			if (sock == -1 && getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, (char*)&err, &len) == 0 && err == 0)
+				sock = fds[i].fd;
 			else
-				rc = connect(*sock, (struct sockaddr*)&address6, sizeof(address6));
-	#endif
+			{
+				/* a failed attempt lets the next one start right away */
+				close(fds[i].fd);
+				next_start = now;
+			}
+			fds[i--] = fds[--nfds];
 		}
 	}
+
+	for (i = 0; i < nfds; i++)
+		close(fds[i].fd);
+
+	if (sock != -1)
+		transport_nonblocking(sock, 0);
+	return sock;
+}
+
+
+/**
+return >=0 for a socket descriptor, <0 for an error code
+Resolved addresses are cached for TRANSPORT_DNS_TTL seconds. Attempts to the addresses of the host
+race each other, the connection is given up after timeout_ms.
+*/
+int transport_open_timeout(char* addr, int port, int timeout_ms)
+{
+	static struct timeval tv;
+	long start = transport_now_ms();
+	int count;
+
+	mysock = INVALID_SOCKET;
+	connect_time_ms = -1;
+
+	if (addr[0] == '[')
+	{
+		char host[MAXHOSTNAMELEN];
+		char* end = strchr(++addr, ']');
+		int len = end ? (int)(end - addr) : (int)strlen(addr);
+
+		if (len >= (int)sizeof(host))
+			return -1;
+		memcpy(host, addr, len);
+		host[len] = '\0';
+		count = transport_resolve(host);
+	}
+	else
+		count = transport_resolve(addr);
+
+	if (count == 0)
+		return -1;
+
+	mysock = transport_race(count, port, timeout_ms);
 	if (mysock == INVALID_SOCKET)
-		return rc;
+	{
+		/* the addresses may have changed */
+		dns_cache.count = 0;
+		return -1;
+	}
+	connect_time_ms = (int)(transport_now_ms() - start);
+
+#if defined(NOSIGPIPE)
+	{
+		int opt = 1;
+
+		if (setsockopt(mysock, SOL_SOCKET, SO_NOSIGPIPE, (void*)&opt, sizeof(opt)) != 0)
+			Log(TRACE_MIN, -1, "Could not set SO_NOSIGPIPE for socket %d", mysock);
+	}
+#endif
 
 	tv.tv_sec = 1;  /* 1 second Timeout */
 	tv.tv_usec = 0;  
@@ -193,6 +345,18 @@ int* sock = &mysock;
 	return mysock;
 }
 
+
+int transport_open(char* addr, int port)
+{
+	return transport_open_timeout(addr, port, TRANSPORT_CONNECT_TIMEOUT);
+}
+
+
+int transport_connect_time(void)
+{
+	return connect_time_ms;
+}
+
 int transport_close(int sock)
 {
 int rc;
@@ -19,4 +19,6 @@ int transport_sendPacketBuffer(int sock, unsigned char* buf, int buflen);
 int transport_getdata(unsigned char* buf, int count);
 int transport_getdatanb(void *sck, unsigned char* buf, int count);
 int transport_open(char* host, int port);
+int transport_open_timeout(char* host, int port, int timeout_ms);
+int transport_connect_time(void); /* ms the last successful transport_open took, -1 if it failed */
 int transport_close(int sock);
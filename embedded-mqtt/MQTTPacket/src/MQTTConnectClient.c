@@ -136,6 +136,7 @@ int MQTTDeserialize_connack(unsigned char* sessionPresent, unsigned char* connac
 	unsigned char* enddata = NULL;
 	int rc = 0;
 	int mylen;
+	int lenlen;
 	MQTTConnackFlags flags = {0};
 
 	FUNC_ENTRY;
@@ -143,7 +144,9 @@ int MQTTDeserialize_connack(unsigned char* sessionPresent, unsigned char* connac
 	if (header.bits.type != CONNACK)
 		goto exit;
 
-	curdata += (rc = MQTTPacket_decodeBuf(curdata, &mylen)); /* read remaining length */
+	if ((lenlen = MQTTPacket_decodeSpan(curdata, buflen - 1, &mylen)) <= 0) /* read remaining length */
+		goto exit;
+	curdata += lenlen;
 	enddata = curdata + mylen;
 	if (enddata - curdata < 2)
 		goto exit;
@@ -58,13 +58,16 @@ int MQTTDeserialize_connect(MQTTPacket_connectData* data, unsigned char* buf, in
 	MQTTString Protocol;
 	int version;
 	int mylen = 0;
+	int lenlen;
 
 	FUNC_ENTRY;
 	header.byte = readChar(&curdata);
 	if (header.bits.type != CONNECT)
 		goto exit;
 
-	curdata += MQTTPacket_decodeBuf(curdata, &mylen); /* read remaining length */
+	if ((lenlen = MQTTPacket_decodeSpan(curdata, len - 1, &mylen)) <= 0) /* read remaining length */
+		goto exit;
+	curdata += lenlen;
 
 	if (!readMQTTLenString(&Protocol, &curdata, enddata) ||
 		enddata - curdata < 0) /* do we have enough data to read the protocol version byte? */
@@ -118,10 +118,13 @@ char* MQTTFormat_toClientString(char* strbuf, int strbuflen, unsigned char* buf,
 {
 	int index = 0;
 	int rem_length = 0;
+	int len;
 	MQTTHeader header = {0};
 
 	header.byte = buf[index++];
-	index += MQTTPacket_decodeBuf(&buf[index], &rem_length);
+	if ((len = MQTTPacket_decodeSpan(&buf[index], buflen - index, &rem_length)) <= 0)
+		return strbuf; /* truncated or malformed remaining length */
+	index += len;
 
 	switch (header.bits.type)
 	{
@@ -186,10 +189,13 @@ char* MQTTFormat_toServerString(char* strbuf, int strbuflen, unsigned char* buf,
 {
 	int index = 0;
 	int rem_length = 0;
+	int len;
 	MQTTHeader header = {0};
 
 	header.byte = buf[index++];
-	index += MQTTPacket_decodeBuf(&buf[index], &rem_length);
+	if ((len = MQTTPacket_decodeSpan(&buf[index], buflen - index, &rem_length)) <= 0)
+		return strbuf; /* truncated or malformed remaining length */
+	index += len;
 
 	switch (header.bits.type)
 	{
@@ -45,6 +45,35 @@ int MQTTPacket_encode(unsigned char* buf, int length)
 }
 
 
+#define MAX_NO_OF_REMAINING_LENGTH_BYTES 4
+
+/**
+ * Decodes the message length according to the MQTT algorithm from the bytes at hand,
+ * without keeping any state between calls
+ * @param buf the encoded length, which may be incomplete
+ * @param buflen the number of bytes available at buf
+ * @param value the decoded length returned
+ * @return the number of bytes used, 0 if more bytes are needed, or MQTTPACKET_READ_ERROR on bad data
+ */
+int MQTTPacket_decodeSpan(const unsigned char* buf, int buflen, int* value)
+{
+	int len = 0;
+	int rem_len = 0;
+
+	do
+	{
+		if (len == MAX_NO_OF_REMAINING_LENGTH_BYTES)
+			return MQTTPACKET_READ_ERROR;	/* bad data */
+		if (len == buflen)
+			return 0;
+		rem_len += (buf[len] & 127) << (7 * len);
+	} while ((buf[len++] & 128) != 0);
+
+	*value = rem_len;
+	return len;
+}
+
+
 /**
  * Decodes the message length according to the MQTT algorithm
  * @param getcharfn pointer to function to read the next character from the data source
@@ -56,7 +85,6 @@ int MQTTPacket_decode(int (*getcharfn)(unsigned char*, int), int* value)
 	unsigned char c;
 	int multiplier = 1;
 	int len = 0;
-#define MAX_NO_OF_REMAINING_LENGTH_BYTES 4
 
 	FUNC_ENTRY;
 	*value = 0;
@@ -98,22 +126,17 @@ int MQTTPacket_len(int rem_len)
 }
 
 
-static unsigned char* bufptr;
-
-int bufchar(unsigned char* c, int count)
-{
-	int i;
-
-	for (i = 0; i < count; ++i)
-		*c = *bufptr++;
-	return count;
-}
-
-
+/**
+ * Decodes the message length at the start of a buffer holding a whole packet
+ * @param buf the encoded length
+ * @param value the decoded length returned
+ * @return the number of bytes read from buf, MAX_NO_OF_REMAINING_LENGTH_BYTES + 1 on bad data
+ */
 int MQTTPacket_decodeBuf(unsigned char* buf, int* value)
 {
-	bufptr = buf;
-	return MQTTPacket_decode(bufchar, value);
+	int rc = MQTTPacket_decodeSpan(buf, MAX_NO_OF_REMAINING_LENGTH_BYTES, value);
+
+	return rc > 0 ? rc : MAX_NO_OF_REMAINING_LENGTH_BYTES + 1;
 }
 
 
@@ -177,10 +200,25 @@ void writeInt(unsigned char** pptr, int anInt)
  */
 void writeCString(unsigned char** pptr, const char* string)
 {
-	int len = strlen(string);
-	writeInt(pptr, len);
-	memcpy(*pptr, string, len);
-	*pptr += len;
+	MQTTLenString lenstring;
+
+	lenstring.len = strlen(string);
+	lenstring.data = (char*)string;
+	writeMQTTLenString(pptr, lenstring);
+}
+
+
+/**
+ * Writes a "UTF" string whose length is already known to an output buffer.
+ * @param pptr pointer to the output buffer - incremented by the number of bytes used & returned
+ * @param lenstring the string to write
+ */
+void writeMQTTLenString(unsigned char** pptr, MQTTLenString lenstring)
+{
+	writeInt(pptr, lenstring.len);
+	if (lenstring.len > 0)
+		memcpy(*pptr, lenstring.data, lenstring.len);
+	*pptr += lenstring.len;
 }
 
 
@@ -193,16 +231,10 @@ int getLenStringLen(char* ptr)
 
 void writeMQTTString(unsigned char** pptr, MQTTString mqttstring)
 {
-	if (mqttstring.lenstring.len > 0)
-	{
-		writeInt(pptr, mqttstring.lenstring.len);
-		memcpy(*pptr, mqttstring.lenstring.data, mqttstring.lenstring.len);
-		*pptr += mqttstring.lenstring.len;
-	}
-	else if (mqttstring.cstring)
+	if (mqttstring.cstring)
 		writeCString(pptr, mqttstring.cstring);
 	else
-		writeInt(pptr, 0);
+		writeMQTTLenString(pptr, mqttstring.lenstring);
 }
 
 
@@ -251,6 +283,26 @@ int MQTTstrlen(MQTTString mqttstring)
 }
 
 
+/**
+ * Gives an MQTTString as a length-carrying string, so that the length of a C string is counted once
+ * @param mqttstring the MQTTString
+ * @return the length and data of the string
+ */
+MQTTLenString MQTTstrview(MQTTString mqttstring)
+{
+	MQTTLenString rc;
+
+	if (mqttstring.cstring)
+	{
+		rc.data = mqttstring.cstring;
+		rc.len = strlen(mqttstring.cstring);
+	}
+	else
+		rc = mqttstring.lenstring;
+	return rc;
+}
+
+
 /**
  * Compares an MQTTString to a C string
  * @param a the MQTTString to compare
@@ -259,23 +311,22 @@ int MQTTstrlen(MQTTString mqttstring)
  */
 int MQTTPacket_equals(MQTTString* a, char* bptr)
 {
-	int alen = 0,
-		blen = 0;
-	char *aptr;
-	
-	if (a->cstring)
-	{
-		aptr = a->cstring;
-		alen = strlen(a->cstring);
-	}
-	else
-	{
-		aptr = a->lenstring.data;
-		alen = a->lenstring.len;
-	}
-	blen = strlen(bptr);
-	
-	return (alen == blen) && (strncmp(aptr, bptr, alen) == 0);
+	return MQTTPacket_equalsLen(a, bptr, strlen(bptr));
+}
+
+
+/**
+ * Compares an MQTTString to a string of known length
+ * @param a the MQTTString to compare
+ * @param bptr the string to compare, which need not be null terminated
+ * @param blen the length of the string to compare
+ * @return boolean - equal or not
+ */
+int MQTTPacket_equalsLen(MQTTString* a, const char* bptr, int blen)
+{
+	MQTTLenString alen = MQTTstrview(*a);
+
+	return (alen.len == blen) && (blen == 0 || memcmp(alen.data, bptr, blen) == 0);
 }
 
 
@@ -293,15 +344,23 @@ int MQTTPacket_read(unsigned char* buf, int buflen, int (*getfn)(unsigned char*,
 	MQTTHeader header = {0};
 	int len = 0;
 	int rem_len = 0;
+	int frc;
 
 	/* 1. read the header byte.  This has the packet type in it */
 	if ((*getfn)(buf, 1) != 1)
 		goto exit;
 
 	len = 1;
-	/* 2. read the remaining length.  This is variable in itself */
-	MQTTPacket_decode(getfn, &rem_len);
-	len += MQTTPacket_encode(buf + 1, rem_len); /* put the original remaining length back into the buffer */
+	/* 2. read the remaining length into place, a byte at a time as its own length is variable */
+	do
+	{
+		if (len == buflen || (*getfn)(buf + len, 1) != 1)
+			goto exit;
+		++len;
+	} while ((frc = MQTTPacket_decodeSpan(buf + 1, len - 1, &rem_len)) == 0);
+	if (frc == MQTTPACKET_READ_ERROR)
+		goto exit;
+	len = 1 + MQTTPacket_encode(buf + 1, rem_len); /* store the shortest encoding of the length */
 
 	/* 3. read the rest of the buffer using a callback to supply the rest of the data */
 	if((rem_len + len) > buflen)
@@ -315,41 +374,6 @@ exit:
 	return rc;
 }
 
-/**
- * Decodes the message length according to the MQTT algorithm, non-blocking
- * @param trp pointer to a transport structure holding what is needed to solve getting data from it
- * @param value the decoded length returned
- * @return integer the number of bytes read from the socket, 0 for call again, or -1 on error
- */
-static int MQTTPacket_decodenb(MQTTTransport *trp)
-{
-	unsigned char c;
-	int rc = MQTTPACKET_READ_ERROR;
-
-	FUNC_ENTRY;
-	if(trp->len == 0){		/* initialize on first call */
-		trp->multiplier = 1;
-		trp->rem_len = 0;
-	}
-	do {
-		int frc;
-		if (++(trp->len) > MAX_NO_OF_REMAINING_LENGTH_BYTES)
-			goto exit;
-		if ((frc=(*trp->getfn)(trp->sck, &c, 1)) == -1)
-			goto exit;
-		if (frc == 0){
-			rc = 0;
-			goto exit;
-		}
-		trp->rem_len += (c & 127) * trp->multiplier;
-		trp->multiplier *= 128;
-	} while ((c & 128) != 0);
-	rc = trp->len;
-exit:
-	FUNC_EXIT_RC(rc);
-	return rc;
-}
-
 /**
  * Helper function to read packet data from some source into a buffer, non-blocking
  * @param buf the buffer into which the packet will be serialized
@@ -378,11 +402,19 @@ int MQTTPacket_readnb(unsigned char* buf, int buflen, MQTTTransport *trp)
 		/*FALLTHROUGH*/
 		/* read the remaining length.  This is variable in itself */
 	case 1:
-		if((frc=MQTTPacket_decodenb(trp)) == MQTTPACKET_READ_ERROR)
+		/* the length bytes are read into place, trp->len counts them until they are complete */
+		do {
+			if (1 + trp->len == buflen)
+				goto exit;
+			if ((frc=(*trp->getfn)(trp->sck, buf + 1 + trp->len, 1)) == -1)
+				goto exit;
+			if (frc == 0)
+				return 0;
+			++trp->len;
+		} while ((frc=MQTTPacket_decodeSpan(buf + 1, trp->len, &trp->rem_len)) == 0);
+		if (frc == MQTTPACKET_READ_ERROR)
 			goto exit;
-		if(frc == 0)
-			return 0;
-		trp->len = 1 + MQTTPacket_encode(buf + 1, trp->rem_len); /* put the original remaining length back into the buffer */
+		trp->len = 1 + MQTTPacket_encode(buf + 1, trp->rem_len); /* store the shortest encoding of the length */
 		if((trp->rem_len + trp->len) > buflen)
 			goto exit;
 		++trp->state;
@@ -87,6 +87,7 @@ typedef struct
 #define MQTTString_initializer {NULL, {0, NULL}}
 
 int MQTTstrlen(MQTTString mqttstring);
+MQTTLenString MQTTstrview(MQTTString mqttstring);
 
 #include "MQTTConnect.h"
 #include "MQTTPublish.h"
@@ -99,10 +100,12 @@ int MQTTDeserialize_ack(unsigned char* packettype, unsigned char* dup, unsigned
 
 int MQTTPacket_len(int rem_len);
 int MQTTPacket_equals(MQTTString* a, char* b);
+DLLExport int MQTTPacket_equalsLen(MQTTString* a, const char* b, int blen);
 
 int MQTTPacket_encode(unsigned char* buf, int length);
 int MQTTPacket_decode(int (*getcharfn)(unsigned char*, int), int* value);
 int MQTTPacket_decodeBuf(unsigned char* buf, int* value);
+DLLExport int MQTTPacket_decodeSpan(const unsigned char* buf, int buflen, int* value);
 
 int readInt(unsigned char** pptr);
 char readChar(unsigned char** pptr);
@@ -111,13 +114,14 @@ void writeInt(unsigned char** pptr, int anInt);
 int readMQTTLenString(MQTTString* mqttstring, unsigned char** pptr, unsigned char* enddata);
 void writeCString(unsigned char** pptr, const char* string);
 void writeMQTTString(unsigned char** pptr, MQTTString mqttstring);
+void writeMQTTLenString(unsigned char** pptr, MQTTLenString lenstring);
 
 DLLExport int MQTTPacket_read(unsigned char* buf, int buflen, int (*getfn)(unsigned char*, int));
 
 typedef struct {
 	int (*getfn)(void *, unsigned char*, int); /* must return -1 for error, 0 for call again, or the number of bytes read */
 	void *sck;	/* pointer to whatever the system may use to identify the transport */
-	int multiplier;
+	int multiplier;	/* no longer used */
 	int rem_len;
 	int len;
 	char state;
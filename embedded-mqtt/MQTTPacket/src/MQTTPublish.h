@@ -27,9 +27,27 @@
 
 #include <stddef.h>
 
+typedef struct
+{
+	unsigned char dup;
+	int qos;
+	unsigned char retained;
+	unsigned short packetid;
+	MQTTString topicName;
+	unsigned char* payload;
+	int payloadlen;
+} MQTTPacket_publishData;
+
+#define MQTTPacket_publishData_initializer {0, 0, 0, 0, MQTTString_initializer, NULL, 0}
+
 DLLExport int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
 		MQTTString topicName, unsigned char* payload, int payloadlen);
 
+DLLExport int MQTTSerialize_publishBatch(unsigned char* buf, int buflen, int count, MQTTPacket_publishData publishes[], int* serialized);
+
+DLLExport int MQTTSerialize_publishHeader(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, int payloadlen);
+
 DLLExport int MQTTDeserialize_publish(unsigned char* dup, int* qos, unsigned char* retained, unsigned short* packetid, MQTTString* topicName,
 		unsigned char** payload, size_t* payloadlen, unsigned char* buf, int len);
 
@@ -40,20 +40,19 @@ int MQTTSerialize_publishLength(int qos, MQTTString topicName, int payloadlen)
 
 
 /**
-  * Serializes the supplied publish data into the supplied buffer, ready for sending
-  * @param buf the buffer into which the packet will be serialized
+  * Serializes everything of a publish packet except the payload, with the length of the topic already known
+  * @param buf the buffer into which the header will be serialized
   * @param buflen the length in bytes of the supplied buffer
   * @param dup integer - the MQTT dup flag
   * @param qos integer - the MQTT QoS value
   * @param retained integer - the MQTT retained flag
   * @param packetid integer - the MQTT packet identifier
-  * @param topicName MQTTString - the MQTT topic in the publish
-  * @param payload byte buffer - the MQTT publish payload
-  * @param payloadlen integer - the length of the MQTT payload
-  * @return the length of the serialized data.  <= 0 indicates error
+  * @param topicName MQTTLenString - the MQTT topic in the publish
+  * @param payloadlen integer - the length of the MQTT payload which will follow the header
+  * @return the length of the serialized header.  <= 0 indicates error
   */
-int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
-		MQTTString topicName, unsigned char* payload, int payloadlen)
+static int MQTTSerialize_publishHeaderLen(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTLenString topicName, int payloadlen)
 {
 	unsigned char *ptr = buf;
 	MQTTHeader header = {0};
@@ -61,7 +60,10 @@ int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int
 	int rc = 0;
 
 	FUNC_ENTRY;
-	if (MQTTPacket_len(rem_len = MQTTSerialize_publishLength(qos, topicName, payloadlen)) > buflen)
+	rem_len = 2 + topicName.len + payloadlen;
+	if (qos > 0)
+		rem_len += 2; /* packetid */
+	if (MQTTPacket_len(rem_len) - payloadlen > buflen)
 	{
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
@@ -75,14 +77,11 @@ int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int
 
 	ptr += MQTTPacket_encode(ptr, rem_len); /* write remaining length */;
 
-	writeMQTTString(&ptr, topicName);
+	writeMQTTLenString(&ptr, topicName);
 
 	if (qos > 0)
 		writeInt(&ptr, packetid);
 
-	memcpy(ptr, payload, payloadlen);
-	ptr += payloadlen;
-
 	rc = ptr - buf;
 
 exit:
@@ -91,6 +90,91 @@ exit:
 }
 
 
+/**
+  * Serializes everything of a publish packet except the payload into the supplied buffer, 
+  * so that the payload can be sent from where it is without being copied.
+  * @param buf the buffer into which the header will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param dup integer - the MQTT dup flag
+  * @param qos integer - the MQTT QoS value
+  * @param retained integer - the MQTT retained flag
+  * @param packetid integer - the MQTT packet identifier
+  * @param topicName MQTTString - the MQTT topic in the publish
+  * @param payloadlen integer - the length of the MQTT payload which will follow the header
+  * @return the length of the serialized header.  <= 0 indicates error
+  */
+int MQTTSerialize_publishHeader(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, int payloadlen)
+{
+	return MQTTSerialize_publishHeaderLen(buf, buflen, dup, qos, retained, packetid, MQTTstrview(topicName), payloadlen);
+}
+
+
+/**
+  * Serializes the supplied publish data into the supplied buffer, ready for sending
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param dup integer - the MQTT dup flag
+  * @param qos integer - the MQTT QoS value
+  * @param retained integer - the MQTT retained flag
+  * @param packetid integer - the MQTT packet identifier
+  * @param topicName MQTTString - the MQTT topic in the publish
+  * @param payload byte buffer - the MQTT publish payload
+  * @param payloadlen integer - the length of the MQTT payload
+  * @return the length of the serialized data.  <= 0 indicates error
+  */
+int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, unsigned char* payload, int payloadlen)
+{
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if ((rc = MQTTSerialize_publishHeaderLen(buf, buflen - payloadlen, dup, qos, retained, packetid, MQTTstrview(topicName), payloadlen)) <= 0)
+		goto exit;
+
+	memcpy(buf + rc, payload, payloadlen);
+	rc += payloadlen;
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+  * Serializes publish packets back to back into the supplied buffer, so that they can be sent in one write
+  * @param buf the buffer into which the packets will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param count the number of publishes
+  * @param publishes array of the publishes, each with its own packet identifier
+  * @param serialized returned integer - the number of publishes which fitted into the buffer
+  * @return the length of the serialized data.  <= 0 indicates error
+  */
+int MQTTSerialize_publishBatch(unsigned char* buf, int buflen, int count, MQTTPacket_publishData publishes[], int* serialized)
+{
+	int rc = 0;
+	int len = 0;
+	int i;
+
+	FUNC_ENTRY;
+	for (i = 0; i < count; ++i)
+	{
+		MQTTPacket_publishData* p = &publishes[i];
+
+		if ((rc = MQTTSerialize_publish(buf + len, buflen - len, p->dup, p->qos, p->retained, p->packetid,
+				p->topicName, p->payload, p->payloadlen)) <= 0)
+			break;
+		len += rc;
+	}
+	*serialized = i;
+	if (i > 0 || count == 0)
+		rc = len; /* those which fitted, the others are left for the next buffer */
+
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
 
 /**
   * Serializes the ack packet into the supplied buffer.
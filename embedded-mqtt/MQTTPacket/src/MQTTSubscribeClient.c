@@ -104,13 +104,16 @@ int MQTTDeserialize_suback(unsigned short* packetid, int maxcount, int* count, i
 	unsigned char* enddata = NULL;
 	int rc = 0;
 	int mylen;
+	int lenlen;
 
 	FUNC_ENTRY;
 	header.byte = readChar(&curdata);
 	if (header.bits.type != SUBACK)
 		goto exit;
 
-	curdata += (rc = MQTTPacket_decodeBuf(curdata, &mylen)); /* read remaining length */
+	if ((lenlen = MQTTPacket_decodeSpan(curdata, buflen - 1, &mylen)) <= 0) /* read remaining length */
+		goto exit;
+	curdata += lenlen;
 	enddata = curdata + mylen;
 	if (enddata - curdata < 2)
 		goto exit;
@@ -120,7 +123,7 @@ int MQTTDeserialize_suback(unsigned short* packetid, int maxcount, int* count, i
 	*count = 0;
 	while (curdata < enddata)
 	{
-		if (*count > maxcount)
+		if (*count >= maxcount)
 		{
 			rc = -1;
 			goto exit;
@@ -40,6 +40,7 @@ int MQTTDeserialize_subscribe(unsigned char* dup, unsigned short* packetid, int
 	unsigned char* enddata = NULL;
 	int rc = -1;
 	int mylen = 0;
+	int lenlen;
 
 	FUNC_ENTRY;
 	header.byte = readChar(&curdata);
@@ -47,7 +48,9 @@ int MQTTDeserialize_subscribe(unsigned char* dup, unsigned short* packetid, int
 		goto exit;
 	*dup = header.bits.dup;
 
-	curdata += (rc = MQTTPacket_decodeBuf(curdata, &mylen)); /* read remaining length */
+	if ((lenlen = MQTTPacket_decodeSpan(curdata, buflen - 1, &mylen)) <= 0) /* read remaining length */
+		goto exit;
+	curdata += lenlen;
 	enddata = curdata + mylen;
 
 	*packetid = readInt(&curdata);
@@ -39,6 +39,7 @@ int MQTTDeserialize_unsubscribe(unsigned char* dup, unsigned short* packetid, in
 	unsigned char* enddata = NULL;
 	int rc = 0;
 	int mylen = 0;
+	int lenlen;
 
 	FUNC_ENTRY;
 	header.byte = readChar(&curdata);
@@ -46,7 +47,9 @@ int MQTTDeserialize_unsubscribe(unsigned char* dup, unsigned short* packetid, in
 		goto exit;
 	*dup = header.bits.dup;
 
-	curdata += (rc = MQTTPacket_decodeBuf(curdata, &mylen)); /* read remaining length */
+	if ((lenlen = MQTTPacket_decodeSpan(curdata, len - 1, &mylen)) <= 0) /* read remaining length */
+		goto exit;
+	curdata += lenlen;
 	enddata = curdata + mylen;
 
 	*packetid = readInt(&curdata);
@@ -0,0 +1,556 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Ian Craggs - initial API and implementation and/or initial documentation
+ *******************************************************************************/
+
+/*
+ * Microbenchmarks of the packet codec. Each result is printed as a line of
+ * comma separated values:
+ *
+ *   benchmark,variant,param,bytes,ns_per_op,bytes_per_ns
+ *
+ * param tells the sizes measured, "64x1024" being a topic of 64 bytes and a
+ * payload of 1024 for the publishes, bytes is the size of the packet or of
+ * the data handled by an op. Each op is timed over runs of --run_ms and the
+ * fastest run is kept.
+ *
+ * The output of a run can be kept as a baseline:
+ *
+ *   bench1 > baseline.csv
+ *   bench1 --baseline baseline.csv
+ *
+ * Against a baseline each line also gets the baseline ns_per_op, the change
+ * in percent and a status: same, faster or slower by more than --threshold
+ * percent, or new. The exit code is 1 if any benchmark is slower.
+ */
+
+#include "MQTTPacket.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define ARRAY_SIZE(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+#define MAX_TOPIC 1024
+#define MAX_PAYLOAD 16384
+#define MAX_PACKET (MAX_TOPIC + MAX_PAYLOAD + 4096)
+#define MAX_FILTERS 8
+#define BATCH_COUNT 16
+
+struct Options
+{
+	char* baseline;           /**< file of a previous run to compare with */
+	double threshold;         /**< percent of change reported as slower or faster */
+	char* benchmark;          /**< only run the benchmarks of this name */
+	int run_ms;
+	int runs;
+} options =
+{
+	NULL,
+	10,
+	NULL,
+	20,
+	5,
+};
+
+typedef struct
+{
+	char* key;                /**< benchmark,variant,param */
+	double ns_per_op;
+} Baseline;
+
+static Baseline* baseline;
+static int baseline_count;
+static int slower;
+
+static volatile int sink;
+
+static unsigned char buf[MAX_PACKET];
+static unsigned char packet[MAX_PACKET];
+static char topic[MAX_TOPIC + 1];
+static unsigned char payload[MAX_PAYLOAD];
+
+
+void usage()
+{
+	printf("options:\n  --baseline <file>  compare with the results in file\n"
+		"  --threshold <percent>  of change reported, default %.0f\n"
+		"  --benchmark <name>  only run the benchmarks of this name\n"
+		"  --run_ms <ms>  time of a run, default %d\n"
+		"  --runs <count>  runs of each benchmark, default %d\n",
+		options.threshold, options.run_ms, options.runs);
+	exit(EXIT_FAILURE);
+}
+
+
+void getopts(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--baseline") == 0)
+		{
+			if (++count < argc)
+				options.baseline = argv[count];
+			else
+				usage();
+		}
+		else if (strcmp(argv[count], "--threshold") == 0)
+		{
+			if (++count < argc)
+				options.threshold = atof(argv[count]);
+			else
+				usage();
+		}
+		else if (strcmp(argv[count], "--benchmark") == 0)
+		{
+			if (++count < argc)
+				options.benchmark = argv[count];
+			else
+				usage();
+		}
+		else if (strcmp(argv[count], "--run_ms") == 0)
+		{
+			if (++count < argc && (options.run_ms = atoi(argv[count])) > 0)
+				;
+			else
+				usage();
+		}
+		else if (strcmp(argv[count], "--runs") == 0)
+		{
+			if (++count < argc && (options.runs = atoi(argv[count])) > 0)
+				;
+			else
+				usage();
+		}
+		else
+			usage();
+		count++;
+	}
+}
+
+
+/* Reads the lines of a previous run, the output of a comparison will do too. */
+int readBaseline(const char* filename)
+{
+	char line[256];
+	FILE* f = fopen(filename, "r");
+
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		char* p = line;
+		double ns_per_op;
+		int i;
+
+		for (i = 0; i < 3 && (p = strchr(p, ',')) != NULL; ++i)
+			++p;
+		if (i < 3 || sscanf(p, "%*d,%lf", &ns_per_op) != 1)
+			continue; /* the header */
+
+		if ((baseline_count & (baseline_count - 1)) == 0)
+			baseline = realloc(baseline, (baseline_count ? baseline_count * 2 : 1) * sizeof(Baseline));
+		p[-1] = '\0';
+		baseline[baseline_count].key = strdup(line);
+		baseline[baseline_count].ns_per_op = ns_per_op;
+		baseline_count++;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+
+Baseline* findBaseline(const char* key)
+{
+	int i;
+
+	for (i = 0; i < baseline_count; ++i)
+		if (strcmp(baseline[i].key, key) == 0)
+			return &baseline[i];
+	return NULL;
+}
+
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static int selected(const char* benchmark)
+{
+	return options.benchmark == NULL || strcmp(options.benchmark, benchmark) == 0;
+}
+
+
+static void report(const char* benchmark, const char* variant, const char* param, int bytes, double ns_per_op)
+{
+	char key[128];
+
+	snprintf(key, sizeof(key), "%s,%s,%s", benchmark, variant, param);
+	printf("%s,%d,%.2f,%.3f", key, bytes, ns_per_op, bytes / ns_per_op);
+
+	if (options.baseline)
+	{
+		Baseline* b = findBaseline(key);
+
+		if (b)
+		{
+			double change = (ns_per_op - b->ns_per_op) * 100 / b->ns_per_op;
+			const char* status = "same";
+
+			if (change > options.threshold)
+			{
+				status = "slower";
+				slower++;
+			}
+			else if (change < -options.threshold)
+				status = "faster";
+			printf(",%.2f,%.1f,%s", b->ns_per_op, change, status);
+		}
+		else
+			printf(",,,new");
+	}
+
+	printf("\n");
+	fflush(stdout);
+}
+
+
+/* Times op, an int expression, over runs of options.run_ms: the number of
+ * ops of a run is doubled until it lasts that long, then the fastest of
+ * options.runs runs is reported. */
+#define BENCH(benchmark, variant, param, bytes, op) \
+	do \
+	{ \
+		long ops_, n_; \
+		int run_, sum_ = 0; \
+		double start_, ns_, best_; \
+		if (!selected(benchmark)) \
+			break; \
+		for (ops_ = 16; ; ops_ *= 2) \
+		{ \
+			start_ = now_ns(); \
+			for (n_ = 0; n_ < ops_; ++n_) \
+				sum_ += (op); \
+			if ((ns_ = now_ns() - start_) >= options.run_ms * 1e6) \
+				break; \
+		} \
+		best_ = ns_; \
+		for (run_ = 1; run_ < options.runs; ++run_) \
+		{ \
+			start_ = now_ns(); \
+			for (n_ = 0; n_ < ops_; ++n_) \
+				sum_ += (op); \
+			if ((ns_ = now_ns() - start_) < best_) \
+				best_ = ns_; \
+		} \
+		sink = sum_; \
+		report(benchmark, variant, param, bytes, best_ / ops_); \
+	} while (0)
+
+
+static char* param1(int a)
+{
+	static char param[32];
+
+	snprintf(param, sizeof(param), "%d", a);
+	return param;
+}
+
+
+static char* param2(int a, int b)
+{
+	static char param[32];
+
+	snprintf(param, sizeof(param), "%dx%d", a, b);
+	return param;
+}
+
+
+static MQTTString cstring(int topiclen)
+{
+	MQTTString s = MQTTString_initializer;
+
+	memset(topic, 'a', topiclen);
+	topic[topiclen] = '\0';
+	s.cstring = topic;
+	return s;
+}
+
+
+static MQTTString lenstring(int topiclen)
+{
+	MQTTString s = MQTTString_initializer;
+
+	memset(topic, 'a', topiclen);
+	s.lenstring.data = topic;
+	s.lenstring.len = topiclen;
+	return s;
+}
+
+
+/* how MQTTPacket_decodeBuf used to decode: a file static cursor read a byte
+ * at a time through a callback */
+static unsigned char* bufptr;
+
+static int bufchar(unsigned char* c, int count)
+{
+	int i;
+
+	for (i = 0; i < count; ++i)
+		*c = *bufptr++;
+	return count;
+}
+
+
+/* Remaining lengths taking 1 to 4 bytes, encoded, and decoded through the
+ * callback and from the buffer directly. */
+void bench_remaining_length(void)
+{
+	int values[] = {100, 10000, 1000000, 100000000};
+	unsigned char enc[4];
+	int i, len, value;
+
+	for (i = 0; i < ARRAY_SIZE(values); ++i)
+	{
+		len = MQTTPacket_encode(enc, values[i]);
+
+		BENCH("encode", "", param1(len), len, MQTTPacket_encode(enc, values[i]));
+		BENCH("decode", "callback", param1(len), len, (bufptr = enc, MQTTPacket_decode(bufchar, &value), value));
+		BENCH("decode", "span", param1(len), len, (MQTTPacket_decodeSpan(enc, len, &value), value));
+	}
+}
+
+
+/* Connects with client identifiers of increasing length, alone and with a
+ * will, a user name and a password. */
+void bench_connect(void)
+{
+	int clientidlens[] = {8, 23, 64};
+	char clientid[65];
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+	MQTTPacket_connectData out = MQTTPacket_connectData_initializer;
+	unsigned char sessionPresent, connack_rc;
+	int i, len;
+
+	memset(clientid, 'c', sizeof(clientid));
+	for (i = 0; i < ARRAY_SIZE(clientidlens); ++i)
+	{
+		clientid[clientidlens[i]] = '\0';
+		data.clientID.cstring = clientid;
+
+		data.willFlag = 0;
+		data.username.cstring = data.password.cstring = NULL;
+		len = MQTTSerialize_connect(packet, sizeof(packet), &data);
+		BENCH("serialize_connect", "clientid", param1(clientidlens[i]), len, MQTTSerialize_connect(buf, sizeof(buf), &data));
+		BENCH("deserialize_connect", "clientid", param1(clientidlens[i]), len, MQTTDeserialize_connect(&out, packet, len));
+
+		data.willFlag = 1;
+		data.will.topicName = cstring(64);
+		data.will.message.cstring = "{\"connected\": false}";
+		data.username.cstring = "username";
+		data.password.cstring = "0123456789abcdef0123456789abcdef";
+		len = MQTTSerialize_connect(packet, sizeof(packet), &data);
+		BENCH("serialize_connect", "will_auth", param1(clientidlens[i]), len, MQTTSerialize_connect(buf, sizeof(buf), &data));
+		BENCH("deserialize_connect", "will_auth", param1(clientidlens[i]), len, MQTTDeserialize_connect(&out, packet, len));
+		clientid[clientidlens[i]] = 'c';
+	}
+
+	len = MQTTSerialize_connack(packet, sizeof(packet), 0, 1);
+	BENCH("serialize_connack", "", "0", len, MQTTSerialize_connack(buf, sizeof(buf), 0, 1));
+	BENCH("deserialize_connack", "", "0", len, MQTTDeserialize_connack(&sessionPresent, &connack_rc, packet, len));
+
+	BENCH("serialize_pingreq", "", "0", 2, MQTTSerialize_pingreq(buf, sizeof(buf)));
+	BENCH("serialize_disconnect", "", "0", 2, MQTTSerialize_disconnect(buf, sizeof(buf)));
+}
+
+
+/* Publishes of every topic length with every payload size, given as C
+ * strings and as length-carrying strings, and topic comparisons. */
+void bench_publish(void)
+{
+	int topiclens[] = {16, 64, 256, 1024};
+	int payloadlens[] = {0, 64, 1024, 16384};
+	MQTTString topicName;
+	unsigned char dup, retained;
+	unsigned short packetid;
+	unsigned char* payloadp;
+	size_t payloadlen;
+	int qos, i, j, len;
+
+	for (i = 0; i < ARRAY_SIZE(topiclens); ++i)
+	{
+		MQTTString c = cstring(topiclens[i]);
+		MQTTString l = lenstring(topiclens[i]);
+
+		for (j = 0; j < ARRAY_SIZE(payloadlens); ++j)
+		{
+			char* param = param2(topiclens[i], payloadlens[j]);
+
+			len = MQTTSerialize_publish(packet, sizeof(packet), 0, 1, 0, 1, c, payload, payloadlens[j]);
+			BENCH("serialize_publish", "cstring", param, len,
+				MQTTSerialize_publish(buf, sizeof(buf), 0, 1, 0, 1, c, payload, payloadlens[j]));
+			BENCH("serialize_publish", "lenstring", param, len,
+				MQTTSerialize_publish(buf, sizeof(buf), 0, 1, 0, 1, l, payload, payloadlens[j]));
+			BENCH("serialize_publishHeader", "lenstring", param, len - payloadlens[j],
+				MQTTSerialize_publishHeader(buf, sizeof(buf), 0, 1, 0, 1, l, payloadlens[j]));
+			BENCH("deserialize_publish", "", param, len,
+				MQTTDeserialize_publish(&dup, &qos, &retained, &packetid, &topicName, &payloadp, &payloadlen, packet, len));
+		}
+
+		BENCH("equals", "cstring", param1(topiclens[i]), topiclens[i], MQTTPacket_equals(&l, topic));
+		BENCH("equals", "lenstring", param1(topiclens[i]), topiclens[i], MQTTPacket_equalsLen(&l, topic, topiclens[i]));
+	}
+}
+
+
+static int serializeEach(unsigned char* out, int outlen, int count, MQTTPacket_publishData publishes[])
+{
+	int len = 0;
+	int i;
+
+	for (i = 0; i < count; ++i)
+		len += MQTTSerialize_publish(out + len, outlen - len, publishes[i].dup, publishes[i].qos, publishes[i].retained,
+			publishes[i].packetid, publishes[i].topicName, publishes[i].payload, publishes[i].payloadlen);
+	return len;
+}
+
+
+/* BATCH_COUNT publishes with a topic of 64 bytes serialized into one buffer,
+ * by MQTTSerialize_publishBatch and one by one. */
+void bench_publish_batch(void)
+{
+	int payloadlens[] = {0, 64, 1024};
+	MQTTPacket_publishData publishes[BATCH_COUNT];
+	int i, j, len, serialized;
+
+	for (j = 0; j < ARRAY_SIZE(payloadlens); ++j)
+	{
+		char* param = param2(64, payloadlens[j]);
+
+		for (i = 0; i < BATCH_COUNT; ++i)
+		{
+			MQTTPacket_publishData p = MQTTPacket_publishData_initializer;
+
+			p.qos = 1;
+			p.packetid = i + 1;
+			p.topicName = lenstring(64);
+			p.payload = payload;
+			p.payloadlen = payloadlens[j];
+			publishes[i] = p;
+		}
+
+		len = serializeEach(packet, sizeof(packet), BATCH_COUNT, publishes);
+		BENCH("serialize_publish16", "batch", param, len,
+			MQTTSerialize_publishBatch(buf, sizeof(buf), BATCH_COUNT, publishes, &serialized));
+		BENCH("serialize_publish16", "single", param, len, serializeEach(buf, sizeof(buf), BATCH_COUNT, publishes));
+	}
+}
+
+
+/* Subscribes and unsubscribes of 1 and MAX_FILTERS topic filters of 64
+ * bytes, and their acknowledgements. */
+void bench_subscribe(void)
+{
+	int counts[] = {1, MAX_FILTERS};
+	MQTTString filters[MAX_FILTERS];
+	MQTTString out[MAX_FILTERS];
+	int qoss[MAX_FILTERS] = {0};
+	int granted[MAX_FILTERS];
+	unsigned char dup;
+	unsigned short packetid;
+	int i, count, len;
+
+	for (i = 0; i < MAX_FILTERS; ++i)
+		filters[i] = lenstring(64);
+
+	for (i = 0; i < ARRAY_SIZE(counts); ++i)
+	{
+		char* param = param2(counts[i], 64);
+
+		len = MQTTSerialize_subscribe(packet, sizeof(packet), 0, 1, counts[i], filters, qoss);
+		BENCH("serialize_subscribe", "", param, len, MQTTSerialize_subscribe(buf, sizeof(buf), 0, 1, counts[i], filters, qoss));
+		BENCH("deserialize_subscribe", "", param, len,
+			MQTTDeserialize_subscribe(&dup, &packetid, MAX_FILTERS, &count, out, granted, packet, len));
+
+		len = MQTTSerialize_unsubscribe(packet, sizeof(packet), 0, 1, counts[i], filters);
+		BENCH("serialize_unsubscribe", "", param, len, MQTTSerialize_unsubscribe(buf, sizeof(buf), 0, 1, counts[i], filters));
+		BENCH("deserialize_unsubscribe", "", param, len,
+			MQTTDeserialize_unsubscribe(&dup, &packetid, MAX_FILTERS, &count, out, packet, len));
+
+		len = MQTTSerialize_suback(packet, sizeof(packet), 1, counts[i], qoss);
+		BENCH("serialize_suback", "", param1(counts[i]), len, MQTTSerialize_suback(buf, sizeof(buf), 1, counts[i], qoss));
+		BENCH("deserialize_suback", "", param1(counts[i]), len,
+			MQTTDeserialize_suback(&packetid, MAX_FILTERS, &count, granted, packet, len));
+	}
+
+	len = MQTTSerialize_unsuback(packet, sizeof(packet), 1);
+	BENCH("serialize_unsuback", "", "0", len, MQTTSerialize_unsuback(buf, sizeof(buf), 1));
+	BENCH("deserialize_unsuback", "", "0", len, MQTTDeserialize_unsuback(&packetid, packet, len));
+}
+
+
+/* The acknowledgements of QoS 1 and 2 publishes. */
+void bench_acks(void)
+{
+	unsigned char type, dup;
+	unsigned short packetid;
+	int len;
+
+	len = MQTTSerialize_puback(packet, sizeof(packet), 1);
+	BENCH("serialize_ack", "puback", "0", len, MQTTSerialize_puback(buf, sizeof(buf), 1));
+	BENCH("serialize_ack", "pubrec", "0", len, MQTTSerialize_ack(buf, sizeof(buf), PUBREC, 0, 1));
+	BENCH("serialize_ack", "pubrel", "0", len, MQTTSerialize_pubrel(buf, sizeof(buf), 0, 1));
+	BENCH("serialize_ack", "pubcomp", "0", len, MQTTSerialize_pubcomp(buf, sizeof(buf), 1));
+	BENCH("deserialize_ack", "puback", "0", len, MQTTDeserialize_ack(&type, &dup, &packetid, packet, len));
+}
+
+
+int main(int argc, char** argv)
+{
+	getopts(argc, argv);
+
+	if (options.baseline && readBaseline(options.baseline) != 0)
+	{
+		fprintf(stderr, "cannot read baseline %s\n", options.baseline);
+		return EXIT_FAILURE;
+	}
+
+	memset(topic, 'a', sizeof(topic));
+	memset(payload, 'p', sizeof(payload));
+
+	printf("benchmark,variant,param,bytes,ns_per_op,bytes_per_ns%s\n",
+		options.baseline ? ",baseline_ns_per_op,change_pct,status" : "");
+
+	bench_remaining_length();
+	bench_connect();
+	bench_publish();
+	bench_publish_batch();
+	bench_subscribe();
+	bench_acks();
+
+	if (slower)
+		fprintf(stderr, "%d benchmarks slower than the baseline by more than %.0f%%\n", slower, options.threshold);
+
+	return slower ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -589,6 +589,7 @@ int test6(struct Options options)
 
 	rc = MQTTSerialize_connack(buf, buflen, connack_rc, sessionPresent);
 	assert("good rc from serialize connack", rc > 0, "rc was %d\n", rc);
+	assert("session present is bit 0 of the connack flags", buf[2] == 0x01, "connack flags were %x\n", buf[2]);
 
 	rc = MQTTDeserialize_connack(&sessionPresent2, &connack_rc2, buf, buflen);
 	assert("good rc from deserialize connack", rc == 1, "rc was %d\n", rc);
@@ -606,10 +607,262 @@ int test6(struct Options options)
 }
 
 
+int test7(struct Options options)
+{
+	int rc = 0;
+	unsigned char buf[300];
+	unsigned char hdr[20];
+	int buflen = sizeof(buf);
+	int i, hdrlen = 0;
+
+	MQTTString topicString = MQTTString_initializer;
+	unsigned char payload[200];
+	int payloadlen = sizeof(payload);
+
+	fprintf(xml, "<testcase classname=\"test1\" name=\"de/serialization\"");
+	global_start_time = start_clock();
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 7 - serialization of publish header without payload");
+
+	for (i = 0; i < payloadlen; ++i)
+		payload[i] = (unsigned char)i;
+	topicString.cstring = "mytopic";
+
+	rc = MQTTSerialize_publish(buf, buflen, 0, 1, 0, 4321, topicString, payload, payloadlen);
+	assert("good rc from serialize publish", rc > 0, "rc was %d\n", rc);
+
+	hdrlen = MQTTSerialize_publishHeader(hdr, sizeof(hdr), 0, 1, 0, 4321, topicString, payloadlen);
+	assert("good rc from serialize publish header", hdrlen > 0, "rc was %d\n", hdrlen);
+
+	/* header followed by the payload must be the same as the whole packet */
+	assert("lengths should add up", hdrlen + payloadlen == rc, "header length was %d\n", hdrlen);
+	assert("headers should be the same", memcmp(buf, hdr, hdrlen) == 0, "headers were different %s\n", "");
+
+	/* the payload does not have to fit the header buffer */
+	rc = MQTTSerialize_publishHeader(hdr, 15, 0, 1, 0, 4321, topicString, 100000);
+	assert("good rc from serialize publish header of a large payload", rc == 15, "rc was %d\n", rc);
+	rc = MQTTSerialize_publishHeader(hdr, 14, 0, 1, 0, 4321, topicString, 100000);
+	assert("short buffer is reported", rc == MQTTPACKET_BUFFER_TOO_SHORT, "rc was %d\n", rc);
+
+/* exit: */
+	MyLog(LOGA_INFO, "TEST7: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+static unsigned char* readptr;
+
+int readfn(unsigned char* buf, int count)
+{
+	memcpy(buf, readptr, count);
+	readptr += count;
+	return count;
+}
+
+
+int test8(struct Options options)
+{
+	int rc = 0;
+	unsigned char buf[300];
+	unsigned char packet[300];
+	int buflen = sizeof(buf);
+	struct
+	{
+		unsigned char bytes[4];
+		int len;
+		int value;
+	} lengths[] =
+	{
+		{{0x00}, 1, 0},
+		{{0x7f}, 1, 127},
+		{{0x80, 0x01}, 2, 128},
+		{{0xff, 0x7f}, 2, 16383},
+		{{0x80, 0x80, 0x01}, 3, 16384},
+		{{0xff, 0xff, 0x7f}, 3, 2097151},
+		{{0x80, 0x80, 0x80, 0x01}, 4, 2097152},
+		{{0xff, 0xff, 0xff, 0x7f}, 4, 268435455},
+	};
+	unsigned char bad[] = {0x80, 0x80, 0x80, 0x80, 0x01};
+	int i, len, value = 0;
+
+	MQTTString topicString = MQTTString_initializer;
+	unsigned char payload[200];
+	int payloadlen = sizeof(payload);
+
+	fprintf(xml, "<testcase classname=\"test1\" name=\"de/serialization\"");
+	global_start_time = start_clock();
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 8 - decoding of remaining lengths");
+
+	for (i = 0; i < ARRAY_SIZE(lengths); ++i)
+	{
+		rc = MQTTPacket_decodeSpan(lengths[i].bytes, lengths[i].len, &value);
+		assert("whole length is decoded", rc == lengths[i].len && value == lengths[i].value, "rc was %d\n", rc);
+
+		rc = MQTTPacket_decodeSpan(lengths[i].bytes, lengths[i].len - 1, &value);
+		assert("more bytes are asked for", rc == 0, "rc was %d\n", rc);
+	}
+
+	rc = MQTTPacket_decodeSpan(bad, sizeof(bad), &value);
+	assert("more than 4 bytes are rejected", rc == MQTTPACKET_READ_ERROR, "rc was %d\n", rc);
+
+	/* a packet is read through the callback with its length decoded on the way */
+	for (i = 0; i < payloadlen; ++i)
+		payload[i] = (unsigned char)i;
+	topicString.cstring = "mytopic";
+	len = MQTTSerialize_publish(packet, sizeof(packet), 0, 1, 0, 4321, topicString, payload, payloadlen);
+	assert("good rc from serialize publish", len > 0, "rc was %d\n", len);
+
+	readptr = packet;
+	rc = MQTTPacket_read(buf, buflen, readfn);
+	assert("publish is read", rc == PUBLISH, "rc was %d\n", rc);
+	assert("whole packet is read", readptr - packet == len, "read %d bytes\n", (int)(readptr - packet));
+	assert("packets should be the same", memcmp(buf, packet, len) == 0, "packets were different %s\n", "");
+
+	readptr = packet;
+	rc = MQTTPacket_read(buf, 2, readfn);
+	assert("short buffer is reported", rc == -1, "rc was %d\n", rc);
+
+/* exit: */
+	MyLog(LOGA_INFO, "TEST8: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+int test9(struct Options options)
+{
+	int rc = 0;
+	unsigned char buf1[100];
+	unsigned char buf2[100];
+	int len1, len2;
+	char topic[] = "mytopic/with/levels?query";
+
+	MQTTString cstring = MQTTString_initializer;
+	MQTTString lenstring = MQTTString_initializer;
+	unsigned char payload[] = "payload";
+
+	fprintf(xml, "<testcase classname=\"test1\" name=\"length-carrying strings\"");
+	global_start_time = start_clock();
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 9 - length-carrying strings");
+
+	/* the same topic as a C string and as a prefix of a longer buffer */
+	cstring.cstring = "mytopic/with/levels";
+	lenstring.lenstring.data = topic;
+	lenstring.lenstring.len = strlen(cstring.cstring);
+
+	len1 = MQTTSerialize_publish(buf1, sizeof(buf1), 0, 1, 0, 23, cstring, payload, sizeof(payload));
+	assert("good rc from serialize publish", len1 > 0, "rc was %d\n", len1);
+	len2 = MQTTSerialize_publish(buf2, sizeof(buf2), 0, 1, 0, 23, lenstring, payload, sizeof(payload));
+	assert("good rc from serialize publish", len2 > 0, "rc was %d\n", len2);
+	assert("packets should be the same", len1 == len2 && memcmp(buf1, buf2, len1) == 0, "packets were different %s\n", "");
+
+	len1 = MQTTSerialize_subscribe(buf1, sizeof(buf1), 0, 23, 1, &cstring, &rc);
+	len2 = MQTTSerialize_subscribe(buf2, sizeof(buf2), 0, 23, 1, &lenstring, &rc);
+	assert("subscribes should be the same", len1 > 0 && len1 == len2 && memcmp(buf1, buf2, len1) == 0, "rc was %d\n", len1);
+
+	rc = MQTTPacket_equalsLen(&lenstring, topic, lenstring.lenstring.len);
+	assert("prefix of the buffer is equal", rc == 1, "rc was %d\n", rc);
+	rc = MQTTPacket_equalsLen(&lenstring, topic, sizeof(topic) - 1);
+	assert("whole buffer is not equal", rc == 0, "rc was %d\n", rc);
+	rc = MQTTPacket_equalsLen(&cstring, topic, lenstring.lenstring.len);
+	assert("C string is equal", rc == 1, "rc was %d\n", rc);
+	rc = MQTTPacket_equalsLen(&cstring, "mytopic/with/levelz", lenstring.lenstring.len);
+	assert("different string is not equal", rc == 0, "rc was %d\n", rc);
+
+/* exit: */
+	MyLog(LOGA_INFO, "TEST9: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+int test10(struct Options options)
+{
+	int rc = 0;
+	unsigned char buf[200];
+	unsigned char one[100];
+	int buflen = sizeof(buf);
+	int i, len, onelen, offset, serialized = 0;
+	MQTTPacket_publishData publishes[3] =
+	{
+		MQTTPacket_publishData_initializer,
+		MQTTPacket_publishData_initializer,
+		MQTTPacket_publishData_initializer,
+	};
+	char* topics[] = {"thngs/a/properties", "thngs/b/properties", "thngs/c/actions/x"};
+	char* payloads[] = {"[{\"value\":1}]", "[{\"value\":22}]", "{}"};
+
+	fprintf(xml, "<testcase classname=\"test1\" name=\"publish batch\"");
+	global_start_time = start_clock();
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 10 - serialization of publishes in a batch");
+
+	for (i = 0; i < ARRAY_SIZE(publishes); ++i)
+	{
+		publishes[i].qos = i % 2;
+		publishes[i].packetid = 100 + i;
+		publishes[i].topicName.cstring = topics[i];
+		publishes[i].payload = (unsigned char*)payloads[i];
+		publishes[i].payloadlen = strlen(payloads[i]);
+	}
+
+	len = MQTTSerialize_publishBatch(buf, buflen, ARRAY_SIZE(publishes), publishes, &serialized);
+	assert("good rc from serialize publish batch", len > 0, "rc was %d\n", len);
+	assert("all publishes serialized", serialized == ARRAY_SIZE(publishes), "serialized %d\n", serialized);
+
+	/* the same bytes as the publishes serialized one by one, each with its packet id */
+	offset = 0;
+	for (i = 0; i < ARRAY_SIZE(publishes); ++i)
+	{
+		unsigned char dup;
+		int qos;
+		unsigned char retained;
+		unsigned short packetid;
+		MQTTString topicName = MQTTString_initializer;
+		unsigned char* payload;
+		size_t payloadlen;
+
+		onelen = MQTTSerialize_publish(one, sizeof(one), 0, publishes[i].qos, 0, publishes[i].packetid,
+				publishes[i].topicName, publishes[i].payload, publishes[i].payloadlen);
+		assert("packets should be the same", offset + onelen <= len && memcmp(buf + offset, one, onelen) == 0,
+				"packet %d was different\n", i);
+
+		rc = MQTTDeserialize_publish(&dup, &qos, &retained, &packetid, &topicName, &payload, &payloadlen,
+				buf + offset, len - offset);
+		assert("good rc from deserialize publish", rc == 1, "rc was %d\n", rc);
+		assert("packetids should be the same", qos == 0 || packetid == publishes[i].packetid, "packetid was %d\n", packetid);
+		assert("payloads should be the same", payloadlen == publishes[i].payloadlen &&
+				memcmp(payload, publishes[i].payload, payloadlen) == 0, "payloadlen was %d\n", (int)payloadlen);
+		offset += onelen;
+	}
+	assert("packets fill the batch", offset == len, "offset was %d\n", offset);
+
+	/* a buffer too short for all of them takes those which fit */
+	rc = MQTTSerialize_publishBatch(buf, len - 1, ARRAY_SIZE(publishes), publishes, &serialized);
+	assert("first publishes serialized", serialized == ARRAY_SIZE(publishes) - 1 && rc == len - onelen,
+			"serialized %d\n", serialized);
+
+	rc = MQTTSerialize_publishBatch(buf, 5, ARRAY_SIZE(publishes), publishes, &serialized);
+	assert("buffer too short", rc == MQTTPACKET_BUFFER_TOO_SHORT && serialized == 0, "rc was %d\n", rc);
+
+/* exit: */
+	MyLog(LOGA_INFO, "TEST10: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
 int main(int argc, char** argv)
 {
 	int rc = 0;
- 	int (*tests[])() = {NULL, test1, test2, test3, test4, test5, test6};
+ 	int (*tests[])() = {NULL, test1, test2, test3, test4, test5, test6, test7, test8, test9, test10};
 
 	xml = fopen("TEST-test1.xml", "w");
 	fprintf(xml, "<testsuite name=\"test1\" tests=\"%d\">\n", (int)(ARRAY_SIZE(tests) - 1));
@@ -29,6 +29,7 @@
 
 typedef enum _evrythng_return_t 
 {
+    EVRYTHNG_QUEUE_FULL          = -14,
     EVRYTHNG_NOT_SUBSCRIBED      = -13,
     EVRYTHNG_ALREADY_SUBSCRIBED  = -12,
     EVRYTHNG_TIMEOUT             = -11,
@@ -43,6 +44,8 @@ typedef enum _evrythng_return_t
     EVRYTHNG_BAD_ARGS            = -2,
     EVRYTHNG_FAILURE             = -1,
     EVRYTHNG_SUCCESS             =  0,
+    EVRYTHNG_IN_PROGRESS         =  1,
+    EVRYTHNG_SPOOLED             =  2,
 } evrythng_return_t;
 
 
@@ -78,6 +81,109 @@ typedef void (*evrythng_callback)();
 typedef void sub_callback(const char* str_json, size_t length);
 
 
+/** @brief Callback prototype used for chunked subscribe functions,
+ *  	   which is called for every piece of a message too large
+ *  	   for the internal read buffer, in order.
+ *
+ *  Note that chunk is not a complete JSON document and does not end with a \0 character.
+ */
+typedef void sub_chunk_callback(const char* chunk, size_t offset, size_t chunk_len, size_t total_len);
+
+
+/** @brief Pointer to an asynchronous publish ticket.
+ */
+typedef struct evrythng_ticket_t* evrythng_ticket_t;
+
+
+/** @brief Pointer to a prepared publish topic.
+ */
+typedef struct evrythng_topic_t* evrythng_topic_t;
+
+
+/** @brief Pointer to a reactor, a set of threads driving many contexts.
+ */
+typedef struct evrythng_reactor_t* evrythng_reactor_t;
+
+
+/** @brief State of the reconnection to the cloud, see EvrythngGetReconnectState.
+ */
+typedef struct evrythng_reconnect_state_t
+{
+    int reconnecting;               /**< 1 while the connection is being restored */
+    int attempt;                    /**< failed attempts since the connection was lost */
+    int next_retry_ms;              /**< time until the next attempt, -1 if not reconnecting */
+    evrythng_return_t last_error;   /**< result of the last connection attempt */
+    int last_mqtt_rc;               /**< MQTT result of the last attempt, a CONNACK return 
+                                         code if the cloud refused the connection */
+    int last_network_ms;            /**< time the network connection of the last successful
+                                         attempt took, -1 if none */
+    int last_connect_ms;            /**< time until the last successful attempt got its 
+                                         CONNACK, -1 if none */
+    int last_resumed;               /**< 1 if the last successful attempt resumed a TLS session */
+} evrythng_reconnect_state_t;
+
+
+/** @brief What to do with a publish when the spool is full, see EvrythngSetSpool.
+ */
+typedef enum 
+{
+    EVRYTHNG_SPOOL_DROP_OLDEST = 0, /**< drop the oldest publishes to make room */
+    EVRYTHNG_SPOOL_DROP_NEWEST = 1, /**< drop the new publish */
+} evrythng_spool_policy_t;
+
+
+/** @brief Content of the spool, see EvrythngGetSpoolStats.
+ */
+typedef struct evrythng_spool_stats_t
+{
+    unsigned int count;     /**< publishes waiting in the spool */
+    size_t bytes;           /**< space they take */
+    unsigned int dropped;   /**< publishes dropped because the spool was full */
+    unsigned int replayed;  /**< publishes sent from the spool */
+} evrythng_spool_stats_t;
+
+
+/** @brief Round trip times of the keepalive pings, see EvrythngGetRttStats.
+ */
+typedef struct evrythng_rtt_stats_t
+{
+    unsigned int samples;   /**< pings answered */
+    int last_ms;            /**< round trip of the last one, -1 if none */
+    int min_ms;             /**< -1 if none */
+    int avg_ms;             /**< -1 if none */
+    int max_ms;             /**< -1 if none */
+} evrythng_rtt_stats_t;
+
+
+/** @brief Packets sent and the network writes they took, see EvrythngGetSendStats.
+ */
+typedef struct evrythng_send_stats_t
+{
+    unsigned long packets;  /**< MQTT packets sent */
+    unsigned long writes;   /**< network writes made to send them */
+} evrythng_send_stats_t;
+
+
+/** @brief What was left undone by EvrythngDisconnectTimeout.
+ */
+typedef struct evrythng_disconnect_report_t
+{
+    unsigned int queued_dropped;    /**< calls and aggregated messages not sent by the deadline */
+    unsigned int inflight_dropped;  /**< publishes sent but not acknowledged by the deadline */
+    unsigned int spooled;           /**< publishes left in the spool */
+    int elapsed_ms;                 /**< time taken to disconnect */
+} evrythng_disconnect_report_t;
+
+
+/** @brief Callback prototype used for asynchronous publish functions,
+ *         which is called when the publish is complete.
+ *
+ *  It is called in the context of the internal library thread, 
+ *  so do not call any library api from it.
+ */
+typedef void (*evrythng_pub_callback)(evrythng_return_t result, void* userdata);
+
+
 /** @brief Initialize context.
  *
  * Use this function to initialize context which contains Evrythng client configuration
@@ -103,6 +209,38 @@ evrythng_return_t EvrythngInitHandle(evrythng_handle_t* handle);
 void EvrythngDestroyHandle(evrythng_handle_t handle);
 
 
+/** @brief Initialize a reactor.
+ *
+ * A reactor lets a gateway run many contexts without a thread per
+ * context. Each of its threads waits on the connections of the contexts 
+ * assigned to it, runs their queued operations and keepalive work and
+ * reconnects them when a connection is lost. Contexts are assigned by
+ * EvrythngSetReactor. Connecting and the operations which wait for an 
+ * acknowledgement are left to a worker thread started with each thread,
+ * so that they do not hold up the other contexts of the thread.
+ *
+ * @param[in] reactor A pointer to reactor.
+ * @param[in] threads The number of threads to start.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS     if reactor is a null pointer or threads is < 1 \n
+ *            \b EVRYTHNG_MEMORY_ERROR if an error occured while allocating memory \n
+ *            \b EVRYTHNG_SUCCESS      on success \n
+ */
+evrythng_return_t EvrythngInitReactor(evrythng_reactor_t* reactor, int threads);
+
+
+/** @brief Destroy a reactor.
+ *
+ * Stops the reactor threads. Every context using the reactor must be
+ * destroyed first.
+ *
+ * @param[in] reactor A reactor.
+ *
+ * @return void
+ */
+void EvrythngDestroyReactor(evrythng_reactor_t reactor);
+
+
 /** @brief Set URL to connect to.
  *
  * Use this function to set URL to internal context, tcp://<ip>:<port> for 
@@ -163,6 +301,159 @@ evrythng_return_t EvrythngSetClientId(evrythng_handle_t handle, const char* clie
 evrythng_return_t EvrythngSetQos(evrythng_handle_t handle, int qos);
 
 
+/** @brief Keep the session in the cloud over reconnections.
+ *
+ * Use this function to connect without the MQTT clean session flag. The
+ * cloud then keeps the subscriptions of the client and queues QoS 1/2 
+ * messages for it while it is offline. On reconnection the subscriptions 
+ * are only sent again if the cloud did not keep the session, unacknowledged 
+ * publishes are resumed. EvrythngDisconnect leaves the subscriptions of 
+ * the session in place. Set a client ID with EvrythngSetClientId for the 
+ * session to outlive the context. Must be called before EvrythngConnect.
+ * Sessions are clean by default.
+ *
+ * @param[in] handle     A pointer to context handle.
+ * @param[in] persistent 1 to keep the session, 0 for a clean session.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS     if handle is a null pointer \n
+ *            \b EVRYTHNG_FAILURE      if the handle is already connected \n
+ *            \b EVRYTHNG_SUCCESS      on success \n
+ */
+evrythng_return_t EvrythngSetPersistentSession(evrythng_handle_t handle, int persistent);
+
+
+/** @brief Set the MQTT keepalive interval.
+ *
+ * A ping is sent when nothing was sent or nothing was received for the 
+ * interval, and the connection is considered lost if nothing at all is
+ * received in answer. The calls also wait for an answer of the cloud for 
+ * the interval, or 60 s with keepalive disabled. Must be called before 
+ * EvrythngConnect. Default is 60 s.
+ *
+ * @param[in] handle  A pointer to context handle.
+ * @param[in] seconds The interval, 0 to disable keepalive.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS     if handle is a null pointer or seconds is < 0 or > 65535 \n
+ *            \b EVRYTHNG_FAILURE      if the handle is already connected \n
+ *            \b EVRYTHNG_SUCCESS      on success \n
+ */
+evrythng_return_t EvrythngSetKeepAlive(evrythng_handle_t handle, int seconds);
+
+
+/** @brief Set how the connection is restored after it was lost.
+ *
+ * Use this function to set the delays between reconnection attempts. The
+ * delay before an attempt is random between 0 and min_delay_ms doubled for 
+ * every failed attempt, up to max_delay_ms. Devices losing the connection 
+ * at the same time, when the cloud restarts, thus do not reconnect all at
+ * once. Each attempt gives up when the cloud did not accept the connection 
+ * within attempt_timeout_ms. The timeout also applies to EvrythngConnect.
+ * If it was not setup 300 ms, 30000 ms and 10000 ms are used.
+ *
+ * @param[in] handle             A pointer to context handle.
+ * @param[in] min_delay_ms       The delay limit of the first attempt.
+ * @param[in] max_delay_ms       The delay limit of any attempt.
+ * @param[in] attempt_timeout_ms The time an attempt may take.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if handle is a null pointer, min_delay_ms is < 0,
+ *                                 max_delay_ms is < min_delay_ms or attempt_timeout_ms is < 1 \n
+ *            \b EVRYTHNG_SUCCESS  on success \n
+ */
+evrythng_return_t EvrythngSetReconnectPolicy(evrythng_handle_t handle, int min_delay_ms, int max_delay_ms, int attempt_timeout_ms);
+
+
+/** @brief Get the state of the reconnection.
+ *
+ * @param[in]  handle A pointer to context handle.
+ * @param[out] state  The reconnection state.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if handle or state is a null pointer \n
+ *            \b EVRYTHNG_SUCCESS  on success \n
+ */
+evrythng_return_t EvrythngGetReconnectState(evrythng_handle_t handle, evrythng_reconnect_state_t* state);
+
+
+/** @brief Keep publishes in a spool while the connection is down.
+ *
+ * Use this function to store publishes made while not connected instead of
+ * failing them with EVRYTHNG_NOT_CONNECTED. Publish functions then return 
+ * EVRYTHNG_SPOOLED, asynchronous ones do not return a ticket nor call the 
+ * callback. Once connected the spool is replayed in order, newer publishes 
+ * are spooled behind the ones waiting, and a publish leaves the spool when 
+ * the cloud acknowledged it. A publish the connection was lost for is sent 
+ * again, so a message may be received twice.
+ * If path is given the spool is a file of size bytes, which survives a 
+ * restart of the device: publishes left by a previous run are replayed 
+ * after connecting. A file which was partly written when the device went 
+ * down is cut after its last intact publish.
+ * Must be called before EvrythngConnect. By default there is no spool.
+ *
+ * @param[in] handle A pointer to context handle.
+ * @param[in] size   The size of the spool in bytes, 0 to remove the spool.
+ * @param[in] policy What to drop when the spool is full.
+ * @param[in] path   The file to keep the spool in, a null pointer to keep it in memory.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS    if handle is a null pointer or size is < 64 \n
+ *            \b EVRYTHNG_FAILURE     if called after EvrythngConnect or the file could not be used \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation failed \n
+ *            \b EVRYTHNG_SUCCESS     on success \n
+ */
+evrythng_return_t EvrythngSetSpool(evrythng_handle_t handle, size_t size, evrythng_spool_policy_t policy, const char* path);
+
+
+/** @brief Limit the rate at which the spool is replayed.
+ *
+ * Use this function to spread the replay of a full spool over time, so that
+ * it does not take all the bandwidth of the device. By default the spool is
+ * replayed as fast as the cloud acknowledges the publishes.
+ *
+ * @param[in] handle       A pointer to context handle.
+ * @param[in] msgs_per_sec The number of publishes sent per second, 0 for no limit.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if handle is a null pointer or msgs_per_sec is < 0 \n
+ *            \b EVRYTHNG_SUCCESS  on success \n
+ */
+evrythng_return_t EvrythngSetSpoolReplayRate(evrythng_handle_t handle, int msgs_per_sec);
+
+
+/** @brief Get the content of the spool.
+ *
+ * @param[in]  handle A pointer to context handle.
+ * @param[out] stats  The spool counters.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if handle or stats is a null pointer \n
+ *            \b EVRYTHNG_SUCCESS  on success \n
+ */
+evrythng_return_t EvrythngGetSpoolStats(evrythng_handle_t handle, evrythng_spool_stats_t* stats);
+
+
+/** @brief Get the round trip times of the keepalive pings.
+ *
+ * Each ping answered is a sample of the latency of the link to the cloud,
+ * counted over all connections of the handle.
+ *
+ * @param[in]  handle A pointer to context handle.
+ * @param[out] stats  The round trip times.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if handle or stats is a null pointer \n
+ *            \b EVRYTHNG_SUCCESS  on success \n
+ */
+evrythng_return_t EvrythngGetRttStats(evrythng_handle_t handle, evrythng_rtt_stats_t* stats);
+
+
+/** @brief Get the number of packets sent and of the network writes they took.
+ *
+ * Counted over all connections of the handle, see EvrythngSetSendBatching.
+ *
+ * @param[in]  handle A pointer to context handle.
+ * @param[out] stats  The send counters.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if handle or stats is a null pointer \n
+ *            \b EVRYTHNG_SUCCESS  on success \n
+ */
+evrythng_return_t EvrythngGetSendStats(evrythng_handle_t handle, evrythng_send_stats_t* stats);
+
+
 /** @brief Set log callback
  *
  * Use this function to set log callback to internal context 
@@ -222,6 +513,181 @@ evrythng_return_t EvrythngSetThreadPriority(evrythng_handle_t handle, int priori
 evrythng_return_t EvrythngSetThreadStacksize(evrythng_handle_t handle, int stacksize);
 
 
+/** @brief Set the depth of the internal operations queue.
+ *
+ * Use this function to set how many publish/subscribe/unsubscribe
+ * operations can be queued at the same time from different threads
+ * of the application. Callers block while the queue is full.
+ * Must be called before EvrythngConnect.
+ * If it was not setup a default value of 32 will be used.
+ *
+ * @param[in] handle A pointer to context handle.
+ * @param[in] depth  A number of queue slots.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS     if handle is a null pointer or depth is < 1 \n
+ *            \b EVRYTHNG_FAILURE      if the handle is already connected \n
+ *            \b EVRYTHNG_MEMORY_ERROR if an error occured while allocating memory \n
+ *            \b EVRYTHNG_SUCCESS      on success \n
+ */
+evrythng_return_t EvrythngSetOpQueueDepth(evrythng_handle_t handle, int depth);
+
+
+/** @brief Set the maximum number of unacknowledged publishes.
+ *
+ * Use this function to set how many QoS 1/2 publishes can await
+ * acknowledgement from the cloud at the same time, so that throughput
+ * on high latency links is not limited to one message per round trip.
+ * Unacknowledged publishes are sent again after a reconnection.
+ * 0 makes every publish wait for its acknowledgement before the next
+ * one is sent. Must be called before EvrythngConnect.
+ * If it was not setup a default value of 8 will be used.
+ *
+ * @param[in] handle       A pointer to context handle.
+ * @param[in] max_inflight A number of publishes.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS     if handle is a null pointer or max_inflight is < 0 \n
+ *            \b EVRYTHNG_FAILURE      if the handle is already connected \n
+ *            \b EVRYTHNG_MEMORY_ERROR if an error occured while allocating memory \n
+ *            \b EVRYTHNG_SUCCESS      on success \n
+ */
+evrythng_return_t EvrythngSetMaxInflight(evrythng_handle_t handle, int max_inflight);
+
+
+/** @brief Write the packets of calls queued together in one go.
+ *
+ * Use this function so that publishes made in a burst do not cost a
+ * network write, and over TLS a record, each. The packets of the calls
+ * the internal thread takes from the queue at once are collected in a
+ * buffer of max_bytes, which is written when it is full, when a call 
+ * waits for an answer from the cloud and once the calls are done.
+ * Must be called before EvrythngConnect.
+ * If it was not setup packets are written one by one.
+ *
+ * @param[in] handle    A pointer to context handle.
+ * @param[in] max_bytes The size of the buffer, 0 to write packets one by one.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS     if handle is a null pointer or max_bytes is < 0 \n
+ *            \b EVRYTHNG_FAILURE      if the handle is already connected \n
+ *            \b EVRYTHNG_MEMORY_ERROR if an error occured while allocating memory \n
+ *            \b EVRYTHNG_SUCCESS      on success \n
+ */
+evrythng_return_t EvrythngSetSendBatching(evrythng_handle_t handle, int max_bytes);
+
+
+/** @brief Read incoming messages into a pool of buffers.
+ *
+ * Use this function so that a subscription callback can hand a message
+ * over to another thread without copying it. Each message is read into
+ * a free buffer of the pool and can be kept past the return of the 
+ * callback with EvrythngRetainMessage. The count buffers of the pool are
+ * allocated once, so the memory used by retained messages is bounded.
+ * While all of them are retained messages are read into the usual buffer
+ * and cannot be retained.
+ * Must be called before EvrythngConnect.
+ * If it was not setup a message is valid until the callback returns only.
+ *
+ * @param[in] handle A pointer to context handle.
+ * @param[in] count  The number of buffers, 0 for no pool.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS     if handle is a null pointer or count is < 0 \n
+ *            \b EVRYTHNG_FAILURE      if the handle is already connected \n
+ *            \b EVRYTHNG_MEMORY_ERROR if an error occured while allocating memory \n
+ *            \b EVRYTHNG_SUCCESS      on success \n
+ */
+evrythng_return_t EvrythngSetMessagePool(evrythng_handle_t handle, int count);
+
+
+/** @brief Keep a message received past the return of its callback.
+ *
+ * Call it from a subscription callback with the message it was given.
+ * A message retained stays valid until EvrythngReleaseMessage, which
+ * may be called from any thread but before EvrythngDestroyHandle.
+ *
+ * @param[in] handle   A pointer to context handle.
+ * @param[in] str_json The message given to the callback.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if handle or str_json is a null pointer \n
+ *            \b EVRYTHNG_FAILURE  if the message is not in a buffer of the pool, 
+ *                                 it has to be copied to be kept \n
+ *            \b EVRYTHNG_SUCCESS  on success \n
+ */
+evrythng_return_t EvrythngRetainMessage(evrythng_handle_t handle, const char* str_json);
+
+
+/** @brief Drop a message retained with EvrythngRetainMessage.
+ *
+ * @param[in] handle   A pointer to context handle.
+ * @param[in] str_json The message retained.
+ */
+void EvrythngReleaseMessage(evrythng_handle_t handle, const char* str_json);
+
+
+/** @brief Drive a context by a reactor.
+ *
+ * Use this function to run the context on the reactor thread with the
+ * fewest contexts instead of a thread of its own. The context shares the
+ * packet buffers of the reactor thread. Must be called before EvrythngConnect.
+ *
+ * @param[in] handle  A pointer to context handle.
+ * @param[in] reactor A reactor.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS     if handle or reactor is a null pointer \n
+ *            \b EVRYTHNG_FAILURE      if the handle was connected or already uses a reactor \n
+ *            \b EVRYTHNG_MEMORY_ERROR if an error occured while allocating memory \n
+ *            \b EVRYTHNG_SUCCESS      on success \n
+ */
+evrythng_return_t EvrythngSetReactor(evrythng_handle_t handle, evrythng_reactor_t reactor);
+
+
+/** @brief Set up the aggregation of thing property updates.
+ *
+ * Property updates passed to EvrythngAggregateThngProperty are collected
+ * per thing and published together as one properties message. The
+ * pending updates of a thing are sent once the oldest of them is
+ * window_ms old, once max_count updates were collected or before the
+ * message would grow past max_bytes. A window_ms of 0 disables the time
+ * based flush, updates are then only sent on the count and size
+ * thresholds or by EvrythngFlushThngProperties.
+ * If it was not setup a window of 100 ms, 32 updates and 4096 bytes are used.
+ *
+ * @param[in] handle     A pointer to context handle.
+ * @param[in] window_ms  The time updates may wait, in milliseconds.
+ * @param[in] max_count  The maximum number of updates in one message.
+ * @param[in] max_bytes  The maximum length of one message.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if handle is a null pointer, window_ms is < 0, 
+ *                                 max_count is < 1 or max_bytes is < 64 \n
+ *            \b EVRYTHNG_SUCCESS  on success \n
+ */
+evrythng_return_t EvrythngSetAggregation(evrythng_handle_t handle, int window_ms, int max_count, int max_bytes);
+
+
+/** @brief Spread the traffic of a context over several connections.
+ *
+ * Use this function for a context carrying the traffic of many things,
+ * so that a large message or a slow acknowledgement on one connection
+ * does not hold up the others. Each connection uses the key of the 
+ * context and a client ID made of the context client ID followed by 
+ * the connection number. Publishes, subscriptions and aggregated 
+ * updates go through the connection picked by a hash of the thing or
+ * product ID, or of the action name, so the messages of each keep their
+ * order. The spool is split between the connections, each keeping its 
+ * publishes in a file named after the path followed by its number.
+ * Spool and round trip statistics cover all connections, the reconnect
+ * state is that of the first one. Must be called before EvrythngConnect,
+ * the other settings are passed on to the connections when connecting.
+ *
+ * @param[in] handle A pointer to context handle.
+ * @param[in] count  The number of connections, 1 to 16. The default is 1.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS     if handle is a null pointer or count is out of range \n
+ *            \b EVRYTHNG_FAILURE      if the handle was connected \n
+ *            \b EVRYTHNG_MEMORY_ERROR if an error occured while allocating memory \n
+ *            \b EVRYTHNG_SUCCESS      on success \n
+ */
+evrythng_return_t EvrythngSetConnections(evrythng_handle_t handle, int count);
+
+
 /** @brief Connect to Evrythng cloud.
  *
  * Use this function to connect to the Evrythng cloud.
@@ -253,6 +719,26 @@ evrythng_return_t EvrythngConnect(evrythng_handle_t handle);
 evrythng_return_t EvrythngDisconnect(evrythng_handle_t handle);
 
 
+/** @brief Disconnect from Evrythng cloud within a deadline.
+ *
+ * Use this function to shut down quickly. Pending aggregated properties 
+ * and the calls already queued are sent and the publishes in flight are 
+ * waited for until timeout_ms has passed, whatever is left then is dropped
+ * and the connection is closed. Subscriptions are not removed one by one,
+ * the cloud drops them with a clean session and keeps them with a 
+ * persistent one. Publishes left in the spool are kept in its file, if any.
+ *
+ * @param[in]  handle     A pointer to context handle.
+ * @param[in]  timeout_ms Time allowed for sending what is pending.
+ * @param[out] report     What was dropped, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if handle is a null pointer or timeout_ms is negative \n
+ *            \b EVRYTHNG_TIMEOUT  if anything pending was dropped \n
+ *            \b EVRYTHNG_SUCCESS  on success \n
+ */
+evrythng_return_t EvrythngDisconnectTimeout(evrythng_handle_t handle, int timeout_ms, evrythng_disconnect_report_t* report);
+
+
 /** @brief Publish a single property to a given thing.
  *
  * This function attempts to publish a single property to a given thing.
@@ -382,6 +868,51 @@ evrythng_return_t EvrythngPubThngProperties(
         const char* properties_json);
 
 
+/** @brief Add a property update to the next properties message of a thing.
+ *
+ * This function collects a property update instead of publishing it
+ * right away. Updates of the same thing are merged into a single
+ * message published to the properties of the thing, see 
+ * EvrythngSetAggregation for when it is sent. If this update reaches 
+ * a threshold the message is published before the function returns.
+ *
+ * @param[in] handle        A context handle.
+ * @param[in] thng_id       A thing ID.
+ * @param[in] property_name The name of a property. 
+ * @param[in] property_json A JSON string which contains property value. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer, a too long string 
+ *                                 or property_json is not an array of objects \n
+ *            \b EVRYTHNG_PUBLISH_ERROR if an error occured trying to publish a message \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngAggregateThngProperty(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* property_name, 
+        const char* property_json);
+
+
+/** @brief Publish the collected property updates.
+ *
+ * This function publishes the property updates collected by
+ * EvrythngAggregateThngProperty without waiting for a threshold.
+ *
+ * @param[in] handle      A context handle.
+ * @param[in] thng_id     A thing ID, or a null pointer for all things.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if handle is a null pointer \n
+ *            \b EVRYTHNG_PUBLISH_ERROR if an error occured trying to publish a message \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngFlushThngProperties(
+        evrythng_handle_t handle, 
+        const char* thng_id);
+
+
 /** @brief Subscribe to a single action of the thing.
  *
  * This function attempts to subscribe to a single action of the thing.
@@ -944,4 +1475,735 @@ evrythng_return_t EvrythngPubActions(
         const char* actions_json);
 
 
+/** @brief Publish a single property to a given thing asynchronously.
+ *
+ * This function queues a publish of a single property to a given thing and returns
+ * immediately. The result is reported to the callback and through the ticket.
+ *
+ * @param[in] handle        A context handle.
+ * @param[in] thng_id       A thing ID.
+ * @param[in] property_name The name of the property.
+ * @param[in] property_json A JSON string which contains property value.
+ * @param[in] callback      A completion callback, may be a null pointer.
+ * @param[in] userdata      A pointer passed to the completion callback.
+ * @param[out] ticket       A ticket to poll with EvrythngTicketStatus, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_QUEUE_FULL if the operations queue is full \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS if the publish was queued \n
+ */
+evrythng_return_t EvrythngPubThngPropertyAsync(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* property_name, 
+        const char* property_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket);
+
+
+/** @brief Publish a few properties to a given thing asynchronously.
+ *
+ * This function queues a publish of a few properties to a given thing and returns
+ * immediately. The result is reported to the callback and through the ticket.
+ *
+ * @param[in] handle          A context handle.
+ * @param[in] thng_id         A thing ID.
+ * @param[in] properties_json A JSON string which contains properties values.
+ * @param[in] callback        A completion callback, may be a null pointer.
+ * @param[in] userdata        A pointer passed to the completion callback.
+ * @param[out] ticket         A ticket to poll with EvrythngTicketStatus, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_QUEUE_FULL if the operations queue is full \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS if the publish was queued \n
+ */
+evrythng_return_t EvrythngPubThngPropertiesAsync(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* properties_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket);
+
+
+/** @brief Publish a single action to a given thing asynchronously.
+ *
+ * This function queues a publish of a single action to a given thing and returns
+ * immediately. The result is reported to the callback and through the ticket.
+ *
+ * @param[in] handle      A context handle.
+ * @param[in] thng_id     A thing ID.
+ * @param[in] action_name The name of an action.
+ * @param[in] action_json A JSON string which contains an action.
+ * @param[in] callback    A completion callback, may be a null pointer.
+ * @param[in] userdata    A pointer passed to the completion callback.
+ * @param[out] ticket     A ticket to poll with EvrythngTicketStatus, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_QUEUE_FULL if the operations queue is full \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS if the publish was queued \n
+ */
+evrythng_return_t EvrythngPubThngActionAsync(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* action_name, 
+        const char* action_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket);
+
+
+/** @brief Publish a few actions to a given thing asynchronously.
+ *
+ * This function queues a publish of a few actions to a given thing and returns
+ * immediately. The result is reported to the callback and through the ticket.
+ *
+ * @param[in] handle       A context handle.
+ * @param[in] thng_id      A thing ID.
+ * @param[in] actions_json A JSON string which contains actions.
+ * @param[in] callback     A completion callback, may be a null pointer.
+ * @param[in] userdata     A pointer passed to the completion callback.
+ * @param[out] ticket      A ticket to poll with EvrythngTicketStatus, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_QUEUE_FULL if the operations queue is full \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS if the publish was queued \n
+ */
+evrythng_return_t EvrythngPubThngActionsAsync(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* actions_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket);
+
+
+/** @brief Publish a location to a given thing asynchronously.
+ *
+ * This function queues a publish of a location to a given thing and returns
+ * immediately. The result is reported to the callback and through the ticket.
+ *
+ * @param[in] handle        A context handle.
+ * @param[in] thng_id       A thing ID.
+ * @param[in] location_json A JSON string which contains location.
+ * @param[in] callback      A completion callback, may be a null pointer.
+ * @param[in] userdata      A pointer passed to the completion callback.
+ * @param[out] ticket       A ticket to poll with EvrythngTicketStatus, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_QUEUE_FULL if the operations queue is full \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS if the publish was queued \n
+ */
+evrythng_return_t EvrythngPubThngLocationAsync(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* location_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket);
+
+
+/** @brief Publish a single property to a given product asynchronously.
+ *
+ * This function queues a publish of a single property to a given product and returns
+ * immediately. The result is reported to the callback and through the ticket.
+ *
+ * @param[in] handle        A context handle.
+ * @param[in] product_id    A product ID.
+ * @param[in] property_name The name of the property.
+ * @param[in] property_json A JSON string which contains property value.
+ * @param[in] callback      A completion callback, may be a null pointer.
+ * @param[in] userdata      A pointer passed to the completion callback.
+ * @param[out] ticket       A ticket to poll with EvrythngTicketStatus, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_QUEUE_FULL if the operations queue is full \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS if the publish was queued \n
+ */
+evrythng_return_t EvrythngPubProductPropertyAsync(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* property_name, 
+        const char* property_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket);
+
+
+/** @brief Publish a few properties to a given product asynchronously.
+ *
+ * This function queues a publish of a few properties to a given product and returns
+ * immediately. The result is reported to the callback and through the ticket.
+ *
+ * @param[in] handle          A context handle.
+ * @param[in] product_id      A product ID.
+ * @param[in] properties_json A JSON string which contains properties values.
+ * @param[in] callback        A completion callback, may be a null pointer.
+ * @param[in] userdata        A pointer passed to the completion callback.
+ * @param[out] ticket         A ticket to poll with EvrythngTicketStatus, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_QUEUE_FULL if the operations queue is full \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS if the publish was queued \n
+ */
+evrythng_return_t EvrythngPubProductPropertiesAsync(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* properties_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket);
+
+
+/** @brief Publish a single action to a given product asynchronously.
+ *
+ * This function queues a publish of a single action to a given product and returns
+ * immediately. The result is reported to the callback and through the ticket.
+ *
+ * @param[in] handle      A context handle.
+ * @param[in] product_id  A product ID.
+ * @param[in] action_name The name of an action.
+ * @param[in] action_json A JSON string which contains an action.
+ * @param[in] callback    A completion callback, may be a null pointer.
+ * @param[in] userdata    A pointer passed to the completion callback.
+ * @param[out] ticket     A ticket to poll with EvrythngTicketStatus, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_QUEUE_FULL if the operations queue is full \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS if the publish was queued \n
+ */
+evrythng_return_t EvrythngPubProductActionAsync(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* action_name, 
+        const char* action_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket);
+
+
+/** @brief Publish a few actions to a given product asynchronously.
+ *
+ * This function queues a publish of a few actions to a given product and returns
+ * immediately. The result is reported to the callback and through the ticket.
+ *
+ * @param[in] handle       A context handle.
+ * @param[in] product_id   A product ID.
+ * @param[in] actions_json A JSON string which contains actions.
+ * @param[in] callback     A completion callback, may be a null pointer.
+ * @param[in] userdata     A pointer passed to the completion callback.
+ * @param[out] ticket      A ticket to poll with EvrythngTicketStatus, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_QUEUE_FULL if the operations queue is full \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS if the publish was queued \n
+ */
+evrythng_return_t EvrythngPubProductActionsAsync(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* actions_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket);
+
+
+/** @brief Publish a single action asynchronously.
+ *
+ * This function queues a publish of a single action and returns
+ * immediately. The result is reported to the callback and through the ticket.
+ *
+ * @param[in] handle      A context handle.
+ * @param[in] action_name The name of an action.
+ * @param[in] action_json A JSON string which contains an action.
+ * @param[in] callback    A completion callback, may be a null pointer.
+ * @param[in] userdata    A pointer passed to the completion callback.
+ * @param[out] ticket     A ticket to poll with EvrythngTicketStatus, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_QUEUE_FULL if the operations queue is full \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS if the publish was queued \n
+ */
+evrythng_return_t EvrythngPubActionAsync(
+        evrythng_handle_t handle, 
+        const char* action_name, 
+        const char* action_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket);
+
+
+/** @brief Publish a few actions asynchronously.
+ *
+ * This function queues a publish of a few actions and returns
+ * immediately. The result is reported to the callback and through the ticket.
+ *
+ * @param[in] handle       A context handle.
+ * @param[in] actions_json A JSON string which contains actions.
+ * @param[in] callback     A completion callback, may be a null pointer.
+ * @param[in] userdata     A pointer passed to the completion callback.
+ * @param[out] ticket      A ticket to poll with EvrythngTicketStatus, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_QUEUE_FULL if the operations queue is full \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS if the publish was queued \n
+ */
+evrythng_return_t EvrythngPubActionsAsync(
+        evrythng_handle_t handle, 
+        const char* actions_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket);
+
+
+/** @brief Get the status of an asynchronous publish.
+ *
+ * @param[in] ticket A ticket returned by one of the asynchronous publish functions.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if ticket is a null pointer \n
+ *            \b EVRYTHNG_IN_PROGRESS if the publish is not complete yet \n
+ *            the result of the publish otherwise, as returned by the blocking variant \n
+ */
+evrythng_return_t EvrythngTicketStatus(evrythng_ticket_t ticket);
+
+
+/** @brief Release an asynchronous publish ticket.
+ *
+ * Every ticket returned by the library must be released, whether the publish
+ * is complete or not. Release all tickets before destroying the handle.
+ *
+ * @param[in] ticket A ticket returned by one of the asynchronous publish functions.
+ *
+ * @return void
+ */
+void EvrythngTicketRelease(evrythng_ticket_t ticket);
+
+
+/** @brief Prepare the topic of a single property of the thing.
+ *
+ * This function formats the topic of a property once, so that values 
+ * published with EvrythngPubPrepared or EvrythngPubPreparedAsync skip 
+ * building the topic on every call.
+ *
+ * @param[in] handle        A context handle.
+ * @param[in] thng_id       A thing ID.
+ * @param[in] property_name The name of a property. 
+ * @param[out] topic        The prepared topic, release it with EvrythngTopicRelease.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngPrepareThngProperty(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* property_name, 
+        evrythng_topic_t* topic);
+
+
+/** @brief Prepare the topic of a single property of the product.
+ *
+ * This function formats the topic of a property once, so that values 
+ * published with EvrythngPubPrepared or EvrythngPubPreparedAsync skip 
+ * building the topic on every call.
+ *
+ * @param[in] handle        A context handle.
+ * @param[in] product_id    A product ID.
+ * @param[in] property_name The name of a property. 
+ * @param[out] topic        The prepared topic, release it with EvrythngTopicRelease.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngPrepareProductProperty(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* property_name, 
+        evrythng_topic_t* topic);
+
+
+/** @brief Publish to a prepared topic.
+ *
+ * This function attempts to publish a value to a topic prepared by one
+ * of the EvrythngPrepare functions.
+ *
+ * @param[in] handle        A context handle.
+ * @param[in] topic         A prepared topic.
+ * @param[in] property_json A JSON string which contains property value. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer \n
+ *            \b EVRYTHNG_PUBLISH_ERROR if an error occured trying to publish a message \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngPubPrepared(
+        evrythng_handle_t handle, 
+        evrythng_topic_t topic, 
+        const char* property_json);
+
+
+/** @brief Publish to a prepared topic asynchronously.
+ *
+ * This function queues a publish to a topic prepared by one of the
+ * EvrythngPrepare functions and returns immediately. The result is 
+ * reported to the callback and through the ticket. The topic may be
+ * released before the publish is complete.
+ *
+ * @param[in] handle        A context handle.
+ * @param[in] topic         A prepared topic.
+ * @param[in] property_json A JSON string which contains property value. 
+ * @param[in] callback      A completion callback, may be a null pointer.
+ * @param[in] userdata      A pointer passed to the completion callback.
+ * @param[out] ticket       A ticket to poll with EvrythngTicketStatus, may be a null pointer.
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer \n
+ *            \b EVRYTHNG_QUEUE_FULL if the operations queue is full \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS if the publish was queued \n
+ */
+evrythng_return_t EvrythngPubPreparedAsync(
+        evrythng_handle_t handle, 
+        evrythng_topic_t topic, 
+        const char* property_json,
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket);
+
+
+/** @brief Release a prepared topic.
+ *
+ * @param[in] topic A topic returned by one of the EvrythngPrepare functions.
+ *
+ * @return void
+ */
+void EvrythngTopicRelease(evrythng_topic_t topic);
+
+
+/** @brief Subscribe to a single property of the thing, receiving large messages in chunks.
+ *
+ * This function attempts to subscribe to a single property of the thing.
+ * Messages too large for the internal read buffer are passed to
+ * chunk_callback piece by piece instead of being dropped.
+ *  
+ * @param[in] handle        A context handle.
+ * @param[in] thng_id       A thing ID.
+ * @param[in] property_name The name of the property. 
+ * @param[in] pub_states    The pubStates flag. 
+ * @param[in] callback      A pointer to a subscribe callback function. 
+ * @param[in] chunk_callback A pointer to a chunked subscribe callback function. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_SUBSCRIPTION_ERROR if an error occured trying to subscribe to a topic \n
+ *            \b EVRYTHNG_ALREADY_SUBSCRIBED if subcribtion already exists \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngSubThngPropertyChunked(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* property_name, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback);
+
+
+/** @brief Subscribe to all properties of the thing, receiving large messages in chunks.
+ * 
+ * This function subscribes to all properties of the thing.
+ * Messages too large for the internal read buffer are passed to
+ * chunk_callback piece by piece instead of being dropped.
+ *
+ * @param[in] handle   A context handle.
+ * @param[in] thng_id  A thing ID. 
+ * @param[in] pub_states    The pubStates flag. 
+ * @param[in] callback A pointer to a subscribe callback function. 
+ * @param[in] chunk_callback A pointer to a chunked subscribe callback function. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_SUBSCRIPTION_ERROR if an error occured trying to subscribe to a topic \n
+ *            \b EVRYTHNG_ALREADY_SUBSCRIBED if subcribtion already exists \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngSubThngPropertiesChunked(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback);
+
+
+/** @brief Subscribe to a single action of the thing, receiving large messages in chunks.
+ *
+ * This function attempts to subscribe to a single action of the thing.
+ * Messages too large for the internal read buffer are passed to
+ * chunk_callback piece by piece instead of being dropped.
+ *
+ * @param[in] handle      A context handle.
+ * @param[in] thng_id     A thing ID.
+ * @param[in] action_name The name of an action. 
+ * @param[in] pub_states    The pubStates flag. 
+ * @param[in] callback    A pointer to a subscribe callback function. 
+ * @param[in] chunk_callback A pointer to a chunked subscribe callback function. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_SUBSCRIPTION_ERROR if an error occured trying to subscribe to a topic \n
+ *            \b EVRYTHNG_ALREADY_SUBSCRIBED if subcribtion already exists \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngSubThngActionChunked(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* action_name, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback);
+
+
+/** @brief Subscribe to all actions of the thing, receiving large messages in chunks.
+ *
+ * This function attempts to subscribe to all actions of the thing.
+ * Messages too large for the internal read buffer are passed to
+ * chunk_callback piece by piece instead of being dropped.
+ *
+ * @param[in] handle   A context handle.
+ * @param[in] thng_id  A thing ID. 
+ * @param[in] pub_states The pubStates flag. 
+ * @param[in] callback A pointer to a subscribe callback function. 
+ * @param[in] chunk_callback A pointer to a chunked subscribe callback function. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_SUBSCRIPTION_ERROR if an error occured trying to subscribe to a topic \n
+ *            \b EVRYTHNG_ALREADY_SUBSCRIBED if subcribtion already exists \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngSubThngActionsChunked(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback);
+
+
+/** @brief Subscribe to a location of the thing, receiving large messages in chunks.
+ *
+ * This function attempts to subscribe to a location of the thing.
+ * Messages too large for the internal read buffer are passed to
+ * chunk_callback piece by piece instead of being dropped.
+ *
+ * @param[in] handle   A context handle.
+ * @param[in] thng_id  A thing ID. 
+ * @param[in] pub_states    The pubStates flag. 
+ * @param[in] callback A pointer to a subscribe callback function. 
+ * @param[in] chunk_callback A pointer to a chunked subscribe callback function. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_SUBSCRIPTION_ERROR if an error occured trying to subscribe to a topic \n
+ *            \b EVRYTHNG_ALREADY_SUBSCRIBED if subcribtion already exists \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngSubThngLocationChunked(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback);
+
+
+/** @brief Subscribe to a single property of the product, receiving large messages in chunks.
+ *
+ * This function attempts to subscribe to a single property of the product.
+ * Messages too large for the internal read buffer are passed to
+ * chunk_callback piece by piece instead of being dropped.
+ *
+ * @param[in] handle        A context handle.
+ * @param[in] product_id    A product ID.
+ * @param[in] property_name The name of the property. 
+ * @param[in] pub_states    The pubStates flag. 
+ * @param[in] callback      A pointer to a subscribe callback function. 
+ * @param[in] chunk_callback A pointer to a chunked subscribe callback function. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_SUBSCRIPTION_ERROR if an error occured trying to subscribe to a topic \n
+ *            \b EVRYTHNG_ALREADY_SUBSCRIBED if subcribtion already exists \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngSubProductPropertyChunked(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* property_name, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback);
+
+
+/** @brief Subscribe to all properties of the product, receiving large messages in chunks.
+ *
+ * This function attempts to subscribe to all properties of the product.
+ * Messages too large for the internal read buffer are passed to
+ * chunk_callback piece by piece instead of being dropped.
+ *
+ * @param[in] handle      A context handle.
+ * @param[in] product_id A product ID. 
+ * @param[in] pub_states    The pubStates flag. 
+ * @param[in] callback    A pointer to a subscribe callback function. 
+ * @param[in] chunk_callback A pointer to a chunked subscribe callback function. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_SUBSCRIPTION_ERROR if an error occured trying to subscribe to a topic \n
+ *            \b EVRYTHNG_ALREADY_SUBSCRIBED if subcribtion already exists \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngSubProductPropertiesChunked(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback);
+
+
+/** @brief Subscribe to a single action of the product, receiving large messages in chunks.
+ *
+ * This function attempts to subscribe to a single action of the product.
+ * Messages too large for the internal read buffer are passed to
+ * chunk_callback piece by piece instead of being dropped.
+ *
+ * @param[in] handle      A context handle.
+ * @param[in] product_id  A product ID.
+ * @param[in] action_name The name of an action. 
+ * @param[in] pub_states    The pubStates flag. 
+ * @param[in] callback    A pointer to a subscribe callback function. 
+ * @param[in] chunk_callback A pointer to a chunked subscribe callback function. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_SUBSCRIPTION_ERROR if an error occured trying to subscribe to a topic \n
+ *            \b EVRYTHNG_ALREADY_SUBSCRIBED if subcribtion already exists \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngSubProductActionChunked(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* action_name, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback);
+
+
+/** @brief Subscribe to all actions of the product, receiving large messages in chunks.
+ *
+ * This function attempts to subscribe to all actions of the product.
+ * Messages too large for the internal read buffer are passed to
+ * chunk_callback piece by piece instead of being dropped.
+ *
+ * @param[in] handle      A context handle.
+ * @param[in] product_id  A product ID. 
+ * @param[in] pub_states  A pubStates flag. 
+ * @param[in] callback    A pointer to a subscribe callback function. 
+ * @param[in] chunk_callback A pointer to a chunked subscribe callback function. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_SUBSCRIPTION_ERROR if an error occured trying to subscribe to a topic \n
+ *            \b EVRYTHNG_ALREADY_SUBSCRIBED if subcribtion already exists \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngSubProductActionsChunked(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback);
+
+
+/** @brief Subscribe to a single action, receiving large messages in chunks.
+ *
+ * This function attempts to subscribe to a single action.
+ * Messages too large for the internal read buffer are passed to
+ * chunk_callback piece by piece instead of being dropped.
+ *
+ * @param[in] handle      A context handle.
+ * @param[in] action_name The name of an action. 
+ * @param[in] pub_states  A pubStates flag. 
+ * @param[in] callback    A pointer to a subscribe callback function. 
+ * @param[in] chunk_callback A pointer to a chunked subscribe callback function. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_SUBSCRIPTION_ERROR if an error occured trying to subscribe to a topic \n
+ *            \b EVRYTHNG_ALREADY_SUBSCRIBED if subcribtion already exists \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngSubActionChunked(
+        evrythng_handle_t handle, 
+        const char* action_name, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback);
+
+
+/** @brief Subscribe to all actions, receiving large messages in chunks.
+ *
+ * This function attempts to subscribe to all actions.
+ * Messages too large for the internal read buffer are passed to
+ * chunk_callback piece by piece instead of being dropped.
+ *  
+ * @param[in] handle   A context handle.
+ * @param[in] pub_states A pubStates flag. 
+ * @param[in] callback A pointer to a subscribe callback function. 
+ * @param[in] chunk_callback A pointer to a chunked subscribe callback function. 
+ *
+ * @return    \b EVRYTHNG_BAD_ARGS if one the arguments is a null pointer or a too long string \n
+ *            \b EVRYTHNG_SUBSCRIPTION_ERROR if an error occured trying to subscribe to a topic \n
+ *            \b EVRYTHNG_ALREADY_SUBSCRIBED if subcribtion already exists \n
+ *            \b EVRYTHNG_MEMORY_ERROR if memory allocation error occured \n
+ *            \b EVRYTHNG_NOT_CONNECTED if internal context is not in connected state \n
+ *            \b EVRYTHNG_SUCCESS on success \n
+ */
+evrythng_return_t EvrythngSubActionsChunked(
+        evrythng_handle_t handle, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback);
+
+
 #endif //_EVRYTHNG_H
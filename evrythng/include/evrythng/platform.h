@@ -17,6 +17,20 @@ enum returnCode
     MQTT_SUCCESS = 0 
 };
 
+/* One of the buffers written by platform_network_writev */
+typedef struct NetworkBuffer
+{
+    unsigned char* data;
+    int len;
+} NetworkBuffer;
+
+/* platform_network_wait result flags, 0 means the wait timed out */
+enum waitResult
+{
+    WAIT_NETWORK = 1,
+    WAIT_NOTIFIED = 2
+};
+
 void platform_timer_init(Timer*);
 void platform_timer_deinit(Timer*);
 char platform_timer_isexpired(Timer*);
@@ -25,11 +39,67 @@ int  platform_timer_left(Timer*);
 
 void platform_network_init(Network*);
 void platform_network_securedinit(Network*, const char* ca_buf, size_t ca_size);
+
+/* Returns the CA chain parsed from ca_buf with a reference taken, or 0 on error.
+ * Ports keep one parsed store per buffer for the whole process, shared by the
+ * connections of every handle, and free it once the last reference is put. */
+void* platform_tls_ca_get(const char* ca_buf, size_t ca_size);
+void  platform_tls_ca_put(void* ca);
+
+/* Sets up a TLS connection verified against a store from platform_tls_ca_get.
+ * *session is kept by the caller from one connection to the next: if set, the 
+ * handshake offers it for resumption, with a full handshake if the server does
+ * not accept it, and once connected it is replaced by the session to offer next.
+ * platform_network_resumed returns 1 if the last handshake resumed a session. */
+void  platform_network_tlsinit(Network*, void* ca, void** session);
+int   platform_network_resumed(Network*);
+void  platform_tls_session_free(void* session);
 int  platform_network_connect(Network*, char*, int);
+
+/* Connects giving up after timeout_ms. Ports should keep resolved addresses
+ * for a while and, for hosts with several addresses, race the attempts with 
+ * non-blocking sockets rather than wait for each in turn. Returns 0 on success. */
+int  platform_network_connect_timeout(Network*, char*, int, int timeout_ms);
 void platform_network_disconnect(Network*);
 int  platform_network_read(Network*, unsigned char*, int, int);
+
+/* Reads whatever is available up to len bytes, waiting up to timeout_ms for
+ * the first byte only. Returns the number of bytes read, 0 if the peer closed
+ * the connection or negative on timeout or error. */
+int  platform_network_recv(Network*, unsigned char*, int len, int timeout_ms);
 int  platform_network_write(Network*, unsigned char*, int, int);
 
+/* Writes the buffers back to back, as writev() does. Returns the number of 
+ * bytes written, which may be less than the total, or negative on error. */
+int  platform_network_writev(Network*, const NetworkBuffer*, int count, int timeout_ms);
+
+/* Blocks until the network has data to read (including data already buffered
+ * by a TLS layer), the notifier is posted or timeout_ms expires. A network that
+ * is not connected is ignored. Consumes pending notifications.
+ * Returns a combination of waitResult flags, 0 on timeout or negative on error. */
+int  platform_network_wait(Network*, Notifier*, int timeout_ms);
+
+void platform_notifier_init(Notifier*);
+void platform_notifier_deinit(Notifier*);
+int  platform_notifier_post(Notifier*);
+
+/* A set of networks waited on together, used by a reactor to drive many
+ * connections from one thread. */
+void platform_poller_init(Poller*);
+void platform_poller_deinit(Poller*);
+
+/* Adds a connected network, data is returned by platform_poller_wait when 
+ * the network has data to read. Returns 0 or negative on error. */
+int  platform_poller_add(Poller*, Network*, void* data);
+void platform_poller_remove(Poller*, Network*);
+
+/* Blocks until networks of the poller have data to read, the notifier is 
+ * posted or timeout_ms expires. Consumes pending notifications. Stores the 
+ * data of up to max readable networks in ready.
+ * Returns the number of readable networks, 0 on timeout or when notified 
+ * or negative on error. */
+int  platform_poller_wait(Poller*, Notifier*, void** ready, int max, int timeout_ms);
+
 void platform_mutex_init(Mutex*);
 void platform_mutex_deinit(Mutex*);
 int  platform_mutex_lock(Mutex*);
@@ -55,6 +125,16 @@ void* platform_malloc(size_t bytes);
 void* platform_realloc(void* ptr, size_t bytes);
 void  platform_free(void* memory);
 
+/* Maps a file of size bytes into memory, creating it or extending it with
+ * zeroes if needed. Changes to the memory are written to the file. 
+ * Returns the mapped memory or 0 on error. */
+void* platform_file_map(const char* path, size_t size);
+void  platform_file_unmap(void* map, size_t size);
+
+/* Writes a range of mapped memory to its file and waits for it to be stored,
+ * the range need not be page aligned. Returns 0 or negative on error. */
+int   platform_file_sync(void* addr, size_t len);
+
 void platform_sleep(int ms);
 
 int platform_rand();
@@ -12,9 +12,20 @@ evrythng_return_t evrythng_subscribe( evrythng_handle_t handle, const char* enti
         const char* entity_id, const char* data_type, const char* data_name, 
         int pub_states, sub_callback *callback);
 
+evrythng_return_t evrythng_subscribe_chunked( evrythng_handle_t handle, const char* entity, 
+        const char* entity_id, const char* data_type, const char* data_name, 
+        int pub_states, sub_callback *callback, sub_chunk_callback *chunk_callback);
+
 evrythng_return_t evrythng_unsubscribe( evrythng_handle_t handle, const char* entity, 
         const char* entity_id, const char* data_type, const char* data_name);
 
+evrythng_return_t evrythng_publish_async( evrythng_handle_t handle, const char* entity, 
+        const char* entity_id, const char* data_type, const char* data_name, const char* property_json,
+        evrythng_pub_callback callback, void* userdata, evrythng_ticket_t* ticket);
+
+evrythng_return_t evrythng_prepare_topic( evrythng_handle_t handle, const char* entity, 
+        const char* entity_id, const char* data_type, const char* data_name, evrythng_topic_t* topic);
+
 evrythng_return_t EvrythngPubThngProperty(
         evrythng_handle_t handle, 
         const char* thng_id, 
@@ -411,3 +422,349 @@ evrythng_return_t EvrythngPubActions(
     return evrythng_publish(handle, "actions", NULL, NULL, "all", actions_json);
 }
 
+
+evrythng_return_t EvrythngPubThngPropertyAsync(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* property_name, 
+        const char* property_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!thng_id || !property_name || !property_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_publish_async(handle, "thngs", thng_id, "properties", property_name, property_json, callback, userdata, ticket);
+}
+
+
+evrythng_return_t EvrythngPubThngPropertiesAsync(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* properties_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!thng_id || !properties_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_publish_async(handle, "thngs", thng_id, "properties", NULL, properties_json, callback, userdata, ticket);
+}
+
+
+evrythng_return_t EvrythngPubThngActionAsync(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* action_name, 
+        const char* action_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!thng_id || !action_name || !action_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_publish_async(handle, "thngs", thng_id, "actions", action_name, action_json, callback, userdata, ticket);
+}
+
+
+evrythng_return_t EvrythngPubThngActionsAsync(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* actions_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!thng_id || !actions_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_publish_async(handle, "thngs", thng_id, "actions", "all", actions_json, callback, userdata, ticket);
+}
+
+
+evrythng_return_t EvrythngPubThngLocationAsync(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* location_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!thng_id || !location_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_publish_async(handle, "thngs", thng_id, "location", NULL, location_json, callback, userdata, ticket);
+}
+
+
+evrythng_return_t EvrythngPubProductPropertyAsync(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* property_name, 
+        const char* property_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!product_id || !property_name || !property_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_publish_async(handle, "products", product_id, "properties", property_name, property_json, callback, userdata, ticket);
+}
+
+
+evrythng_return_t EvrythngPubProductPropertiesAsync(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* properties_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!product_id || !properties_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_publish_async(handle, "products", product_id, "properties", NULL, properties_json, callback, userdata, ticket);
+}
+
+
+evrythng_return_t EvrythngPubProductActionAsync(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* action_name, 
+        const char* action_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!product_id || !action_name || !action_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_publish_async(handle, "products", product_id, "actions", action_name, action_json, callback, userdata, ticket);
+}
+
+
+evrythng_return_t EvrythngPubProductActionsAsync(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* actions_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!product_id || !actions_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_publish_async(handle, "products", product_id, "actions", "all", actions_json, callback, userdata, ticket);
+}
+
+
+evrythng_return_t EvrythngPubActionAsync(
+        evrythng_handle_t handle, 
+        const char* action_name, 
+        const char* action_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!action_name || !action_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_publish_async(handle, "actions", NULL, NULL, action_name, action_json, callback, userdata, ticket);
+}
+
+
+evrythng_return_t EvrythngPubActionsAsync(
+        evrythng_handle_t handle, 
+        const char* actions_json, 
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!actions_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_publish_async(handle, "actions", NULL, NULL, "all", actions_json, callback, userdata, ticket);
+}
+
+
+evrythng_return_t EvrythngSubThngPropertyChunked(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* property_name, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback)
+{
+    if (!thng_id || !property_name || !callback || !chunk_callback)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_subscribe_chunked(handle, "thngs", thng_id, "properties", property_name, pub_states, callback, chunk_callback);
+}
+
+
+evrythng_return_t EvrythngSubThngPropertiesChunked(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback)
+{
+    if (!thng_id || !callback || !chunk_callback)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_subscribe_chunked(handle, "thngs", thng_id, "properties", NULL, pub_states, callback, chunk_callback);
+}
+
+
+evrythng_return_t EvrythngSubThngActionChunked(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* action_name, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback)
+{
+    if (!thng_id || !action_name || !callback || !chunk_callback)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_subscribe_chunked(handle, "thngs", thng_id, "actions", action_name, pub_states, callback, chunk_callback);
+}
+
+
+evrythng_return_t EvrythngSubThngActionsChunked(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback)
+{
+    if (!thng_id || !callback || !chunk_callback)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_subscribe_chunked(handle, "thngs", thng_id, "actions", "all", pub_states, callback, chunk_callback);
+}
+
+
+evrythng_return_t EvrythngSubThngLocationChunked(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback)
+{
+    if (!thng_id || !callback || !chunk_callback)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_subscribe_chunked(handle, "thngs", thng_id, "location", NULL, pub_states, callback, chunk_callback);
+}
+
+
+evrythng_return_t EvrythngSubProductPropertyChunked(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* property_name, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback)
+{
+    if (!product_id || !property_name || !callback || !chunk_callback)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_subscribe_chunked(handle, "products", product_id, "properties", property_name, pub_states, callback, chunk_callback);
+}
+
+
+evrythng_return_t EvrythngSubProductPropertiesChunked(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback)
+{
+    if (!product_id || !callback || !chunk_callback)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_subscribe_chunked(handle, "products", product_id, "properties", NULL, pub_states, callback, chunk_callback);
+}
+
+
+evrythng_return_t EvrythngSubProductActionChunked(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* action_name, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback)
+{
+    if (!product_id || !action_name || !callback || !chunk_callback)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_subscribe_chunked(handle, "products", product_id, "actions", action_name, pub_states, callback, chunk_callback);
+}
+
+
+evrythng_return_t EvrythngSubProductActionsChunked(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback)
+{
+    if (!product_id || !callback || !chunk_callback)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_subscribe_chunked(handle, "products", product_id, "actions", "all", pub_states, callback, chunk_callback);
+}
+
+
+evrythng_return_t EvrythngSubActionChunked(
+        evrythng_handle_t handle, 
+        const char* action_name, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback)
+{
+    if (!action_name || !callback || !chunk_callback)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_subscribe_chunked(handle, "actions", NULL, NULL, action_name, pub_states, callback, chunk_callback);
+}
+
+
+evrythng_return_t EvrythngSubActionsChunked(evrythng_handle_t handle, int pub_states, sub_callback *callback, sub_chunk_callback *chunk_callback)
+{
+    if (!callback || !chunk_callback)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_subscribe_chunked(handle, "actions", NULL, NULL, "all", pub_states, callback, chunk_callback);
+}
+
+
+evrythng_return_t EvrythngPrepareThngProperty(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* property_name, 
+        evrythng_topic_t* topic)
+{
+    if (!thng_id || !property_name)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_prepare_topic(handle, "thngs", thng_id, "properties", property_name, topic);
+}
+
+
+evrythng_return_t EvrythngPrepareProductProperty(
+        evrythng_handle_t handle, 
+        const char* product_id, 
+        const char* property_name, 
+        evrythng_topic_t* topic)
+{
+    if (!product_id || !property_name)
+        return EVRYTHNG_BAD_ARGS;
+
+    return evrythng_prepare_topic(handle, "products", product_id, "properties", property_name, topic);
+}
@@ -11,34 +11,193 @@
 #include "evrythng/evrythng.h"
 #include "evrythng/platform.h"
 #include "evrythng_tls_certificate.h"
+#include "evrythng_spool.h"
 
 #define TOPIC_MAX_LEN 128
 #define USERNAME "authorization"
 
 static void mqtt_thread(void* arg);
+static void reactor_thread(void* arg);
+static void reactor_worker(void* arg);
 static void message_callback(MessageData* data, void* userdata);
-static evrythng_return_t evrythng_connect_internal(evrythng_handle_t handle);
+static void message_chunk_callback(MessageData* data, size_t offset, unsigned char* chunk, size_t chunk_len, void* userdata);
+static evrythng_return_t evrythng_connect_internal(evrythng_handle_t handle, int attempts);
 static evrythng_return_t evrythng_disconnect_internal(evrythng_handle_t handle, int gracefull);
+static int op_queue_flush(evrythng_handle_t handle, evrythng_return_t result);
 
 typedef struct sub_callback_t {
     char*                   topic;
+    size_t                  filter_len;     /* length of topic without the pubStates query */
     int                     qos;
     sub_callback*           callback;
+    sub_chunk_callback*     chunk_callback;
     struct sub_callback_t*  next;
 } sub_callback_t;
 
 
+/* A level of the subscription trie. Children named after the next topic 
+ * level are sorted for a binary search, the "+" and "#" children are kept
+ * aside. Finding the subscription of a topic thus takes a few searches per
+ * topic level, whatever the number of subscriptions. */
+typedef struct sub_node_t {
+    const char*         level;
+    size_t              level_len;
+    struct sub_node_t** children;
+    int                 nchildren;
+    int                 capacity;
+    struct sub_node_t*  plus;
+    struct sub_node_t*  hash;
+    sub_callback_t*     sub;
+} sub_node_t;
+
+static void sub_trie_clear(sub_node_t* node);
+
+
 enum { MQTT_NOP, MQTT_CONNECT, MQTT_DISCONNECT, MQTT_PUBLISH, MQTT_SUBSCRIBE, MQTT_UNSUBSCRIBE };
+enum { OP_QUEUED, OP_RUNNING, OP_DONE };
 typedef struct mqtt_op 
 {
     int op;
     const char* topic;
+    int topic_len;          /* length of topic if it is known, 0 otherwise */
     MQTTMessage* message;
     sub_callback* callback;
+    sub_chunk_callback* chunk_callback;
     evrythng_return_t result;
+    int state;
+    int slot;
+    Semaphore done_sem;
+    struct evrythng_ticket_t* ticket;
+    evrythng_handle_t handle;
 } mqtt_op;
 
 
+/* An asynchronous publish. It owns copies of the topic and the payload 
+ * and is freed when both the library and the application have dropped 
+ * their references. */
+struct evrythng_ticket_t {
+    mqtt_op             op;
+    MQTTMessage         message;
+    evrythng_handle_t   handle;
+    evrythng_pub_callback callback;
+    void*               userdata;
+    int                 refs;
+    char                topic[TOPIC_MAX_LEN];
+};
+
+
+/* A publish topic formatted once, see EvrythngPrepareThngProperty. */
+struct evrythng_topic_t {
+    int     len;
+    char*   name;
+    int     connection; /* of the handle, see connection_for */
+};
+
+
+#define OP_QUEUE_DEFAULT_DEPTH 32
+#define OP_QUEUE_BATCH_MAX 16
+
+#define MAX_INFLIGHT_DEFAULT 8
+
+/* upper bound for mqtt_thread to sleep when there is nothing to do */
+#define IDLE_WAIT_MAX_MS 60000
+
+#define MQTT_BUFFER_SIZE 1024
+
+/* the calls wait for the cloud as long as a keepalive interval */
+#define KEEPALIVE_DEFAULT_S 60
+
+#define RECONNECT_MIN_DEFAULT_MS 300
+#define RECONNECT_MAX_DEFAULT_MS 30000
+#define CONNECT_TIMEOUT_DEFAULT_MS 10000
+
+#define REACTOR_STACKSIZE 8192
+#define REACTOR_EVENTS_MAX 64
+/* handle timers are checked at most this often by a reactor thread */
+#define REACTOR_TIMER_SLACK_MS 10
+
+/* spooled publishes sent before waiting for an acknowledgement */
+#define SPOOL_REPLAY_WINDOW 8
+
+#define AGGR_WINDOW_DEFAULT_MS 100
+#define AGGR_MAX_COUNT_DEFAULT 32
+#define AGGR_MAX_BYTES_DEFAULT 4096
+
+#define CONNECTIONS_MAX 16
+
+/* Property updates of a thing waiting to be published as one message.
+ * Entries stay in the list once flushed and are freed with the handle. */
+typedef struct aggr_thng_t {
+    char*   thng_id;
+    char*   buf;        /* the message so far, without the closing bracket */
+    int     len;
+    int     size;
+    int     count;
+    Timer   deadline;
+    struct aggr_thng_t* next;
+} aggr_thng_t;
+
+/* A publish replayed from the spool. It references the record, which
+ * stays in the spool until the slots before it are done. */
+enum { SLOT_PENDING, SLOT_OK, SLOT_FAILED };
+typedef struct spool_slot_t {
+    MQTTMessage         message;
+    int                 state;
+    struct evrythng_ctx_t* handle;
+} spool_slot_t;
+
+/* Bounded multi-producer / single-consumer ring of pending operations.
+ * Producers are application threads, the consumer is mqtt_thread. Slots
+ * hold pointers to ops living on the producers' stacks; a slot is set to
+ * zero when its producer gives up waiting before the op was taken. */
+typedef struct mqtt_op_queue
+{
+    mqtt_op**   ops;
+    int         depth;
+    int         head;
+    int         count;
+    int         space_waiters;  /* producers waiting on space_sem */
+    int         space_posts;    /* posts of space_sem not taken by a waiter yet */
+    Mutex       mtx;
+    Notifier    ready;
+    Semaphore   space_sem;
+} mqtt_op_queue;
+
+
+/* A reactor thread and the handles it drives. The handles share its
+ * serialize and read buffers, they are only used by the thread. Steps which
+ * block on the network are run by the worker with its own buffers, see 
+ * reactor_offload. */
+typedef struct reactor_shard_t
+{
+    Thread      thread;
+    Thread      worker;
+    int         stop;
+    int         count;      /* handles assigned, guarded by the reactor mutex */
+    Poller      poller;
+    Notifier    wake;
+    Mutex       mtx;
+    struct evrythng_ctx_t* woken;   /* handles with work, guarded by mtx */
+    struct evrythng_ctx_t* handles; /* handles attached, used by the thread only */
+    struct evrythng_ctx_t* work;    /* handles offloaded to the worker, guarded by mtx */
+    struct evrythng_ctx_t* work_last;
+    Semaphore   work_sem;
+    Timer       timer;      /* when handle timers are due */
+    int         timer_set;
+    unsigned char serialize_buffer[MQTT_BUFFER_SIZE];
+    unsigned char read_buffer[MQTT_BUFFER_SIZE];
+    unsigned char worker_serialize_buffer[MQTT_BUFFER_SIZE];
+    unsigned char worker_read_buffer[MQTT_BUFFER_SIZE];
+} reactor_shard_t;
+
+
+struct evrythng_reactor_t {
+    Mutex               mtx;
+    int                 nshards;
+    reactor_shard_t*    shards;
+};
+
+
 struct evrythng_ctx_t {
     char*   host;
     int     port;
@@ -46,6 +205,8 @@ struct evrythng_ctx_t {
     char*   key;
     const char* ca_buf;
     size_t  ca_size;
+    void*   tls_ca;         /* shared with the other handles */
+    void*   tls_session;    /* offered for resumption on reconnect */
     int     secure_connection;
     int     qos;
     int     initialized;
@@ -55,9 +216,41 @@ struct evrythng_ctx_t {
     int     mqtt_thread_stop;
     int     mqtt_thread_priority;
     int     mqtt_thread_stacksize;
-
-    unsigned char serialize_buffer[1024];
-    unsigned char read_buffer[1024];
+    int     mqtt_rc;
+
+    /* the serialize, read and receive buffers, only the receive 
+     * buffer is kept by handles driven by a reactor */
+    unsigned char* buffers;
+
+    evrythng_reactor_t reactor;
+    reactor_shard_t* shard;
+    struct evrythng_ctx_t* shard_next;  /* handles attached to the shard */
+    struct evrythng_ctx_t* shard_prev;
+    struct evrythng_ctx_t* woken_next;  /* handles woken, see handle_wake */
+    int     woken;
+    int     attached;
+    int     polled;     /* the network is in the shard poller */
+    int     offloaded;  /* the shard worker runs the handle, guarded by the shard mutex */
+    struct evrythng_ctx_t* work_next;
+    /* reconnection backoff, the state is guarded by the op queue mutex */
+    int     reconnect_min_ms;
+    int     reconnect_max_ms;
+    int     connect_timeout_ms;
+    int     reconnecting;
+    int     reconnect_attempt;
+    evrythng_return_t reconnect_error;
+    int     reconnect_mqtt_rc;
+    int     connect_network_ms;
+    int     connect_total_ms;
+    int     connect_resumed;
+    Timer   reconnect_timer;
+    Semaphore detached;
+
+    /* set while disconnecting with a deadline, see EvrythngDisconnectTimeout */
+    int     draining;
+    Timer   drain_deadline;
+    unsigned int drain_queued_dropped;
+    unsigned int drain_inflight_dropped;
 
     evrythng_log_callback log_callback;
 
@@ -69,12 +262,42 @@ struct evrythng_ctx_t {
     MQTTPacket_connectData  mqtt_conn_opts;
 
     sub_callback_t *sub_callbacks;
-
-    mqtt_op     next_op;
-    Mutex       async_op_mtx;
-    Mutex       next_op_mtx;
-    Semaphore   next_op_ready_sem;
-    Semaphore   next_op_result_sem;
+    sub_node_t  sub_trie;
+
+    mqtt_op_queue op_queue;
+
+    aggr_thng_t* aggr;
+    Mutex   aggr_mtx;
+    int     aggr_window_ms;
+    int     aggr_max_count;
+    int     aggr_max_bytes;
+
+    /* the packets of the ops run together are written at once, see EvrythngSetSendBatching */
+    unsigned char* cork_buffer;
+    int     cork_size;
+
+    /* messages are read into these, see EvrythngSetMessagePool */
+    MQTTBufferPool msg_pool;
+    unsigned char* msg_pool_mem;
+    int     msg_pool_count;
+
+    /* publishes kept while not connected, see spool_check and spool_replay */
+    spool_t spool;
+    Mutex   spool_mtx;
+    int     spool_rate;
+    int     spool_rate_sent;
+    Timer   spool_rate_timer;
+    unsigned int spool_replayed;
+    spool_slot_t spool_slots[SPOOL_REPLAY_WINDOW];  /* in replay order, guarded by spool_mtx */
+    int     spool_slot_head;
+    int     spool_slot_count;
+    int     spool_replay_failed;
+    char*   spool_path;
+
+    /* the other connections of the handle, which is the first one itself,
+     * see EvrythngSetConnections */
+    int     nconnections;
+    struct evrythng_ctx_t** connections;
 };
 
 
@@ -91,6 +314,61 @@ static void evrythng_log(evrythng_handle_t handle, evrythng_log_level_t level, c
 #define error(fmt, ...) evrythng_log(handle, EVRYTHNG_LOG_ERROR, fmt,  ##__VA_ARGS__);
 
 
+/* Lets the thread driving a handle know there is work for it. */
+static void handle_wake(evrythng_handle_t handle)
+{
+    reactor_shard_t* shard = handle->shard;
+
+    if (!shard)
+    {
+        if (handle->initialized)
+            platform_notifier_post(&handle->op_queue.ready);
+        return;
+    }
+
+    platform_mutex_lock(&shard->mtx);
+    if (!handle->woken)
+    {
+        handle->woken = 1;
+        handle->woken_next = shard->woken;
+        shard->woken = handle;
+    }
+    platform_mutex_unlock(&shard->mtx);
+
+    platform_notifier_post(&shard->wake);
+}
+
+
+/* The connection a thing, product or action goes through, so that the 
+ * messages of each are kept in order. */
+static int connection_index(evrythng_handle_t handle, const char* key)
+{
+    uint32_t h = 2166136261u;
+
+    if (handle->nconnections < 2 || !key)
+        return 0;
+
+    for (; *key; key++)
+    {
+        h ^= (unsigned char)*key;
+        h *= 16777619u;
+    }
+    return h % handle->nconnections;
+}
+
+
+static evrythng_handle_t connection_at(evrythng_handle_t handle, int index)
+{
+    return index > 0 && index < handle->nconnections ? handle->connections[index - 1] : handle;
+}
+
+
+static evrythng_handle_t connection_for(evrythng_handle_t handle, const char* entity_id, const char* data_name)
+{
+    return connection_at(handle, connection_index(handle, entity_id ? entity_id : data_name));
+}
+
+
 evrythng_return_t EvrythngInitHandle(evrythng_handle_t* handle)
 {
     if (!handle) 
@@ -105,7 +383,7 @@ evrythng_return_t EvrythngInitHandle(evrythng_handle_t* handle)
     memcpy(&(*handle)->mqtt_conn_opts, &(MQTTPacket_connectData)MQTTPacket_connectData_initializer, sizeof(MQTTPacket_connectData));
 
     (*handle)->mqtt_conn_opts.MQTTVersion = 3;
-    (*handle)->mqtt_conn_opts.keepAliveInterval = 60;
+    (*handle)->mqtt_conn_opts.keepAliveInterval = KEEPALIVE_DEFAULT_S;
     (*handle)->mqtt_conn_opts.cleansession = 1;
     (*handle)->mqtt_conn_opts.willFlag = 0;
     (*handle)->mqtt_conn_opts.username.cstring = USERNAME;
@@ -116,22 +394,60 @@ evrythng_return_t EvrythngInitHandle(evrythng_handle_t* handle)
 
     (*handle)->command_timeout_ms = (*handle)->mqtt_conn_opts.keepAliveInterval * 1000;
 
+    (*handle)->buffers = (unsigned char*)platform_malloc(3 * MQTT_BUFFER_SIZE);
+    if (!(*handle)->buffers)
+    {
+        platform_free(*handle);
+        *handle = 0;
+        return EVRYTHNG_MEMORY_ERROR;
+    }
+
 	MQTTClientInit(
             &(*handle)->mqtt_client, 
             &(*handle)->mqtt_network, 
             (*handle)->command_timeout_ms, 
-            (*handle)->serialize_buffer, sizeof((*handle)->serialize_buffer), 
-            (*handle)->read_buffer, sizeof((*handle)->read_buffer));
+            (*handle)->buffers, MQTT_BUFFER_SIZE, 
+            (*handle)->buffers + MQTT_BUFFER_SIZE, MQTT_BUFFER_SIZE);
+    MQTTSetReceiveBuffer(&(*handle)->mqtt_client, (*handle)->buffers + 2 * MQTT_BUFFER_SIZE, MQTT_BUFFER_SIZE);
 
     (*handle)->mqtt_thread_stacksize = 8192;
 
     (*handle)->mqtt_client.messageHandler = message_callback;
+    (*handle)->mqtt_client.chunkHandler = message_chunk_callback;
     (*handle)->mqtt_client.messageHandlerData = (void*)(*handle);
 
-    platform_mutex_init(&(*handle)->next_op_mtx);
-    platform_mutex_init(&(*handle)->async_op_mtx);
-    platform_semaphore_init(&(*handle)->next_op_ready_sem);
-    platform_semaphore_init(&(*handle)->next_op_result_sem);
+    (*handle)->op_queue.depth = OP_QUEUE_DEFAULT_DEPTH;
+    (*handle)->op_queue.ops = (mqtt_op**)platform_malloc(OP_QUEUE_DEFAULT_DEPTH * sizeof(mqtt_op*));
+    if (!(*handle)->op_queue.ops || 
+            MQTTSetMaxInflight(&(*handle)->mqtt_client, MAX_INFLIGHT_DEFAULT) != MQTT_SUCCESS)
+    {
+        if ((*handle)->op_queue.ops) platform_free((*handle)->op_queue.ops);
+        MQTTClientDeinit(&(*handle)->mqtt_client);
+        platform_free((*handle)->buffers);
+        platform_free(*handle);
+        *handle = 0;
+        return EVRYTHNG_MEMORY_ERROR;
+    }
+
+    platform_mutex_init(&(*handle)->op_queue.mtx);
+    platform_notifier_init(&(*handle)->op_queue.ready);
+    platform_semaphore_init(&(*handle)->op_queue.space_sem);
+
+    (*handle)->aggr_window_ms = AGGR_WINDOW_DEFAULT_MS;
+    (*handle)->aggr_max_count = AGGR_MAX_COUNT_DEFAULT;
+    (*handle)->aggr_max_bytes = AGGR_MAX_BYTES_DEFAULT;
+    platform_mutex_init(&(*handle)->aggr_mtx);
+
+    platform_mutex_init(&(*handle)->spool_mtx);
+    platform_timer_init(&(*handle)->spool_rate_timer);
+
+    platform_timer_init(&(*handle)->reconnect_timer);
+    platform_timer_init(&(*handle)->drain_deadline);
+    (*handle)->reconnect_min_ms = RECONNECT_MIN_DEFAULT_MS;
+    (*handle)->reconnect_max_ms = RECONNECT_MAX_DEFAULT_MS;
+    (*handle)->connect_timeout_ms = CONNECT_TIMEOUT_DEFAULT_MS;
+    (*handle)->connect_network_ms = -1;
+    (*handle)->connect_total_ms = -1;
 
     return EVRYTHNG_SUCCESS;
 }
@@ -139,36 +455,92 @@ evrythng_return_t EvrythngInitHandle(evrythng_handle_t* handle)
 
 void EvrythngDestroyHandle(evrythng_handle_t handle)
 {
+    int i;
+
     if (!handle) return;
     if (handle->initialized && MQTTisConnected(&handle->mqtt_client)) EvrythngDisconnect(handle);
 
+    for (i = 1; i < handle->nconnections; i++)
+        EvrythngDestroyHandle(handle->connections[i - 1]);
+    if (handle->connections) platform_free(handle->connections);
+
     if (handle->initialized)
     {
         handle->mqtt_thread_stop = 1;
-        platform_thread_join(&handle->mqtt_thread, 0x00FFFFFF);
-        platform_thread_destroy(&handle->mqtt_thread);
+        handle_wake(handle);
+        if (handle->shard)
+        {
+            platform_semaphore_wait(&handle->detached, 0x00FFFFFF);
+        }
+        else
+        {
+            platform_thread_join(&handle->mqtt_thread, 0x00FFFFFF);
+            platform_thread_destroy(&handle->mqtt_thread);
+        }
+    }
+
+    if (handle->shard)
+    {
+        platform_mutex_lock(&handle->reactor->mtx);
+        handle->shard->count--;
+        platform_mutex_unlock(&handle->reactor->mtx);
+        platform_semaphore_deinit(&handle->detached);
     }
 
+    op_queue_flush(handle, EVRYTHNG_NOT_CONNECTED);
+
+    if (handle->tls_session) platform_tls_session_free(handle->tls_session);
+    if (handle->tls_ca) platform_tls_ca_put(handle->tls_ca);
+
     if (handle->host) platform_free(handle->host);
     if (handle->key) platform_free(handle->key);
     if (handle->client_id) platform_free(handle->client_id);
+    if (handle->spool_path) platform_free(handle->spool_path);
 
-    sub_callback_t **_sub_callback = &handle->sub_callbacks;
-    while (*_sub_callback) 
+    sub_callback_t *_sub_callback = handle->sub_callbacks;
+    while (_sub_callback) 
     {
-        sub_callback_t* _sub_callback_tmp = *_sub_callback;
-        _sub_callback = &(*_sub_callback)->next;
+        sub_callback_t* _sub_callback_tmp = _sub_callback;
+        _sub_callback = _sub_callback->next;
         platform_free(_sub_callback_tmp->topic);
         platform_free(_sub_callback_tmp);
     }
+    sub_trie_clear(&handle->sub_trie);
+
+    while (handle->aggr)
+    {
+        aggr_thng_t* a = handle->aggr;
+        handle->aggr = a->next;
+        if (a->count)
+            warning("dropping %d property updates of %s", a->count, a->thng_id);
+        platform_timer_deinit(&a->deadline);
+        platform_free(a->buf);
+        platform_free(a->thng_id);
+        platform_free(a);
+    }
+    platform_mutex_deinit(&handle->aggr_mtx);
 
     MQTTClientDeinit(&handle->mqtt_client);
+    if (handle->msg_pool_mem)
+    {
+        MQTTBufferPoolDeinit(&handle->msg_pool);
+        platform_free(handle->msg_pool_mem);
+    }
+
+    platform_free(handle->op_queue.ops);
+    platform_mutex_deinit(&handle->op_queue.mtx);
+    if (!handle->shard)
+        platform_notifier_deinit(&handle->op_queue.ready);
+    platform_semaphore_deinit(&handle->op_queue.space_sem);
 
-    platform_mutex_deinit(&handle->next_op_mtx);
-    platform_mutex_deinit(&handle->async_op_mtx);
-    platform_semaphore_deinit(&handle->next_op_ready_sem);
-    platform_semaphore_deinit(&handle->next_op_result_sem);
+    spool_deinit(&handle->spool);
+    platform_mutex_deinit(&handle->spool_mtx);
+    platform_timer_deinit(&handle->spool_rate_timer);
 
+    platform_timer_deinit(&handle->reconnect_timer);
+    platform_timer_deinit(&handle->drain_deadline);
+    platform_free(handle->cork_buffer);
+    platform_free(handle->buffers);
     platform_free(handle);
 }
 
@@ -280,320 +652,1315 @@ evrythng_return_t EvrythngSetQos(evrythng_handle_t handle, int qos)
 }
 
 
-evrythng_return_t EvrythngSetThreadPriority(evrythng_handle_t handle, int priority)
+evrythng_return_t EvrythngSetPersistentSession(evrythng_handle_t handle, int persistent)
 {
-    if (!handle || priority < 0)
+    if (!handle)
         return EVRYTHNG_BAD_ARGS;
 
-    handle->mqtt_thread_priority = priority;
+    /* restoring the subscriptions relies on the session of the first connection */
+    if (handle->initialized)
+        return EVRYTHNG_FAILURE;
+
+    handle->mqtt_conn_opts.cleansession = persistent ? 0 : 1;
 
     return EVRYTHNG_SUCCESS;
 }
 
 
-evrythng_return_t EvrythngSetThreadStacksize(evrythng_handle_t handle, int stacksize)
+evrythng_return_t EvrythngSetKeepAlive(evrythng_handle_t handle, int seconds)
 {
-    if (!handle || stacksize < 1024)
+    if (!handle || seconds < 0 || seconds > 65535)
         return EVRYTHNG_BAD_ARGS;
 
-    handle->mqtt_thread_stacksize = stacksize;
+    if (handle->initialized)
+        return EVRYTHNG_FAILURE;
+
+    handle->mqtt_conn_opts.keepAliveInterval = seconds;
+    handle->command_timeout_ms = (seconds ? seconds : KEEPALIVE_DEFAULT_S) * 1000;
+    handle->mqtt_client.command_timeout_ms = handle->command_timeout_ms;
 
     return EVRYTHNG_SUCCESS;
 }
 
 
-static evrythng_return_t add_sub_callback(evrythng_handle_t handle, const char* topic, int qos, sub_callback *callback)
+evrythng_return_t EvrythngSetReconnectPolicy(evrythng_handle_t handle, int min_delay_ms, int max_delay_ms, int attempt_timeout_ms)
 {
-    evrythng_return_t ret = EVRYTHNG_SUCCESS;
+    if (!handle || min_delay_ms < 0 || max_delay_ms < min_delay_ms || attempt_timeout_ms <= 0)
+        return EVRYTHNG_BAD_ARGS;
 
-    char* qp_start = strstr(topic, "?pubStates=");
-    int topic_len = 
-        qp_start == NULL ? strlen(topic) : qp_start - topic;
+    platform_mutex_lock(&handle->op_queue.mtx);
+    handle->reconnect_min_ms = min_delay_ms;
+    handle->reconnect_max_ms = max_delay_ms;
+    handle->connect_timeout_ms = attempt_timeout_ms;
+    platform_mutex_unlock(&handle->op_queue.mtx);
 
-    sub_callback_t **_sub_callbacks = &handle->sub_callbacks;
-    while (*_sub_callbacks) 
-    {
-        qp_start = strstr((*_sub_callbacks)->topic, "?pubStates=");
-        int saved_topic_len = 
-            qp_start == NULL ? strlen((*_sub_callbacks)->topic) : qp_start - (*_sub_callbacks)->topic;
+    return EVRYTHNG_SUCCESS;
+}
 
-        if ((topic_len == saved_topic_len) && 
-                (strncmp((*_sub_callbacks)->topic, topic, saved_topic_len)) == 0) 
-        {
-            debug("callback for %s already exists", topic);
-            ret = EVRYTHNG_ALREADY_SUBSCRIBED;
-            goto out;
-        }
-        _sub_callbacks = &(*_sub_callbacks)->next;
-    }
 
-    if ((*_sub_callbacks = (sub_callback_t*)platform_malloc(sizeof(sub_callback_t))) == NULL) 
-    {
-        ret = EVRYTHNG_MEMORY_ERROR;
-        goto out;
-    }
+evrythng_return_t EvrythngGetReconnectState(evrythng_handle_t handle, evrythng_reconnect_state_t* state)
+{
+    if (!handle || !state)
+        return EVRYTHNG_BAD_ARGS;
 
-    if (((*_sub_callbacks)->topic = (char*)platform_malloc(strlen(topic) + 1)) == NULL) 
+    platform_mutex_lock(&handle->op_queue.mtx);
+    state->reconnecting = handle->reconnecting;
+    state->attempt = handle->reconnect_attempt;
+    state->next_retry_ms = -1;
+    if (handle->reconnecting)
     {
-        platform_free(*_sub_callbacks);
-        ret = EVRYTHNG_MEMORY_ERROR;
-        goto out;
+        state->next_retry_ms = platform_timer_left(&handle->reconnect_timer);
+        if (state->next_retry_ms < 0)
+            state->next_retry_ms = 0;
     }
+    state->last_error = handle->reconnect_error;
+    state->last_mqtt_rc = handle->reconnect_mqtt_rc;
+    state->last_network_ms = handle->connect_network_ms;
+    state->last_connect_ms = handle->connect_total_ms;
+    state->last_resumed = handle->connect_resumed;
+    platform_mutex_unlock(&handle->op_queue.mtx);
 
-    strcpy((*_sub_callbacks)->topic, topic);
-    (*_sub_callbacks)->qos = qos;
-    (*_sub_callbacks)->callback = callback;
-    (*_sub_callbacks)->next = 0;
-
-out:
-    return ret;
+    return EVRYTHNG_SUCCESS;
 }
 
 
-static evrythng_return_t rm_sub_callback(evrythng_handle_t handle, const char* topic, char* deleted_topic)
+/* Sets up the spool of each connection, the other connections
+ * keep their publishes in files named after the path. */
+static evrythng_return_t connections_spool(evrythng_handle_t handle, size_t size, evrythng_spool_policy_t policy, const char* path)
 {
-    evrythng_return_t ret = EVRYTHNG_NOT_SUBSCRIBED;
-
-    sub_callback_t *currP, *prevP = NULL;
+    evrythng_return_t rc;
+    int i;
 
-    for (currP = handle->sub_callbacks; currP != NULL; prevP = currP, currP = currP->next) 
+    for (i = 1; i < handle->nconnections; i++)
     {
-        int len;
-        char* qp = strstr(currP->topic, "?pubStates=");
-        if (qp)
-            len = qp - currP->topic;
-        else
-            len = strlen(currP->topic);
+        char* connection_path = 0;
 
-        if (strncmp(currP->topic, topic, len) == 0) 
+        if (path)
         {
-            if (prevP == NULL) 
-            {
-                /* Fix beginning pointer. */
-                handle->sub_callbacks = currP->next;
-            } 
-            else 
-            {
-                /*
-                 * Fix previous node's next to
-                 * skip over the removed node.
-                 */
-                prevP->next = currP->next;
-            }
-
-            if (deleted_topic)
-                strcpy(deleted_topic, currP->topic);
-            
-            /* Deallocate the node. */
-            platform_free(currP->topic);
-            platform_free(currP);
-
-            /* Done searching. */
-            ret = EVRYTHNG_SUCCESS;
-            break;
+            size_t len = strlen(path) + 4;
+            if (!(connection_path = (char*)platform_malloc(len)))
+                return EVRYTHNG_MEMORY_ERROR;
+            snprintf(connection_path, len, "%s.%d", path, i);
         }
+        rc = EvrythngSetSpool(handle->connections[i - 1], size, policy, connection_path);
+        if (connection_path)
+            platform_free(connection_path);
+        if (rc != EVRYTHNG_SUCCESS)
+            return rc;
     }
 
-    return ret;
+    return EVRYTHNG_SUCCESS;
 }
 
 
-static sub_callback* get_sub_callback(evrythng_handle_t handle, MQTTString* topic)
+evrythng_return_t EvrythngSetSpool(evrythng_handle_t handle, size_t size, evrythng_spool_policy_t policy, const char* path)
 {
-    sub_callback* cb = 0;
+    if (!handle || (size && size < 64))
+        return EVRYTHNG_BAD_ARGS;
 
-    sub_callback_t *_sub_callback = handle->sub_callbacks;
-    while (_sub_callback) 
+    if (handle->initialized)
+        return EVRYTHNG_FAILURE;
+
+    spool_deinit(&handle->spool);
+    if (handle->spool_path)
+        platform_free(handle->spool_path);
+    handle->spool_path = 0;
+    if (!size)
+        return connections_spool(handle, 0, policy, 0);
+
+    if (spool_init(&handle->spool, size, policy == EVRYTHNG_SPOOL_DROP_NEWEST ? SPOOL_DROP_NEWEST : SPOOL_DROP_OLDEST, path) != 0)
     {
-        if (MQTTPacket_equals(topic, _sub_callback->topic) || MQTTisTopicMatched(_sub_callback->topic, topic))
-        {
-            cb = _sub_callback->callback;
-            break;
-        }
-        _sub_callback = _sub_callback->next;
+        error("could not set up a spool of %u bytes", (unsigned)size);
+        return path ? EVRYTHNG_FAILURE : EVRYTHNG_MEMORY_ERROR;
     }
 
-    return cb;
+    if (handle->spool.state.count)
+        debug("%u publishes left in the spool", (unsigned)handle->spool.state.count);
+
+    if (path && replace_str(&handle->spool_path, path, strlen(path)) != EVRYTHNG_SUCCESS)
+        return EVRYTHNG_MEMORY_ERROR;
+
+    return connections_spool(handle, size, policy, path);
 }
 
 
-void message_callback(MessageData* data, void* userdata)
+evrythng_return_t EvrythngSetSpoolReplayRate(evrythng_handle_t handle, int msgs_per_sec)
 {
-    evrythng_handle_t handle = (evrythng_handle_t)userdata;
+    if (!handle || msgs_per_sec < 0)
+        return EVRYTHNG_BAD_ARGS;
 
-    //debug("received msg topic: %s", data->topicName->lenstring.data);
-    //debug("received msg, length %d, payload: %s", data->message->payloadlen, (char*)data->message->payload);
+    handle->spool_rate = msgs_per_sec;
 
-    if (data->message->payloadlen < 3) 
-    {
-        error("incorrect message lenth %d", data->message->payloadlen);
-        return;
-    }
+    handle_wake(handle);
 
-    sub_callback* cb = get_sub_callback(handle, data->topicName);
-    if (cb)
-    {
-        (*cb)(data->message->payload, data->message->payloadlen);
-    }
+    return EVRYTHNG_SUCCESS;
 }
 
 
-static evrythng_return_t evrythng_async_op(evrythng_handle_t handle, int op, const char* topic, MQTTMessage* message, sub_callback *callback)
+evrythng_return_t EvrythngGetSpoolStats(evrythng_handle_t handle, evrythng_spool_stats_t* stats)
 {
-    evrythng_return_t rc;
+    int i;
 
-    if (!handle)
+    if (!handle || !stats)
         return EVRYTHNG_BAD_ARGS;
 
-    platform_mutex_lock(&handle->async_op_mtx);
-
-    platform_mutex_lock(&handle->next_op_mtx);
-
-    handle->next_op.op = op;
-    handle->next_op.topic = topic;
-    handle->next_op.message = message;
-    handle->next_op.callback = callback;
-
-    platform_mutex_unlock(&handle->next_op_mtx);
-
-    platform_semaphore_post(&handle->next_op_ready_sem);
-
-    if (platform_semaphore_wait(&handle->next_op_result_sem, handle->command_timeout_ms * 2))
-    {
-        platform_mutex_lock(&handle->next_op_mtx);
-        handle->next_op.op = MQTT_NOP;
-        platform_semaphore_wait(&handle->next_op_result_sem, 0);
-        platform_mutex_unlock(&handle->next_op_mtx);
-        rc = EVRYTHNG_TIMEOUT;
-    }
-    else
+    memset(stats, 0, sizeof *stats);
+    for (i = 0; i < (handle->nconnections > 1 ? handle->nconnections : 1); i++)
     {
-        rc = handle->next_op.result;
+        evrythng_handle_t c = connection_at(handle, i);
+
+        platform_mutex_lock(&c->spool_mtx);
+        stats->count += c->spool.state.count;
+        stats->bytes += spool_bytes(&c->spool);
+        stats->dropped += c->spool.dropped;
+        stats->replayed += c->spool_replayed;
+        platform_mutex_unlock(&c->spool_mtx);
     }
 
-    platform_mutex_unlock(&handle->async_op_mtx);
-
-    return rc;
+    return EVRYTHNG_SUCCESS;
 }
 
-#define MQTT_CLIENTID_LEN 23
-static const char* clientid_charset = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
-evrythng_return_t EvrythngConnect(evrythng_handle_t handle)
+evrythng_return_t EvrythngGetRttStats(evrythng_handle_t handle, evrythng_rtt_stats_t* stats)
 {
-    if (!handle)
+    if (!handle || !stats)
         return EVRYTHNG_BAD_ARGS;
 
-    if (!handle->initialized)
+    MQTTRtt rtt;
+    MQTTGetRtt(&handle->mqtt_client, &rtt);
+    stats->samples = rtt.samples;
+    stats->last_ms = rtt.last_ms;
+    stats->min_ms = rtt.min_ms;
+    stats->avg_ms = rtt.avg_ms;
+    stats->max_ms = rtt.max_ms;
+
+    /* the other connections of the handle add their samples */
+    unsigned long sum = rtt.samples * (unsigned long)rtt.avg_ms;
+    int i;
+    for (i = 1; i < handle->nconnections; i++)
     {
-        if (!handle->client_id)
-        {
-            int i;
-            handle->client_id = (char*)platform_malloc(MQTT_CLIENTID_LEN+1);
-            if (!handle->client_id)
-                return EVRYTHNG_MEMORY_ERROR;
-            memset(handle->client_id, 0, MQTT_CLIENTID_LEN+1);
+        MQTTGetRtt(&handle->connections[i - 1]->mqtt_client, &rtt);
+        if (rtt.samples == 0)
+            continue;
+        if (stats->samples == 0 || rtt.min_ms < stats->min_ms)
+            stats->min_ms = rtt.min_ms;
+        if (rtt.max_ms > stats->max_ms)
+            stats->max_ms = rtt.max_ms;
+        sum += rtt.samples * (unsigned long)rtt.avg_ms;
+        stats->samples += rtt.samples;
+        stats->avg_ms = (int)(sum / stats->samples);
+    }
 
-            for (i = 0; i < MQTT_CLIENTID_LEN; i++)
-                handle->client_id[i] = clientid_charset[platform_rand() % strlen(clientid_charset)];
+    return EVRYTHNG_SUCCESS;
+}
 
-            handle->mqtt_conn_opts.clientID.cstring = handle->client_id;
-            debug("client ID: %s", handle->client_id);
-        }
 
-        platform_thread_create(&handle->mqtt_thread, handle->mqtt_thread_priority, "mqtt_thread", mqtt_thread, handle->mqtt_thread_stacksize, (void*)handle);
+evrythng_return_t EvrythngGetSendStats(evrythng_handle_t handle, evrythng_send_stats_t* stats)
+{
+    int i;
 
-        handle->initialized = 1;
-    }
+    if (!handle || !stats)
+        return EVRYTHNG_BAD_ARGS;
 
-    if (MQTTisConnected(&handle->mqtt_client))
+    memset(stats, 0, sizeof *stats);
+    for (i = 0; i < (handle->nconnections > 1 ? handle->nconnections : 1); i++)
     {
-        warning("already connected");
-        return EVRYTHNG_SUCCESS;
+        MQTTSendStats send;
+        MQTTGetSendStats(&connection_at(handle, i)->mqtt_client, &send);
+        stats->packets += send.packets;
+        stats->writes += send.writes;
     }
 
-    return evrythng_async_op(handle, MQTT_CONNECT, 0, 0, 0);
+    return EVRYTHNG_SUCCESS;
 }
 
 
-evrythng_return_t evrythng_connect_internal(evrythng_handle_t handle)
+evrythng_return_t EvrythngSetThreadPriority(evrythng_handle_t handle, int priority)
 {
-    int rc;
-
-    if (MQTTisConnected(&handle->mqtt_client))
-    {
-        warning("already connected");
-        return EVRYTHNG_SUCCESS;
-    }
-
-    if (handle->secure_connection)
-        platform_network_securedinit(&handle->mqtt_network, handle->ca_buf, handle->ca_size);
-    else
-        platform_network_init(&handle->mqtt_network);
+    if (!handle || priority < 0)
+        return EVRYTHNG_BAD_ARGS;
 
-    int attempt;
-    for (attempt = 1; attempt <= 3; attempt++)
-    {
-        debug("connecting to host: %s, port: %d (%d)", handle->host, handle->port, attempt);
-        if (platform_network_connect(&handle->mqtt_network, handle->host, handle->port))
-        {
-            error("Failed to establish network connection");
-            platform_network_disconnect(&handle->mqtt_network);
-            continue;
-        }
-        debug("network connection established");
+    handle->mqtt_thread_priority = priority;
 
-        if ((rc = MQTTConnect(&handle->mqtt_client, &handle->mqtt_conn_opts)) != MQTT_SUCCESS)
-        {
-            error("Failed to connect, return code %d", rc);
-            platform_network_disconnect(&handle->mqtt_network);
-            continue;
-        }
-        debug("MQTT connected");
-        break;
-    }
+    return EVRYTHNG_SUCCESS;
+}
 
-    if (!MQTTisConnected(&handle->mqtt_client))
-    {
-        return EVRYTHNG_CONNECTION_FAILED;
-    }
 
+evrythng_return_t EvrythngSetThreadStacksize(evrythng_handle_t handle, int stacksize)
+{
+    if (!handle || stacksize < 1024)
+        return EVRYTHNG_BAD_ARGS;
 
-    sub_callback_t* _sub_callback = handle->sub_callbacks;
-    while (_sub_callback) 
-    {
-        int rc = MQTTSubscribe(
-                &handle->mqtt_client, 
-                _sub_callback->topic, 
-                _sub_callback->qos);
-        if (rc >= 0) 
-        {
-            debug("successfully subscribed to %s", _sub_callback->topic);
-        }
-        else 
-        {
-            error("subscription failed, rc = %d", rc);
-            break;
-        }
-        _sub_callback = _sub_callback->next;
-    }
+    handle->mqtt_thread_stacksize = stacksize;
 
     return EVRYTHNG_SUCCESS;
 }
 
 
-evrythng_return_t EvrythngDisconnect(evrythng_handle_t handle)
+evrythng_return_t EvrythngSetOpQueueDepth(evrythng_handle_t handle, int depth)
 {
-    if (!handle)
+    if (!handle || depth < 1)
         return EVRYTHNG_BAD_ARGS;
 
-    if (!handle->initialized)
-        return EVRYTHNG_SUCCESS;
+    if (handle->initialized)
+        return EVRYTHNG_FAILURE;
 
-    if (!MQTTisConnected(&handle->mqtt_client))
-        return EVRYTHNG_SUCCESS;
+    mqtt_op** ops = (mqtt_op**)platform_realloc(handle->op_queue.ops, depth * sizeof(mqtt_op*));
+    if (!ops)
+        return EVRYTHNG_MEMORY_ERROR;
 
-    return evrythng_async_op(handle, MQTT_DISCONNECT, 0, 0, 0);
+    handle->op_queue.ops = ops;
+    handle->op_queue.depth = depth;
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+evrythng_return_t EvrythngSetMaxInflight(evrythng_handle_t handle, int max_inflight)
+{
+    if (!handle || max_inflight < 0)
+        return EVRYTHNG_BAD_ARGS;
+
+    if (handle->initialized)
+        return EVRYTHNG_FAILURE;
+
+    if (MQTTSetMaxInflight(&handle->mqtt_client, max_inflight) != MQTT_SUCCESS)
+        return EVRYTHNG_MEMORY_ERROR;
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+evrythng_return_t EvrythngSetSendBatching(evrythng_handle_t handle, int max_bytes)
+{
+    if (!handle || max_bytes < 0)
+        return EVRYTHNG_BAD_ARGS;
+
+    if (handle->initialized)
+        return EVRYTHNG_FAILURE;
+
+    unsigned char* cork_buffer = 0;
+    if (max_bytes > 0 && !(cork_buffer = (unsigned char*)platform_malloc(max_bytes)))
+        return EVRYTHNG_MEMORY_ERROR;
+
+    MQTTSetCorkBuffer(&handle->mqtt_client, cork_buffer, max_bytes);
+    platform_free(handle->cork_buffer);
+    handle->cork_buffer = cork_buffer;
+    handle->cork_size = max_bytes;
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+evrythng_return_t EvrythngSetMessagePool(evrythng_handle_t handle, int count)
+{
+    if (!handle || count < 0)
+        return EVRYTHNG_BAD_ARGS;
+
+    if (handle->initialized)
+        return EVRYTHNG_FAILURE;
+
+    MQTTSetReadBufferPool(&handle->mqtt_client, 0);
+    if (handle->msg_pool_mem)
+    {
+        MQTTBufferPoolDeinit(&handle->msg_pool);
+        platform_free(handle->msg_pool_mem);
+        handle->msg_pool_mem = 0;
+    }
+    handle->msg_pool_count = 0;
+
+    if (count == 0)
+        return EVRYTHNG_SUCCESS;
+
+    /* the reference counts follow the buffers */
+    unsigned char* mem = (unsigned char*)platform_malloc(count * (MQTT_BUFFER_SIZE + sizeof(int)));
+    if (!mem)
+        return EVRYTHNG_MEMORY_ERROR;
+
+    MQTTBufferPoolInit(&handle->msg_pool, mem, MQTT_BUFFER_SIZE, count, (int*)(mem + count * MQTT_BUFFER_SIZE));
+    MQTTSetReadBufferPool(&handle->mqtt_client, &handle->msg_pool);
+    handle->msg_pool_mem = mem;
+    handle->msg_pool_count = count;
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+evrythng_return_t EvrythngRetainMessage(evrythng_handle_t handle, const char* str_json)
+{
+    int i;
+
+    if (!handle || !str_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    for (i = 0; i < (handle->nconnections > 1 ? handle->nconnections : 1); i++)
+    {
+        evrythng_handle_t c = connection_at(handle, i);
+        if (c->msg_pool_mem && MQTTBufferRetain(&c->msg_pool, str_json) == MQTT_SUCCESS)
+            return EVRYTHNG_SUCCESS;
+    }
+
+    return EVRYTHNG_FAILURE;
+}
+
+
+void EvrythngReleaseMessage(evrythng_handle_t handle, const char* str_json)
+{
+    int i;
+
+    if (!handle || !str_json)
+        return;
+
+    for (i = 0; i < (handle->nconnections > 1 ? handle->nconnections : 1); i++)
+    {
+        evrythng_handle_t c = connection_at(handle, i);
+        if (c->msg_pool_mem)
+            MQTTBufferRelease(&c->msg_pool, str_json);
+    }
+}
+
+
+evrythng_return_t EvrythngSetReactor(evrythng_handle_t handle, evrythng_reactor_t reactor)
+{
+    int i;
+
+    if (!handle || !reactor)
+        return EVRYTHNG_BAD_ARGS;
+
+    if (handle->initialized || handle->shard)
+        return EVRYTHNG_FAILURE;
+
+    unsigned char* recv_buffer = (unsigned char*)platform_malloc(MQTT_BUFFER_SIZE);
+    if (!recv_buffer)
+        return EVRYTHNG_MEMORY_ERROR;
+
+    platform_mutex_lock(&reactor->mtx);
+    reactor_shard_t* shard = &reactor->shards[0];
+    for (i = 1; i < reactor->nshards; i++)
+        if (reactor->shards[i].count < shard->count)
+            shard = &reactor->shards[i];
+    shard->count++;
+    platform_mutex_unlock(&reactor->mtx);
+
+    platform_free(handle->buffers);
+    handle->buffers = recv_buffer;
+    handle->mqtt_client.buf = shard->serialize_buffer;
+    handle->mqtt_client.readbuf = shard->read_buffer;
+    MQTTSetReceiveBuffer(&handle->mqtt_client, recv_buffer, MQTT_BUFFER_SIZE);
+
+    /* the shard notifier is used instead */
+    platform_notifier_deinit(&handle->op_queue.ready);
+    platform_semaphore_init(&handle->detached);
+
+    handle->reactor = reactor;
+    handle->shard = shard;
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+evrythng_return_t EvrythngSetAggregation(evrythng_handle_t handle, int window_ms, int max_count, int max_bytes)
+{
+    if (!handle || window_ms < 0 || max_count < 1 || max_bytes < 64)
+        return EVRYTHNG_BAD_ARGS;
+
+    platform_mutex_lock(&handle->aggr_mtx);
+    handle->aggr_window_ms = window_ms;
+    handle->aggr_max_count = max_count;
+    handle->aggr_max_bytes = max_bytes;
+    platform_mutex_unlock(&handle->aggr_mtx);
+
+    handle_wake(handle);
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+evrythng_return_t EvrythngSetConnections(evrythng_handle_t handle, int count)
+{
+    evrythng_handle_t* connections = 0;
+    evrythng_return_t rc;
+    int i;
+
+    if (!handle || count < 1 || count > CONNECTIONS_MAX)
+        return EVRYTHNG_BAD_ARGS;
+
+    if (handle->initialized)
+        return EVRYTHNG_FAILURE;
+
+    if (count > 1)
+    {
+        connections = (evrythng_handle_t*)platform_malloc((count - 1) * sizeof(evrythng_handle_t));
+        if (!connections)
+            return EVRYTHNG_MEMORY_ERROR;
+        for (i = 0; i < count - 1; i++)
+        {
+            if ((rc = EvrythngInitHandle(&connections[i])) != EVRYTHNG_SUCCESS)
+            {
+                while (i--)
+                    EvrythngDestroyHandle(connections[i]);
+                platform_free(connections);
+                return rc;
+            }
+        }
+    }
+
+    for (i = 1; i < handle->nconnections; i++)
+        EvrythngDestroyHandle(handle->connections[i - 1]);
+    if (handle->connections)
+        platform_free(handle->connections);
+
+    handle->connections = connections;
+    handle->nconnections = count;
+
+    /* publishes may be spooled before connecting */
+    if (handle->spool.data)
+        return connections_spool(handle, handle->spool.size, 
+                handle->spool.policy == SPOOL_DROP_NEWEST ? EVRYTHNG_SPOOL_DROP_NEWEST : EVRYTHNG_SPOOL_DROP_OLDEST, 
+                handle->spool_path);
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+static int sub_node_cmp(const sub_node_t* node, const char* level, size_t len)
+{
+    int c = memcmp(node->level, level, node->level_len < len ? node->level_len : len);
+    if (c)
+        return c;
+    return node->level_len < len ? -1 : node->level_len > len;
+}
+
+
+/* Returns the index of the child named level or, if there is none, 
+ * the complement of the index it belongs at. */
+static int sub_node_find(const sub_node_t* node, const char* level, size_t len)
+{
+    int lo = 0, hi = node->nchildren - 1;
+
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        int c = sub_node_cmp(node->children[mid], level, len);
+        if (!c)
+            return mid;
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    return ~lo;
+}
+
+
+static void sub_trie_clear(sub_node_t* node)
+{
+    int i;
+
+    for (i = 0; i < node->nchildren; i++)
+    {
+        sub_trie_clear(node->children[i]);
+        platform_free(node->children[i]);
+    }
+    if (node->plus)
+    {
+        sub_trie_clear(node->plus);
+        platform_free(node->plus);
+    }
+    if (node->hash)
+    {
+        sub_trie_clear(node->hash);
+        platform_free(node->hash);
+    }
+    if (node->children)
+        platform_free(node->children);
+
+    memset(node, 0, sizeof(sub_node_t));
+}
+
+
+/* Returns the child for a level, created if it does not exist yet, 
+ * or 0 if memory allocation failed. */
+static sub_node_t* sub_node_child(sub_node_t* node, const char* level, size_t len)
+{
+    sub_node_t** slot = 0;
+    sub_node_t* child;
+    int i = 0;
+
+    if (len == 1 && *level == '+')
+        slot = &node->plus;
+    else if (len == 1 && *level == '#')
+        slot = &node->hash;
+    else if ((i = sub_node_find(node, level, len)) >= 0)
+        return node->children[i];
+
+    if (slot && *slot)
+        return *slot;
+
+    /* the level name is stored right after the node */
+    child = (sub_node_t*)platform_malloc(sizeof(sub_node_t) + len + 1);
+    if (!child)
+        return 0;
+    memset(child, 0, sizeof(sub_node_t));
+    memcpy(child + 1, level, len);
+    ((char*)(child + 1))[len] = '\0';
+    child->level = (const char*)(child + 1);
+    child->level_len = len;
+
+    if (slot)
+    {
+        *slot = child;
+        return child;
+    }
+
+    if (node->nchildren == node->capacity)
+    {
+        int capacity = node->capacity ? node->capacity * 2 : 4;
+        sub_node_t** children = (sub_node_t**)platform_realloc(node->children, capacity * sizeof(sub_node_t*));
+        if (!children)
+        {
+            platform_free(child);
+            return 0;
+        }
+        node->children = children;
+        node->capacity = capacity;
+    }
+
+    i = ~i;
+    memmove(&node->children[i + 1], &node->children[i], (node->nchildren - i) * sizeof(sub_node_t*));
+    node->children[i] = child;
+    node->nchildren++;
+
+    return child;
+}
+
+
+/* Returns the node of a topic filter, adding the levels it is missing. */
+static sub_node_t* sub_trie_insert(sub_node_t* node, const char* filter, size_t len)
+{
+    const char* end = filter + len;
+
+    for (;;)
+    {
+        const char* sep = (const char*)memchr(filter, '/', end - filter);
+
+        node = sub_node_child(node, filter, (sep ? sep : end) - filter);
+        if (!node || !sep)
+            return node;
+        filter = sep + 1;
+    }
+}
+
+
+/* Detaches the subscription of a topic filter and frees the levels no 
+ * longer leading to any subscription. Returns the subscription or 0. */
+static sub_callback_t* sub_trie_remove(sub_node_t* node, const char* filter, const char* end)
+{
+    const char* sep = (const char*)memchr(filter, '/', end - filter);
+    size_t len = (sep ? sep : end) - filter;
+    sub_node_t** slot;
+    sub_callback_t* sub;
+    int i = -1;
+
+    if (len == 1 && *filter == '+')
+        slot = &node->plus;
+    else if (len == 1 && *filter == '#')
+        slot = &node->hash;
+    else if ((i = sub_node_find(node, filter, len)) >= 0)
+        slot = &node->children[i];
+    else
+        return 0;
+
+    sub_node_t* child = *slot;
+    if (!child)
+        return 0;
+
+    if (sep)
+    {
+        sub = sub_trie_remove(child, sep + 1, end);
+    }
+    else
+    {
+        sub = child->sub;
+        child->sub = 0;
+    }
+
+    if (!child->sub && !child->nchildren && !child->plus && !child->hash)
+    {
+        sub_trie_clear(child);
+        platform_free(child);
+        if (i < 0)
+        {
+            *slot = 0;
+        }
+        else
+        {
+            memmove(&node->children[i], &node->children[i + 1], (node->nchildren - i - 1) * sizeof(sub_node_t*));
+            node->nchildren--;
+        }
+    }
+
+    return sub;
+}
+
+
+static sub_callback_t* sub_trie_match(const sub_node_t* node, const char* name, const char* end);
+
+/* Continues a match below a node, sep is the separator after its level. */
+static sub_callback_t* sub_trie_match_next(const sub_node_t* node, const char* sep, const char* end)
+{
+    if (sep)
+        return sub_trie_match(node, sep + 1, end);
+    if (node->sub)
+        return node->sub;
+    /* "a/#" matches "a" as well */
+    return node->hash ? node->hash->sub : 0;
+}
+
+
+/* Finds the subscription for the topic levels from name to end. Exact 
+ * levels are tried before "+" and "#", so the most specific filter wins. */
+static sub_callback_t* sub_trie_match(const sub_node_t* node, const char* name, const char* end)
+{
+    const char* sep = (const char*)memchr(name, '/', end - name);
+    sub_callback_t* sub = 0;
+    int i;
+
+    if ((i = sub_node_find(node, name, (sep ? sep : end) - name)) >= 0)
+        sub = sub_trie_match_next(node->children[i], sep, end);
+    if (!sub && node->plus)
+        sub = sub_trie_match_next(node->plus, sep, end);
+    if (!sub && node->hash)
+        sub = node->hash->sub;
+
+    return sub;
+}
+
+
+static evrythng_return_t add_sub_callback(evrythng_handle_t handle, const char* topic, int qos, sub_callback *callback, sub_chunk_callback *chunk_callback)
+{
+    char* qp_start = strstr(topic, "?pubStates=");
+    size_t filter_len = qp_start == NULL ? strlen(topic) : (size_t)(qp_start - topic);
+
+    sub_node_t* node = sub_trie_insert(&handle->sub_trie, topic, filter_len);
+    if (!node)
+    {
+        sub_trie_remove(&handle->sub_trie, topic, topic + filter_len);
+        return EVRYTHNG_MEMORY_ERROR;
+    }
+
+    if (node->sub)
+    {
+        debug("callback for %s already exists", topic);
+        return EVRYTHNG_ALREADY_SUBSCRIBED;
+    }
+
+    sub_callback_t* sub = (sub_callback_t*)platform_malloc(sizeof(sub_callback_t));
+    if (!sub || !(sub->topic = (char*)platform_malloc(strlen(topic) + 1)))
+    {
+        if (sub) platform_free(sub);
+        sub_trie_remove(&handle->sub_trie, topic, topic + filter_len);
+        return EVRYTHNG_MEMORY_ERROR;
+    }
+
+    strcpy(sub->topic, topic);
+    sub->filter_len = filter_len;
+    sub->qos = qos;
+    sub->callback = callback;
+    sub->chunk_callback = chunk_callback;
+    sub->next = handle->sub_callbacks;
+    handle->sub_callbacks = sub;
+
+    node->sub = sub;
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+static evrythng_return_t rm_sub_callback(evrythng_handle_t handle, const char* topic, char* deleted_topic)
+{
+    const char* qp_start = strchr(topic, '?');
+    size_t filter_len = qp_start == NULL ? strlen(topic) : (size_t)(qp_start - topic);
+
+    sub_callback_t* sub = sub_trie_remove(&handle->sub_trie, topic, topic + filter_len);
+    if (!sub)
+        return EVRYTHNG_NOT_SUBSCRIBED;
+
+    sub_callback_t** prev = &handle->sub_callbacks;
+    while (*prev != sub)
+        prev = &(*prev)->next;
+    *prev = sub->next;
+
+    if (deleted_topic)
+        strcpy(deleted_topic, sub->topic);
+
+    platform_free(sub->topic);
+    platform_free(sub);
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+static sub_callback_t* get_sub_callback(evrythng_handle_t handle, MQTTString* topic)
+{
+    const char* name = topic->lenstring.data;
+    size_t len = topic->lenstring.len;
+
+    if (!name)
+    {
+        if (!topic->cstring)
+            return 0;
+        name = topic->cstring;
+        len = strlen(name);
+    }
+
+    /* the topic may carry the pubStates query of the subscription */
+    const char* qp_start = (const char*)memchr(name, '?', len);
+    if (qp_start)
+        len = qp_start - name;
+
+    return sub_trie_match(&handle->sub_trie, name, name + len);
+}
+
+
+void message_callback(MessageData* data, void* userdata)
+{
+    evrythng_handle_t handle = (evrythng_handle_t)userdata;
+
+    //debug("received msg topic: %s", data->topicName->lenstring.data);
+    //debug("received msg, length %d, payload: %s", data->message->payloadlen, (char*)data->message->payload);
+
+    if (data->message->payloadlen < 3) 
+    {
+        error("incorrect message lenth %d", data->message->payloadlen);
+        return;
+    }
+
+    sub_callback_t* sub = get_sub_callback(handle, data->topicName);
+    if (sub && sub->callback)
+    {
+        (*sub->callback)(data->message->payload, data->message->payloadlen);
+    }
+}
+
+
+/* Pieces of a message which did not fit the read buffer. */
+void message_chunk_callback(MessageData* data, size_t offset, unsigned char* chunk, size_t chunk_len, void* userdata)
+{
+    evrythng_handle_t handle = (evrythng_handle_t)userdata;
+
+    sub_callback_t* sub = get_sub_callback(handle, data->topicName);
+    if (sub && sub->chunk_callback)
+    {
+        (*sub->chunk_callback)((const char*)chunk, offset, chunk_len, data->message->payloadlen);
+    }
+    else if (offset == 0)
+    {
+        warning("dropping message of %u bytes, no chunked subscription", (unsigned)data->message->payloadlen);
+    }
+}
+
+
+static evrythng_return_t op_queue_push(evrythng_handle_t handle, mqtt_op* op, int block)
+{
+    mqtt_op_queue* q = &handle->op_queue;
+
+    platform_mutex_lock(&q->mtx);
+
+    while (q->count == q->depth)
+    {
+        if (!block)
+        {
+            platform_mutex_unlock(&q->mtx);
+            return EVRYTHNG_QUEUE_FULL;
+        }
+
+        q->space_waiters++;
+        platform_mutex_unlock(&q->mtx);
+
+        if (platform_semaphore_wait(&q->space_sem, handle->command_timeout_ms))
+        {
+            platform_mutex_lock(&q->mtx);
+            q->space_waiters--;
+            /* a post made while timing out is left to no one, take it back */
+            if (q->space_posts > q->space_waiters && platform_semaphore_wait(&q->space_sem, 0) == 0)
+                q->space_posts--;
+            platform_mutex_unlock(&q->mtx);
+            return EVRYTHNG_TIMEOUT;
+        }
+
+        platform_mutex_lock(&q->mtx);
+        q->space_waiters--;
+        q->space_posts--;
+    }
+
+    op->state = OP_QUEUED;
+    op->slot = (q->head + q->count) % q->depth;
+    q->ops[op->slot] = op;
+    q->count++;
+
+    platform_mutex_unlock(&q->mtx);
+
+    handle_wake(handle);
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+/* Whether a publish goes out with MQTTPublishTopic, which blocks until it 
+ * is written and acknowledged, rather than into the in-flight window. */
+static int publish_blocks(evrythng_handle_t handle, int qos)
+{
+    return qos == QOS0 || handle->mqtt_client.max_inflight == 0;
+}
+
+
+/* Whether an op blocks the thread running it on the network, which all but
+ * the publishes going into the in-flight window do. While draining those 
+ * wait for room in the window as well, see drain_op. */
+static int op_blocks(evrythng_handle_t handle, mqtt_op* op)
+{
+    return handle->draining || op->op != MQTT_PUBLISH || publish_blocks(handle, op->message->qos);
+}
+
+
+/* Takes up to max queued ops at once and marks them as running.
+ * Returns the number of ops stored in batch, taken is set to the number
+ * of slots freed, including the ones cancelled by their producers. If 
+ * held is given, an op which blocks is left queued with the ones after it
+ * and held is set. */
+static int op_queue_pop_batch(evrythng_handle_t handle, mqtt_op** batch, int max, int* taken, int* held)
+{
+    mqtt_op_queue* q = &handle->op_queue;
+    int n = 0, freed;
+
+    platform_mutex_lock(&q->mtx);
+
+    if (held)
+        *held = 0;
+
+    for (*taken = 0; q->count > 0 && n < max; (*taken)++)
+    {
+        mqtt_op* op = q->ops[q->head];
+        if (op && held && op_blocks(handle, op))
+        {
+            *held = 1;
+            break;
+        }
+        q->ops[q->head] = 0;
+        q->head = (q->head + 1) % q->depth;
+        q->count--;
+
+        if (!op)
+            continue;
+
+        op->state = OP_RUNNING;
+        batch[n++] = op;
+    }
+
+    for (freed = *taken; freed > 0 && q->space_posts < q->space_waiters; freed--)
+    {
+        q->space_posts++;
+        platform_semaphore_post(&q->space_sem);
+    }
+
+    platform_mutex_unlock(&q->mtx);
+
+    return n;
+}
+
+
+static void ticket_unref(evrythng_ticket_t ticket)
+{
+    platform_mutex_lock(&ticket->handle->op_queue.mtx);
+    int refs = --ticket->refs;
+    platform_mutex_unlock(&ticket->handle->op_queue.mtx);
+
+    if (!refs)
+        platform_free(ticket);
+}
+
+
+static void op_complete(evrythng_handle_t handle, mqtt_op* op, evrythng_return_t result)
+{
+    evrythng_ticket_t ticket = op->ticket;
+
+    /* the callback runs before the ticket status turns final */
+    if (ticket && ticket->callback)
+        (*ticket->callback)(result, ticket->userdata);
+
+    platform_mutex_lock(&handle->op_queue.mtx);
+    op->result = result;
+    op->state = OP_DONE;
+    if (!ticket)
+        platform_semaphore_post(&op->done_sem);
+    platform_mutex_unlock(&handle->op_queue.mtx);
+
+    if (ticket)
+        ticket_unref(ticket);
+}
+
+
+/* Completes all ops left in the queue, used once mqtt_thread is gone or 
+ * the connection is closed. Returns the number of ops completed. */
+static int op_queue_flush(evrythng_handle_t handle, evrythng_return_t result)
+{
+    mqtt_op* batch[OP_QUEUE_BATCH_MAX];
+    int i, n, taken, count = 0;
+
+    do
+    {
+        n = op_queue_pop_batch(handle, batch, OP_QUEUE_BATCH_MAX, &taken, 0);
+        for (i = 0; i < n; i++)
+            op_complete(handle, batch[i], result);
+        count += n;
+    }
+    while (taken > 0);
+
+    return count;
+}
+
+
+/* Waits up to timeout ms for a queued op to be done. An op which was not
+ * taken by then is dropped from the queue, one which is running is waited
+ * for as it may reference the caller's stack. */
+static evrythng_return_t op_wait(evrythng_handle_t handle, mqtt_op* op, int timeout_ms)
+{
+    if (!platform_semaphore_wait(&op->done_sem, timeout_ms))
+        return op->result;
+
+    platform_mutex_lock(&handle->op_queue.mtx);
+    if (op->state == OP_QUEUED)
+    {
+        /* not taken yet, drop it from the ring */
+        handle->op_queue.ops[op->slot] = 0;
+        platform_mutex_unlock(&handle->op_queue.mtx);
+    }
+    else
+    {
+        /* mqtt_thread references our stack until the op is done */
+        int done = op->state == OP_DONE;
+        platform_mutex_unlock(&handle->op_queue.mtx);
+        if (!done)
+            platform_semaphore_wait(&op->done_sem, 0x00FFFFFF);
+    }
+
+    return EVRYTHNG_TIMEOUT;
+}
+
+
+static evrythng_return_t evrythng_async_op(evrythng_handle_t handle, int op, const char* topic, int topic_len, MQTTMessage* message, sub_callback *callback, sub_chunk_callback *chunk_callback)
+{
+    evrythng_return_t rc;
+    mqtt_op _op = {
+        .op = op,
+        .topic = topic,
+        .topic_len = topic_len,
+        .message = message,
+        .callback = callback,
+        .chunk_callback = chunk_callback,
+        .result = EVRYTHNG_FAILURE,
+    };
+
+    if (!handle)
+        return EVRYTHNG_BAD_ARGS;
+
+    platform_semaphore_init(&_op.done_sem);
+
+    if ((rc = op_queue_push(handle, &_op, 1)) != EVRYTHNG_SUCCESS)
+    {
+        platform_semaphore_deinit(&_op.done_sem);
+        return rc;
+    }
+
+    rc = op_wait(handle, &_op, handle->command_timeout_ms * 2);
+
+    platform_semaphore_deinit(&_op.done_sem);
+
+    return rc;
+}
+
+#define MQTT_CLIENTID_LEN 23
+static const char* clientid_charset = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+/* Gives the other connections of the handle its settings, they connect 
+ * with the same key and client IDs derived from its own. */
+static evrythng_return_t connections_configure(evrythng_handle_t handle)
+{
+    char client_id[MQTT_CLIENTID_LEN + 1];
+    evrythng_return_t rc;
+    int i;
+
+    for (i = 1; i < handle->nconnections; i++)
+    {
+        evrythng_handle_t c = handle->connections[i - 1];
+
+        if (c->initialized)
+            continue;
+
+        if (handle->host && (rc = replace_str(&c->host, handle->host, strlen(handle->host))) != EVRYTHNG_SUCCESS)
+            return rc;
+        c->port = handle->port;
+        c->secure_connection = handle->secure_connection;
+        c->ca_buf = handle->ca_buf;
+        c->ca_size = handle->ca_size;
+
+        c->mqtt_conn_opts = handle->mqtt_conn_opts;
+        c->mqtt_conn_opts.password.cstring = 0;
+        if (handle->key && (rc = EvrythngSetKey(c, handle->key)) != EVRYTHNG_SUCCESS)
+            return rc;
+        /* the suffix replaces the end of an ID too long to take it */
+        snprintf(client_id, sizeof client_id, "%.*s-%d", MQTT_CLIENTID_LEN - snprintf(0, 0, "-%d", i), handle->client_id, i);
+        if ((rc = EvrythngSetClientId(c, client_id)) != EVRYTHNG_SUCCESS)
+            return rc;
+
+        c->qos = handle->qos;
+        c->command_timeout_ms = handle->command_timeout_ms;
+        c->mqtt_client.command_timeout_ms = handle->mqtt_client.command_timeout_ms;
+        c->reconnect_min_ms = handle->reconnect_min_ms;
+        c->reconnect_max_ms = handle->reconnect_max_ms;
+        c->connect_timeout_ms = handle->connect_timeout_ms;
+        c->log_callback = handle->log_callback;
+        c->on_connection_lost = handle->on_connection_lost;
+        c->on_connection_restored = handle->on_connection_restored;
+        c->mqtt_thread_priority = handle->mqtt_thread_priority;
+        c->mqtt_thread_stacksize = handle->mqtt_thread_stacksize;
+        c->spool_rate = handle->spool_rate;
+
+        if ((rc = EvrythngSetOpQueueDepth(c, handle->op_queue.depth)) != EVRYTHNG_SUCCESS
+                || (rc = EvrythngSetMaxInflight(c, handle->mqtt_client.max_inflight)) != EVRYTHNG_SUCCESS
+                || (rc = EvrythngSetAggregation(c, handle->aggr_window_ms, handle->aggr_max_count, handle->aggr_max_bytes)) != EVRYTHNG_SUCCESS
+                || (rc = EvrythngSetSendBatching(c, handle->cork_size)) != EVRYTHNG_SUCCESS
+                || (rc = EvrythngSetMessagePool(c, handle->msg_pool_count)) != EVRYTHNG_SUCCESS
+                || (handle->reactor && !c->reactor && (rc = EvrythngSetReactor(c, handle->reactor)) != EVRYTHNG_SUCCESS))
+            return rc;
+    }
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+evrythng_return_t EvrythngConnect(evrythng_handle_t handle)
+{
+    evrythng_return_t rc;
+    int i;
+
+    if (!handle)
+        return EVRYTHNG_BAD_ARGS;
+
+    if (!handle->initialized)
+    {
+        if (!handle->client_id)
+        {
+            int i;
+            handle->client_id = (char*)platform_malloc(MQTT_CLIENTID_LEN+1);
+            if (!handle->client_id)
+                return EVRYTHNG_MEMORY_ERROR;
+            memset(handle->client_id, 0, MQTT_CLIENTID_LEN+1);
+
+            for (i = 0; i < MQTT_CLIENTID_LEN; i++)
+                handle->client_id[i] = clientid_charset[platform_rand() % strlen(clientid_charset)];
+
+            handle->mqtt_conn_opts.clientID.cstring = handle->client_id;
+            debug("client ID: %s", handle->client_id);
+        }
+
+        if ((rc = connections_configure(handle)) != EVRYTHNG_SUCCESS)
+            return rc;
+
+        /* a handle driven by a reactor is attached when its first op is taken */
+        if (!handle->shard)
+            platform_thread_create(&handle->mqtt_thread, handle->mqtt_thread_priority, "mqtt_thread", mqtt_thread, handle->mqtt_thread_stacksize, (void*)handle);
+
+        handle->initialized = 1;
+    }
+
+    for (i = 1; i < handle->nconnections; i++)
+        if ((rc = EvrythngConnect(handle->connections[i - 1])) != EVRYTHNG_SUCCESS)
+            return rc;
+
+    if (MQTTisConnected(&handle->mqtt_client))
+    {
+        warning("already connected");
+        return EVRYTHNG_SUCCESS;
+    }
+
+    return evrythng_async_op(handle, MQTT_CONNECT, 0, 0, 0, 0, 0);
+}
+
+
+/* Subscribes again to all topics, packing them in as few subscribe 
+ * packets as possible which are sent without waiting for each suback. */
+static void restore_subscriptions(evrythng_handle_t handle)
+{
+    sub_callback_t* _sub_callback;
+    int i, count = 0;
+
+    for (_sub_callback = handle->sub_callbacks; _sub_callback; _sub_callback = _sub_callback->next)
+        count++;
+    if (!count)
+        return;
+
+    MQTTString* topics = (MQTTString*)platform_malloc(count * (sizeof(MQTTString) + 2 * sizeof(int)));
+    if (!topics)
+    {
+        error("not enough memory to restore subscriptions");
+        return;
+    }
+    int* qos = (int*)(topics + count);
+    int* granted = qos + count;
+
+    for (i = 0, _sub_callback = handle->sub_callbacks; _sub_callback; i++, _sub_callback = _sub_callback->next)
+    {
+        topics[i].cstring = 0;
+        topics[i].lenstring.data = _sub_callback->topic;
+        topics[i].lenstring.len = strlen(_sub_callback->topic);
+        qos[i] = _sub_callback->qos;
+    }
+
+    int rc = MQTTSubscribeMany(&handle->mqtt_client, count, topics, qos, granted);
+    if (rc != MQTT_SUCCESS)
+        error("subscription failed, rc = %d", rc);
+
+    for (i = 0, _sub_callback = handle->sub_callbacks; _sub_callback; i++, _sub_callback = _sub_callback->next)
+    {
+        if (granted[i] == 0x80)
+        {
+            if (rc == MQTT_SUCCESS)
+                error("subscription to %s refused", _sub_callback->topic);
+        }
+        else
+        {
+            debug("successfully subscribed to %s, granted qos %d", _sub_callback->topic, granted[i]);
+        }
+    }
+
+    platform_free(topics);
+}
+
+
+evrythng_return_t evrythng_connect_internal(evrythng_handle_t handle, int attempts)
+{
+    int rc = MQTT_FAILURE;
+
+    if (MQTTisConnected(&handle->mqtt_client))
+    {
+        warning("already connected");
+        return EVRYTHNG_SUCCESS;
+    }
+
+    if (handle->secure_connection)
+    {
+        /* the CA chain is parsed once for all handles */
+        if (!handle->tls_ca)
+            handle->tls_ca = platform_tls_ca_get(handle->ca_buf, handle->ca_size);
+        if (!handle->tls_ca)
+        {
+            error("Failed to load the CA certificates");
+            return EVRYTHNG_CERT_REQUIRED_ERROR;
+        }
+        platform_network_tlsinit(&handle->mqtt_network, handle->tls_ca, &handle->tls_session);
+    }
+    else
+        platform_network_init(&handle->mqtt_network);
+
+    MQTTConnackData connack;
+    evrythng_return_t result = EVRYTHNG_CONNECTION_FAILED;
+    int network_ms = -1;
+    int attempt;
+    Timer deadline;
+
+    platform_timer_init(&deadline);
+    for (attempt = 1; attempt <= attempts; attempt++)
+    {
+        debug("connecting to host: %s, port: %d (%d)", handle->host, handle->port, attempt);
+
+        /* the network connection and the connack share the connect timeout */
+        platform_timer_countdown(&deadline, handle->connect_timeout_ms);
+        if (platform_network_connect_timeout(&handle->mqtt_network, handle->host, handle->port, handle->connect_timeout_ms))
+        {
+            error("Failed to establish network connection");
+            platform_network_disconnect(&handle->mqtt_network);
+            result = EVRYTHNG_CONNECTION_FAILED;
+            rc = MQTT_FAILURE;
+            continue;
+        }
+        network_ms = handle->connect_timeout_ms - platform_timer_left(&deadline);
+        debug("network connection established in %d ms", network_ms);
+
+        /* the connack is waited for until the deadline */
+        int left_ms = platform_timer_left(&deadline);
+        unsigned int command_timeout_ms = handle->mqtt_client.command_timeout_ms;
+        handle->mqtt_client.command_timeout_ms = left_ms > 0 ? left_ms : 1;
+        rc = MQTTConnectWithResults(&handle->mqtt_client, &handle->mqtt_conn_opts, &connack);
+        handle->mqtt_client.command_timeout_ms = command_timeout_ms;
+        if (rc != MQTT_SUCCESS)
+        {
+            error("Failed to connect, return code %d", rc);
+            platform_network_disconnect(&handle->mqtt_network);
+            /* a connack return code means the server refused the connection */
+            result = rc > 0 ? EVRYTHNG_FAILURE : EVRYTHNG_TIMEOUT;
+            continue;
+        }
+        debug("MQTT connected");
+        break;
+    }
+
+    /* the client mutex is not taken under the op queue one, publishes are
+     * completed while the client holds it */
+    int connected = MQTTisConnected(&handle->mqtt_client);
+
+    platform_mutex_lock(&handle->op_queue.mtx);
+    handle->reconnect_mqtt_rc = rc;
+    handle->reconnect_error = connected ? EVRYTHNG_SUCCESS : result;
+    if (connected)
+    {
+        handle->connect_network_ms = network_ms;
+        handle->connect_total_ms = handle->connect_timeout_ms - platform_timer_left(&deadline);
+        handle->connect_resumed = handle->secure_connection && platform_network_resumed(&handle->mqtt_network);
+    }
+    platform_mutex_unlock(&handle->op_queue.mtx);
+    platform_timer_deinit(&deadline);
+
+    if (!connected)
+    {
+        return result;
+    }
+
+    /* the subscriptions were kept with the session */
+    if (connack.sessionPresent)
+    {
+        debug("session present");
+    }
+    else
+    {
+        restore_subscriptions(handle);
+    }
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+evrythng_return_t EvrythngDisconnect(evrythng_handle_t handle)
+{
+    int i;
+
+    if (!handle)
+        return EVRYTHNG_BAD_ARGS;
+
+    if (!handle->initialized)
+        return EVRYTHNG_SUCCESS;
+
+    for (i = 1; i < handle->nconnections; i++)
+        EvrythngDisconnect(handle->connections[i - 1]);
+
+    if (!MQTTisConnected(&handle->mqtt_client))
+        return EVRYTHNG_SUCCESS;
+
+    EvrythngFlushThngProperties(handle, 0);
+
+    return evrythng_async_op(handle, MQTT_DISCONNECT, 0, 0, 0, 0, 0);
 }
 
 
@@ -601,334 +1968,1946 @@ evrythng_return_t evrythng_disconnect_internal(evrythng_handle_t handle, int gra
 {
     int rc;
 
-    if (!MQTTisConnected(&handle->mqtt_client))
-        return EVRYTHNG_SUCCESS;
+    if (!MQTTisConnected(&handle->mqtt_client))
+        return EVRYTHNG_SUCCESS;
+
+    if (gracefull)
+    {
+        int wait_ms = handle->draining ? platform_timer_left(&handle->drain_deadline) : handle->command_timeout_ms;
+        rc = MQTTWaitInflight(&handle->mqtt_client, wait_ms);
+        if (rc != MQTT_SUCCESS)
+        {
+            warning("not all publishes were acknowledged, rc = %d", rc);
+        }
+
+        /* a persistent session keeps its subscriptions, a clean one loses 
+         * them anyway when draining against a deadline */
+        sub_callback_t* _sub_callback = handle->mqtt_conn_opts.cleansession && !handle->draining ? handle->sub_callbacks : 0;
+        while (_sub_callback) 
+        {
+            rc = MQTTUnsubscribe(&handle->mqtt_client, _sub_callback->topic);
+            if (rc >= 0) 
+            {
+                debug("successfully unsubscribed from %s", _sub_callback->topic);
+            }
+            else 
+            {
+                warning("unsubscription failed, rc = %d", rc);
+                break;
+            }
+            _sub_callback = _sub_callback->next;
+        }
+
+        rc = MQTTDisconnect(&handle->mqtt_client);
+        if (rc != MQTT_SUCCESS)
+        {
+            error("failed to disconnect mqtt: rc = %d", rc);
+        }
+
+        MQTTAbortInflight(&handle->mqtt_client, MQTT_CONNECTION_LOST);
+    }
+    else
+    {
+        handle->mqtt_client.isconnected = 0;
+    }
+
+    platform_network_disconnect(&handle->mqtt_network);
+
+    debug("MQTT disconnected");
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+static evrythng_return_t format_pub_topic(
+        evrythng_handle_t handle, 
+        char* pub_topic,
+        const char* entity, 
+        const char* entity_id, 
+        const char* data_type, 
+        const char* data_name)
+{
+    int rc;
+
+    if (entity_id == NULL) 
+    {
+        rc = snprintf(pub_topic, TOPIC_MAX_LEN, "%s/%s", entity, data_name);
+        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
+        {
+            error("Topic overflow");
+            return EVRYTHNG_BAD_ARGS;
+        }
+    } 
+    else if (data_name == NULL) 
+    {
+        rc = snprintf(pub_topic, TOPIC_MAX_LEN, "%s/%s/%s", entity, entity_id, data_type);
+        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
+        {
+            error("topic overflow");
+            return EVRYTHNG_BAD_ARGS;
+        }
+    } 
+    else 
+    {
+        rc = snprintf(pub_topic, TOPIC_MAX_LEN, "%s/%s/%s/%s", entity, entity_id, data_type, data_name);
+        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
+        {
+            error("topic overflow");
+            return EVRYTHNG_BAD_ARGS;
+        }
+    }
+
+    debug("publish topic: %s", pub_topic);
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+/* Decides whether a publish is sent now or kept in the spool, which it is
+ * while not connected and until the publishes before it were replayed. 
+ * Returns EVRYTHNG_SUCCESS if the publish is to be sent, otherwise its result. */
+static evrythng_return_t spool_check(
+        evrythng_handle_t handle, 
+        const char* topic, 
+        int topic_len, 
+        const char* payload, 
+        size_t payloadlen)
+{
+    int connected = MQTTisConnected(&handle->mqtt_client);
+
+    if (!handle->spool.data)
+    {
+        if (connected)
+            return EVRYTHNG_SUCCESS;
+        error("client is not connected");
+        return EVRYTHNG_NOT_CONNECTED;
+    }
+
+    platform_mutex_lock(&handle->spool_mtx);
+    if (connected && handle->spool.state.count == 0)
+    {
+        platform_mutex_unlock(&handle->spool_mtx);
+        return EVRYTHNG_SUCCESS;
+    }
+    int rc = spool_push(&handle->spool, topic, topic_len, handle->qos, payload, payloadlen);
+    platform_mutex_unlock(&handle->spool_mtx);
+
+    if (rc)
+    {
+        warning("spool full, publish to %s dropped", topic);
+        return EVRYTHNG_QUEUE_FULL;
+    }
+
+    if (connected)
+        handle_wake(handle);
+
+    return EVRYTHNG_SPOOLED;
+}
+
+
+evrythng_return_t evrythng_publish(
+        evrythng_handle_t handle, 
+        const char* entity, 
+        const char* entity_id, 
+        const char* data_type, 
+        const char* data_name, 
+        const char* property_json)
+{
+    if (!handle) return EVRYTHNG_BAD_ARGS;
+
+    handle = connection_for(handle, entity_id, data_name);
+
+    evrythng_return_t rc;
+    char pub_topic[TOPIC_MAX_LEN];
+
+    if ((rc = format_pub_topic(handle, pub_topic, entity, entity_id, data_type, data_name)) != EVRYTHNG_SUCCESS)
+        return rc;
+
+    size_t payloadlen = strlen(property_json);
+
+    if ((rc = spool_check(handle, pub_topic, strlen(pub_topic), property_json, payloadlen)) != EVRYTHNG_SUCCESS)
+        return rc;
+
+    MQTTMessage msg = {
+        .qos = handle->qos, 
+        .retained = 1, 
+        .dup = 0,
+        .id = 0,
+        .payload = (void*)property_json,
+        .payloadlen = payloadlen
+    };
+
+    return evrythng_async_op(handle, MQTT_PUBLISH, pub_topic, 0, &msg, 0, 0);
+}
+
+
+/* Allocates an asynchronous publish with a copy of the payload, 
+ * the topic is filled in by the caller. */
+static evrythng_ticket_t ticket_new(
+        evrythng_handle_t handle, 
+        const char* property_json,
+        size_t payloadlen,
+        evrythng_pub_callback callback,
+        void* userdata,
+        int app_ref)
+{
+    evrythng_ticket_t t = (evrythng_ticket_t)platform_malloc(sizeof(struct evrythng_ticket_t) + payloadlen + 1);
+    if (!t)
+        return 0;
+    memset(t, 0, sizeof(struct evrythng_ticket_t));
+
+    /* the payload is stored right after the ticket */
+    memcpy(t + 1, property_json, payloadlen + 1);
+
+    t->message.qos = handle->qos;
+    t->message.retained = 1;
+    t->message.payload = (void*)(t + 1);
+    t->message.payloadlen = payloadlen;
+
+    t->handle = handle;
+    t->callback = callback;
+    t->userdata = userdata;
+    t->refs = app_ref ? 2 : 1;
+
+    t->op.op = MQTT_PUBLISH;
+    t->op.topic = t->topic;
+    t->op.message = &t->message;
+    t->op.result = EVRYTHNG_IN_PROGRESS;
+    t->op.ticket = t;
+
+    return t;
+}
+
+
+static evrythng_return_t ticket_push(evrythng_handle_t handle, evrythng_ticket_t t, evrythng_ticket_t* ticket)
+{
+    evrythng_return_t rc;
+
+    if ((rc = op_queue_push(handle, &t->op, 0)) != EVRYTHNG_SUCCESS)
+    {
+        platform_free(t);
+        return rc;
+    }
+
+    if (ticket)
+        *ticket = t;
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+evrythng_return_t evrythng_publish_async(
+        evrythng_handle_t handle, 
+        const char* entity, 
+        const char* entity_id, 
+        const char* data_type, 
+        const char* data_name, 
+        const char* property_json,
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!handle) return EVRYTHNG_BAD_ARGS;
+
+    handle = connection_for(handle, entity_id, data_name);
+
+    evrythng_return_t rc;
+    char pub_topic[TOPIC_MAX_LEN];
+
+    if ((rc = format_pub_topic(handle, pub_topic, entity, entity_id, data_type, data_name)) != EVRYTHNG_SUCCESS)
+        return rc;
+
+    int topic_len = strlen(pub_topic);
+    size_t payloadlen = strlen(property_json);
+
+    if ((rc = spool_check(handle, pub_topic, topic_len, property_json, payloadlen)) != EVRYTHNG_SUCCESS)
+        return rc;
+
+    evrythng_ticket_t t = ticket_new(handle, property_json, payloadlen, callback, userdata, ticket != 0);
+    if (!t)
+        return EVRYTHNG_MEMORY_ERROR;
+
+    memcpy(t->topic, pub_topic, topic_len + 1);
+    t->op.topic_len = topic_len;
+
+    return ticket_push(handle, t, ticket);
+}
+
+
+evrythng_return_t evrythng_prepare_topic(
+        evrythng_handle_t handle, 
+        const char* entity, 
+        const char* entity_id, 
+        const char* data_type, 
+        const char* data_name, 
+        evrythng_topic_t* topic)
+{
+    if (!handle || !topic) return EVRYTHNG_BAD_ARGS;
+
+    int connection = connection_index(handle, entity_id ? entity_id : data_name);
+    evrythng_return_t rc;
+    char pub_topic[TOPIC_MAX_LEN];
+
+    if ((rc = format_pub_topic(handle, pub_topic, entity, entity_id, data_type, data_name)) != EVRYTHNG_SUCCESS)
+        return rc;
+
+    int len = strlen(pub_topic);
+
+    /* the name is stored right after the topic */
+    evrythng_topic_t t = (evrythng_topic_t)platform_malloc(sizeof(struct evrythng_topic_t) + len + 1);
+    if (!t)
+        return EVRYTHNG_MEMORY_ERROR;
+
+    t->len = len;
+    t->name = (char*)(t + 1);
+    t->connection = connection;
+    memcpy(t->name, pub_topic, len + 1);
+
+    *topic = t;
+
+    return EVRYTHNG_SUCCESS;
+}
+
+
+void EvrythngTopicRelease(evrythng_topic_t topic)
+{
+    if (topic)
+        platform_free(topic);
+}
+
+
+evrythng_return_t EvrythngPubPrepared(
+        evrythng_handle_t handle, 
+        evrythng_topic_t topic, 
+        const char* property_json)
+{
+    if (!handle || !topic || !property_json) return EVRYTHNG_BAD_ARGS;
+
+    handle = connection_at(handle, topic->connection);
+
+    evrythng_return_t rc;
+    size_t payloadlen = strlen(property_json);
+
+    if ((rc = spool_check(handle, topic->name, topic->len, property_json, payloadlen)) != EVRYTHNG_SUCCESS)
+        return rc;
+
+    MQTTMessage msg = {
+        .qos = handle->qos, 
+        .retained = 1, 
+        .dup = 0,
+        .id = 0,
+        .payload = (void*)property_json,
+        .payloadlen = payloadlen
+    };
+
+    return evrythng_async_op(handle, MQTT_PUBLISH, topic->name, topic->len, &msg, 0, 0);
+}
+
+
+evrythng_return_t EvrythngPubPreparedAsync(
+        evrythng_handle_t handle, 
+        evrythng_topic_t topic, 
+        const char* property_json,
+        evrythng_pub_callback callback,
+        void* userdata,
+        evrythng_ticket_t* ticket)
+{
+    if (!handle || !topic || !property_json) return EVRYTHNG_BAD_ARGS;
+
+    handle = connection_at(handle, topic->connection);
+
+    evrythng_return_t rc;
+    size_t payloadlen = strlen(property_json);
+
+    if ((rc = spool_check(handle, topic->name, topic->len, property_json, payloadlen)) != EVRYTHNG_SUCCESS)
+        return rc;
+
+    evrythng_ticket_t t = ticket_new(handle, property_json, payloadlen, callback, userdata, ticket != 0);
+    if (!t)
+        return EVRYTHNG_MEMORY_ERROR;
+
+    memcpy(t->topic, topic->name, topic->len + 1);
+    t->op.topic_len = topic->len;
+
+    return ticket_push(handle, t, ticket);
+}
+
+
+evrythng_return_t EvrythngTicketStatus(evrythng_ticket_t ticket)
+{
+    if (!ticket)
+        return EVRYTHNG_BAD_ARGS;
+
+    platform_mutex_lock(&ticket->handle->op_queue.mtx);
+    evrythng_return_t rc = ticket->op.result;
+    platform_mutex_unlock(&ticket->handle->op_queue.mtx);
+
+    return rc;
+}
+
+
+void EvrythngTicketRelease(evrythng_ticket_t ticket)
+{
+    if (!ticket)
+        return;
+
+    ticket_unref(ticket);
+}
+
+
+static const char* skip_ws(const char* p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+        p++;
+    return p;
+}
+
+
+static void aggr_emit(char* dst, int* len, const char* s, int n)
+{
+    if (dst)
+        memcpy(dst + *len, s, n);
+    *len += n;
+}
+
+
+/* Emits a string as the contents of a JSON string, quotes, backslashes and
+ * control characters escaped. */
+static void aggr_emit_string(char* dst, int* len, const char* s)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    for (; *s; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+        {
+            char esc[2] = { '\\', (char)c };
+            aggr_emit(dst, len, esc, 2);
+        }
+        else if (c < 0x20)
+        {
+            char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+            aggr_emit(dst, len, esc, 6);
+        }
+        else
+            aggr_emit(dst, len, s, 1);
+    }
+}
+
+
+/* Converts a property value array such as [{"value": 1}] to the entries of 
+ * a properties message, {"key": "<name>", "value": 1}, separated by ", " 
+ * unless first is set. The name is escaped. With a null dst only the length is computed. 
+ * Returns the length or -1 if the JSON is not an array of objects. */
+static int aggr_format(char* dst, int first, const char* name, const char* json)
+{
+    const char* p = skip_ws(json);
+    int len = 0;
+
+    if (*p != '[')
+        return -1;
+    p = skip_ws(p + 1);
+
+    while (*p != ']')
+    {
+        const char* end;
+        int depth = 1, in_str = 0;
+
+        if (*p != '{')
+            return -1;
+
+        /* find the end of the object, brackets inside strings do not count */
+        for (end = p + 1; *end && depth; end++)
+        {
+            if (in_str)
+            {
+                if (*end == '\\' && end[1])
+                    end++;
+                else if (*end == '"')
+                    in_str = 0;
+            }
+            else if (*end == '"')
+                in_str = 1;
+            else if (*end == '{' || *end == '[')
+                depth++;
+            else if (*end == '}' || *end == ']')
+                depth--;
+        }
+        if (depth)
+            return -1;
+
+        if (!first)
+            aggr_emit(dst, &len, ", ", 2);
+        first = 0;
+        aggr_emit(dst, &len, "{\"key\": \"", 9);
+        aggr_emit_string(dst, &len, name);
+        aggr_emit(dst, &len, "\"", 1);
+
+        p = skip_ws(p + 1);
+        if (*p != '}')
+            aggr_emit(dst, &len, ", ", 2);
+        aggr_emit(dst, &len, p, end - p);
+
+        p = skip_ws(end);
+        if (*p == ',')
+        {
+            p = skip_ws(p + 1);
+            if (*p != '{')
+                return -1;
+        }
+        else if (*p != ']')
+            return -1;
+    }
+
+    return len;
+}
+
+
+/* Detaches the pending message of a thing, closed and ready to publish. */
+static char* aggr_take(aggr_thng_t* a)
+{
+    char* payload = a->buf;
+
+    payload[a->len] = ']';
+    payload[a->len + 1] = '\0';
+
+    a->buf = 0;
+    a->len = a->size = a->count = 0;
+
+    return payload;
+}
+
+
+static evrythng_return_t aggr_publish(evrythng_handle_t handle, const char* thng_id, char* payload)
+{
+    evrythng_return_t rc = evrythng_publish(handle, "thngs", thng_id, "properties", 0, payload);
+    if (rc != EVRYTHNG_SUCCESS && rc != EVRYTHNG_SPOOLED)
+    {
+        error("could not publish aggregated properties of %s, rc = %d", thng_id, rc);
+    }
+    platform_free(payload);
+    return rc;
+}
+
+
+evrythng_return_t EvrythngAggregateThngProperty(
+        evrythng_handle_t handle, 
+        const char* thng_id, 
+        const char* property_name, 
+        const char* property_json)
+{
+    if (!handle || !thng_id || !property_name || !property_json)
+        return EVRYTHNG_BAD_ARGS;
+
+    handle = connection_for(handle, thng_id, 0);
+
+    int add = aggr_format(0, 1, property_name, property_json);
+    if (add < 0)
+    {
+        error("%s: property value is not an array of objects", __func__);
+        return EVRYTHNG_BAD_ARGS;
+    }
+    if (add == 0)
+        return EVRYTHNG_SUCCESS;
+
+    if (!MQTTisConnected(&handle->mqtt_client)) 
+    {
+        error("%s: client is not connected", __func__);
+        return EVRYTHNG_NOT_CONNECTED;
+    }
+
+    evrythng_return_t rc = EVRYTHNG_SUCCESS, r;
+    char *full = 0, *ready = 0;
+    int notify = 0;
+    aggr_thng_t* a;
+
+    platform_mutex_lock(&handle->aggr_mtx);
+
+    for (a = handle->aggr; a; a = a->next)
+        if (!strcmp(a->thng_id, thng_id))
+            break;
+
+    if (!a)
+    {
+        a = (aggr_thng_t*)platform_malloc(sizeof(aggr_thng_t));
+        if (!a || !(a->thng_id = (char*)platform_malloc(strlen(thng_id) + 1)))
+        {
+            if (a) platform_free(a);
+            platform_mutex_unlock(&handle->aggr_mtx);
+            return EVRYTHNG_MEMORY_ERROR;
+        }
+        strcpy(a->thng_id, thng_id);
+        a->buf = 0;
+        a->len = a->size = a->count = 0;
+        platform_timer_init(&a->deadline);
+        a->next = handle->aggr;
+        handle->aggr = a;
+    }
+
+    /* the pending updates go first if this one would make the message too long */
+    if (a->count && a->len + 2 + add + 1 > handle->aggr_max_bytes)
+        full = aggr_take(a);
+
+    /* room for the separator, the closing bracket and the terminator */
+    int needed = (a->count ? a->len + 2 : 1) + add + 2;
+    if (needed > a->size)
+    {
+        char* buf = (char*)platform_realloc(a->buf, needed);
+        if (!buf)
+        {
+            rc = EVRYTHNG_MEMORY_ERROR;
+            goto out;
+        }
+        a->buf = buf;
+        a->size = needed;
+    }
+
+    if (!a->count)
+    {
+        a->buf[0] = '[';
+        a->len = 1;
+        platform_timer_countdown(&a->deadline, handle->aggr_window_ms);
+        notify = handle->aggr_window_ms > 0;
+    }
+
+    a->len += aggr_format(a->buf + a->len, a->count == 0, property_name, property_json);
+    a->count++;
+
+    if (a->count >= handle->aggr_max_count)
+        ready = aggr_take(a);
+
+out:
+    platform_mutex_unlock(&handle->aggr_mtx);
+
+    /* let mqtt_thread pick up the new deadline */
+    if (notify)
+        handle_wake(handle);
+
+    if (full && (r = aggr_publish(handle, thng_id, full)) != EVRYTHNG_SUCCESS)
+        rc = r;
+    if (ready && (r = aggr_publish(handle, thng_id, ready)) != EVRYTHNG_SUCCESS && rc == EVRYTHNG_SUCCESS)
+        rc = r;
+
+    return rc;
+}
+
+
+evrythng_return_t EvrythngFlushThngProperties(evrythng_handle_t handle, const char* thng_id)
+{
+    if (!handle)
+        return EVRYTHNG_BAD_ARGS;
+
+    evrythng_return_t rc = EVRYTHNG_SUCCESS, r;
+    int i;
+
+    if (thng_id)
+        handle = connection_for(handle, thng_id, 0);
+    else
+        for (i = 1; i < handle->nconnections; i++)
+            if ((r = EvrythngFlushThngProperties(handle->connections[i - 1], 0)) != EVRYTHNG_SUCCESS)
+                rc = r;
+
+    for (;;)
+    {
+        char* payload = 0;
+        aggr_thng_t* a;
+
+        platform_mutex_lock(&handle->aggr_mtx);
+        for (a = handle->aggr; a; a = a->next)
+        {
+            if (a->count && (!thng_id || !strcmp(a->thng_id, thng_id)))
+            {
+                payload = aggr_take(a);
+                break;
+            }
+        }
+        platform_mutex_unlock(&handle->aggr_mtx);
+
+        if (!payload)
+            break;
+
+        /* entries live as long as the handle, a->thng_id stays valid */
+        if ((r = aggr_publish(handle, a->thng_id, payload)) != EVRYTHNG_SUCCESS && rc == EVRYTHNG_SUCCESS)
+            rc = r;
+    }
+
+    return rc;
+}
+
+
+/* Queues the pending updates of all things of a connection without waiting
+ * for them to be sent, retrying while the op queue is full until the 
+ * deadline. Returns the number of messages which were not queued. */
+static unsigned int aggr_drain(evrythng_handle_t handle, Timer* deadline)
+{
+    unsigned int dropped = 0;
+
+    for (;;)
+    {
+        char* payload = 0;
+        aggr_thng_t* a;
+        evrythng_return_t rc;
+
+        platform_mutex_lock(&handle->aggr_mtx);
+        for (a = handle->aggr; a; a = a->next)
+        {
+            if (a->count)
+            {
+                payload = aggr_take(a);
+                break;
+            }
+        }
+        platform_mutex_unlock(&handle->aggr_mtx);
+
+        if (!payload)
+            break;
+
+        while ((rc = evrythng_publish_async(handle, "thngs", a->thng_id, "properties", 0, payload, 0, 0, 0)) == EVRYTHNG_QUEUE_FULL
+                && !platform_timer_isexpired(deadline))
+            platform_sleep(1);
+
+        if (rc != EVRYTHNG_SUCCESS && rc != EVRYTHNG_SPOOLED)
+        {
+            error("could not queue aggregated properties of %s, rc = %d", a->thng_id, rc);
+            dropped++;
+        }
+        platform_free(payload);
+    }
+
+    return dropped;
+}
+
+
+/* Queues the pending aggregated updates and the disconnection of a 
+ * connection behind the ops already queued, which mqtt_thread runs while 
+ * the deadline allows, see drain_op. The op is left as MQTT_NOP if the 
+ * connection is not established. Returns the number of updates dropped. */
+static unsigned int drain_start(evrythng_handle_t handle, mqtt_op* op, Timer* deadline)
+{
+    unsigned int dropped;
+
+    memset(op, 0, sizeof *op);
+    op->op = MQTT_NOP;
+
+    if (!MQTTisConnected(&handle->mqtt_client))
+        return aggr_drain(handle, deadline);
+
+    platform_mutex_lock(&handle->op_queue.mtx);
+    handle->draining = 1;
+    handle->drain_queued_dropped = 0;
+    handle->drain_inflight_dropped = 0;
+    platform_timer_countdown(&handle->drain_deadline, platform_timer_left(deadline));
+    platform_mutex_unlock(&handle->op_queue.mtx);
+
+    dropped = aggr_drain(handle, deadline);
+
+    platform_semaphore_init(&op->done_sem);
+    op->op = MQTT_DISCONNECT;
+    op->result = EVRYTHNG_FAILURE;
+    if (op_queue_push(handle, op, 1) != EVRYTHNG_SUCCESS)
+    {
+        op->op = MQTT_NOP;
+        platform_semaphore_deinit(&op->done_sem);
+        platform_mutex_lock(&handle->op_queue.mtx);
+        handle->draining = 0;
+        platform_mutex_unlock(&handle->op_queue.mtx);
+    }
+
+    return dropped;
+}
+
+
+/* Waits for the disconnection queued by drain_start and adds what was 
+ * dropped to the report. Ops still queued then are dropped as well. */
+static void drain_finish(evrythng_handle_t handle, mqtt_op* op, Timer* deadline, evrythng_disconnect_report_t* report)
+{
+    if (op->op == MQTT_DISCONNECT)
+    {
+        if (op_wait(handle, op, platform_timer_left(deadline) + handle->command_timeout_ms) != EVRYTHNG_SUCCESS)
+        {
+            warning("disconnection did not complete in time");
+        }
+        platform_semaphore_deinit(&op->done_sem);
+
+        platform_mutex_lock(&handle->op_queue.mtx);
+        handle->draining = 0;
+        report->queued_dropped += handle->drain_queued_dropped;
+        report->inflight_dropped += handle->drain_inflight_dropped;
+        platform_mutex_unlock(&handle->op_queue.mtx);
+    }
+
+    report->queued_dropped += op_queue_flush(handle, EVRYTHNG_NOT_CONNECTED);
+}
+
+
+evrythng_return_t EvrythngDisconnectTimeout(evrythng_handle_t handle, int timeout_ms, evrythng_disconnect_report_t* report)
+{
+    evrythng_disconnect_report_t r;
+    evrythng_spool_stats_t spool;
+    Timer deadline, elapsed;
+    int i, n;
+
+    if (!handle || timeout_ms < 0)
+        return EVRYTHNG_BAD_ARGS;
+
+    memset(&r, 0, sizeof r);
+    platform_timer_init(&elapsed);
+    platform_timer_countdown(&elapsed, 0x00FFFFFF);
+    platform_timer_init(&deadline);
+    platform_timer_countdown(&deadline, timeout_ms);
+
+    if (handle->initialized)
+    {
+        n = handle->nconnections > 1 ? handle->nconnections : 1;
+
+        mqtt_op* ops = (mqtt_op*)platform_malloc(n * sizeof(mqtt_op));
+        if (!ops)
+        {
+            platform_timer_deinit(&elapsed);
+            platform_timer_deinit(&deadline);
+            return EVRYTHNG_MEMORY_ERROR;
+        }
+
+        /* the connections drain in parallel */
+        for (i = 0; i < n; i++)
+            r.queued_dropped += drain_start(connection_at(handle, i), &ops[i], &deadline);
+        for (i = 0; i < n; i++)
+            drain_finish(connection_at(handle, i), &ops[i], &deadline, &r);
+
+        platform_free(ops);
+
+        EvrythngGetSpoolStats(handle, &spool);
+        r.spooled = spool.count;
+    }
+
+    r.elapsed_ms = 0x00FFFFFF - platform_timer_left(&elapsed);
+    platform_timer_deinit(&elapsed);
+    platform_timer_deinit(&deadline);
+
+    if (r.queued_dropped || r.inflight_dropped)
+    {
+        warning("disconnected in %d ms, dropped %u queued and %u unacknowledged messages", 
+                r.elapsed_ms, r.queued_dropped, r.inflight_dropped);
+    }
+
+    if (report)
+        *report = r;
+
+    return r.queued_dropped || r.inflight_dropped ? EVRYTHNG_TIMEOUT : EVRYTHNG_SUCCESS;
+}
+
+
+/* Queues the messages of the things whose window has passed, called by 
+ * mqtt_thread. Returns the time until the next window ends or -1 if no 
+ * update is pending. */
+static int aggr_flush_expired(evrythng_handle_t handle)
+{
+    aggr_thng_t* a;
+    int next = -1;
+
+    platform_mutex_lock(&handle->aggr_mtx);
+
+    for (a = handle->aggr; a && handle->aggr_window_ms; a = a->next)
+    {
+        if (!a->count)
+            continue;
+
+        int left = platform_timer_left(&a->deadline);
+        if (left <= 0)
+        {
+            evrythng_return_t rc;
+
+            a->buf[a->len] = ']';
+            a->buf[a->len + 1] = '\0';
+
+            /* the ticket takes a copy, the buffer is kept for the next updates */
+            rc = evrythng_publish_async(handle, "thngs", a->thng_id, "properties", 0, a->buf, 0, 0, 0);
+            if (rc == EVRYTHNG_SUCCESS)
+            {
+                a->len = a->count = 0;
+                continue;
+            }
+
+            if (rc != EVRYTHNG_NOT_CONNECTED)
+            {
+                warning("could not queue properties of %s, rc = %d", a->thng_id, rc);
+            }
+            platform_timer_countdown(&a->deadline, handle->aggr_window_ms);
+            left = handle->aggr_window_ms;
+        }
+
+        if (next < 0 || left < next)
+            next = left;
+    }
+
+    platform_mutex_unlock(&handle->aggr_mtx);
+
+    return next;
+}
+
+
+evrythng_return_t evrythng_subscribe_chunked(
+        evrythng_handle_t handle, 
+        const char* entity, 
+        const char* entity_id, 
+        const char* data_type, 
+        const char* data_name, 
+        int pub_states,
+        sub_callback *callback,
+        sub_chunk_callback *chunk_callback)
+{
+    handle = connection_for(handle, entity_id, data_name);
+
+    if (!MQTTisConnected(&handle->mqtt_client)) 
+    {
+        error("%s: client is not connected", __func__);
+        return EVRYTHNG_NOT_CONNECTED;
+    }
+
+    int rc;
+    char sub_topic[TOPIC_MAX_LEN] = { 0 };
+
+    if (entity_id == NULL) 
+    {
+        rc = snprintf(sub_topic, TOPIC_MAX_LEN, "%s/%s?pubStates=%d", entity, data_name, pub_states);
+        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
+        {
+            debug("topic overflow");
+            return EVRYTHNG_BAD_ARGS;
+        }
+    } 
+    else if (data_name == NULL) 
+    {
+        rc = snprintf(sub_topic, TOPIC_MAX_LEN, "%s/%s/%s?pubStates=%d", entity, entity_id, data_type, pub_states);
+        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
+        {
+            debug("topic overflow");
+            return EVRYTHNG_BAD_ARGS;
+        }
+    } 
+    else 
+    {
+        rc = snprintf(sub_topic, TOPIC_MAX_LEN, "%s/%s/%s/%s?pubStates=%d", entity, entity_id, data_type, data_name, pub_states);
+        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
+        {
+            debug("topic overflow");
+            return EVRYTHNG_BAD_ARGS;
+        }
+    }
+
+    return evrythng_async_op(handle, MQTT_SUBSCRIBE, sub_topic, 0, 0, callback, chunk_callback);
+}
+
+
+evrythng_return_t evrythng_subscribe(
+        evrythng_handle_t handle, 
+        const char* entity, 
+        const char* entity_id, 
+        const char* data_type, 
+        const char* data_name, 
+        int pub_states,
+        sub_callback *callback)
+{
+    return evrythng_subscribe_chunked(handle, entity, entity_id, data_type, data_name, pub_states, callback, 0);
+}
+
+
+evrythng_return_t evrythng_unsubscribe(
+        evrythng_handle_t handle, 
+        const char* entity, 
+        const char* entity_id, 
+        const char* data_type, 
+        const char* data_name)
+{
+    handle = connection_for(handle, entity_id, data_name);
+
+    if (!MQTTisConnected(&handle->mqtt_client)) 
+    {
+        error("%s: client is not connected", __func__);
+        return EVRYTHNG_NOT_CONNECTED;
+    }
+
+    int rc;
+    char unsub_topic[TOPIC_MAX_LEN];
+
+    if (entity_id == NULL) 
+    {
+        rc = snprintf(unsub_topic, TOPIC_MAX_LEN, "%s/%s", entity, data_name);
+        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
+        {
+            debug("topic overflow");
+            return EVRYTHNG_BAD_ARGS;
+        }
+    } 
+    else if (data_name == NULL) 
+    {
+        rc = snprintf(unsub_topic, TOPIC_MAX_LEN, "%s/%s/%s", entity, entity_id, data_type);
+        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
+        {
+            debug("topic overflow");
+            return EVRYTHNG_BAD_ARGS;
+        }
+    } 
+    else 
+    {
+        rc = snprintf(unsub_topic, TOPIC_MAX_LEN, "%s/%s/%s/%s", entity, entity_id, data_type, data_name);
+        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
+        {
+            debug("topic overflow");
+            return EVRYTHNG_BAD_ARGS;
+        }
+    }
+
+    return evrythng_async_op(handle, MQTT_UNSUBSCRIBE, unsub_topic, 0, 0, 0, 0);
+}
+
+
+/* Completion of a publish which was waiting in the in-flight window. */
+static void publish_complete(unsigned short id, int rc, void* context)
+{
+    mqtt_op* op = (mqtt_op*)context;
+    evrythng_handle_t handle = op->handle;
+
+    if (rc == MQTT_SUCCESS)
+    {
+        debug("publish %u acknowledged", id);
+        op_complete(handle, op, EVRYTHNG_SUCCESS);
+    }
+    else
+    {
+        error("publish %u was not acknowledged, rc = %d", id, rc);
+        if (handle->draining)
+            handle->drain_inflight_dropped++;
+        op_complete(handle, op, rc == MQTT_CONNECTION_LOST ? EVRYTHNG_NOT_CONNECTED : EVRYTHNG_PUBLISH_ERROR);
+    }
+}
+
+
+static int process_op(evrythng_handle_t handle, mqtt_op* op)
+{
+    char actual_topic[TOPIC_MAX_LEN];
+    MQTTString topic = MQTTString_initializer;
+    evrythng_return_t result;
+    int rc = MQTT_SUCCESS;
+
+    switch (op->op)
+    {
+        case MQTT_CONNECT:
+            result = evrythng_connect_internal(handle, 3);
+            break;
+
+        case MQTT_DISCONNECT:
+            result = evrythng_disconnect_internal(handle, 1);
+            /* closed on purpose, it is not to be restored */
+            handle->mqtt_rc = MQTT_SUCCESS;
+            break;
+
+        case MQTT_PUBLISH:
+            if (op->topic_len)
+            {
+                topic.lenstring.data = (char*)op->topic;
+                topic.lenstring.len = op->topic_len;
+            }
+            else
+                topic.cstring = (char*)op->topic;
+
+            if (op->message->qos != QOS0 && handle->mqtt_client.max_inflight > 0)
+            {
+                op->handle = handle;
+                rc = MQTTPublishTopicAsync(&handle->mqtt_client, topic, op->message, publish_complete, op);
+                if (rc == MQTT_SUCCESS)
+                    return rc; /* completed by publish_complete */
+            }
+            else
+                rc = MQTTPublishTopic(&handle->mqtt_client, topic, op->message);
+
+            if (rc == MQTT_SUCCESS) 
+            {
+                debug("published message: %s", op->message->payload);
+                result = EVRYTHNG_SUCCESS;
+            }
+            else 
+            {
+                error("could not publish message, rc = %d", rc);
+                result = EVRYTHNG_PUBLISH_ERROR;
+            }
+            break;
+
+        case MQTT_SUBSCRIBE:
+            result = add_sub_callback(handle, op->topic, handle->qos, op->callback, op->chunk_callback);
+            if (result != EVRYTHNG_SUCCESS)
+            {
+                error("could not add sub topic: %d", result);
+            }
+            else
+            {
+                rc = MQTTSubscribe(&handle->mqtt_client, op->topic, handle->qos);
+                if (rc >= 0) 
+                {
+                    debug("successfully subscribed to %s", op->topic);
+                    result = EVRYTHNG_SUCCESS;
+                }
+                else
+                {
+                    debug("subscription failed: %d", rc);
+                    result = EVRYTHNG_SUBSCRIPTION_ERROR;
+                    rm_sub_callback(handle, op->topic, 0);
+                }
+            }
+            break;
+
+        case MQTT_UNSUBSCRIBE:
+            result = rm_sub_callback(handle, op->topic, actual_topic);
+            if (result != EVRYTHNG_SUCCESS)
+            {
+                debug("could not remove callback for topic: %s", op->topic);
+            }
+            else
+            {
+                rc = MQTTUnsubscribe(&handle->mqtt_client, actual_topic);
+                if (rc >= 0) 
+                {
+                    debug("successfully unsubscribed from %s", actual_topic);
+                    result = EVRYTHNG_SUCCESS;
+                }
+                else
+                {
+                    result = EVRYTHNG_UNSUBSCRIPTION_ERROR;
+                }
+            }
+            break;
+
+        default:
+            result = EVRYTHNG_BAD_ARGS;
+            break;
+    }
+
+    op_complete(handle, op, result);
+
+    return rc;
+}
+
+
+/* Runs an op queued before a disconnection with a deadline, it may not 
+ * wait for the network longer than the time left. Ops which cannot be 
+ * started before the deadline are dropped. */
+static int drain_op(evrythng_handle_t handle, mqtt_op* op)
+{
+    int left = platform_timer_left(&handle->drain_deadline);
+    int rc = MQTT_SUCCESS;
+
+    /* such a publish waits for room in the window here rather than in 
+     * MQTTPublishTopicAsync, whose timeout also bounds the acknowledgement */
+    int windowed = op->op == MQTT_PUBLISH && op->message->qos != QOS0 && handle->mqtt_client.max_inflight > 0;
+    if (windowed && left > 0)
+    {
+        rc = MQTTWaitInflightRoom(&handle->mqtt_client, left);
+        left = platform_timer_left(&handle->drain_deadline);
+    }
+
+    if (left <= 0 || rc != MQTT_SUCCESS)
+    {
+        handle->drain_queued_dropped++;
+        op_complete(handle, op, rc == MQTT_CONNECTION_LOST ? EVRYTHNG_NOT_CONNECTED : EVRYTHNG_TIMEOUT);
+        return rc == MQTT_CONNECTION_LOST ? rc : MQTT_SUCCESS;
+    }
+
+    unsigned int command_timeout_ms = handle->mqtt_client.command_timeout_ms;
+    if (!windowed && (unsigned int)left < command_timeout_ms)
+        handle->mqtt_client.command_timeout_ms = left;
+    rc = process_op(handle, op);
+    handle->mqtt_client.command_timeout_ms = command_timeout_ms;
+
+    if (rc >= 0)
+        return rc;
+
+    handle->drain_queued_dropped++;
+
+    /* out of time rather than connection, which is closed next anyway */
+    return platform_timer_isexpired(&handle->drain_deadline) ? MQTT_SUCCESS : rc;
+}
+
+
+/* Runs a batch of queued ops. Returns the number of queue slots taken,
+ * 0 if the queue was empty. If held is given, ops which block are left 
+ * queued as by op_queue_pop_batch. */
+static int handle_ops(evrythng_handle_t handle, int* held)
+{
+    mqtt_op* batch[OP_QUEUE_BATCH_MAX];
+    int i, rc, taken, n = op_queue_pop_batch(handle, batch, OP_QUEUE_BATCH_MAX, &taken, held);
+
+    /* the packets of the batch go out together, once it is done or whenever 
+     * an op waits for an answer */
+    int corked = n > 1 && handle->mqtt_rc != MQTT_CONNECTION_LOST && handle->cork_buffer
+            && MQTTCork(&handle->mqtt_client) == MQTT_SUCCESS;
+
+    for (i = 0; i < n; i++)
+    {
+        if (handle->mqtt_rc == MQTT_CONNECTION_LOST && batch[i]->op != MQTT_DISCONNECT)
+        {
+            /* the rest of the batch is failed, reconnection happens next */
+            if (handle->draining)
+                handle->drain_queued_dropped++;
+            op_complete(handle, batch[i], EVRYTHNG_NOT_CONNECTED);
+            continue;
+        }
+
+        if (handle->draining && batch[i]->op != MQTT_DISCONNECT)
+            rc = drain_op(handle, batch[i]);
+        else
+            rc = process_op(handle, batch[i]);
+
+        if (rc == MQTT_CONNECTION_LOST)
+            handle->mqtt_rc = MQTT_CONNECTION_LOST;
+    }
+
+    if (corked && MQTTUncork(&handle->mqtt_client) == MQTT_CONNECTION_LOST)
+        handle->mqtt_rc = MQTT_CONNECTION_LOST;
+
+    return taken;
+}
+
+
+/* Reads incoming packets if the network is readable, then does keepalive work. */
+static void handle_network(evrythng_handle_t handle, int readable)
+{
+    if (readable)
+        handle->mqtt_rc = MQTTCycle(&handle->mqtt_client, handle->command_timeout_ms);
+
+    if (handle->mqtt_rc != MQTT_CONNECTION_LOST)
+        handle->mqtt_rc = MQTTKeepalive(&handle->mqtt_client);
+}
+
+
+/* Takes replayed publishes off the spool once acknowledged, in order. If one
+ * failed the spool is replayed again from it, once the publishes sent after 
+ * it are done. */
+static void spool_collect(evrythng_handle_t handle)
+{
+    platform_mutex_lock(&handle->spool_mtx);
+    while (handle->spool_slot_count > 0)
+    {
+        spool_slot_t* slot = &handle->spool_slots[handle->spool_slot_head];
+
+        if (slot->state == SLOT_PENDING)
+            break;
+
+        if (slot->state == SLOT_OK && !handle->spool_replay_failed)
+        {
+            spool_pop(&handle->spool);
+            handle->spool_replayed++;
+        }
+        else
+            handle->spool_replay_failed = 1;
+
+        handle->spool_slot_head = (handle->spool_slot_head + 1) % SPOOL_REPLAY_WINDOW;
+        handle->spool_slot_count--;
+    }
+
+    if (handle->spool_slot_count == 0 && handle->spool_replay_failed)
+    {
+        spool_rewind(&handle->spool);
+        handle->spool_replay_failed = 0;
+    }
+    platform_mutex_unlock(&handle->spool_mtx);
+}
+
+
+static void spool_publish_complete(unsigned short id, int rc, void* context)
+{
+    spool_slot_t* slot = (spool_slot_t*)context;
+    evrythng_handle_t handle = slot->handle;
+
+    if (rc != MQTT_SUCCESS)
+    {
+        warning("spooled publish %u was not acknowledged, rc = %d", id, rc);
+    }
+
+    slot->state = rc == MQTT_SUCCESS ? SLOT_OK : SLOT_FAILED;
+    spool_collect(handle);
+}
+
+
+/* Sends publishes from the spool while connected, up to SPOOL_REPLAY_WINDOW
+ * waiting for acknowledgement and within the replay rate. Returns the time
+ * until the rate allows more, -1 if there is nothing to wait for. */
+static int spool_replay(evrythng_handle_t handle)
+{
+    spool_record_t record;
+    MQTTClient* c = &handle->mqtt_client;
+    int rc;
+
+    if (!handle->spool.data || !MQTTisConnected(c) || handle->mqtt_rc == MQTT_CONNECTION_LOST)
+        return -1;
 
-    if (gracefull)
+    while (c->max_inflight == 0 || c->inflight_count < c->max_inflight)
     {
-        sub_callback_t* _sub_callback = handle->sub_callbacks;
-        while (_sub_callback) 
+        if (handle->spool_rate > 0)
         {
-            rc = MQTTUnsubscribe(&handle->mqtt_client, _sub_callback->topic);
-            if (rc >= 0) 
+            if (platform_timer_isexpired(&handle->spool_rate_timer))
             {
-                debug("successfully unsubscribed from %s", _sub_callback->topic);
+                platform_timer_countdown(&handle->spool_rate_timer, 1000);
+                handle->spool_rate_sent = 0;
             }
-            else 
+            if (handle->spool_rate_sent >= handle->spool_rate)
             {
-                warning("unsubscription failed, rc = %d", rc);
-                break;
+                platform_mutex_lock(&handle->spool_mtx);
+                int left = handle->spool.cursor_count < handle->spool.state.count;
+                platform_mutex_unlock(&handle->spool_mtx);
+                return left ? platform_timer_left(&handle->spool_rate_timer) : -1;
             }
-            _sub_callback = _sub_callback->next;
         }
 
-        rc = MQTTDisconnect(&handle->mqtt_client);
-        if (rc != MQTT_SUCCESS)
+        spool_slot_t* slot = 0;
+        platform_mutex_lock(&handle->spool_mtx);
+        if (handle->spool_slot_count < SPOOL_REPLAY_WINDOW && !handle->spool_replay_failed 
+                && spool_next(&handle->spool, &record))
         {
-            error("failed to disconnect mqtt: rc = %d", rc);
+            slot = &handle->spool_slots[(handle->spool_slot_head + handle->spool_slot_count) % SPOOL_REPLAY_WINDOW];
+            slot->state = SLOT_PENDING;
+            handle->spool_slot_count++;
+        }
+        platform_mutex_unlock(&handle->spool_mtx);
+        if (!slot)
+            break;
+
+        MQTTString topic = MQTTString_initializer;
+        topic.lenstring.data = (char*)record.topic;
+        topic.lenstring.len = record.topic_len;
+
+        memset(&slot->message, 0, sizeof slot->message);
+        slot->message.qos = (enum QoS)record.qos;
+        slot->message.retained = 1;
+        slot->message.payload = (void*)record.payload;
+        slot->message.payloadlen = record.payloadlen;
+        slot->handle = handle;
+
+        handle->spool_rate_sent++;
+
+        if (record.qos != QOS0 && c->max_inflight > 0)
+        {
+            rc = MQTTPublishTopicAsync(c, topic, &slot->message, spool_publish_complete, slot);
+            if (rc == MQTT_SUCCESS)
+                continue; /* completed by spool_publish_complete */
+        }
+        else
+            rc = MQTTPublishTopic(c, topic, &slot->message);
+
+        spool_publish_complete(slot->message.id, rc, slot);
+
+        if (rc == MQTT_CONNECTION_LOST)
+        {
+            handle->mqtt_rc = MQTT_CONNECTION_LOST;
+            break;
         }
     }
-    else
+
+    return -1;
+}
+
+
+/* Whether spool_replay has publishes to send. Returns 0 if it has now, the
+ * time until the replay rate allows more or -1 if there is nothing to send. */
+static int spool_due(evrythng_handle_t handle)
+{
+    if (!handle->spool.data || !MQTTisConnected(&handle->mqtt_client) || handle->mqtt_rc == MQTT_CONNECTION_LOST)
+        return -1;
+
+    platform_mutex_lock(&handle->spool_mtx);
+    int left = handle->spool.cursor_count < handle->spool.state.count 
+            && handle->spool_slot_count < SPOOL_REPLAY_WINDOW && !handle->spool_replay_failed;
+    platform_mutex_unlock(&handle->spool_mtx);
+    if (!left)
+        return -1;
+
+    if (handle->spool_rate > 0 && handle->spool_rate_sent >= handle->spool_rate 
+            && !platform_timer_isexpired(&handle->spool_rate_timer))
+        return platform_timer_left(&handle->spool_rate_timer);
+
+    return 0;
+}
+
+
+/* The earlier of two timeouts, -1 meaning none. */
+static int timeout_min(int a, int b)
+{
+    if (a < 0)
+        return b;
+    if (b < 0)
+        return a;
+    return a < b ? a : b;
+}
+
+
+/* Time until the next keepalive work or aggregation flush of a handle, 
+ * -1 if there is nothing to wait for. */
+static int handle_timeout(evrythng_handle_t handle, int aggr_left)
+{
+    int timeout = MQTTKeepaliveLeft(&handle->mqtt_client);
+
+    if (aggr_left >= 0 && (timeout < 0 || aggr_left < timeout))
+        timeout = aggr_left;
+
+    return timeout;
+}
+
+
+/* Sets when the next reconnection attempt is due. The delay is random up
+ * to reconnect_min_ms doubled for every failed attempt and capped at
+ * reconnect_max_ms, so that devices which lost the connection at the same
+ * time spread out their attempts. */
+static void reconnect_schedule(evrythng_handle_t handle)
+{
+    int window = handle->reconnect_min_ms;
+    int i;
+
+    for (i = 0; i < handle->reconnect_attempt && window < handle->reconnect_max_ms; i++)
+        window = window > handle->reconnect_max_ms / 2 ? handle->reconnect_max_ms : window * 2;
+
+    int delay = (unsigned int)platform_rand() % ((unsigned int)window + 1);
+
+    platform_mutex_lock(&handle->op_queue.mtx);
+    handle->reconnecting = 1;
+    platform_timer_countdown(&handle->reconnect_timer, delay);
+    platform_mutex_unlock(&handle->op_queue.mtx);
+
+    debug("reconnecting in %d ms, attempt %d", delay, handle->reconnect_attempt + 1);
+}
+
+
+static void connection_lost(evrythng_handle_t handle)
+{
+    warning("mqtt server connection lost");
+    evrythng_disconnect_internal(handle, 0);
+
+    if (handle->on_connection_lost)
+        (*handle->on_connection_lost)();
+
+    platform_mutex_lock(&handle->op_queue.mtx);
+    handle->reconnect_attempt = 0;
+    handle->reconnect_error = EVRYTHNG_NOT_CONNECTED;
+    platform_mutex_unlock(&handle->op_queue.mtx);
+
+    reconnect_schedule(handle);
+}
+
+
+/* A single reconnection attempt, the next one is scheduled if it fails.
+ * Returns 1 once connected. */
+static int reconnect(evrythng_handle_t handle)
+{
+    if (evrythng_connect_internal(handle, 1) != EVRYTHNG_SUCCESS)
     {
-        handle->mqtt_client.isconnected = 0;
+        platform_mutex_lock(&handle->op_queue.mtx);
+        handle->reconnect_attempt++;
+        platform_mutex_unlock(&handle->op_queue.mtx);
+
+        reconnect_schedule(handle);
+        return 0;
+    }
+
+    platform_mutex_lock(&handle->op_queue.mtx);
+    handle->reconnecting = 0;
+    handle->reconnect_attempt = 0;
+    platform_mutex_unlock(&handle->op_queue.mtx);
+
+    handle->mqtt_rc = MQTT_SUCCESS;
+
+    if (handle->on_connection_restored)
+        (*handle->on_connection_restored)();
+
+    return 1;
+}
+
+
+static void mqtt_thread(void* arg)
+{
+    evrythng_handle_t handle = (evrythng_handle_t)arg;
+
+    while (!handle->mqtt_thread_stop)
+    {
+        if (handle->mqtt_rc == MQTT_CONNECTION_LOST)
+        {
+            connection_lost(handle);
+
+            /* ops wait in the queue until the connection is restored */
+            while (!handle->mqtt_thread_stop)
+            {
+                if (platform_timer_isexpired(&handle->reconnect_timer) && reconnect(handle))
+                    break;
+                platform_network_wait(&handle->mqtt_network, &handle->op_queue.ready, 
+                        platform_timer_left(&handle->reconnect_timer));
+            }
+            handle->mqtt_rc = MQTT_SUCCESS;
+        }
+
+        int aggr_left = aggr_flush_expired(handle);
+
+        if (handle_ops(handle, 0))
+            continue;
+
+        int spool_left = spool_replay(handle);
+        if (handle->mqtt_rc == MQTT_CONNECTION_LOST)
+            continue;
+
+        /* sleep until there is something to read, a new op, keepalive work,
+         * the end of an aggregation window or more publishes may be replayed */
+        int timeout = handle_timeout(handle, timeout_min(aggr_left, spool_left));
+        if (timeout < 0 || timeout > IDLE_WAIT_MAX_MS)
+            timeout = IDLE_WAIT_MAX_MS;
+
+        int events = platform_network_wait(&handle->mqtt_network, &handle->op_queue.ready, timeout);
+        if (events < 0 && MQTTisConnected(&handle->mqtt_client))
+        {
+            handle->mqtt_rc = MQTT_CONNECTION_LOST;
+            continue;
+        }
+
+        handle_network(handle, events > 0 && (events & WAIT_NETWORK));
+    }
+
+    evrythng_disconnect_internal(handle, 1);
+    MQTTAbortInflight(&handle->mqtt_client, MQTT_CONNECTION_LOST);
+}
+
+
+evrythng_return_t EvrythngInitReactor(evrythng_reactor_t* reactor, int threads)
+{
+    int i;
+
+    if (!reactor || threads < 1)
+        return EVRYTHNG_BAD_ARGS;
+
+    evrythng_reactor_t r = (evrythng_reactor_t)platform_malloc(sizeof(struct evrythng_reactor_t));
+    if (!r)
+        return EVRYTHNG_MEMORY_ERROR;
+
+    r->shards = (reactor_shard_t*)platform_malloc(threads * sizeof(reactor_shard_t));
+    if (!r->shards)
+    {
+        platform_free(r);
+        return EVRYTHNG_MEMORY_ERROR;
+    }
+    memset(r->shards, 0, threads * sizeof(reactor_shard_t));
+    r->nshards = threads;
+    platform_mutex_init(&r->mtx);
+
+    for (i = 0; i < threads; i++)
+    {
+        reactor_shard_t* shard = &r->shards[i];
+
+        platform_poller_init(&shard->poller);
+        platform_notifier_init(&shard->wake);
+        platform_mutex_init(&shard->mtx);
+        platform_semaphore_init(&shard->work_sem);
+        platform_timer_init(&shard->timer);
+        platform_thread_create(&shard->thread, 0, "evrythng_reactor", reactor_thread, REACTOR_STACKSIZE, (void*)shard);
+        platform_thread_create(&shard->worker, 0, "evrythng_worker", reactor_worker, REACTOR_STACKSIZE, (void*)shard);
     }
 
-    platform_network_disconnect(&handle->mqtt_network);
-
-    debug("MQTT disconnected");
+    *reactor = r;
 
     return EVRYTHNG_SUCCESS;
 }
 
 
-evrythng_return_t evrythng_publish(
-        evrythng_handle_t handle, 
-        const char* entity, 
-        const char* entity_id, 
-        const char* data_type, 
-        const char* data_name, 
-        const char* property_json)
+void EvrythngDestroyReactor(evrythng_reactor_t reactor)
 {
-    if (!handle) return EVRYTHNG_BAD_ARGS;
+    int i;
 
-    if (!MQTTisConnected(&handle->mqtt_client)) 
+    if (!reactor)
+        return;
+
+    for (i = 0; i < reactor->nshards; i++)
     {
-        error("%s: client is not connected", __func__);
-        return EVRYTHNG_NOT_CONNECTED;
+        reactor_shard_t* shard = &reactor->shards[i];
+
+        shard->stop = 1;
+        platform_notifier_post(&shard->wake);
+        platform_thread_join(&shard->thread, 0x00FFFFFF);
+        platform_thread_destroy(&shard->thread);
+        platform_semaphore_post(&shard->work_sem);
+        platform_thread_join(&shard->worker, 0x00FFFFFF);
+        platform_thread_destroy(&shard->worker);
+
+        platform_poller_deinit(&shard->poller);
+        platform_notifier_deinit(&shard->wake);
+        platform_mutex_deinit(&shard->mtx);
+        platform_semaphore_deinit(&shard->work_sem);
+        platform_timer_deinit(&shard->timer);
     }
 
-    int rc;
-    char pub_topic[TOPIC_MAX_LEN];
+    platform_mutex_deinit(&reactor->mtx);
+    platform_free(reactor->shards);
+    platform_free(reactor);
+}
 
-    if (entity_id == NULL) 
+
+/* Makes the shard check its handle timers within timeout ms. */
+static void reactor_schedule(reactor_shard_t* shard, int timeout)
+{
+    if (timeout < 0)
+        return;
+
+    if (timeout < REACTOR_TIMER_SLACK_MS)
+        timeout = REACTOR_TIMER_SLACK_MS;
+
+    if (!shard->timer_set || timeout < platform_timer_left(&shard->timer))
     {
-        rc = snprintf(pub_topic, TOPIC_MAX_LEN, "%s/%s", entity, data_name);
-        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
-        {
-            error("Topic overflow");
-            return EVRYTHNG_BAD_ARGS;
-        }
-    } 
-    else if (data_name == NULL) 
+        platform_timer_countdown(&shard->timer, timeout);
+        shard->timer_set = 1;
+    }
+}
+
+
+/* Has the shard poller watch the network of a connected handle, or stop 
+ * watching it. */
+static void reactor_poll(reactor_shard_t* shard, evrythng_handle_t handle, int poll)
+{
+    if (poll && !handle->polled && MQTTisConnected(&handle->mqtt_client))
     {
-        rc = snprintf(pub_topic, TOPIC_MAX_LEN, "%s/%s/%s", entity, entity_id, data_type);
-        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
-        {
-            error("topic overflow");
-            return EVRYTHNG_BAD_ARGS;
-        }
-    } 
-    else 
+        platform_poller_add(&shard->poller, &handle->mqtt_network, handle);
+        handle->polled = 1;
+    }
+    else if (!poll && handle->polled)
     {
-        rc = snprintf(pub_topic, TOPIC_MAX_LEN, "%s/%s/%s/%s", entity, entity_id, data_type, data_name);
-        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
-        {
-            error("topic overflow");
-            return EVRYTHNG_BAD_ARGS;
-        }
+        platform_poller_remove(&shard->poller, &handle->mqtt_network);
+        handle->polled = 0;
     }
+}
 
-    debug("publish topic: %s", pub_topic);
 
-    MQTTMessage msg = {
-        .qos = handle->qos, 
-        .retained = 1, 
-        .dup = 0,
-        .id = 0,
-        .payload = (void*)property_json,
-        .payloadlen = strlen(property_json)
-    };
+/* Hands a handle to the shard worker for a step which blocks on the network:
+ * a connection, ops waiting for the cloud, a spool replay outside of the
+ * in-flight window or a packet too large for the receive buffer. The shard
+ * thread leaves the handle alone until the worker wakes it again, so that
+ * the other handles are not held up. */
+static void reactor_offload(reactor_shard_t* shard, evrythng_handle_t handle)
+{
+    reactor_poll(shard, handle, 0);
+
+    platform_mutex_lock(&shard->mtx);
+    handle->offloaded = 1;
+    handle->work_next = 0;
+    if (shard->work_last)
+        shard->work_last->work_next = handle;
+    else
+        shard->work = handle;
+    shard->work_last = handle;
+    platform_mutex_unlock(&shard->mtx);
 
-    return evrythng_async_op(handle, MQTT_PUBLISH, pub_topic, &msg, 0);
+    platform_semaphore_post(&shard->work_sem);
 }
 
 
-evrythng_return_t evrythng_subscribe(
-        evrythng_handle_t handle, 
-        const char* entity, 
-        const char* entity_id, 
-        const char* data_type, 
-        const char* data_name, 
-        int pub_states,
-        sub_callback *callback)
+/* Whether the worker has a handle, it is done with it once it wakes it. */
+static int reactor_offloaded(reactor_shard_t* shard, evrythng_handle_t handle)
 {
-    if (!MQTTisConnected(&handle->mqtt_client)) 
+    platform_mutex_lock(&shard->mtx);
+    int offloaded = handle->offloaded;
+    platform_mutex_unlock(&shard->mtx);
+
+    return offloaded;
+}
+
+
+/* Reads what the network of a handle has, then handles the packets it 
+ * completed and does keepalive work. The rest of a partial packet is not
+ * waited for, a packet larger than the receive buffer is left to the worker.
+ * Returns 1 if the handle was offloaded for it. */
+static int reactor_read(reactor_shard_t* shard, evrythng_handle_t handle)
+{
+    int rc = MQTTReceive(&handle->mqtt_client);
+
+    if (rc == MQTT_BUFFER_OVERFLOW)
     {
-        error("%s: client is not connected", __func__);
-        return EVRYTHNG_NOT_CONNECTED;
+        reactor_offload(shard, handle);
+        return 1;
     }
 
-    int rc;
-    char sub_topic[TOPIC_MAX_LEN] = { 0 };
+    if (rc == MQTT_CONNECTION_LOST)
+        handle->mqtt_rc = rc;
+    handle_network(handle, rc == 1);
 
-    if (entity_id == NULL) 
-    {
-        rc = snprintf(sub_topic, TOPIC_MAX_LEN, "%s/%s?pubStates=%d", entity, data_name, pub_states);
-        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
-        {
-            debug("topic overflow");
-            return EVRYTHNG_BAD_ARGS;
-        }
-    } 
-    else if (data_name == NULL) 
-    {
-        rc = snprintf(sub_topic, TOPIC_MAX_LEN, "%s/%s/%s?pubStates=%d", entity, entity_id, data_type, pub_states);
-        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
-        {
-            debug("topic overflow");
-            return EVRYTHNG_BAD_ARGS;
-        }
-    } 
-    else 
+    return 0;
+}
+
+
+/* Replays the spool of a handle, or offloads the handle if its publishes 
+ * block. Returns 1 if it was offloaded, left is set as by spool_replay. */
+static int reactor_spool(reactor_shard_t* shard, evrythng_handle_t handle, int* left)
+{
+    if (!publish_blocks(handle, handle->qos))
     {
-        rc = snprintf(sub_topic, TOPIC_MAX_LEN, "%s/%s/%s/%s?pubStates=%d", entity, entity_id, data_type, data_name, pub_states);
-        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
-        {
-            debug("topic overflow");
-            return EVRYTHNG_BAD_ARGS;
-        }
+        *left = spool_replay(handle);
+        return 0;
     }
 
-    return evrythng_async_op(handle, MQTT_SUBSCRIBE, sub_topic, 0, callback);
+    if ((*left = spool_due(handle)) != 0)
+        return 0;
+
+    reactor_offload(shard, handle);
+    return 1;
 }
 
 
-evrythng_return_t evrythng_unsubscribe(
-        evrythng_handle_t handle, 
-        const char* entity, 
-        const char* entity_id, 
-        const char* data_type, 
-        const char* data_name)
+/* Starts reconnecting a handle whose connection was lost, attempts are 
+ * made by the worker once reactor_check finds them due. Ops stay queued 
+ * until the handle is connected. */
+static void reactor_lost(reactor_shard_t* shard, evrythng_handle_t handle)
 {
-    if (!MQTTisConnected(&handle->mqtt_client)) 
+    reactor_poll(shard, handle, 0);
+    connection_lost(handle);
+
+    reactor_schedule(shard, platform_timer_left(&handle->reconnect_timer));
+}
+
+
+static void reactor_detach(reactor_shard_t* shard, evrythng_handle_t handle)
+{
+    reactor_poll(shard, handle, 0);
+    evrythng_disconnect_internal(handle, 1);
+    MQTTAbortInflight(&handle->mqtt_client, MQTT_CONNECTION_LOST);
+
+    if (handle->attached)
     {
-        error("%s: client is not connected", __func__);
-        return EVRYTHNG_NOT_CONNECTED;
+        if (handle->shard_prev)
+            handle->shard_prev->shard_next = handle->shard_next;
+        else
+            shard->handles = handle->shard_next;
+        if (handle->shard_next)
+            handle->shard_next->shard_prev = handle->shard_prev;
+        handle->attached = 0;
     }
 
-    int rc;
-    char unsub_topic[TOPIC_MAX_LEN];
+    platform_semaphore_post(&handle->detached);
+}
 
-    if (entity_id == NULL) 
+
+/* Work of a woken handle: attaching or detaching it and running its ops. */
+static void reactor_turn(reactor_shard_t* shard, evrythng_handle_t handle)
+{
+    /* the worker wakes the handle once it is done with it */
+    if (reactor_offloaded(shard, handle))
+        return;
+
+    if (handle->mqtt_thread_stop)
     {
-        rc = snprintf(unsub_topic, TOPIC_MAX_LEN, "%s/%s", entity, data_name);
-        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
-        {
-            debug("topic overflow");
-            return EVRYTHNG_BAD_ARGS;
-        }
-    } 
-    else if (data_name == NULL) 
+        /* a graceful disconnection waits for the cloud */
+        if (MQTTisConnected(&handle->mqtt_client))
+            reactor_offload(shard, handle);
+        else
+            reactor_detach(shard, handle);
+        return;
+    }
+
+    if (!handle->attached)
     {
-        rc = snprintf(unsub_topic, TOPIC_MAX_LEN, "%s/%s/%s", entity, entity_id, data_type);
-        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
-        {
-            debug("topic overflow");
-            return EVRYTHNG_BAD_ARGS;
-        }
-    } 
-    else 
+        handle->shard_prev = 0;
+        handle->shard_next = shard->handles;
+        if (shard->handles)
+            shard->handles->shard_prev = handle;
+        shard->handles = handle;
+        handle->attached = 1;
+    }
+
+    if (handle->reconnecting)
     {
-        rc = snprintf(unsub_topic, TOPIC_MAX_LEN, "%s/%s/%s/%s", entity, entity_id, data_type, data_name);
-        if (rc < 0 || rc >= TOPIC_MAX_LEN) 
-        {
-            debug("topic overflow");
-            return EVRYTHNG_BAD_ARGS;
-        }
+        reactor_schedule(shard, platform_timer_left(&handle->reconnect_timer));
+        return;
+    }
+
+    reactor_poll(shard, handle, 1);
+
+    /* packets read ahead by the worker are not signalled by the poller */
+    if (handle->mqtt_client.rx_end > handle->mqtt_client.rx_start && reactor_read(shard, handle))
+        return;
+
+    int aggr_left = aggr_flush_expired(handle);
+
+    /* more ops may be queued, come back after the other handles had their turn */
+    int held;
+    if (handle_ops(handle, &held) && !held)
+        handle_wake(handle);
+
+    if (held && handle->mqtt_rc != MQTT_CONNECTION_LOST)
+    {
+        reactor_offload(shard, handle);
+        return;
     }
 
-    return evrythng_async_op(handle, MQTT_UNSUBSCRIBE, unsub_topic, 0, 0);
+    int spool_left;
+    if (reactor_spool(shard, handle, &spool_left))
+        return;
+
+    if (handle->mqtt_rc == MQTT_CONNECTION_LOST)
+        reactor_lost(shard, handle);
+    else
+        reactor_schedule(shard, handle_timeout(handle, timeout_min(aggr_left, spool_left)));
 }
 
 
-static void mqtt_thread(void* arg)
+/* Runs the timer work of every handle and finds when it is due next. */
+static void reactor_check(reactor_shard_t* shard)
 {
-    char actual_topic[TOPIC_MAX_LEN];
-    int rc = MQTT_SUCCESS;
+    evrythng_handle_t handle;
 
-    evrythng_handle_t handle = (evrythng_handle_t)arg;
+    shard->timer_set = 0;
 
-    while (!handle->mqtt_thread_stop)
+    for (handle = shard->handles; handle; handle = handle->shard_next)
     {
-        if (rc == MQTT_CONNECTION_LOST)
+        if (reactor_offloaded(shard, handle))
+            continue;
+
+        if (handle->reconnecting)
         {
-            warning("mqtt server connection lost");
-            evrythng_disconnect_internal(handle, 0);
+            /* the worker makes the attempt, then wakes the handle to run 
+             * the ops which waited for the connection */
+            if (platform_timer_isexpired(&handle->reconnect_timer))
+                reactor_offload(shard, handle);
+            else
+                reactor_schedule(shard, platform_timer_left(&handle->reconnect_timer));
+            continue;
+        }
 
-            if (handle->on_connection_lost)
-                (*handle->on_connection_lost)();
+        int aggr_left = aggr_flush_expired(handle);
 
-            while (!handle->mqtt_thread_stop)
-            {
-                if (evrythng_connect_internal(handle) != EVRYTHNG_SUCCESS)
-                {
-                    platform_printf("could not connect, retrying\n");
-                    platform_sleep(300);
-                    continue;
-                }
-                
-                if (handle->on_connection_restored)
-                    (*handle->on_connection_restored)();
-                break;
-            }
-        }
+        if (MQTTKeepaliveLeft(&handle->mqtt_client) == 0)
+            handle_network(handle, 0);
 
-        if (platform_semaphore_wait(&handle->next_op_ready_sem, 0))
-        {
-            rc = MQTTYield(&handle->mqtt_client, 300);
-            platform_sleep(100);
+        int spool_left;
+        if (reactor_spool(shard, handle, &spool_left))
             continue;
+
+        if (handle->mqtt_rc == MQTT_CONNECTION_LOST)
+            reactor_lost(shard, handle);
+        else
+            reactor_schedule(shard, handle_timeout(handle, timeout_min(aggr_left, spool_left)));
+    }
+}
+
+
+static void reactor_thread(void* arg)
+{
+    reactor_shard_t* shard = (reactor_shard_t*)arg;
+    void* ready[REACTOR_EVENTS_MAX];
+    int i, n;
+
+    while (!shard->stop)
+    {
+        evrythng_handle_t handle, next;
+
+        platform_mutex_lock(&shard->mtx);
+        handle = shard->woken;
+        shard->woken = 0;
+        platform_mutex_unlock(&shard->mtx);
+
+        for (; handle; handle = next)
+        {
+            /* cleared before the turn, so that a wake during it is not lost */
+            platform_mutex_lock(&shard->mtx);
+            next = handle->woken_next;
+            handle->woken = 0;
+            platform_mutex_unlock(&shard->mtx);
+
+            reactor_turn(shard, handle);
         }
 
-        platform_mutex_lock(&handle->next_op_mtx);
+        /* sleep until a connection has something to read, a handle is woken
+         * or handle timers are due */
+        int timeout = shard->timer_set ? platform_timer_left(&shard->timer) : IDLE_WAIT_MAX_MS;
+        if (timeout < 0)
+            timeout = 0;
+        if (timeout > IDLE_WAIT_MAX_MS)
+            timeout = IDLE_WAIT_MAX_MS;
+
+        n = platform_poller_wait(&shard->poller, &shard->wake, ready, REACTOR_EVENTS_MAX, timeout);
 
-        switch (handle->next_op.op)
+        for (i = 0; i < n; i++)
         {
-            case MQTT_CONNECT:
-                handle->next_op.result = evrythng_connect_internal(handle);
-                break;
+            handle = (evrythng_handle_t)ready[i];
 
-            case MQTT_DISCONNECT:
-                handle->next_op.result = evrythng_disconnect_internal(handle, 1);
-                break;
+            if (reactor_read(shard, handle))
+                continue;
 
-            case MQTT_PUBLISH:
-                rc = MQTTPublish(&handle->mqtt_client, 
-                        handle->next_op.topic,
-                        handle->next_op.message);
-                if (rc == MQTT_SUCCESS) 
-                {
-                    debug("published message: %s", handle->next_op.message->payload);
-                    handle->next_op.result = EVRYTHNG_SUCCESS;
-                }
-                else 
-                {
-                    error("could not publish message, rc = %d", rc);
-                    handle->next_op.result = EVRYTHNG_PUBLISH_ERROR;
-                }
-                break;
+            /* acknowledgements make room for more of the spool */
+            int spool_left;
+            if (reactor_spool(shard, handle, &spool_left))
+                continue;
 
-            case MQTT_SUBSCRIBE:
-                rc = add_sub_callback(handle, handle->next_op.topic, 
-                        handle->qos, handle->next_op.callback);
+            if (handle->mqtt_rc == MQTT_CONNECTION_LOST)
+                reactor_lost(shard, handle);
+            else
+                reactor_schedule(shard, handle_timeout(handle, spool_left));
+        }
 
-                if (rc != EVRYTHNG_SUCCESS)
-                {
-                    error("could not add sub topic: %d", rc);
-                    handle->next_op.result = rc;
-                }
-                else
-                {
-                    rc = MQTTSubscribe(&handle->mqtt_client, 
-                            handle->next_op.topic, 
-                            handle->qos);
-                    if (rc >= 0) 
-                    {
-                        debug("successfully subscribed to %s", handle->next_op.topic);
-                        handle->next_op.result = EVRYTHNG_SUCCESS;
-                    }
-                    else
-                    {
-                        debug("subscription failed: %d", rc);
-                        handle->next_op.result = EVRYTHNG_SUBSCRIPTION_ERROR;
-                        rm_sub_callback(handle, handle->next_op.topic, 0);
-                    }
-                }
-                break;
+        if (shard->timer_set && platform_timer_isexpired(&shard->timer))
+            reactor_check(shard);
+    }
+}
 
-            case MQTT_UNSUBSCRIBE:
-                rc = rm_sub_callback(handle, handle->next_op.topic, actual_topic);
-                if (rc != EVRYTHNG_SUCCESS)
-                {
-                    debug("could not remove callback for topic: %s", handle->next_op.topic);
-                    handle->next_op.result = rc;
-                }
-                else
-                {
-                    rc = MQTTUnsubscribe(&handle->mqtt_client, actual_topic);
-                    if (rc >= 0) 
-                    {
-                        debug("successfully unsubscribed from %s", actual_topic);
-                        handle->next_op.result = EVRYTHNG_SUCCESS;
-                    }
-                    else
-                    {
-                        handle->next_op.result = EVRYTHNG_UNSUBSCRIPTION_ERROR;
-                    }
-                }
-                break;
 
-            default:
-                handle->next_op.result = EVRYTHNG_BAD_ARGS;
-                break;
+/* Points a handle at the serialize and read buffers of the thread running it.
+ * A read buffer taken from the message pool stays with the handle. */
+static void reactor_buffers(evrythng_handle_t handle, unsigned char* buf, unsigned char* readbuf)
+{
+    MQTTClient* c = &handle->mqtt_client;
+
+    c->buf = buf;
+    if (c->pool_index >= 0)
+        c->own_readbuf = readbuf;
+    else
+        c->readbuf = readbuf;
+}
+
+
+/* Runs the steps offloaded by reactor_offload, one handle at a time, and
+ * gives each handle back to the shard thread by waking it. */
+static void reactor_worker(void* arg)
+{
+    reactor_shard_t* shard = (reactor_shard_t*)arg;
+
+    while (!shard->stop)
+    {
+        evrythng_handle_t handle;
+
+        if (platform_semaphore_wait(&shard->work_sem, IDLE_WAIT_MAX_MS))
+            continue;
+
+        platform_mutex_lock(&shard->mtx);
+        handle = shard->work;
+        if (handle && !(shard->work = handle->work_next))
+            shard->work_last = 0;
+        platform_mutex_unlock(&shard->mtx);
+
+        if (!handle)
+            continue;
+
+        /* the shard buffers are in use by the shard thread */
+        reactor_buffers(handle, shard->worker_serialize_buffer, shard->worker_read_buffer);
+
+        if (handle->mqtt_thread_stop)
+            evrythng_disconnect_internal(handle, 1);
+        else if (handle->reconnecting)
+            reconnect(handle);
+        else
+        {
+            /* a packet too large for the receive buffer is waited for here */
+            if (MQTTisConnected(&handle->mqtt_client) && MQTTReceive(&handle->mqtt_client) != 0)
+                handle_network(handle, 1);
+            handle_ops(handle, 0);
+            spool_replay(handle);
         }
 
-        platform_semaphore_post(&handle->next_op_result_sem);
+        reactor_buffers(handle, shard->serialize_buffer, shard->read_buffer);
 
-        platform_mutex_unlock(&handle->next_op_mtx);
-    }
+        platform_mutex_lock(&shard->mtx);
+        handle->offloaded = 0;
+        platform_mutex_unlock(&shard->mtx);
 
-    evrythng_disconnect_internal(handle, 1);
+        handle_wake(handle);
+    }
 }
 
 
@@ -0,0 +1,366 @@
+/*
+ * (c) Copyright 2012 EVRYTHNG Ltd London / Zurich
+ * www.evrythng.com
+ */
+
+#include <string.h>
+
+#include "evrythng/platform.h"
+#include "evrythng_spool.h"
+
+#define SPOOL_MAGIC 0x45565350 /* "EVSP" */
+#define SPOOL_HEADER_SIZE 64
+#define SPOOL_ALIGN(n) (((n) + 3) & ~(uint32_t)3)
+
+typedef struct spool_header_t
+{
+    uint32_t        magic;
+    uint32_t        size;
+    spool_state_t   states[2];
+} spool_header_t;
+
+/* Each record starts with this header, followed by the topic and the payload.
+ * The checksum covers everything after it. */
+typedef struct spool_record_header_t
+{
+    uint32_t        size;       /* the whole record, aligned */
+    uint32_t        checksum;
+    uint16_t        topic_len;
+    uint8_t         qos;
+    uint8_t         reserved;
+    uint32_t        payloadlen;
+} spool_record_header_t;
+
+
+static uint32_t fnv1a(uint32_t h, const void* data, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+
+static uint32_t state_checksum(const spool_state_t* st)
+{
+    return fnv1a(2166136261u, st, offsetof(spool_state_t, checksum));
+}
+
+
+static uint32_t record_checksum(const spool_record_header_t* r)
+{
+    return fnv1a(2166136261u, &r->topic_len, sizeof *r - offsetof(spool_record_header_t, topic_len) + r->topic_len + r->payloadlen);
+}
+
+
+/* The records wrap when those at the end of the ring are followed by some at its beginning. */
+static int spool_wrapped(const spool_t* s)
+{
+    return s->state.count > 0 && s->state.tail <= s->state.head;
+}
+
+
+static void spool_reset(spool_t* s)
+{
+    s->state.head = s->state.tail = 0;
+    s->state.wrap = s->size;
+    s->state.count = 0;
+    s->cursor = 0;
+    s->cursor_count = 0;
+}
+
+
+/* Writes the state to the older slot of a spool file. */
+static void spool_commit(spool_t* s)
+{
+    spool_header_t* h;
+
+    s->state.seq++;
+    if (!s->map)
+        return;
+
+    h = (spool_header_t*)s->map;
+    s->state.checksum = state_checksum(&s->state);
+    h->states[s->state.seq & 1] = s->state;
+    platform_file_sync(h, sizeof *h);
+}
+
+
+/* Moves head past the oldest record. */
+static void spool_advance(spool_t* s)
+{
+    spool_record_header_t* r = (spool_record_header_t*)(s->data + s->state.head);
+    int wrapped = spool_wrapped(s);
+
+    s->state.head += r->size;
+    s->state.count--;
+    if (s->state.count == 0)
+    {
+        spool_reset(s);
+        return;
+    }
+    if (wrapped && s->state.head == s->state.wrap)
+    {
+        s->state.head = 0;
+        s->state.wrap = s->size;
+    }
+}
+
+
+/* Checks the records of a state read back from a spool file, the records
+ * from the first one which is not intact on are dropped. */
+static void spool_recover(spool_t* s)
+{
+    uint32_t off = s->state.head;
+    uint32_t limit = spool_wrapped(s) ? s->state.wrap : s->state.tail;
+    uint32_t i;
+
+    for (i = 0; i < s->state.count; i++)
+    {
+        spool_record_header_t* r;
+
+        if (off == limit && limit == s->state.wrap && spool_wrapped(s))
+        {
+            off = 0;
+            limit = s->state.tail;
+        }
+        r = (spool_record_header_t*)(s->data + off);
+        if (off + sizeof *r > limit
+                || r->size < SPOOL_ALIGN(sizeof *r + r->topic_len + r->payloadlen)
+                || r->size > limit - off
+                || r->checksum != record_checksum(r))
+            break;
+        off += r->size;
+    }
+
+    if (i == 0)
+    {
+        spool_reset(s);
+        return;
+    }
+    s->state.count = i;
+    s->state.tail = off;
+    if (!spool_wrapped(s))
+        s->state.wrap = s->size;
+}
+
+
+static int spool_load(spool_t* s)
+{
+    spool_header_t* h = (spool_header_t*)s->map;
+    const spool_state_t* current = 0;
+    int i;
+
+    if (h->magic != SPOOL_MAGIC || h->size != s->size)
+        return -1;
+
+    for (i = 0; i < 2; i++)
+    {
+        const spool_state_t* st = &h->states[i];
+        if (st->checksum != state_checksum(st)
+                || st->head >= s->size || st->tail > s->size || st->wrap > s->size)
+            continue;
+        if (!current || (int32_t)(st->seq - current->seq) > 0)
+            current = st;
+    }
+    if (!current)
+        return -1;
+
+    s->state = *current;
+    if (s->state.count == 0)
+        spool_reset(s);
+    spool_recover(s);
+    s->cursor = s->state.head;
+
+    /* the older state may count records the recovery dropped */
+    spool_commit(s);
+    return 0;
+}
+
+
+int spool_init(spool_t* s, size_t size, int policy, const char* path)
+{
+    memset(s, 0, sizeof *s);
+
+    size &= ~(size_t)3;
+    if (size < 64 || size > 0x7fffffff)
+        return -1;
+
+    s->size = (uint32_t)size;
+    s->policy = policy;
+
+    if (!path)
+    {
+        s->data = (unsigned char*)platform_malloc(size);
+        if (!s->data)
+            return -1;
+        spool_reset(s);
+        return 0;
+    }
+
+    s->map_size = SPOOL_HEADER_SIZE + size;
+    s->map = platform_file_map(path, s->map_size);
+    if (!s->map)
+        return -1;
+    s->data = (unsigned char*)s->map + SPOOL_HEADER_SIZE;
+
+    if (spool_load(s) != 0)
+    {
+        spool_header_t* h = (spool_header_t*)s->map;
+
+        memset(h, 0, sizeof *h);
+        h->magic = SPOOL_MAGIC;
+        h->size = s->size;
+        spool_reset(s);
+        s->state.seq = 0;
+        spool_commit(s);
+    }
+    return 0;
+}
+
+
+void spool_deinit(spool_t* s)
+{
+    if (s->map)
+        platform_file_unmap(s->map, s->map_size);
+    else if (s->data)
+        platform_free(s->data);
+    memset(s, 0, sizeof *s);
+}
+
+
+int spool_push(spool_t* s, const char* topic, int topic_len, int qos, const void* payload, size_t payloadlen)
+{
+    spool_record_header_t* r;
+    uint32_t need;
+    uint32_t off;
+    int dropped = 0;
+
+    if (!s->data || topic_len < 0 || topic_len > 0xffff || payloadlen > s->size)
+        goto drop;
+
+    need = SPOOL_ALIGN(sizeof *r + topic_len + payloadlen);
+    if (need > s->size)
+        goto drop;
+
+    for (;;)
+    {
+        if (s->state.count == 0)
+        {
+            spool_reset(s);
+            off = 0;
+            break;
+        }
+        if (!spool_wrapped(s))
+        {
+            if (s->size - s->state.tail >= need)
+            {
+                off = s->state.tail;
+                break;
+            }
+            if (s->state.head >= need)
+            {
+                s->state.wrap = s->state.tail;
+                off = 0;
+                break;
+            }
+        }
+        else if (s->state.head - s->state.tail >= need)
+        {
+            off = s->state.tail;
+            break;
+        }
+
+        /* full, records being replayed are kept */
+        if (s->policy != SPOOL_DROP_OLDEST || s->cursor_count > 0)
+            goto drop;
+
+        spool_advance(s);
+        s->cursor = s->state.head;
+        s->dropped++;
+        dropped = 1;
+    }
+
+    /* the space of dropped records is only reused once they are gone from the file */
+    if (dropped)
+        spool_commit(s);
+
+    r = (spool_record_header_t*)(s->data + off);
+    r->size = need;
+    r->topic_len = (uint16_t)topic_len;
+    r->qos = (uint8_t)qos;
+    r->reserved = 0;
+    r->payloadlen = (uint32_t)payloadlen;
+    memcpy(r + 1, topic, topic_len);
+    memcpy((unsigned char*)(r + 1) + topic_len, payload, payloadlen);
+    r->checksum = record_checksum(r);
+    if (s->map)
+        platform_file_sync(r, need);
+
+    s->state.tail = off + need;
+    s->state.count++;
+    spool_commit(s);
+    return 0;
+
+drop:
+    s->dropped++;
+    return -1;
+}
+
+
+int spool_next(spool_t* s, spool_record_t* record)
+{
+    spool_record_header_t* r;
+
+    if (s->cursor_count == s->state.count)
+        return 0;
+
+    if (spool_wrapped(s) && s->cursor == s->state.wrap)
+        s->cursor = 0;
+
+    r = (spool_record_header_t*)(s->data + s->cursor);
+    record->topic = (const char*)(r + 1);
+    record->topic_len = r->topic_len;
+    record->qos = r->qos;
+    record->payload = (const unsigned char*)(r + 1) + r->topic_len;
+    record->payloadlen = r->payloadlen;
+
+    s->cursor += r->size;
+    s->cursor_count++;
+    return 1;
+}
+
+
+void spool_pop(spool_t* s)
+{
+    if (s->state.count == 0)
+        return;
+
+    spool_advance(s);
+    if (s->cursor_count > 0)
+        s->cursor_count--;
+    if (s->cursor_count == 0)
+        s->cursor = s->state.head;
+    spool_commit(s);
+}
+
+
+void spool_rewind(spool_t* s)
+{
+    s->cursor = s->state.head;
+    s->cursor_count = 0;
+}
+
+
+size_t spool_bytes(const spool_t* s)
+{
+    if (s->state.count == 0)
+        return 0;
+    if (spool_wrapped(s))
+        return s->state.wrap - s->state.head + s->state.tail;
+    return s->state.tail - s->state.head;
+}
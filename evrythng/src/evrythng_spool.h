@@ -0,0 +1,78 @@
+/*
+ * (c) Copyright 2012 EVRYTHNG Ltd London / Zurich
+ * www.evrythng.com
+ */
+
+#if !defined(_EVRYTHNG_SPOOL_H)
+#define _EVRYTHNG_SPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A ring of publishes kept while they cannot be sent, in memory or in a
+ * file mapped into memory. Records are stored whole, a record which does
+ * not fit before the end of the ring starts over at its beginning.
+ *
+ * A spool file starts with two copies of the ring state. An update is
+ * written to the older copy once the records it covers are synced, so
+ * that a crash leaves at least one valid state and the records it counts.
+ */
+
+enum { SPOOL_DROP_OLDEST, SPOOL_DROP_NEWEST };
+
+typedef struct spool_state_t
+{
+    uint32_t seq;       /* the valid state with the highest seq is current */
+    uint32_t head;      /* offset of the oldest record */
+    uint32_t tail;      /* offset past the newest record */
+    uint32_t wrap;      /* offset where the records before the tail end, size if they do not wrap */
+    uint32_t count;
+    uint32_t checksum;
+} spool_state_t;
+
+typedef struct spool_record_t
+{
+    const char*             topic;
+    int                     topic_len;
+    int                     qos;
+    const unsigned char*    payload;
+    size_t                  payloadlen;
+} spool_record_t;
+
+typedef struct spool_t
+{
+    unsigned char*  data;
+    uint32_t        size;
+    spool_state_t   state;
+    int             policy;
+    unsigned int    dropped;
+    uint32_t        cursor;         /* the next record to replay */
+    uint32_t        cursor_count;   /* records from head to cursor */
+    void*           map;            /* the mapped file, 0 in memory */
+    size_t          map_size;
+} spool_t;
+
+/* Sets up a spool of size bytes in memory or, if path is given, in a file
+ * which keeps the records of a previous run. Returns 0 or -1 on error. */
+int  spool_init(spool_t* s, size_t size, int policy, const char* path);
+void spool_deinit(spool_t* s);
+
+/* Adds a record, dropping the oldest ones if needed and allowed by the policy.
+ * Records from head to the cursor are never dropped. Returns 0, or -1 if the
+ * record was dropped. */
+int  spool_push(spool_t* s, const char* topic, int topic_len, int qos, const void* payload, size_t payloadlen);
+
+/* Gets the record at the cursor and moves the cursor past it. Returns 0 if
+ * there is no record left to replay. The record is valid until popped. */
+int  spool_next(spool_t* s, spool_record_t* record);
+
+/* Removes the oldest record, once it was replayed. */
+void spool_pop(spool_t* s);
+
+/* Moves the cursor back to the oldest record, to replay again what was not popped. */
+void spool_rewind(spool_t* s);
+
+/* The space taken by the records. */
+size_t spool_bytes(const spool_t* s);
+
+#endif
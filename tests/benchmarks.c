@@ -0,0 +1,1289 @@
+/*
+ * (c) Copyright 2012 EVRYTHNG Ltd London / Zurich
+ * www.evrythng.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "evrythng/evrythng.h"
+#include "evrythng/platform.h"
+#include "evrythng_config.h"
+
+#define PROPERTY_VALUE_JSON "[{\"value\": 500}]"
+
+/* long enough for any single benchmark run */
+#define BENCH_TIMER_MS 3600000
+
+static void bench_start(Timer* t)
+{
+    platform_timer_init(t);
+    platform_timer_countdown(t, BENCH_TIMER_MS);
+}
+
+static int bench_elapsed_ms(Timer* t)
+{
+    int elapsed = BENCH_TIMER_MS - platform_timer_left(t);
+    return elapsed > 0 ? elapsed : 1;
+}
+
+static void bench_init_handle(evrythng_handle_t* h)
+{
+    EvrythngInitHandle(h);
+    EvrythngSetUrl(*h, MQTT_URL);
+    EvrythngSetKey(*h, DEVICE_API_KEY);
+}
+
+
+#define PRODUCERS_MAX 32
+#define OPS_PER_PRODUCER 50
+
+typedef struct producer_t
+{
+    evrythng_handle_t handle;
+    Thread thread;
+    Semaphore* done;
+    int failures;
+} producer_t;
+
+static void producer_thread(void* arg)
+{
+    producer_t* p = (producer_t*)arg;
+    int i;
+
+    for (i = 0; i < OPS_PER_PRODUCER; i++)
+        if (EvrythngPubThngProperty(p->handle, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON) != EVRYTHNG_SUCCESS)
+            p->failures++;
+
+    platform_semaphore_post(p->done);
+}
+
+/* Measures publish throughput of a single handle with 1 to PRODUCERS_MAX
+ * application threads publishing concurrently. */
+void bench_producers_scaling()
+{
+    static producer_t producers[PRODUCERS_MAX];
+    evrythng_handle_t h;
+    Semaphore done;
+    Timer t;
+    int n, i;
+
+    bench_init_handle(&h);
+    EvrythngSetOpQueueDepth(h, PRODUCERS_MAX);
+    if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+    {
+        platform_printf("%s: could not connect\n", __func__);
+        EvrythngDestroyHandle(h);
+        return;
+    }
+
+    platform_semaphore_init(&done);
+
+    platform_printf("%s: producers, ops, ms, ops/sec, failures\n", __func__);
+
+    for (n = 1; n <= PRODUCERS_MAX; n *= 2)
+    {
+        int failures = 0;
+
+        bench_start(&t);
+
+        for (i = 0; i < n; i++)
+        {
+            producers[i].handle = h;
+            producers[i].done = &done;
+            producers[i].failures = 0;
+            platform_thread_create(&producers[i].thread, 0, "producer", producer_thread, 8192, &producers[i]);
+        }
+
+        for (i = 0; i < n; i++)
+            platform_semaphore_wait(&done, 0x00FFFFFF);
+
+        int ms = bench_elapsed_ms(&t);
+
+        for (i = 0; i < n; i++)
+        {
+            platform_thread_join(&producers[i].thread, 0x00FFFFFF);
+            platform_thread_destroy(&producers[i].thread);
+            failures += producers[i].failures;
+        }
+
+        platform_printf("%s: %d, %d, %d, %d, %d\n", __func__, 
+                n, n * OPS_PER_PRODUCER, ms, n * OPS_PER_PRODUCER * 1000 / ms, failures);
+    }
+
+    platform_semaphore_deinit(&done);
+
+    EvrythngDisconnect(h);
+    EvrythngDestroyHandle(h);
+}
+
+#define LATENCY_OPS 200
+
+/* Measures round-trip latency of sequential publishes from a single thread,
+ * which is dominated by how quickly the mqtt thread picks up a new op. */
+void bench_publish_latency()
+{
+    evrythng_handle_t h;
+    Timer t;
+    int i, failures = 0;
+
+    bench_init_handle(&h);
+    if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+    {
+        platform_printf("%s: could not connect\n", __func__);
+        EvrythngDestroyHandle(h);
+        return;
+    }
+
+    bench_start(&t);
+
+    for (i = 0; i < LATENCY_OPS; i++)
+        if (EvrythngPubThngProperty(h, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON) != EVRYTHNG_SUCCESS)
+            failures++;
+
+    int ms = bench_elapsed_ms(&t);
+
+    platform_printf("%s: ops, ms, us/op, failures\n", __func__);
+    platform_printf("%s: %d, %d, %d, %d\n", __func__, LATENCY_OPS, ms, ms * 1000 / LATENCY_OPS, failures);
+
+    EvrythngDisconnect(h);
+    EvrythngDestroyHandle(h);
+}
+
+#define WINDOW_MAX 32
+#define WINDOW_OPS 400
+
+static void window_pub_callback(evrythng_return_t result, void* userdata)
+{
+    (void)result;
+    platform_semaphore_post((Semaphore*)userdata);
+}
+
+/* Measures asynchronous publish throughput of a single thread for in-flight 
+ * window sizes 0 (stop-and-wait) to WINDOW_MAX. The gain grows with the 
+ * round trip time to the broker. */
+void bench_inflight_window()
+{
+    evrythng_handle_t h;
+    Semaphore done;
+    Timer t;
+    int w, i;
+
+    platform_semaphore_init(&done);
+
+    platform_printf("%s: window, ops, ms, ops/sec, failures\n", __func__);
+
+    for (w = 0; w <= WINDOW_MAX; w = w ? w * 2 : 1)
+    {
+        int failures = 0;
+
+        bench_init_handle(&h);
+        EvrythngSetMaxInflight(h, w);
+        EvrythngSetOpQueueDepth(h, WINDOW_MAX * 2);
+        if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+        {
+            platform_printf("%s: could not connect\n", __func__);
+            EvrythngDestroyHandle(h);
+            break;
+        }
+
+        bench_start(&t);
+
+        for (i = 0; i < WINDOW_OPS; i++)
+        {
+            evrythng_return_t rc;
+            while ((rc = EvrythngPubThngPropertyAsync(h, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON, 
+                        window_pub_callback, &done, 0)) == EVRYTHNG_QUEUE_FULL)
+                platform_sleep(1);
+            if (rc != EVRYTHNG_SUCCESS)
+            {
+                failures++;
+                platform_semaphore_post(&done);
+            }
+        }
+
+        for (i = 0; i < WINDOW_OPS; i++)
+            platform_semaphore_wait(&done, 0x00FFFFFF);
+
+        int ms = bench_elapsed_ms(&t);
+
+        platform_printf("%s: %d, %d, %d, %d, %d\n", __func__, 
+                w, WINDOW_OPS, ms, WINDOW_OPS * 1000 / ms, failures);
+
+        EvrythngDisconnect(h);
+        EvrythngDestroyHandle(h);
+    }
+
+    platform_semaphore_deinit(&done);
+}
+
+#define BURST_MSGS 2000
+
+static Semaphore burst_sem;
+
+static void burst_sub_callback(const char* str_json, size_t len)
+{
+    (void)str_json;
+    (void)len;
+    platform_semaphore_post(&burst_sem);
+}
+
+/* Measures how fast a burst of small inbound messages is received, which 
+ * is dominated by the cost of reading and framing packets. */
+void bench_receive_burst()
+{
+    evrythng_handle_t h;
+    Timer t;
+    int i, received = 0;
+
+    bench_init_handle(&h);
+    EvrythngSetOpQueueDepth(h, 256);
+    if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+    {
+        platform_printf("%s: could not connect\n", __func__);
+        EvrythngDestroyHandle(h);
+        return;
+    }
+
+    platform_semaphore_init(&burst_sem);
+    EvrythngSubThngProperty(h, THNG_1, PROPERTY_1, 0, burst_sub_callback);
+
+    bench_start(&t);
+
+    for (i = 0; i < BURST_MSGS; i++)
+        while (EvrythngPubThngPropertyAsync(h, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON, 0, 0, 0) == EVRYTHNG_QUEUE_FULL)
+            platform_sleep(1);
+
+    for (received = 0; received < BURST_MSGS; received++)
+        if (platform_semaphore_wait(&burst_sem, 10000))
+            break;
+
+    int ms = bench_elapsed_ms(&t);
+
+    platform_printf("%s: msgs, received, ms, msgs/sec\n", __func__);
+    platform_printf("%s: %d, %d, %d, %d\n", __func__, BURST_MSGS, received, ms, received * 1000 / ms);
+
+    EvrythngUnsubThngProperty(h, THNG_1, PROPERTY_1);
+    platform_semaphore_deinit(&burst_sem);
+
+    EvrythngDisconnect(h);
+    EvrythngDestroyHandle(h);
+}
+
+#define TICK_PROPERTIES 20
+#define TICKS 20
+
+/* Measures the time for a device to report TICK_PROPERTIES properties of 
+ * one thing per tick, with a publish per property and with the updates of 
+ * a tick aggregated into one message. */
+void bench_property_aggregation()
+{
+    evrythng_handle_t h;
+    char name[32];
+    Timer t;
+    int aggregate, tick, i;
+
+    bench_init_handle(&h);
+    EvrythngSetAggregation(h, 0, TICK_PROPERTIES, 4096);
+    if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+    {
+        platform_printf("%s: could not connect\n", __func__);
+        EvrythngDestroyHandle(h);
+        return;
+    }
+
+    platform_printf("%s: mode, properties, ms, us/tick, failures\n", __func__);
+
+    for (aggregate = 0; aggregate <= 1; aggregate++)
+    {
+        int failures = 0;
+
+        bench_start(&t);
+
+        for (tick = 0; tick < TICKS; tick++)
+        {
+            for (i = 0; i < TICK_PROPERTIES; i++)
+            {
+                evrythng_return_t rc;
+
+                snprintf(name, sizeof name, "property_%d", i);
+                if (aggregate)
+                    rc = EvrythngAggregateThngProperty(h, THNG_1, name, PROPERTY_VALUE_JSON);
+                else
+                    rc = EvrythngPubThngProperty(h, THNG_1, name, PROPERTY_VALUE_JSON);
+                if (rc != EVRYTHNG_SUCCESS)
+                    failures++;
+            }
+        }
+
+        int ms = bench_elapsed_ms(&t);
+
+        platform_printf("%s: %s, %d, %d, %d, %d\n", __func__, aggregate ? "aggregated" : "individual",
+                TICKS * TICK_PROPERTIES, ms, ms * 1000 / TICKS, failures);
+    }
+
+    EvrythngDisconnect(h);
+    EvrythngDestroyHandle(h);
+}
+
+#define DISPATCH_SUBS_MAX 10000
+#define DISPATCH_MSGS 2000
+
+static Semaphore dispatch_sem;
+
+static void dispatch_sub_callback(const char* str_json, size_t len)
+{
+    (void)str_json;
+    (void)len;
+    platform_semaphore_post(&dispatch_sem);
+}
+
+/* Measures how fast inbound messages are dispatched with 10 to 
+ * DISPATCH_SUBS_MAX subscriptions in place. The messages go to the 
+ * subscription made last. */
+void bench_sub_dispatch()
+{
+    evrythng_handle_t h;
+    char name[32];
+    Timer t;
+    int n, i, received;
+
+    platform_semaphore_init(&dispatch_sem);
+
+    platform_printf("%s: subs, msgs, received, ms, msgs/sec\n", __func__);
+
+    for (n = 10; n <= DISPATCH_SUBS_MAX; n *= 10)
+    {
+        bench_init_handle(&h);
+        EvrythngSetOpQueueDepth(h, 256);
+        if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+        {
+            platform_printf("%s: could not connect\n", __func__);
+            EvrythngDestroyHandle(h);
+            break;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            snprintf(name, sizeof name, "property_%d", i);
+            EvrythngSubThngProperty(h, THNG_1, name, 0, dispatch_sub_callback);
+        }
+
+        bench_start(&t);
+
+        for (i = 0; i < DISPATCH_MSGS; i++)
+            while (EvrythngPubThngPropertyAsync(h, THNG_1, name, PROPERTY_VALUE_JSON, 0, 0, 0) == EVRYTHNG_QUEUE_FULL)
+                platform_sleep(1);
+
+        for (received = 0; received < DISPATCH_MSGS; received++)
+            if (platform_semaphore_wait(&dispatch_sem, 10000))
+                break;
+
+        int ms = bench_elapsed_ms(&t);
+
+        platform_printf("%s: %d, %d, %d, %d, %d\n", __func__, n, DISPATCH_MSGS, received, ms, received * 1000 / ms);
+
+        EvrythngDisconnect(h);
+        EvrythngDestroyHandle(h);
+    }
+
+    platform_semaphore_deinit(&dispatch_sem);
+}
+
+#define PREPARED_PROPERTIES 5
+#define PREPARED_ROUNDS 2000
+
+/* Measures QoS 0 publishes of PREPARED_PROPERTIES properties, with the 
+ * topic built on every call and with prepared topics. */
+void bench_prepared_topics()
+{
+    evrythng_topic_t topics[PREPARED_PROPERTIES];
+    char names[PREPARED_PROPERTIES][32];
+    evrythng_handle_t h;
+    Timer t;
+    int prepared, round, i;
+
+    bench_init_handle(&h);
+    EvrythngSetQos(h, 0);
+    EvrythngSetOpQueueDepth(h, 256);
+    if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+    {
+        platform_printf("%s: could not connect\n", __func__);
+        EvrythngDestroyHandle(h);
+        return;
+    }
+
+    for (i = 0; i < PREPARED_PROPERTIES; i++)
+    {
+        snprintf(names[i], sizeof names[i], "property_%d", i);
+        EvrythngPrepareThngProperty(h, THNG_1, names[i], &topics[i]);
+    }
+
+    platform_printf("%s: mode, ops, ms, ops/sec, failures\n", __func__);
+
+    for (prepared = 0; prepared <= 1; prepared++)
+    {
+        int failures = 0;
+
+        bench_start(&t);
+
+        for (round = 0; round < PREPARED_ROUNDS; round++)
+        {
+            for (i = 0; i < PREPARED_PROPERTIES; i++)
+            {
+                evrythng_return_t rc;
+                do
+                {
+                    if (prepared)
+                        rc = EvrythngPubPreparedAsync(h, topics[i], PROPERTY_VALUE_JSON, 0, 0, 0);
+                    else
+                        rc = EvrythngPubThngPropertyAsync(h, THNG_1, names[i], PROPERTY_VALUE_JSON, 0, 0, 0);
+                }
+                while (rc == EVRYTHNG_QUEUE_FULL);
+                if (rc != EVRYTHNG_SUCCESS)
+                    failures++;
+            }
+        }
+
+        int ms = bench_elapsed_ms(&t);
+        int ops = PREPARED_ROUNDS * PREPARED_PROPERTIES;
+
+        platform_printf("%s: %s, %d, %d, %d, %d\n", __func__, prepared ? "prepared" : "formatted",
+                ops, ms, ops * 1000 / ms, failures);
+    }
+
+    for (i = 0; i < PREPARED_PROPERTIES; i++)
+        EvrythngTopicRelease(topics[i]);
+
+    EvrythngDisconnect(h);
+    EvrythngDestroyHandle(h);
+}
+
+
+#define RESTORE_SUBS_MAX 200
+
+/* Measures how long a reconnection takes with 0 to RESTORE_SUBS_MAX 
+ * subscriptions, with a clean session which has them restored and with 
+ * a persistent session which keeps them. */
+void bench_restore_subscriptions()
+{
+    static char names[RESTORE_SUBS_MAX][32];
+    static const int counts[] = {0, 25, 50, 100, RESTORE_SUBS_MAX};
+    evrythng_handle_t h;
+    Timer t;
+    unsigned k;
+    int persistent;
+
+    platform_printf("%s: session, subscriptions, ms, failures\n", __func__);
+
+    for (persistent = 0; persistent <= 1; persistent++)
+    {
+        int n = 0;
+
+        bench_init_handle(&h);
+        if (persistent)
+        {
+            EvrythngSetClientId(h, "bench_restore_subscriptions");
+            EvrythngSetPersistentSession(h, 1);
+        }
+        if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+        {
+            platform_printf("%s: could not connect\n", __func__);
+            EvrythngDestroyHandle(h);
+            return;
+        }
+
+        for (k = 0; k < sizeof counts / sizeof counts[0]; k++)
+        {
+            int failures = 0, count = counts[k];
+
+            for (; n < count; n++)
+            {
+                snprintf(names[n], sizeof names[n], "property_%d", n);
+                if (EvrythngSubThngProperty(h, THNG_1, names[n], 0, dispatch_sub_callback) != EVRYTHNG_SUCCESS)
+                    failures++;
+            }
+
+            EvrythngDisconnect(h);
+
+            bench_start(&t);
+            if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+                failures++;
+            int ms = bench_elapsed_ms(&t);
+
+            platform_printf("%s: %s, %d, %d, %d\n", __func__, persistent ? "persistent" : "clean", 
+                    count, ms, failures);
+        }
+
+        /* do not leave the subscriptions in the session */
+        for (n = 0; persistent && n < RESTORE_SUBS_MAX; n++)
+            EvrythngUnsubThngProperty(h, THNG_1, names[n]);
+
+        EvrythngDisconnect(h);
+        EvrythngDestroyHandle(h);
+    }
+}
+
+
+#define FLEET_DEVICES 10000
+#define FLEET_SLOT_MS 10
+#define FLEET_SLOT_CAPACITY 5       /* connections the broker accepts per slot, 500/s */
+#define FLEET_SLOTS 120000          /* 20 minutes */
+
+typedef struct fleet_policy_t
+{
+    const char* name;
+    int min_ms;
+    int max_ms;
+    int jitter;
+    int burst;      /* attempts made back to back */
+} fleet_policy_t;
+
+/* The delay before a reconnection attempt, as chosen by the library. */
+static int fleet_delay(const fleet_policy_t* p, int attempt)
+{
+    int window = p->min_ms, i;
+
+    for (i = 0; i < attempt && window < p->max_ms; i++)
+        window = window > p->max_ms / 2 ? p->max_ms : window * 2;
+
+    return p->jitter ? (unsigned int)platform_rand() % ((unsigned int)window + 1) : window;
+}
+
+/* Simulates FLEET_DEVICES devices reconnecting at once to a broker which
+ * has just restarted and accepts FLEET_SLOT_CAPACITY connections every 
+ * FLEET_SLOT_MS, refusing any further attempt, and reports how long the
+ * fleet takes to reconnect with each reconnection policy. The first one 
+ * is the former fixed 300 ms retry of 3 attempts. */
+void bench_fleet_reconnect()
+{
+    static const fleet_policy_t policies[] = {
+        {"fixed 300 ms, 3 attempts", 300, 300, 0, 3},
+        {"exponential 300 ms to 30 s", 300, 30000, 0, 1},
+        {"full jitter 300 ms to 30 s", 300, 30000, 1, 1},
+        {"full jitter 300 ms to 5 s", 300, 5000, 1, 1},
+        {"full jitter 1 s to 60 s", 1000, 60000, 1, 1},
+    };
+    static int head[FLEET_SLOTS];
+    static int next[FLEET_DEVICES];
+    static int attempt[FLEET_DEVICES];
+    unsigned k;
+    int i;
+
+    platform_printf("%s: policy, devices, 50%% ms, 99%% ms, 100%% ms, attempts (-1: not within the simulated time)\n", __func__);
+
+    for (k = 0; k < sizeof policies / sizeof policies[0]; k++)
+    {
+        const fleet_policy_t* p = &policies[k];
+        int slot, connected = 0, attempts = 0, t50 = -1, t99 = -1, t100 = -1;
+
+        for (slot = 0; slot < FLEET_SLOTS; slot++)
+            head[slot] = -1;
+
+        /* the first attempt follows the loss of the connection */
+        for (i = 0; i < FLEET_DEVICES; i++)
+        {
+            attempt[i] = 0;
+            int s = p->jitter ? fleet_delay(p, 0) / FLEET_SLOT_MS : 0;
+            next[i] = head[s];
+            head[s] = i;
+        }
+
+        for (slot = 0; slot < FLEET_SLOTS && connected < FLEET_DEVICES; slot++)
+        {
+            int accepted = 0, d = head[slot];
+
+            while (d >= 0)
+            {
+                int n = next[d], tries;
+
+                for (tries = 0; tries < p->burst; tries++)
+                {
+                    attempts++;
+                    if (accepted < FLEET_SLOT_CAPACITY)
+                        break;
+                }
+
+                if (tries < p->burst)
+                {
+                    accepted++;
+                    connected++;
+                    if (t50 < 0 && connected * 2 >= FLEET_DEVICES)
+                        t50 = slot * FLEET_SLOT_MS;
+                    if (t99 < 0 && connected * 100 >= FLEET_DEVICES * 99)
+                        t99 = slot * FLEET_SLOT_MS;
+                    if (connected == FLEET_DEVICES)
+                        t100 = slot * FLEET_SLOT_MS;
+                }
+                else
+                {
+                    int s = slot + 1 + fleet_delay(p, attempt[d]++) / FLEET_SLOT_MS;
+                    if (s < FLEET_SLOTS)
+                    {
+                        next[d] = head[s];
+                        head[s] = d;
+                    }
+                }
+                d = n;
+            }
+        }
+
+        platform_printf("%s: %s, %d, %d, %d, %d, %d\n", __func__, p->name, FLEET_DEVICES, 
+                t50, t99, t100, attempts);
+    }
+}
+
+
+#define GATEWAY_HANDLES_MAX 500
+#define GATEWAY_PUBS 10
+#define GATEWAY_REACTOR_THREADS 4
+
+static void gateway_pub_callback(evrythng_return_t result, void* userdata)
+{
+    platform_semaphore_post((Semaphore*)userdata);
+}
+
+/* Measures connecting 10, 100 and GATEWAY_HANDLES_MAX handles and publishing 
+ * GATEWAY_PUBS QoS 1 messages from each, with a thread per handle and 
+ * with the handles driven by a reactor of GATEWAY_REACTOR_THREADS threads. */
+void bench_gateway_handles()
+{
+    static evrythng_handle_t handles[GATEWAY_HANDLES_MAX];
+    static const int counts[] = {10, 100, GATEWAY_HANDLES_MAX};
+    Semaphore done;
+    Timer t;
+    unsigned k;
+    int reactor, i, j;
+
+    platform_semaphore_init(&done);
+
+    platform_printf("%s: handles, mode, threads, connect ms, publish ms, msgs/sec, failures\n", __func__);
+
+    for (k = 0; k < sizeof counts / sizeof counts[0]; k++)
+    {
+        int n = counts[k];
+
+        for (reactor = 0; reactor <= 1; reactor++)
+        {
+            evrythng_reactor_t r = 0;
+            int failures = 0, pending = 0;
+
+            if (reactor && EvrythngInitReactor(&r, GATEWAY_REACTOR_THREADS) != EVRYTHNG_SUCCESS)
+                break;
+
+            bench_start(&t);
+
+            for (i = 0; i < n; i++)
+            {
+                bench_init_handle(&handles[i]);
+                if (r)
+                    EvrythngSetReactor(handles[i], r);
+                if (EvrythngConnect(handles[i]) != EVRYTHNG_SUCCESS)
+                    failures++;
+            }
+
+            int connect_ms = bench_elapsed_ms(&t);
+
+            bench_start(&t);
+
+            for (j = 0; j < GATEWAY_PUBS; j++)
+            {
+                for (i = 0; i < n; i++)
+                {
+                    evrythng_return_t rc;
+                    do
+                    {
+                        rc = EvrythngPubThngPropertyAsync(handles[i], THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON, 
+                                gateway_pub_callback, &done, 0);
+                    }
+                    while (rc == EVRYTHNG_QUEUE_FULL);
+                    if (rc == EVRYTHNG_SUCCESS)
+                        pending++;
+                    else
+                        failures++;
+                }
+            }
+
+            while (pending--)
+                if (platform_semaphore_wait(&done, 10000))
+                    failures++;
+
+            int publish_ms = bench_elapsed_ms(&t);
+
+            platform_printf("%s: %d, %s, %d, %d, %d, %d, %d\n", __func__, n, 
+                    reactor ? "reactor" : "thread per handle", reactor ? GATEWAY_REACTOR_THREADS : n, 
+                    connect_ms, publish_ms, n * GATEWAY_PUBS * 1000 / publish_ms, failures);
+
+            for (i = 0; i < n; i++)
+            {
+                EvrythngDisconnect(handles[i]);
+                EvrythngDestroyHandle(handles[i]);
+            }
+
+            if (r)
+                EvrythngDestroyReactor(r);
+        }
+    }
+
+    platform_semaphore_deinit(&done);
+}
+
+
+#define SPOOL_BENCH_PUBS 1000
+#define SPOOL_BENCH_SIZE (256 * 1024)
+#define SPOOL_BENCH_FILE "bench.spool"
+
+typedef struct spool_bench_t
+{
+    const char* name;
+    const char* path;
+    int rate;
+} spool_bench_t;
+
+/* Measures spooling SPOOL_BENCH_PUBS publishes while not connected and 
+ * replaying them once connected, with the spool in memory and in a file,
+ * as fast as they are acknowledged and at a limited rate. */
+void bench_spool_replay()
+{
+    static const spool_bench_t runs[] = {
+        {"memory", 0, 0},
+        {"file", SPOOL_BENCH_FILE, 0},
+        {"memory, 500 msgs/sec", 0, 500},
+    };
+    evrythng_spool_stats_t stats;
+    evrythng_handle_t h;
+    Timer t;
+    unsigned k;
+    int i;
+
+    platform_printf("%s: spool, publishes, spool ms, replay ms, replayed msgs/sec, failures\n", __func__);
+
+    for (k = 0; k < sizeof runs / sizeof runs[0]; k++)
+    {
+        int failures = 0;
+
+        bench_init_handle(&h);
+        if (EvrythngSetSpool(h, SPOOL_BENCH_SIZE, EVRYTHNG_SPOOL_DROP_NEWEST, runs[k].path) != EVRYTHNG_SUCCESS)
+        {
+            platform_printf("%s: could not set up the spool\n", __func__);
+            EvrythngDestroyHandle(h);
+            return;
+        }
+        EvrythngSetSpoolReplayRate(h, runs[k].rate);
+
+        bench_start(&t);
+        for (i = 0; i < SPOOL_BENCH_PUBS; i++)
+            if (EvrythngPubThngProperty(h, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON) != EVRYTHNG_SPOOLED)
+                failures++;
+        int spool_ms = bench_elapsed_ms(&t);
+
+        bench_start(&t);
+        if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+            failures++;
+        do
+        {
+            platform_sleep(1);
+            EvrythngGetSpoolStats(h, &stats);
+        }
+        while (stats.count > 0 && bench_elapsed_ms(&t) < 60000);
+        int replay_ms = bench_elapsed_ms(&t);
+
+        platform_printf("%s: %s, %d, %d, %d, %d, %d\n", __func__, runs[k].name, SPOOL_BENCH_PUBS, 
+                spool_ms, replay_ms, (int)stats.replayed * 1000 / replay_ms, failures + (int)stats.count);
+
+        EvrythngDisconnect(h);
+        EvrythngDestroyHandle(h);
+    }
+}
+
+
+#define CONNECT_BENCH_RUNS 20
+
+/* Measures the time to connected of CONNECT_BENCH_RUNS connections in turn, 
+ * the network part and the whole up to the CONNACK. The first connection 
+ * resolves the host, the following ones may use addresses the port cached. */
+void bench_connect_time()
+{
+    evrythng_reconnect_state_t state;
+    evrythng_handle_t h;
+    int i, failures = 0;
+    int network_total = 0, connect_total = 0, connect_max = 0, first_network = -1, first_connect = -1;
+
+    platform_printf("%s: connections, first network ms, first connect ms, avg network ms, avg connect ms, max connect ms, failures\n", __func__);
+
+    bench_init_handle(&h);
+    for (i = 0; i < CONNECT_BENCH_RUNS; i++)
+    {
+        if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+        {
+            failures++;
+            continue;
+        }
+        EvrythngGetReconnectState(h, &state);
+        EvrythngDisconnect(h);
+
+        if (i == 0)
+        {
+            first_network = state.last_network_ms;
+            first_connect = state.last_connect_ms;
+            continue;
+        }
+        network_total += state.last_network_ms;
+        connect_total += state.last_connect_ms;
+        if (state.last_connect_ms > connect_max)
+            connect_max = state.last_connect_ms;
+    }
+    EvrythngDestroyHandle(h);
+
+    int measured = CONNECT_BENCH_RUNS - 1 - failures;
+    if (measured < 1)
+        measured = 1;
+    platform_printf("%s: %d, %d, %d, %d, %d, %d, %d\n", __func__, CONNECT_BENCH_RUNS, first_network, first_connect,
+            network_total / measured, connect_total / measured, connect_max, failures);
+}
+
+
+#define TLS_BENCH_RUNS 20
+
+/* Compares the time to connected with a full TLS handshake, a new handle for
+ * each connection, to the time with the session of the previous connection 
+ * of the same handle resumed. The reused handle keeps the CA chain loaded so
+ * that neither run includes parsing it. */
+void bench_tls_resume()
+{
+    evrythng_reconnect_state_t state;
+    evrythng_handle_t reused, h;
+    int k, i;
+
+    if (strncmp(MQTT_URL, "ssl", strlen("ssl")) != 0)
+    {
+        platform_printf("%s: needs an ssl url\n", __func__);
+        return;
+    }
+
+    platform_printf("%s: handshake, connections, avg network ms, avg connect ms, resumed, failures\n", __func__);
+
+    bench_init_handle(&reused);
+    if (EvrythngConnect(reused) == EVRYTHNG_SUCCESS)
+        EvrythngDisconnect(reused);
+
+    for (k = 0; k < 2; k++)
+    {
+        int network_total = 0, connect_total = 0, resumed = 0, failures = 0;
+
+        for (i = 0; i < TLS_BENCH_RUNS; i++)
+        {
+            h = reused;
+            if (k == 0)
+                bench_init_handle(&h);
+
+            if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+                failures++;
+            else
+            {
+                EvrythngGetReconnectState(h, &state);
+                EvrythngDisconnect(h);
+                network_total += state.last_network_ms;
+                connect_total += state.last_connect_ms;
+                resumed += state.last_resumed;
+            }
+
+            if (h != reused)
+                EvrythngDestroyHandle(h);
+        }
+
+        int measured = TLS_BENCH_RUNS - failures > 0 ? TLS_BENCH_RUNS - failures : 1;
+        platform_printf("%s: %s, %d, %d, %d, %d, %d\n", __func__, k == 0 ? "full" : "resumed", TLS_BENCH_RUNS, 
+                network_total / measured, connect_total / measured, resumed, failures);
+    }
+
+    EvrythngDestroyHandle(reused);
+}
+
+
+#define RTT_BENCH_SECONDS 10
+
+/* Keeps a connection idle with a keepalive of a second and reports the round
+ * trip times of the pings. */
+void bench_keepalive_rtt()
+{
+    evrythng_rtt_stats_t stats;
+    evrythng_handle_t h;
+
+    platform_printf("%s: seconds, pings, last ms, min ms, avg ms, max ms\n", __func__);
+
+    bench_init_handle(&h);
+    EvrythngSetKeepAlive(h, 1);
+    if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+    {
+        platform_printf("%s: could not connect\n", __func__);
+        EvrythngDestroyHandle(h);
+        return;
+    }
+    platform_sleep(RTT_BENCH_SECONDS * 1000);
+    EvrythngGetRttStats(h, &stats);
+
+    platform_printf("%s: %d, %u, %d, %d, %d, %d\n", __func__, RTT_BENCH_SECONDS, stats.samples, 
+            stats.last_ms, stats.min_ms, stats.avg_ms, stats.max_ms);
+
+    EvrythngDisconnect(h);
+    EvrythngDestroyHandle(h);
+}
+
+
+#define CONNECTIONS_BENCH_MAX 8
+#define CONNECTIONS_BENCH_THNGS 64
+#define CONNECTIONS_BENCH_PUBS 2000
+
+/* Measures QoS 1 publishes to CONNECTIONS_BENCH_THNGS things from a single 
+ * handle spreading them over 1 to CONNECTIONS_BENCH_MAX connections. */
+void bench_connections_scaling()
+{
+    static char thngs[CONNECTIONS_BENCH_THNGS][16];
+    evrythng_handle_t h;
+    Semaphore done;
+    Timer t;
+    int n, i;
+
+    for (i = 0; i < CONNECTIONS_BENCH_THNGS; i++)
+        snprintf(thngs[i], sizeof thngs[i], "thng%04d", i);
+
+    platform_semaphore_init(&done);
+
+    platform_printf("%s: connections, msgs, connect ms, publish ms, msgs/sec, failures\n", __func__);
+
+    for (n = 1; n <= CONNECTIONS_BENCH_MAX; n *= 2)
+    {
+        int failures = 0, pending = 0;
+
+        bench_init_handle(&h);
+        EvrythngSetOpQueueDepth(h, 64);
+        EvrythngSetMaxInflight(h, 16);
+        EvrythngSetConnections(h, n);
+
+        bench_start(&t);
+        if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+        {
+            platform_printf("%s: could not connect\n", __func__);
+            EvrythngDestroyHandle(h);
+            break;
+        }
+        int connect_ms = bench_elapsed_ms(&t);
+
+        bench_start(&t);
+
+        for (i = 0; i < CONNECTIONS_BENCH_PUBS; i++)
+        {
+            evrythng_return_t rc;
+            do
+            {
+                rc = EvrythngPubThngPropertyAsync(h, thngs[i % CONNECTIONS_BENCH_THNGS], PROPERTY_1, 
+                        PROPERTY_VALUE_JSON, gateway_pub_callback, &done, 0);
+            }
+            while (rc == EVRYTHNG_QUEUE_FULL);
+            if (rc == EVRYTHNG_SUCCESS)
+                pending++;
+            else
+                failures++;
+        }
+
+        while (pending--)
+            if (platform_semaphore_wait(&done, 10000))
+                failures++;
+
+        int publish_ms = bench_elapsed_ms(&t);
+
+        platform_printf("%s: %d, %d, %d, %d, %d, %d\n", __func__, n, CONNECTIONS_BENCH_PUBS, 
+                connect_ms, publish_ms, CONNECTIONS_BENCH_PUBS * 1000 / publish_ms, failures);
+
+        EvrythngDisconnect(h);
+        EvrythngDestroyHandle(h);
+    }
+
+    platform_semaphore_deinit(&done);
+}
+
+
+#define SHUTDOWN_SUBS 100
+#define SHUTDOWN_PUBS 500
+#define SHUTDOWN_TIMEOUT_MS 200
+
+/* Measures shutting down a handle with SHUTDOWN_SUBS subscriptions right 
+ * after queueing SHUTDOWN_PUBS QoS 1 publishes, with EvrythngDisconnect and
+ * with EvrythngDisconnectTimeout, until the handle is destroyed. */
+void bench_shutdown()
+{
+    static char names[SHUTDOWN_SUBS][32];
+    evrythng_disconnect_report_t report;
+    evrythng_handle_t h;
+    Semaphore done;
+    Timer t;
+    int deadline, i;
+
+    platform_semaphore_init(&done);
+
+    platform_printf("%s: mode, subscriptions, publishes, ms, queued dropped, inflight dropped\n", __func__);
+
+    for (deadline = 0; deadline <= 1; deadline++)
+    {
+        memset(&report, 0, sizeof report);
+
+        bench_init_handle(&h);
+        EvrythngSetOpQueueDepth(h, SHUTDOWN_PUBS);
+        if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+        {
+            platform_printf("%s: could not connect\n", __func__);
+            EvrythngDestroyHandle(h);
+            break;
+        }
+
+        for (i = 0; i < SHUTDOWN_SUBS; i++)
+        {
+            snprintf(names[i], sizeof names[i], "property_%d", i);
+            EvrythngSubThngProperty(h, THNG_1, names[i], 0, dispatch_sub_callback);
+        }
+
+        for (i = 0; i < SHUTDOWN_PUBS; i++)
+            EvrythngPubThngPropertyAsync(h, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON, gateway_pub_callback, &done, 0);
+
+        bench_start(&t);
+        if (deadline)
+            EvrythngDisconnectTimeout(h, SHUTDOWN_TIMEOUT_MS, &report);
+        else
+            EvrythngDisconnect(h);
+        EvrythngDestroyHandle(h);
+        int ms = bench_elapsed_ms(&t);
+
+        for (i = 0; i < SHUTDOWN_PUBS; i++)
+            platform_semaphore_wait(&done, 10000);
+
+        platform_printf("%s: %s, %d, %d, %d, %u, %u\n", __func__, deadline ? "deadline" : "graceful", 
+                SHUTDOWN_SUBS, SHUTDOWN_PUBS, ms, report.queued_dropped, report.inflight_dropped);
+    }
+
+    platform_semaphore_deinit(&done);
+}
+
+
+#define BATCHING_BURST 50
+#define BATCHING_BURSTS 20
+
+/* Measures bursts of BATCHING_BURST property updates published at once, 
+ * written packet by packet and with EvrythngSetSendBatching, and the 
+ * packets each network write carried. */
+void bench_send_batching()
+{
+    evrythng_send_stats_t stats;
+    evrythng_handle_t h;
+    Semaphore done;
+    Timer t;
+    int batching, burst, i;
+
+    platform_semaphore_init(&done);
+
+    platform_printf("%s: batch bytes, msgs, ms, msgs/sec, packets, writes, packets per write\n", __func__);
+
+    for (batching = 0; batching <= 4096; batching += 4096)
+    {
+        int failures = 0;
+
+        bench_init_handle(&h);
+        EvrythngSetOpQueueDepth(h, BATCHING_BURST);
+        EvrythngSetMaxInflight(h, BATCHING_BURST);
+        EvrythngSetSendBatching(h, batching);
+        if (EvrythngConnect(h) != EVRYTHNG_SUCCESS)
+        {
+            platform_printf("%s: could not connect\n", __func__);
+            EvrythngDestroyHandle(h);
+            break;
+        }
+
+        bench_start(&t);
+
+        for (burst = 0; burst < BATCHING_BURSTS; burst++)
+        {
+            for (i = 0; i < BATCHING_BURST; i++)
+                if (EvrythngPubThngPropertyAsync(h, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON, 
+                            gateway_pub_callback, &done, 0) != EVRYTHNG_SUCCESS)
+                    failures++;
+            for (i = failures; i < BATCHING_BURST; i++)
+                platform_semaphore_wait(&done, 10000);
+            failures = 0;
+        }
+
+        int ms = bench_elapsed_ms(&t);
+        EvrythngGetSendStats(h, &stats);
+
+        platform_printf("%s: %d, %d, %d, %d, %lu, %lu, %.2f\n", __func__, batching, BATCHING_BURST * BATCHING_BURSTS, 
+                ms, BATCHING_BURST * BATCHING_BURSTS * 1000 / ms, stats.packets, stats.writes, 
+                stats.writes ? (double)stats.packets / stats.writes : 0.0);
+
+        EvrythngDisconnect(h);
+        EvrythngDestroyHandle(h);
+    }
+
+    platform_semaphore_deinit(&done);
+}
+
+
+#define HANDOFF_MSGS 2000
+#define HANDOFF_PAYLOAD 512
+#define HANDOFF_POOL 16
+
+/* messages passed from the subscription callback to a worker thread */
+typedef struct handoff_t
+{
+    evrythng_handle_t handle;
+    const char* msgs[HANDOFF_MSGS];
+    size_t lens[HANDOFF_MSGS];
+    int retained[HANDOFF_MSGS];
+    int head, tail;
+    int copies;
+    Mutex mtx;
+    Semaphore ready;
+    Semaphore done;
+    Thread thread;
+} handoff_t;
+
+static handoff_t handoff;
+
+static void handoff_sub_callback(const char* str_json, size_t len)
+{
+    int retained = EvrythngRetainMessage(handoff.handle, str_json) == EVRYTHNG_SUCCESS;
+    const char* msg = str_json;
+
+    if (!retained)
+    {
+        char* copy = (char*)platform_malloc(len);
+        if (!copy)
+            return;
+        memcpy(copy, str_json, len);
+        msg = copy;
+        handoff.copies++;
+    }
+
+    platform_mutex_lock(&handoff.mtx);
+    handoff.msgs[handoff.tail] = msg;
+    handoff.lens[handoff.tail] = len;
+    handoff.retained[handoff.tail] = retained;
+    handoff.tail = (handoff.tail + 1) % HANDOFF_MSGS;
+    platform_mutex_unlock(&handoff.mtx);
+    platform_semaphore_post(&handoff.ready);
+}
+
+static void handoff_worker(void* arg)
+{
+    volatile unsigned int sum = 0;
+    int n;
+    size_t i;
+
+    (void)arg;
+    for (n = 0; n < HANDOFF_MSGS; n++)
+    {
+        if (platform_semaphore_wait(&handoff.ready, 10000))
+            break;
+
+        platform_mutex_lock(&handoff.mtx);
+        const char* msg = handoff.msgs[handoff.head];
+        size_t len = handoff.lens[handoff.head];
+        int retained = handoff.retained[handoff.head];
+        handoff.head = (handoff.head + 1) % HANDOFF_MSGS;
+        platform_mutex_unlock(&handoff.mtx);
+
+        for (i = 0; i < len; i++)
+            sum += (unsigned char)msg[i];
+
+        if (retained)
+            EvrythngReleaseMessage(handoff.handle, msg);
+        else
+            platform_free((void*)msg);
+    }
+
+    platform_semaphore_post(&handoff.done);
+}
+
+/* Measures HANDOFF_MSGS inbound messages of HANDOFF_PAYLOAD bytes handed 
+ * over to a worker thread, copied out of the read buffer and retained in 
+ * a pool of HANDOFF_POOL buffers with EvrythngSetMessagePool. */
+void bench_message_handoff()
+{
+    char payload[HANDOFF_PAYLOAD + 1];
+    Timer t;
+    int pool, i;
+
+    memset(payload, 'a', HANDOFF_PAYLOAD);
+    memcpy(payload, "[{\"value\": \"", 12);
+    memcpy(payload + HANDOFF_PAYLOAD - 3, "\"}]", 3);
+    payload[HANDOFF_PAYLOAD] = '\0';
+
+    platform_mutex_init(&handoff.mtx);
+    platform_semaphore_init(&handoff.ready);
+    platform_semaphore_init(&handoff.done);
+
+    platform_printf("%s: pool buffers, msgs, ms, msgs/sec, copies, retained\n", __func__);
+
+    for (pool = 0; pool <= HANDOFF_POOL; pool += HANDOFF_POOL)
+    {
+        bench_init_handle(&handoff.handle);
+        EvrythngSetOpQueueDepth(handoff.handle, 256);
+        EvrythngSetMessagePool(handoff.handle, pool);
+        if (EvrythngConnect(handoff.handle) != EVRYTHNG_SUCCESS)
+        {
+            platform_printf("%s: could not connect\n", __func__);
+            EvrythngDestroyHandle(handoff.handle);
+            break;
+        }
+
+        handoff.head = handoff.tail = 0;
+        handoff.copies = 0;
+        EvrythngSubThngProperty(handoff.handle, THNG_1, PROPERTY_1, 0, handoff_sub_callback);
+        platform_thread_create(&handoff.thread, 0, "worker", handoff_worker, 8192, 0);
+
+        bench_start(&t);
+
+        for (i = 0; i < HANDOFF_MSGS; i++)
+            while (EvrythngPubThngPropertyAsync(handoff.handle, THNG_1, PROPERTY_1, payload, 0, 0, 0) == EVRYTHNG_QUEUE_FULL)
+                platform_sleep(1);
+
+        platform_semaphore_wait(&handoff.done, 0x00FFFFFF);
+
+        int ms = bench_elapsed_ms(&t);
+
+        platform_thread_join(&handoff.thread, 0x00FFFFFF);
+        platform_thread_destroy(&handoff.thread);
+
+        platform_printf("%s: %d, %d, %d, %d, %d, %d\n", __func__, pool, HANDOFF_MSGS, 
+                ms, HANDOFF_MSGS * 1000 / ms, handoff.copies, HANDOFF_MSGS - handoff.copies);
+
+        EvrythngUnsubThngProperty(handoff.handle, THNG_1, PROPERTY_1);
+        EvrythngDisconnect(handoff.handle);
+        EvrythngDestroyHandle(handoff.handle);
+    }
+
+    platform_semaphore_deinit(&handoff.done);
+    platform_semaphore_deinit(&handoff.ready);
+    platform_mutex_deinit(&handoff.mtx);
+}
+
+
+void RunAllBenchmarks()
+{
+    bench_publish_latency();
+    bench_producers_scaling();
+    bench_inflight_window();
+    bench_receive_burst();
+    bench_property_aggregation();
+    bench_sub_dispatch();
+    bench_prepared_topics();
+    bench_gateway_handles();
+    bench_restore_subscriptions();
+    bench_fleet_reconnect();
+    bench_spool_replay();
+    bench_connect_time();
+    bench_tls_resume();
+    bench_keepalive_rtt();
+    bench_connections_scaling();
+    bench_shutdown();
+    bench_send_batching();
+    bench_message_handoff();
+}
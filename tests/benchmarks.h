@@ -0,0 +1,11 @@
+/*
+ * (c) Copyright 2012 EVRYTHNG Ltd London / Zurich
+ * www.evrythng.com
+ */
+
+#ifndef _EVRYTHNG_BENCHMARKS_H
+#define _EVRYTHNG_BENCHMARKS_H
+
+void RunAllBenchmarks();
+
+#endif
@@ -3,7 +3,14 @@
  * www.evrythng.com
  */
 
+#include <stdio.h>
 #include <string.h>
+#if !defined(CONFIG_OS_FREERTOS)
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
 
 #include "evrythng/evrythng.h"
 #include "evrythng_config.h"
@@ -161,6 +168,37 @@ void test_set_callback_fail(CuTest* tc)
     EvrythngDestroyHandle(h);
 }
 
+void test_set_max_inflight(CuTest* tc)
+{
+    evrythng_handle_t h;
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngInitHandle(&h));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetMaxInflight(0, 1));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetMaxInflight(h, -1));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetMaxInflight(h, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetMaxInflight(h, 16));
+    EvrythngDestroyHandle(h);
+}
+
+void test_set_reconnect_policy(CuTest* tc)
+{
+    evrythng_handle_t h;
+    evrythng_reconnect_state_t state;
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngInitHandle(&h));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetReconnectPolicy(0, 300, 30000, 10000));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetReconnectPolicy(h, -1, 30000, 10000));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetReconnectPolicy(h, 300, 100, 10000));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetReconnectPolicy(h, 300, 30000, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetReconnectPolicy(h, 0, 0, 1000));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngGetReconnectState(h, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetReconnectState(h, &state));
+    CuAssertIntEquals(tc, 0, state.reconnecting);
+    CuAssertIntEquals(tc, 0, state.attempt);
+    CuAssertIntEquals(tc, -1, state.next_retry_ms);
+    CuAssertIntEquals(tc, -1, state.last_network_ms);
+    CuAssertIntEquals(tc, -1, state.last_connect_ms);
+    EvrythngDestroyHandle(h);
+}
+
 static void common_tcp_init_handle(evrythng_handle_t* h)
 {
     EvrythngInitHandle(h);
@@ -189,6 +227,68 @@ void test_tcp_connect_ok2(CuTest* tc)
     PRINT_END_MEM_STATS
 }
 
+void test_tcp_connect_time(CuTest* tc)
+{
+    evrythng_handle_t h1;
+    evrythng_reconnect_state_t state;
+    common_tcp_init_handle(&h1);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetReconnectPolicy(h1, 300, 30000, 5000));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h1));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetReconnectState(h1, &state));
+    CuAssertTrue(tc, state.last_network_ms >= 0);
+    CuAssertTrue(tc, state.last_connect_ms >= state.last_network_ms);
+    CuAssertTrue(tc, state.last_connect_ms <= 5000);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngDisconnect(h1));
+    EvrythngDestroyHandle(h1);
+}
+
+void test_keepalive_rtt(CuTest* tc)
+{
+    evrythng_handle_t h1;
+    evrythng_rtt_stats_t stats;
+    common_tcp_init_handle(&h1);
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetKeepAlive(h1, -1));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetKeepAlive(h1, 65536));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngGetRttStats(h1, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetRttStats(h1, &stats));
+    CuAssertIntEquals(tc, 0, stats.samples);
+    CuAssertIntEquals(tc, -1, stats.avg_ms);
+
+    /* an idle connection pings every second */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetKeepAlive(h1, 1));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h1));
+    CuAssertIntEquals(tc, EVRYTHNG_FAILURE, EvrythngSetKeepAlive(h1, 60));
+    platform_sleep(2500);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetRttStats(h1, &stats));
+    CuAssertTrue(tc, stats.samples >= 1);
+    CuAssertTrue(tc, stats.min_ms >= 0);
+    CuAssertTrue(tc, stats.min_ms <= stats.avg_ms && stats.avg_ms <= stats.max_ms);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngDisconnect(h1));
+    EvrythngDestroyHandle(h1);
+}
+
+void test_tls_resume(CuTest* tc)
+{
+    evrythng_handle_t h1;
+    evrythng_reconnect_state_t state;
+
+    /* only ssl urls have a session to resume */
+    if (strncmp(MQTT_URL, "ssl", strlen("ssl")) != 0)
+        return;
+
+    common_tcp_init_handle(&h1);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h1));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetReconnectState(h1, &state));
+    CuAssertIntEquals(tc, 0, state.last_resumed);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngDisconnect(h1));
+
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h1));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetReconnectState(h1, &state));
+    CuAssertIntEquals(tc, 1, state.last_resumed);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngDisconnect(h1));
+    EvrythngDestroyHandle(h1);
+}
+
 static void test_sub_callback(const char* str_json, size_t len)
 {
     char msg[len+1]; snprintf(msg, sizeof msg, "%s", str_json);
@@ -385,6 +485,673 @@ void test_pubsuball_actions(CuTest* tc)
     END_SINGLE_CONNECTION
 }
 
+static void test_pub_callback(evrythng_return_t result, void* userdata)
+{
+    *(evrythng_return_t*)userdata = result;
+}
+
+void test_pubsub_thng_prop_async(CuTest* tc)
+{
+    evrythng_ticket_t ticket;
+    evrythng_return_t result = EVRYTHNG_IN_PROGRESS;
+
+    START_SINGLE_CONNECTION
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(h1, THNG_1, PROPERTY_1, 0, test_sub_callback));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngPropertyAsync(h1, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON, test_pub_callback, &result, &ticket));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    while (EvrythngTicketStatus(ticket) == EVRYTHNG_IN_PROGRESS)
+        platform_sleep(10);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngTicketStatus(ticket));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, result);
+    EvrythngTicketRelease(ticket);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngPropertyAsync(h1, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON, 0, 0, 0));
+    END_SINGLE_CONNECTION
+}
+
+#define LARGE_VALUE_LEN 4000
+
+static size_t chunked_received;
+
+static void test_sub_chunk_callback(const char* chunk, size_t offset, size_t chunk_len, size_t total_len)
+{
+    if (offset != chunked_received)
+        return;
+    chunked_received += chunk_len;
+    if (chunked_received == total_len)
+        platform_semaphore_post(&sub_sem);
+}
+
+void test_pubsub_thng_prop_chunked(CuTest* tc)
+{
+    static char large_json[LARGE_VALUE_LEN + 32];
+    char* value;
+
+    /* a property value which does not fit the 1 KB read buffer */
+    strcpy(large_json, "[{\"value\": \"");
+    value = large_json + strlen(large_json);
+    memset(value, 'x', LARGE_VALUE_LEN);
+    strcpy(value + LARGE_VALUE_LEN, "\"}]");
+    chunked_received = 0;
+
+    START_SINGLE_CONNECTION
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSubThngPropertyChunked(h1, THNG_1, PROPERTY_1, 0, test_sub_callback, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngPropertyChunked(h1, THNG_1, PROPERTY_1, 0, test_sub_callback, test_sub_chunk_callback));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, large_json));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    CuAssertIntEquals(tc, (int)strlen(large_json), (int)chunked_received);
+    /* small messages still go to the plain callback */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON));
+    END_SINGLE_CONNECTION
+}
+
+void test_pubsub_thng_prop_prepared(CuTest* tc)
+{
+    evrythng_topic_t topic;
+
+    START_SINGLE_CONNECTION
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngPrepareThngProperty(h1, THNG_1, 0, &topic));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPrepareThngProperty(h1, THNG_1, PROPERTY_1, &topic));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(h1, THNG_1, PROPERTY_1, 0, test_sub_callback));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubPrepared(h1, topic, PROPERTY_VALUE_JSON));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    /* the topic is copied by the asynchronous publish */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubPreparedAsync(h1, topic, PROPERTY_VALUE_JSON, 0, 0, 0));
+    EvrythngTopicRelease(topic);
+    END_SINGLE_CONNECTION
+}
+
+static int route_property_1, route_properties;
+
+static void test_route_property_1_callback(const char* str_json, size_t len)
+{
+    route_property_1++;
+    platform_semaphore_post(&sub_sem);
+}
+
+static void test_route_properties_callback(const char* str_json, size_t len)
+{
+    route_properties++;
+    platform_semaphore_post(&sub_sem);
+}
+
+void test_sub_routing(CuTest* tc)
+{
+    route_property_1 = route_properties = 0;
+
+    START_SINGLE_CONNECTION
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(h1, THNG_1, PROPERTY_2, 0, test_sub_callback));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(h1, THNG_1, PROPERTY_1, 0, test_route_property_1_callback));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperties(h1, THNG_1, 0, test_route_properties_callback));
+
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    CuAssertIntEquals(tc, 1, route_property_1);
+    CuAssertIntEquals(tc, 0, route_properties);
+
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperties(h1, THNG_1, PROPERTIES_VALUE_JSON));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    CuAssertIntEquals(tc, 1, route_property_1);
+    CuAssertIntEquals(tc, 1, route_properties);
+
+    /* removing a subscription leaves the ones sharing its levels in place */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngUnsubThngProperty(h1, THNG_1, PROPERTY_1));
+    CuAssertIntEquals(tc, EVRYTHNG_NOT_SUBSCRIBED, EvrythngUnsubThngProperty(h1, THNG_1, PROPERTY_1));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_2, PROPERTY_VALUE_JSON));
+    END_SINGLE_CONNECTION
+}
+
+static char aggr_received[256];
+
+static void test_aggr_sub_callback(const char* str_json, size_t len)
+{
+    snprintf(aggr_received, sizeof aggr_received, "%.*s", (int)len, str_json);
+    platform_semaphore_post(&sub_sem);
+}
+
+void test_set_aggregation(CuTest* tc)
+{
+    evrythng_handle_t h;
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngInitHandle(&h));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetAggregation(0, 100, 32, 4096));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetAggregation(h, -1, 32, 4096));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetAggregation(h, 100, 0, 4096));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetAggregation(h, 100, 32, 16));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetAggregation(h, 0, 1, 64));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngAggregateThngProperty(h, THNG_1, PROPERTY_1, "{\"value\": 500}"));
+    EvrythngDestroyHandle(h);
+}
+
+void test_aggregate_thng_props(CuTest* tc)
+{
+    START_SINGLE_CONNECTION
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperties(h1, THNG_1, 0, test_aggr_sub_callback));
+
+    /* published once the second update is collected */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetAggregation(h1, 0, 2, 4096));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngAggregateThngProperty(h1, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngAggregateThngProperty(h1, THNG_1, PROPERTY_2, "[{\"value\": 100}]"));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    CuAssertStrEquals(tc, PROPERTIES_VALUE_JSON, aggr_received);
+
+    /* published on flush */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngAggregateThngProperty(h1, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngFlushThngProperties(h1, THNG_1));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    CuAssertStrEquals(tc, "[{\"key\": \"property_1\", \"value\": 500}]", aggr_received);
+
+    /* a name which is not valid inside a JSON string is escaped */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngAggregateThngProperty(h1, THNG_1, "a\"b\\c\n", PROPERTY_VALUE_JSON));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngFlushThngProperties(h1, THNG_1));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    CuAssertStrEquals(tc, "[{\"key\": \"a\\\"b\\\\c\\u000a\", \"value\": 500}]", aggr_received);
+
+    /* published by mqtt_thread once the window has passed */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetAggregation(h1, 50, 32, 4096));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngAggregateThngProperty(h1, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON));
+    END_SINGLE_CONNECTION
+}
+
+#define RESTORED_SUBS 40
+
+void test_restore_subscriptions(CuTest* tc)
+{
+    char names[RESTORED_SUBS][32];
+    int i;
+
+    START_SINGLE_CONNECTION
+    for (i = 0; i < RESTORED_SUBS; i++)
+    {
+        snprintf(names[i], sizeof names[i], "property_%d", i);
+        CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(h1, THNG_1, names[i], 0, test_sub_callback));
+    }
+
+    /* the subscriptions do not fit in one subscribe packet */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngDisconnect(h1));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h1));
+
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(h1, THNG_1, names[0], PROPERTY_VALUE_JSON));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(h1, THNG_1, names[RESTORED_SUBS - 1], PROPERTY_VALUE_JSON));
+    END_SINGLE_CONNECTION
+}
+
+void test_persistent_session(CuTest* tc)
+{
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetPersistentSession(0, 1));
+
+    PRINT_START_MEM_STATS
+    evrythng_handle_t h1;
+    common_tcp_init_handle(&h1);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetClientId(h1, "persistent_session"));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetPersistentSession(h1, 1));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h1));
+    CuAssertIntEquals(tc, EVRYTHNG_FAILURE, EvrythngSetPersistentSession(h1, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(h1, THNG_1, PROPERTY_1, 0, test_sub_callback));
+
+    /* the subscription is kept by the session, not sent again */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngDisconnect(h1));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h1));
+
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+
+    /* leave no subscription behind in the session */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngUnsubThngProperty(h1, THNG_1, PROPERTY_1));
+    EvrythngDisconnect(h1);
+    EvrythngDestroyHandle(h1);
+    PRINT_END_MEM_STATS
+}
+
+static char spool_order[16];
+static int spool_received;
+
+static void test_spool_sub_callback(const char* str_json, size_t len)
+{
+    const char* v = strstr(str_json, "\"value\": ");
+    if (v && spool_received < (int)sizeof spool_order)
+        spool_order[spool_received++] = v[9];
+    platform_semaphore_post(&sub_sem);
+}
+
+/* Waits for the spooled values to arrive after anything received before them. */
+static int spool_wait_order(const char* expected)
+{
+    int n = strlen(expected);
+    while (spool_received < n || memcmp(spool_order + spool_received - n, expected, n))
+    {
+        if (platform_semaphore_wait(&sub_sem, 10000))
+            return 0;
+    }
+    return 1;
+}
+
+void test_set_spool(CuTest* tc)
+{
+    evrythng_handle_t h;
+    evrythng_spool_stats_t stats;
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngInitHandle(&h));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetSpool(0, 4096, EVRYTHNG_SPOOL_DROP_OLDEST, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetSpool(h, 32, EVRYTHNG_SPOOL_DROP_OLDEST, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetSpoolReplayRate(h, -1));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngGetSpoolStats(h, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_NOT_CONNECTED, EvrythngPubThngProperty(h, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON));
+
+    /* a full spool drops what the policy says */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetSpool(h, 192, EVRYTHNG_SPOOL_DROP_NEWEST, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SPOOLED, EvrythngPubThngProperty(h, THNG_1, PROPERTY_1, PROPERTIES_VALUE_JSON));
+    CuAssertIntEquals(tc, EVRYTHNG_QUEUE_FULL, EvrythngPubThngProperty(h, THNG_1, PROPERTY_1, PROPERTIES_VALUE_JSON));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetSpool(h, 192, EVRYTHNG_SPOOL_DROP_OLDEST, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SPOOLED, EvrythngPubThngProperty(h, THNG_1, PROPERTY_1, PROPERTIES_VALUE_JSON));
+    CuAssertIntEquals(tc, EVRYTHNG_SPOOLED, EvrythngPubThngProperty(h, THNG_1, PROPERTY_1, PROPERTIES_VALUE_JSON));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetSpoolStats(h, &stats));
+    CuAssertIntEquals(tc, 1, stats.count);
+    CuAssertIntEquals(tc, 1, stats.dropped);
+
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetSpool(h, 0, EVRYTHNG_SPOOL_DROP_OLDEST, 0));
+    EvrythngDestroyHandle(h);
+}
+
+void test_spool_replay(CuTest* tc)
+{
+    evrythng_spool_stats_t stats;
+
+    PRINT_START_MEM_STATS
+    evrythng_handle_t h1, h2;
+    common_tcp_init_handle(&h2);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h2));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(h2, THNG_1, PROPERTY_1, 0, test_spool_sub_callback));
+    spool_received = 0;
+
+    /* published before the connection, sent in order once connected */
+    common_tcp_init_handle(&h1);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetSpool(h1, 4096, EVRYTHNG_SPOOL_DROP_OLDEST, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SPOOLED, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, "[{\"value\": 1}]"));
+    CuAssertIntEquals(tc, EVRYTHNG_SPOOLED, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, "[{\"value\": 2}]"));
+    CuAssertIntEquals(tc, EVRYTHNG_SPOOLED, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, "[{\"value\": 3}]"));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetSpoolStats(h1, &stats));
+    CuAssertIntEquals(tc, 3, stats.count);
+
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h1));
+    CuAssertTrue(tc, spool_wait_order("123"));
+
+    EvrythngDisconnect(h1);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetSpoolStats(h1, &stats));
+    CuAssertIntEquals(tc, 0, stats.count);
+    CuAssertIntEquals(tc, 3, stats.replayed);
+    EvrythngDestroyHandle(h1);
+
+    EvrythngDisconnect(h2);
+    EvrythngDestroyHandle(h2);
+    PRINT_END_MEM_STATS
+}
+
+#define SPOOL_FILE "evrythng_test.spool"
+
+void test_spool_file(CuTest* tc)
+{
+    evrythng_spool_stats_t stats;
+
+    PRINT_START_MEM_STATS
+    evrythng_handle_t h1, h2;
+    common_tcp_init_handle(&h2);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h2));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(h2, THNG_1, PROPERTY_1, 0, test_spool_sub_callback));
+    spool_received = 0;
+
+    /* the publishes survive the handle */
+    common_tcp_init_handle(&h1);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetSpool(h1, 4096, EVRYTHNG_SPOOL_DROP_OLDEST, SPOOL_FILE));
+    CuAssertIntEquals(tc, EVRYTHNG_SPOOLED, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, "[{\"value\": 4}]"));
+    CuAssertIntEquals(tc, EVRYTHNG_SPOOLED, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, "[{\"value\": 5}]"));
+    EvrythngDestroyHandle(h1);
+
+    common_tcp_init_handle(&h1);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetSpool(h1, 4096, EVRYTHNG_SPOOL_DROP_OLDEST, SPOOL_FILE));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetSpoolStats(h1, &stats));
+    CuAssertIntEquals(tc, 2, stats.count);
+
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h1));
+    CuAssertTrue(tc, spool_wait_order("45"));
+
+    /* the file is left empty */
+    EvrythngDisconnect(h1);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetSpoolStats(h1, &stats));
+    CuAssertIntEquals(tc, 0, stats.count);
+    EvrythngDestroyHandle(h1);
+
+    EvrythngDisconnect(h2);
+    EvrythngDestroyHandle(h2);
+    PRINT_END_MEM_STATS
+}
+
+void test_connections_pubsub(CuTest* tc)
+{
+    evrythng_handle_t h1;
+    evrythng_spool_stats_t stats;
+
+    PRINT_START_MEM_STATS
+    common_tcp_init_handle(&h1);
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetConnections(h1, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetConnections(h1, 17));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetSpool(h1, 4096, EVRYTHNG_SPOOL_DROP_OLDEST, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetConnections(h1, 3));
+
+    /* spooled by the connection of the thing */
+    CuAssertIntEquals(tc, EVRYTHNG_SPOOLED, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, "[{\"value\": 1}]"));
+    CuAssertIntEquals(tc, EVRYTHNG_SPOOLED, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, "[{\"value\": 2}]"));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetSpoolStats(h1, &stats));
+    CuAssertIntEquals(tc, 2, stats.count);
+
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h1));
+    CuAssertIntEquals(tc, EVRYTHNG_FAILURE, EvrythngSetConnections(h1, 2));
+    spool_received = 0;
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(h1, THNG_1, PROPERTY_1, 0, test_spool_sub_callback));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, "[{\"value\": 3}]"));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, "[{\"value\": 4}]"));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(h1, THNG_1, PROPERTY_1, "[{\"value\": 5}]"));
+    CuAssertTrue(tc, spool_wait_order("345"));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetSpoolStats(h1, &stats));
+    CuAssertIntEquals(tc, 0, stats.count);
+    CuAssertIntEquals(tc, 2, stats.replayed);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngUnsubThngProperty(h1, THNG_1, PROPERTY_1));
+
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubProductProperty(h1, PRODUCT_1, PROPERTY_1, 0, test_sub_callback));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubProductProperty(h1, PRODUCT_1, PROPERTY_1, PROPERTY_VALUE_JSON));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngUnsubProductProperty(h1, PRODUCT_1, PROPERTY_1));
+
+    EvrythngDisconnect(h1);
+    EvrythngDestroyHandle(h1);
+    PRINT_END_MEM_STATS
+}
+
+#define DRAIN_PUBS 20
+
+static int drain_acked;
+
+static void test_drain_pub_callback(evrythng_return_t result, void* userdata)
+{
+    if (result == EVRYTHNG_SUCCESS)
+        drain_acked++;
+}
+
+static void test_drain_sub_callback(const char* str_json, size_t len)
+{
+}
+
+void test_disconnect_timeout(CuTest* tc)
+{
+    evrythng_disconnect_report_t report;
+    evrythng_handle_t h1, h2;
+    evrythng_return_t rc;
+    int i;
+
+    PRINT_START_MEM_STATS
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngDisconnectTimeout(0, 1000, &report));
+    common_tcp_init_handle(&h1);
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngDisconnectTimeout(h1, -1, &report));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngDisconnectTimeout(h1, 1000, 0));
+
+    /* everything pending is sent in time */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h1));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(h1, THNG_1, PROPERTY_1, 0, test_drain_sub_callback));
+    drain_acked = 0;
+    for (i = 0; i < 5; i++)
+        CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngPropertyAsync(h1, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON, 
+                    test_drain_pub_callback, 0, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngAggregateThngProperty(h1, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngDisconnectTimeout(h1, 5000, &report));
+    CuAssertIntEquals(tc, 5, drain_acked);
+    CuAssertIntEquals(tc, 0, report.queued_dropped);
+    CuAssertIntEquals(tc, 0, report.inflight_dropped);
+    CuAssertIntEquals(tc, 0, report.spooled);
+    CuAssertTrue(tc, report.elapsed_ms < 5000);
+    EvrythngDestroyHandle(h1);
+
+    /* with no time given what was not acknowledged yet is reported */
+    common_tcp_init_handle(&h2);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetConnections(h2, 2));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h2));
+    drain_acked = 0;
+    for (i = 0; i < DRAIN_PUBS; i++)
+        CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngPropertyAsync(h2, i % 2 ? THNG_1 : PRODUCT_1, PROPERTY_1, 
+                    PROPERTY_VALUE_JSON, test_drain_pub_callback, 0, 0));
+    rc = EvrythngDisconnectTimeout(h2, 0, &report);
+    CuAssertIntEquals(tc, DRAIN_PUBS, drain_acked + report.queued_dropped + report.inflight_dropped);
+    CuAssertIntEquals(tc, report.queued_dropped || report.inflight_dropped ? EVRYTHNG_TIMEOUT : EVRYTHNG_SUCCESS, rc);
+    EvrythngDestroyHandle(h2);
+    PRINT_END_MEM_STATS
+}
+
+#define BATCH_PUBS 32
+
+void test_send_batching(CuTest* tc)
+{
+    evrythng_send_stats_t stats;
+    evrythng_handle_t h1;
+    int i;
+
+    PRINT_START_MEM_STATS
+    common_tcp_init_handle(&h1);
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetSendBatching(h1, -1));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngGetSendStats(h1, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetSendBatching(h1, 4096));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h1));
+    CuAssertIntEquals(tc, EVRYTHNG_FAILURE, EvrythngSetSendBatching(h1, 0));
+
+    /* the publishes queued while the window is full go out together */
+    drain_acked = 0;
+    for (i = 0; i < BATCH_PUBS; i++)
+        CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngPropertyAsync(h1, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON, 
+                    test_drain_pub_callback, 0, 0));
+    for (i = 0; i < 1000 && drain_acked < BATCH_PUBS; i++)
+        platform_sleep(10);
+    CuAssertIntEquals(tc, BATCH_PUBS, drain_acked);
+
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngGetSendStats(h1, &stats));
+    CuAssertTrue(tc, stats.packets >= BATCH_PUBS);
+    CuAssertTrue(tc, stats.writes < stats.packets);
+
+    EvrythngDisconnect(h1);
+    EvrythngDestroyHandle(h1);
+    PRINT_END_MEM_STATS
+}
+
+#define POOL_MSGS 4
+
+static evrythng_handle_t pool_handle;
+static const char* pool_msgs[POOL_MSGS];
+static size_t pool_lens[POOL_MSGS];
+static evrythng_return_t pool_retained[POOL_MSGS];
+static int pool_received;
+
+static void test_pool_sub_callback(const char* str_json, size_t len)
+{
+    if (pool_received < POOL_MSGS)
+    {
+        pool_msgs[pool_received] = str_json;
+        pool_lens[pool_received] = len;
+        pool_retained[pool_received] = EvrythngRetainMessage(pool_handle, str_json);
+        pool_received++;
+    }
+    platform_semaphore_post(&sub_sem);
+}
+
+static int pool_msg_equals(int i, const char* json)
+{
+    return pool_lens[i] == strlen(json) && memcmp(pool_msgs[i], json, pool_lens[i]) == 0;
+}
+
+void test_message_pool(CuTest* tc)
+{
+    PRINT_START_MEM_STATS
+    common_tcp_init_handle(&pool_handle);
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetMessagePool(pool_handle, -1));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetMessagePool(pool_handle, 2));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(pool_handle));
+    CuAssertIntEquals(tc, EVRYTHNG_FAILURE, EvrythngSetMessagePool(pool_handle, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_FAILURE, EvrythngRetainMessage(pool_handle, PROPERTY_VALUE_JSON));
+
+    pool_received = 0;
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(pool_handle, THNG_1, PROPERTY_1, 0, test_pool_sub_callback));
+
+    /* the third message finds both buffers retained */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(pool_handle, THNG_1, PROPERTY_1, "[{\"value\": 1}]"));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(pool_handle, THNG_1, PROPERTY_1, "[{\"value\": 2}]"));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(pool_handle, THNG_1, PROPERTY_1, "[{\"value\": 3}]"));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, pool_retained[0]);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, pool_retained[1]);
+    CuAssertIntEquals(tc, EVRYTHNG_FAILURE, pool_retained[2]);
+    CuAssertTrue(tc, pool_msg_equals(0, "[{\"value\": 1}]"));
+    CuAssertTrue(tc, pool_msg_equals(1, "[{\"value\": 2}]"));
+
+    /* a buffer released is read into again */
+    EvrythngReleaseMessage(pool_handle, pool_msgs[0]);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(pool_handle, THNG_1, PROPERTY_1, "[{\"value\": 4}]"));
+    CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, pool_retained[3]);
+    CuAssertTrue(tc, pool_msg_equals(1, "[{\"value\": 2}]"));
+    CuAssertTrue(tc, pool_msg_equals(3, "[{\"value\": 4}]"));
+
+    EvrythngReleaseMessage(pool_handle, pool_msgs[1]);
+    EvrythngReleaseMessage(pool_handle, pool_msgs[3]);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngUnsubThngProperty(pool_handle, THNG_1, PROPERTY_1));
+    EvrythngDisconnect(pool_handle);
+    EvrythngDestroyHandle(pool_handle);
+    PRINT_END_MEM_STATS
+}
+
+void test_set_reactor(CuTest* tc)
+{
+    evrythng_reactor_t r;
+    evrythng_handle_t h;
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngInitReactor(0, 1));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngInitReactor(&r, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngInitReactor(&r, 1));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngInitHandle(&h));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetReactor(0, r));
+    CuAssertIntEquals(tc, EVRYTHNG_BAD_ARGS, EvrythngSetReactor(h, 0));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetReactor(h, r));
+    CuAssertIntEquals(tc, EVRYTHNG_FAILURE, EvrythngSetReactor(h, r));
+    EvrythngDestroyHandle(h);
+    EvrythngDestroyReactor(r);
+}
+
+#define REACTOR_HANDLES 4
+
+void test_reactor_pubsub(CuTest* tc)
+{
+    int i;
+    evrythng_reactor_t r;
+    evrythng_handle_t h[REACTOR_HANDLES];
+
+    PRINT_START_MEM_STATS
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngInitReactor(&r, 2));
+    for (i = 0; i < REACTOR_HANDLES; i++)
+    {
+        common_tcp_init_handle(&h[i]);
+        CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetReactor(h[i], r));
+        CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(h[i]));
+        CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(h[i], THNG_1, PROPERTY_1, 0, test_sub_callback));
+    }
+
+    /* every handle receives the update */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(h[0], THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON));
+    for (i = 0; i < REACTOR_HANDLES; i++)
+        CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 10000));
+
+    for (i = 0; i < REACTOR_HANDLES; i++)
+    {
+        EvrythngDisconnect(h[i]);
+        EvrythngDestroyHandle(h[i]);
+    }
+    EvrythngDestroyReactor(r);
+    PRINT_END_MEM_STATS
+}
+
+#if !defined(CONFIG_OS_FREERTOS)
+static int slow_listener;
+static Semaphore slow_done;
+
+/* Accepts a connection, answers its connect and then sends only the first 
+ * byte of a publish, holding back the rest until the test is done. */
+static void slow_sender(void* arg)
+{
+    unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    unsigned char buf[512];
+    int fd = accept(slow_listener, 0, 0);
+
+    if (fd < 0)
+        return;
+    if (recv(fd, buf, sizeof buf, 0) > 0 && send(fd, connack, sizeof connack, 0) == sizeof connack)
+        send(fd, "\x30", 1, 0);
+    platform_semaphore_wait(&slow_done, 0x00FFFFFF);
+    close(fd);
+}
+
+void test_reactor_slow_sender(CuTest* tc)
+{
+    int i;
+    char url[64];
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof addr;
+    evrythng_reactor_t r;
+    evrythng_handle_t fast, slow;
+    Thread sender;
+    Timer timer;
+
+    PRINT_START_MEM_STATS
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    slow_listener = socket(AF_INET, SOCK_STREAM, 0);
+    CuAssertTrue(tc, slow_listener >= 0);
+    CuAssertIntEquals(tc, 0, bind(slow_listener, (struct sockaddr*)&addr, sizeof addr));
+    CuAssertIntEquals(tc, 0, listen(slow_listener, 1));
+    CuAssertIntEquals(tc, 0, getsockname(slow_listener, (struct sockaddr*)&addr, &addr_len));
+    snprintf(url, sizeof url, "tcp://127.0.0.1:%d", ntohs(addr.sin_port));
+    platform_semaphore_init(&slow_done);
+    platform_thread_create(&sender, 0, "slow_sender", slow_sender, 8192, 0);
+
+    /* both handles are driven by the same thread */
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngInitReactor(&r, 1));
+    common_tcp_init_handle(&fast);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetReactor(fast, r));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(fast));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSubThngProperty(fast, THNG_1, PROPERTY_1, 0, test_sub_callback));
+    common_tcp_init_handle(&slow);
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetUrl(slow, url));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngSetReactor(slow, r));
+    CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngConnect(slow));
+
+    /* the rest of the packet is not waited for, well within the command timeout */
+    platform_timer_init(&timer);
+    platform_timer_countdown(&timer, 5000);
+    for (i = 0; i < 3; i++)
+    {
+        CuAssertIntEquals(tc, EVRYTHNG_SUCCESS, EvrythngPubThngProperty(fast, THNG_1, PROPERTY_1, PROPERTY_VALUE_JSON));
+        CuAssertIntEquals(tc, 0, platform_semaphore_wait(&sub_sem, 5000));
+    }
+    CuAssertTrue(tc, !platform_timer_isexpired(&timer));
+    platform_timer_deinit(&timer);
+
+    EvrythngDisconnect(fast);
+    EvrythngDestroyHandle(fast);
+    EvrythngDestroyHandle(slow);
+    EvrythngDestroyReactor(r);
+
+    platform_semaphore_post(&slow_done);
+    platform_thread_join(&sender, 0x00FFFFFF);
+    platform_thread_destroy(&sender);
+    platform_semaphore_deinit(&slow_done);
+    close(slow_listener);
+    PRINT_END_MEM_STATS
+}
+#endif
+
 CuSuite* CuGetSuite(void)
 {
 	CuSuite* suite = CuSuiteNew();
@@ -400,8 +1167,16 @@ CuSuite* CuGetSuite(void)
 	SUITE_ADD_TEST(suite, test_set_qos_fail);
 	SUITE_ADD_TEST(suite, test_set_callback_ok);
 	SUITE_ADD_TEST(suite, test_set_callback_fail);
+	SUITE_ADD_TEST(suite, test_set_max_inflight);
+	SUITE_ADD_TEST(suite, test_set_aggregation);
+	SUITE_ADD_TEST(suite, test_set_reactor);
+	SUITE_ADD_TEST(suite, test_set_reconnect_policy);
+	SUITE_ADD_TEST(suite, test_set_spool);
 	SUITE_ADD_TEST(suite, test_tcp_connect_ok1);
     SUITE_ADD_TEST(suite, test_tcp_connect_ok2);
+    SUITE_ADD_TEST(suite, test_tcp_connect_time);
+    SUITE_ADD_TEST(suite, test_tls_resume);
+    SUITE_ADD_TEST(suite, test_keepalive_rtt);
 
 #endif
 	SUITE_ADD_TEST(suite, test_unsub_nonexistent);
@@ -410,10 +1185,27 @@ CuSuite* CuGetSuite(void)
 
 	SUITE_ADD_TEST(suite, test_subunsub_thng);
 	SUITE_ADD_TEST(suite, test_subunsub_prod);
+	SUITE_ADD_TEST(suite, test_sub_routing);
+	SUITE_ADD_TEST(suite, test_restore_subscriptions);
+	SUITE_ADD_TEST(suite, test_persistent_session);
 
 #if 1
 	SUITE_ADD_TEST(suite, test_pubsub_thng_prop);
 	SUITE_ADD_TEST(suite, test_pubsuball_thng_prop);
+	SUITE_ADD_TEST(suite, test_pubsub_thng_prop_async);
+	SUITE_ADD_TEST(suite, test_pubsub_thng_prop_chunked);
+	SUITE_ADD_TEST(suite, test_pubsub_thng_prop_prepared);
+	SUITE_ADD_TEST(suite, test_aggregate_thng_props);
+	SUITE_ADD_TEST(suite, test_reactor_pubsub);
+#if !defined(CONFIG_OS_FREERTOS)
+	SUITE_ADD_TEST(suite, test_reactor_slow_sender);
+#endif
+	SUITE_ADD_TEST(suite, test_connections_pubsub);
+	SUITE_ADD_TEST(suite, test_disconnect_timeout);
+	SUITE_ADD_TEST(suite, test_send_batching);
+	SUITE_ADD_TEST(suite, test_message_pool);
+	SUITE_ADD_TEST(suite, test_spool_replay);
+	SUITE_ADD_TEST(suite, test_spool_file);
 
 	SUITE_ADD_TEST(suite, test_pubsub_thng_action);
 	SUITE_ADD_TEST(suite, test_pubsuball_thng_actions);